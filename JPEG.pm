@@ -37,6 +37,103 @@ JPEG format loader for Photo image type.
 JPEG access is via release 5 of the The Independent JPEG Group's (IJG)
 free JPEG software.
 
+=head1 FILE SIZE
+
+The C<-targetsize> write option picks the highest quality whose file
+fits in the given number of bytes, in place of C<-quality>:
+
+  $image->write('small.jpg', -format => ['jpeg', -targetsize => 20000]);
+
+If even quality 1 does not fit, the file is written at quality 1 anyway
+and Tk::JPEG::warning() says so.
+
+=over 4
+
+=item Tk::JPEG::warning()
+
+Returns the first warning libjpeg gave while reading or writing the last
+image, such as corrupt data or a missed C<-targetsize>, or undef if
+there was none.
+
+=back
+
+=head1 MEMORY USE
+
+Progressive and multi-pass images need buffers for the whole image.
+The C<-maxmemory> format option limits what libjpeg may allocate, in
+kbytes or, with an C<m> suffix, megabytes; anything beyond that is
+kept in temporary files:
+
+  $image->read('huge.jpg', -format => ['jpeg', -maxmemory => '64m']);
+
+These functions set process-wide defaults and report usage:
+
+=over 4
+
+=item Tk::JPEG::maxmemory([BYTES])
+
+Returns the default limit, in bytes, and sets it if BYTES is given.
+0 means no limit; -1, the initial value, leaves it to the C<JPEGMEM>
+environment variable.
+
+=item Tk::JPEG::tempdir([DIR])
+
+Returns the directory for temporary files, and sets it if DIR is given.
+When it is undefined C<$ENV{TMPDIR}> or F</tmp> is used.
+
+=item Tk::JPEG::peakmemory()
+
+Returns the most memory libjpeg used at once, in bytes, while reading
+or writing the last image.
+
+=back
+
+=head1 FEWER COLOURS
+
+For displays with only a few colours libjpeg can quantize while it
+decodes, which is faster and usually looks better than leaving it to Tk:
+
+  $image->read('photo.jpg', -format => ['jpeg', -colors => 64]);
+
+C<-colors> takes 8 to 256, or 2 to 256 when the output is greyscale
+(a greyscale file, or with C<-grayscale>).  By default libjpeg makes a first pass over
+the image to choose the colours and Floyd-Steinberg dithers to them.
+C<-dither> may be C<none>, C<ordered> or C<fs>; C<ordered> (as does
+C<-fast>) uses a fixed, evenly spaced colour map instead, so needs no
+first pass and gives the same colours for every image.
+
+C<-samecolormap> reuses the colour map chosen by the last read with
+C<-colors>, skipping the first pass.  Images shown together, or tiles of
+one image, then share one set of colours.  The map is kept per process,
+not per image or widget: it is the one from the last read with
+C<-colors> by any caller (or interpreter), so a read that should share
+colours must follow the read that chose them without another quantized
+read in between.  C<-samecolormap> is an error with C<-dither ordered>
+or C<-fast>, whose fixed colour map is the same for every image anyway.
+
+=head1 SIMD
+
+On x86 processors the bundled libjpeg uses SSE2 or AVX2 versions of its
+DCTs, colour conversions, resampling and C<-colors> colour matching, chosen
+once per process from what the CPU supports.  Setting C<$ENV{TKJPEG_SIMD}>
+to C<none>, C<sse2> or C<avx2> before the first image is read or written
+(or C<simd> is called) caps that choice, for timing comparisons or to rule
+out a SIMD problem.
+
+=over 4
+
+=item Tk::JPEG::simd()
+
+In list context returns pairs of kernel name and the instruction set it
+used (C<avx2>, C<sse2> or C<none>) for the image most recently read or
+written by any caller in this process, suitable for assigning to a hash.
+A kernel the image did not need, or could not use the SIMD version for,
+shows C<none>; before the first image, all do.  In scalar context
+returns the best instruction set used.  Nothing (or
+C<none>) is reported when Tk::JPEG was built with an external libjpeg.
+
+=back
+
 =head1 AUTHOR
 
 Nick Ing-Simmons E<lt>nick@ni-s.u-net.comE<gt>
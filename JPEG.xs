@@ -19,6 +19,11 @@
 #include <tkGlue.m>
 
 extern Tk_PhotoImageFormat	imgFmtJPEG;
+extern long	ImgJpegMaxMemory _ANSI_ARGS_((int set, long bytes));
+extern char *	ImgJpegTempDir _ANSI_ARGS_((int set, char *dir));
+extern long	ImgJpegPeakMemory _ANSI_ARGS_((void));
+extern char *	ImgJpegWarning _ANSI_ARGS_((void));
+extern char *	ImgJpegSimdKernel _ANSI_ARGS_((int n, char **isetPtr));
 
 DECLARE_VTABLES;
 TkimgphotoVtab *TkimgphotoVptr;
@@ -28,6 +33,67 @@ MODULE = Tk::JPEG	PACKAGE = Tk::JPEG
 
 PROTOTYPES: DISABLE
 
+long
+maxmemory(...)
+CODE:
+ {
+  RETVAL = ImgJpegMaxMemory(items > 0, (items > 0) ? (long) SvIV(ST(0)) : 0L);
+ }
+OUTPUT:
+ RETVAL
+
+SV *
+tempdir(...)
+CODE:
+ {
+  char *dir = ImgJpegTempDir(0, NULL);
+  RETVAL = (dir) ? newSVpv(dir, 0) : &PL_sv_undef;
+  if (items > 0)
+   ImgJpegTempDir(1, SvOK(ST(0)) ? SvPV_nolen(ST(0)) : NULL);
+ }
+OUTPUT:
+ RETVAL
+
+long
+peakmemory()
+CODE:
+ {
+  RETVAL = ImgJpegPeakMemory();
+ }
+OUTPUT:
+ RETVAL
+
+SV *
+warning()
+CODE:
+ {
+  char *msg = ImgJpegWarning();
+  RETVAL = (*msg) ? newSVpv(msg, 0) : &PL_sv_undef;
+ }
+OUTPUT:
+ RETVAL
+
+void
+simd()
+PPCODE:
+ {
+  char *name, *iset, *level = "none";
+  int i;
+  for (i = 0; (name = ImgJpegSimdKernel(i, &iset)) != NULL; i++)
+   {
+    if (GIMME_V == G_ARRAY)
+     {
+      XPUSHs(sv_2mortal(newSVpv(name, 0)));
+      XPUSHs(sv_2mortal(newSVpv(iset, 0)));
+     }
+    else if (strcmp(iset, "avx2") == 0 ||
+             (strcmp(iset, "sse2") == 0 && strcmp(level, "none") == 0))
+     level = iset;
+   }
+  if (GIMME_V != G_ARRAY)
+   XPUSHs(sv_2mortal(newSVpv(level, 0)));
+ }
+
 BOOT:
  {
   IMPORT_VTABLES;
@@ -15,6 +15,11 @@
  * The supported options for reading are:
  *	-fast:        Fast, low-quality processing
  *	-grayscale:   Force incoming image to grayscale
+ *	-scale M/N:   Scale image by M/N using the IDCT (1/1, 1/2, 1/4, 1/8)
+ *	              Default value: 1/1
+ *	-maxmemory N: Memory budget for libjpeg in kbytes, or megabytes with
+ *	              an 'm' suffix; larger work arrays go to temporary files
+ *	              Default value: see ImgJpegMaxMemory
  * The supported options for writing are:
  *	-quality N:   Compression quality (0..100; 5-95 is useful range)
  *	              Default value: 75
@@ -23,7 +28,12 @@
  *	-grayscale:   Create monochrome JPEG file
  *	-optimize:    Optimize Huffman table
  *	-progressive: Create progressive JPEG file
- *
+ *	-maxmemory N: As for reading
+ *	-targetsize N: Use the highest quality that keeps the file within
+ *	              N bytes; -quality is ignored.  Implies -optimize.
+ *	              Not available with a system libjpeg.  If even
+ *	              quality 1 is too big the file is still written,
+ *	              with a warning for ImgJpegWarning
  *
  * Copyright (c) 1996-1997 Thomas G. Lane.
  * This file is based on tkImgPPM.c from the Tk 4.2 distribution.
@@ -50,6 +60,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <setjmp.h>
 
 /* Tk */
@@ -147,12 +159,48 @@ struct my_error_mgr {		/* Extended libjpeg error manager */
   jmp_buf setjmp_buffer;	/* for return to caller from error exit */
 };
 
+/*
+ * Process-wide memory settings, see ImgJpegMaxMemory and friends.
+ */
+
+static long maxMemory = -1;	/* bytes; -1 keeps the library's default */
+static char *tempDir = NULL;	/* directory for libjpeg's temporary files */
+static long peakMemory = 0;	/* peak usage of the last read or write */
+
+/*
+ * The first libjpeg warning given by the last read or write, such as
+ * "Corrupt JPEG data" or a missed -targetsize; empty if there was none.
+ */
+
+static char lastWarning[JMSG_LENGTH_MAX];
+
+/*
+ * The colormap chosen by the last read with "-colors", which a later read
+ * with "-samecolormap" maps to instead of choosing its own.  Like the
+ * memory settings these belong to the process, not to an image or an
+ * interpreter: "last" means the last quantized read by any caller.
+ */
+
+static JSAMPLE lastColormap[3][256];
+static int lastColors = 0;	/* entries in lastColormap; 0 if none yet */
+static int lastColorComponents = 0; /* 3 for an RGB map, 1 for gray */
+
 /*
  * Prototypes for local procedures defined in this file:
  */
 
 static int	CommonMatchJPEG _ANSI_ARGS_((MFile *handle,
 		    int *widthPtr, int *heightPtr));
+static int	GetScaleJPEG _ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *value,
+		    unsigned int *numPtr, unsigned int *denomPtr));
+static int	GetMemoryJPEG _ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *value,
+		    long *bytesPtr));
+static void	SetMemoryJPEG _ANSI_ARGS_((j_common_ptr cinfo));
+static void	ColormapRowJPEG _ANSI_ARGS_((j_decompress_ptr cinfo,
+		    JSAMPROW indexes, JSAMPROW pixels, int width));
+static void	PeakMemoryJPEG _ANSI_ARGS_((j_common_ptr cinfo));
+static void	ScaleMatchJPEG _ANSI_ARGS_((Tcl_Interp *interp,
+		    Tcl_Obj *format, int *widthPtr, int *heightPtr));
 static int	CommonReadJPEG _ANSI_ARGS_((Tcl_Interp *interp,
 		    j_decompress_ptr cinfo, Tcl_Obj *format,
 		    Tk_PhotoHandle imageHandle, int destX, int destY,
@@ -172,6 +220,8 @@ static boolean	my_empty_output_buffer _ANSI_ARGS_((j_compress_ptr));
 static void	my_term_destination _ANSI_ARGS_((j_compress_ptr));
 static void	my_error_exit _ANSI_ARGS_((j_common_ptr cinfo));
 static void	my_output_message _ANSI_ARGS_((j_common_ptr cinfo));
+static void	my_emit_message _ANSI_ARGS_((j_common_ptr cinfo,
+		    int msg_level));
 static void	append_jpeg_message _ANSI_ARGS_((Tcl_Interp *interp,
 		    j_common_ptr cinfo));
 static int	load_jpeg_library _ANSI_ARGS_((Tcl_Interp *interp));
@@ -654,7 +704,11 @@ ChnMatchJPEG(interp, chan, fileName, format, widthPtr, heightPtr)
 
     handle.data = (char *) chan;
     handle.state = IMG_CHAN;
-    return CommonMatchJPEG(&handle, widthPtr, heightPtr);
+    if (!CommonMatchJPEG(&handle, widthPtr, heightPtr)) {
+	return 0;
+    }
+    ScaleMatchJPEG(interp, format, widthPtr, heightPtr);
+    return 1;
 }
 
 /*
@@ -690,7 +744,11 @@ ObjMatchJPEG(interp, data, format, widthPtr, heightPtr)
     ImgFixObjMatchProc(&interp, &data, &format, &widthPtr, &heightPtr);
 
     ImgReadInit(data, '\377', &handle);
-    return CommonMatchJPEG(&handle, widthPtr, heightPtr);
+    if (!CommonMatchJPEG(&handle, widthPtr, heightPtr)) {
+	return 0;
+    }
+    ScaleMatchJPEG(interp, format, widthPtr, heightPtr);
+    return 1;
 }
 
 /*
@@ -771,6 +829,290 @@ CommonMatchJPEG(handle, widthPtr, heightPtr)
 
     return 1;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetScaleJPEG --
+ *
+ *	Parse the value of a "-scale M/N" format option.
+ *
+ * Results:
+ *	A standard TCL completion code.  The scaling fraction is
+ *	stored in numPtr and denomPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GetScaleJPEG(interp, value, numPtr, denomPtr)
+    Tcl_Interp *interp;
+    Tcl_Obj *value;		/* The option value, e.g. "1/4". */
+    unsigned int *numPtr, *denomPtr;
+{
+    char *string = Tcl_GetStringFromObj(value, (int *) NULL);
+    int num, denom;
+
+    if ((sscanf(string, "%d/%d", &num, &denom) != 2)
+	    || (num <= 0) || (denom <= 0)) {
+	if (interp) {
+	    Tcl_AppendResult(interp, "bad scale \"", string,
+		    "\": should be M/N, eg, 1/8", (char *) NULL);
+	}
+	return TCL_ERROR;
+    }
+    *numPtr = (unsigned int) num;
+    *denomPtr = (unsigned int) denom;
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScaleMatchJPEG --
+ *
+ *	Adjust the dimensions found by CommonMatchJPEG for a "-scale"
+ *	option in the format, so that the photo image is sized to what
+ *	CommonReadJPEG will actually deliver.
+ *
+ * Side effects:
+ *  the scaled size is placed in widthPtr and heightPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ScaleMatchJPEG(interp, format, widthPtr, heightPtr)
+    Tcl_Interp *interp;
+    Tcl_Obj *format;		/* User-specified format object, or NULL. */
+    int *widthPtr, *heightPtr;	/* Image dimensions, scaled in place. */
+{
+    unsigned int num = 1, denom = 1;
+    int objc, i, divisor;
+    Tcl_Obj **objv = (Tcl_Obj **) NULL;
+
+    if (ImgListObjGetElements((Tcl_Interp *) NULL, format, &objc, &objv)
+	    != TCL_OK) {
+	return;
+    }
+    for (i = 1; i < objc - 1; i++) {
+	if (!strcmp(Tcl_GetStringFromObj(objv[i], (int *) NULL), "-scale")) {
+	    GetScaleJPEG((Tcl_Interp *) NULL, objv[++i], &num, &denom);
+	}
+    }
+
+    /* Same choice of IDCT size as jpeg_calc_output_dimensions() */
+    if (num * 8 <= denom) {
+	divisor = 8;
+    } else if (num * 4 <= denom) {
+	divisor = 4;
+    } else if (num * 2 <= denom) {
+	divisor = 2;
+    } else {
+	divisor = 1;
+    }
+    *widthPtr = (*widthPtr + divisor - 1) / divisor;
+    *heightPtr = (*heightPtr + divisor - 1) / divisor;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetMemoryJPEG --
+ *
+ *	Parse the value of a "-maxmemory N" format option.  As with
+ *	cjpeg/djpeg, N is in kbytes, or in megabytes if followed by 'm'.
+ *	Anything else after the digits, or a size that does not fit in
+ *	a long, is an error.
+ *
+ * Results:
+ *	A standard TCL completion code.  The limit in bytes is
+ *	stored in bytesPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GetMemoryJPEG(interp, value, bytesPtr)
+    Tcl_Interp *interp;
+    Tcl_Obj *value;		/* The option value, e.g. "4096" or "4m". */
+    long *bytesPtr;
+{
+    char *string = Tcl_GetStringFromObj(value, (int *) NULL);
+    char *end = string;
+    long lval, unit = 1000L;
+
+    lval = isdigit((unsigned char) *string) ? strtol(string, &end, 10) : -1;
+    if (lval >= 0 && (*end == 'm' || *end == 'M')) {
+	unit = 1000L * 1000L;
+	end++;
+    }
+    if (lval < 0 || *end != '\0') {
+	Tcl_AppendResult(interp, "bad memory size \"", string,
+		"\": should be kbytes, or megabytes with 'm'", (char *) NULL);
+	return TCL_ERROR;
+    }
+    if (lval > LONG_MAX / unit) {
+	Tcl_AppendResult(interp, "memory size \"", string,
+		"\" is too large", (char *) NULL);
+	return TCL_ERROR;
+    }
+    *bytesPtr = lval * unit;
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetMemoryJPEG --
+ *
+ *	Apply the process-wide memory settings to a freshly created
+ *	compress or decompress object, before any format options.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetMemoryJPEG(cinfo)
+    j_common_ptr cinfo;
+{
+    if (maxMemory >= 0) {
+	cinfo->mem->max_memory_to_use = maxMemory;
+    }
+#ifndef HAVE_JPEGLIB_H
+    cinfo->mem->temp_directory = tempDir;
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PeakMemoryJPEG --
+ *
+ *	Remember how much memory libjpeg used for the image just
+ *	processed, for ImgJpegPeakMemory.  Only the bundled library
+ *	keeps track of this.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PeakMemoryJPEG(cinfo)
+    j_common_ptr cinfo;
+{
+#ifndef HAVE_JPEGLIB_H
+    peakMemory = cinfo->mem->peak_memory_used;
+#endif
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ImgJpegMaxMemory, ImgJpegTempDir, ImgJpegPeakMemory --
+ *
+ *	Process-wide defaults for the "-maxmemory" option and for the
+ *	directory libjpeg uses for its temporary files, and the peak
+ *	memory use of the last image read or written.  A maximum of -1
+ *	leaves libjpeg's own default (the JPEGMEM environment variable,
+ *	else no limit), 0 means no limit.  A NULL directory means $TMPDIR
+ *	or /tmp.
+ *
+ * Results:
+ *	ImgJpegMaxMemory returns the previous limit, ImgJpegTempDir
+ *	the directory now in effect.
+ *
+ *----------------------------------------------------------------------
+ */
+
+long
+ImgJpegMaxMemory(set, bytes)
+    int set;			/* Non-zero to change the value. */
+    long bytes;			/* New limit in bytes. */
+{
+    long old = maxMemory;
+    if (set) {
+	maxMemory = (bytes < 0) ? -1 : bytes;
+    }
+    return old;
+}
+
+char *
+ImgJpegTempDir(set, dir)
+    int set;			/* Non-zero to change the value. */
+    char *dir;			/* New directory, or NULL. */
+{
+    if (set) {
+	if (tempDir != NULL) {
+	    ckfree(tempDir);
+	    tempDir = NULL;
+	}
+	if (dir != NULL && *dir) {
+	    tempDir = (char *) ckalloc(strlen(dir) + 1);
+	    strcpy(tempDir, dir);
+	}
+    }
+    return tempDir;
+}
+
+long
+ImgJpegPeakMemory()
+{
+    return peakMemory;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ImgJpegWarning --
+ *
+ *	Reports the first warning libjpeg gave while reading or writing
+ *	the last image; Tk has no way to pass it on with the image.
+ *
+ * Results:
+ *	The message, or an empty string if there was none.
+ *
+ *----------------------------------------------------------------------
+ */
+
+char *
+ImgJpegWarning()
+{
+    return lastWarning;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ImgJpegSimdKernel --
+ *
+ *	Reports the n'th SIMD kernel of the bundled libjpeg and the
+ *	instruction set it used for the last image read or written in
+ *	this process: "avx2", "sse2" or "none".  The environment
+ *	variable TKJPEG_SIMD (none, sse2 or avx2) lowers the choice.
+ *
+ * Results:
+ *	The kernel's name, or NULL after the last one (and always when
+ *	an external libjpeg is used).
+ *
+ *----------------------------------------------------------------------
+ */
+
+char *
+ImgJpegSimdKernel(n, isetPtr)
+    int n;			/* Index of the kernel, from 0. */
+    char **isetPtr;		/* Receives the instruction set name. */
+{
+#ifndef HAVE_JPEGLIB_H
+    const char *iset;
+    char *name = (char *) jpeg_simd_kernel(n, &iset);
+
+    *isetPtr = (char *) iset;
+    return name;
+#else
+    *isetPtr = "none";
+    return NULL;
+#endif
+}
 
 /*
  *----------------------------------------------------------------------
@@ -819,6 +1161,8 @@ ChnReadJPEG(interp, chan, fileName, format, imageHandle, destX, destY,
     cinfo.err = jpeg_std_error(&jerror.pub);
     jerror.pub.error_exit = my_error_exit;
     jerror.pub.output_message = my_output_message;
+    jerror.pub.emit_message = my_emit_message;
+    lastWarning[0] = '\0';
 
     /* Establish the setjmp return context for my_error_exit to use. */
     if (setjmp(jerror.setjmp_buffer)) {
@@ -890,6 +1234,8 @@ ObjReadJPEG(interp, data, format, imageHandle, destX, destY,
     cinfo.err = jpeg_std_error(&jerror.pub);
     jerror.pub.error_exit = my_error_exit;
     jerror.pub.output_message = my_output_message;
+    jerror.pub.emit_message = my_emit_message;
+    lastWarning[0] = '\0';
 
     /* Establish the setjmp return context for my_error_exit to use. */
     if (setjmp(jerror.setjmp_buffer)) {
@@ -915,6 +1261,44 @@ ObjReadJPEG(interp, data, format, imageHandle, destX, destY,
     return result;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * ColormapRowJPEG --
+ *
+ *	Look up a row of colormap indexes, as produced by the library's
+ *	color quantizer, into pixels of out_color_components samples.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ColormapRowJPEG(cinfo, indexes, pixels, width)
+    j_decompress_ptr cinfo;
+    JSAMPROW indexes;		/* Colormap indexes from the library. */
+    JSAMPROW pixels;		/* Where to put the looked-up pixels. */
+    int width;			/* Number of pixels. */
+{
+    JSAMPARRAY colormap = cinfo->colormap;
+    int x, c;
+
+    if (cinfo->out_color_components == 3) {
+	JSAMPROW map0 = colormap[0], map1 = colormap[1], map2 = colormap[2];
+	for (x = 0; x < width; x++) {
+	    c = GETJSAMPLE(indexes[x]);
+	    pixels[0] = map0[c];
+	    pixels[1] = map1[c];
+	    pixels[2] = map2[c];
+	    pixels += 3;
+	}
+    } else {
+	JSAMPROW map0 = colormap[0];
+	for (x = 0; x < width; x++) {
+	    pixels[x] = map0[GETJSAMPLE(indexes[x])];
+	}
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -948,13 +1332,19 @@ CommonReadJPEG(interp, cinfo, format, imageHandle, destX, destY,
     int srcX, srcY;		/* Coordinates of top-left pixel to be used
 				 * in image being read. */
 {
-    static char *jpegReadOptions[] = {"-fast", "-grayscale", NULL};
+    static char *jpegReadOptions[] = {"-fast", "-grayscale", "-scale",
+	"-maxmemory", "-colors", "-dither", "-samecolormap", NULL};
+    static char *jpegDitherModes[] = {"none", "ordered", "fs", NULL};
     int fileWidth, fileHeight, stopY, curY, outY, outWidth, outHeight;
     myblock bl;
 #define block bl.ck
     JSAMPARRAY buffer;		/* Output row buffer */
-    int objc, i, index;
+    JSAMPARRAY pixels = NULL;	/* Colormapped row, for "-colors" */
+    int objc, i, index, colors, sameColormap = 0;
     Tcl_Obj **objv = (Tcl_Obj **) NULL;
+    Tcl_Obj *colorsObj = NULL;	/* The "-colors" value, for messages */
+
+    SetMemoryJPEG((j_common_ptr) cinfo);
 
     /* Ready to read header data. */
     jpeg_read_header(cinfo, TRUE);
@@ -990,12 +1380,144 @@ CommonReadJPEG(interp, cinfo, format, imageHandle, destX, destY,
 		    cinfo->out_color_space = JCS_GRAYSCALE;
 		    break;
 		}
+		case 2: {
+		    /* Scale the output in the IDCT. */
+		    if (++i >= objc) {
+			Tcl_AppendResult(interp, "No value for option \"",
+				Tcl_GetStringFromObj(objv[--i], (int *) NULL), "\"", (char *) NULL);
+			return TCL_ERROR;
+		    }
+		    if (GetScaleJPEG(interp, objv[i], &cinfo->scale_num,
+			    &cinfo->scale_denom) != TCL_OK) {
+			return TCL_ERROR;
+		    }
+		    break;
+		}
+		case 3: {
+		    if (++i >= objc) {
+			Tcl_AppendResult(interp, "No value for option \"",
+				Tcl_GetStringFromObj(objv[--i], (int *) NULL), "\"", (char *) NULL);
+			return TCL_ERROR;
+		    }
+		    if (GetMemoryJPEG(interp, objv[i],
+			    &cinfo->mem->max_memory_to_use) != TCL_OK) {
+			return TCL_ERROR;
+		    }
+		    break;
+		}
+		case 4: {
+		    /* Quantize to a colormap of at most this many colors. */
+		    if (++i >= objc) {
+			Tcl_AppendResult(interp, "No value for option \"",
+				Tcl_GetStringFromObj(objv[--i], (int *) NULL), "\"", (char *) NULL);
+			return TCL_ERROR;
+		    }
+		    if (Tcl_GetIntFromObj(interp, objv[i], &colors) != TCL_OK) {
+			return TCL_ERROR;
+		    }
+		    if ((colors < 2) || (colors > 256)) {
+			Tcl_AppendResult(interp, "bad colors \"",
+				Tcl_GetStringFromObj(objv[i], (int *) NULL),
+				"\": should be 2 to 256", (char *) NULL);
+			return TCL_ERROR;
+		    }
+		    cinfo->quantize_colors = TRUE;
+		    cinfo->desired_number_of_colors = colors;
+		    colorsObj = objv[i];
+		    break;
+		}
+		case 5: {
+		    /* How to dither when quantizing. */
+		    if (++i >= objc) {
+			Tcl_AppendResult(interp, "No value for option \"",
+				Tcl_GetStringFromObj(objv[--i], (int *) NULL), "\"", (char *) NULL);
+			return TCL_ERROR;
+		    }
+		    if (Tcl_GetIndexFromObj(interp, objv[i], jpegDitherModes,
+			    "dither mode", 0, &index) != TCL_OK) {
+			return TCL_ERROR;
+		    }
+		    if (index == 0) {
+			cinfo->dither_mode = JDITHER_NONE;
+		    } else if (index == 1) {
+			/* only the fixed-colormap quantizer can do this */
+			cinfo->dither_mode = JDITHER_ORDERED;
+			cinfo->two_pass_quantize = FALSE;
+		    } else {
+			cinfo->dither_mode = JDITHER_FS;
+		    }
+		    break;
+		}
+		case 6: {
+		    /* Map to the last "-colors" read's colormap. */
+		    sameColormap = 1;
+		    break;
+		}
 	    }
 	}
     }
 
+    /* Neither of libjpeg's quantizers can share fewer than 8 colors among
+     * three components (the fixed colormap needs two values of each); only
+     * grayscale output, from a grayscale file or "-grayscale", can have
+     * 2 to 7.
+     */
+    if (cinfo->quantize_colors && (cinfo->desired_number_of_colors < 8)
+	    && (cinfo->out_color_space != JCS_GRAYSCALE)) {
+	Tcl_AppendResult(interp, "bad colors \"",
+		Tcl_GetStringFromObj(colorsObj, (int *) NULL),
+		"\": should be 8 to 256 (2 to 256 for grayscale)",
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+
+    /* A given colormap is only used by the two-pass quantizer, which
+     * would quietly turn ordered dithering into Floyd-Steinberg.  The
+     * ordered dither's own map is the same for every image anyway.
+     */
+    if (cinfo->quantize_colors && sameColormap
+	    && (cinfo->dither_mode == JDITHER_ORDERED)) {
+	Tcl_AppendResult(interp, "option \"-samecolormap\" cannot be",
+		" used with ordered dithering or \"-fast\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+
+    /* With "-samecolormap", hand the library the colormap remembered from
+     * the last quantized read; it then maps each pixel straight to it and
+     * skips the prescan pass that would choose a new one.  Only a color
+     * map can be given, the library always makes its own gray map.
+     */
+    if (cinfo->quantize_colors && sameColormap && (lastColors > 0)
+	    && (lastColorComponents == 3)
+	    && (cinfo->out_color_space == JCS_RGB)) {
+	cinfo->colormap = (*cinfo->mem->alloc_sarray)
+		((j_common_ptr) cinfo, JPOOL_IMAGE, (JDIMENSION) lastColors, 3);
+	for (i = 0; i < 3; i++) {
+	    memcpy(cinfo->colormap[i], lastColormap[i], (size_t) lastColors);
+	}
+	cinfo->actual_number_of_colors = lastColors;
+    }
+
+#ifdef JCS_ALPHA_EXTENSIONS
+    /* Have the library write Tk's own four-byte pixels, alpha included,
+     * so that Tk can take the rows as they are.  (Not when quantizing:
+     * then the rows are colormap indexes.) */
+    if ((cinfo->out_color_space == JCS_RGB) && !cinfo->quantize_colors) {
+	cinfo->out_color_space = JCS_EXT_RGBA;
+    }
+#endif
+
     jpeg_start_decompress(cinfo);
 
+    /* Remember the colormap the library chose, for "-samecolormap". */
+    if (cinfo->quantize_colors) {
+	lastColors = cinfo->actual_number_of_colors;
+	lastColorComponents = cinfo->out_color_components;
+	for (i = 0; i < lastColorComponents; i++) {
+	    memcpy(lastColormap[i], cinfo->colormap[i], (size_t) lastColors);
+	}
+    }
+
     /* Check dimensions. */
     fileWidth = (int) cinfo->output_width;
     fileHeight = (int) cinfo->output_height;
@@ -1022,6 +1544,7 @@ CommonReadJPEG(interp, cinfo, format, imageHandle, destX, destY,
 	block.offset[0] = 0;
 	block.offset[1] = 0;
 	block.offset[2] = 0;
+	block.offset[3] = 0;
 	break;
     case JCS_RGB:
 	/* note: this pixel layout assumes default configuration of libjpeg. */
@@ -1029,7 +1552,18 @@ CommonReadJPEG(interp, cinfo, format, imageHandle, destX, destY,
 	block.offset[0] = 0;
 	block.offset[1] = 1;
 	block.offset[2] = 2;
+	block.offset[3] = 0;
+	break;
+#ifdef JCS_ALPHA_EXTENSIONS
+    case JCS_EXT_RGBA:
+	/* the library has set the alpha bytes to 255 (opaque) */
+	block.pixelSize = 4;
+	block.offset[0] = 0;
+	block.offset[1] = 1;
+	block.offset[2] = 2;
+	block.offset[3] = 3;
 	break;
+#endif
     default:
 	Tcl_AppendResult(interp, "Unsupported JPEG color space", (char *) NULL);
 	return TCL_ERROR;
@@ -1037,7 +1571,6 @@ CommonReadJPEG(interp, cinfo, format, imageHandle, destX, destY,
     block.width = outWidth;
     block.height = 1;
     block.pitch = block.pixelSize * fileWidth;
-    block.offset[3] = 0;
 
     Tk_PhotoExpand(imageHandle, destX + outWidth, destY + outHeight);
 
@@ -1047,17 +1580,31 @@ CommonReadJPEG(interp, cinfo, format, imageHandle, destX, destY,
 		 cinfo->output_width * cinfo->output_components, 1);
     block.pixelPtr = (unsigned char *) buffer[0] + srcX * block.pixelSize;
 
+    /* When quantizing, the rows hold colormap indexes; they are looked up
+     * into a second row for Tk, which has no indexed block format. */
+    if (cinfo->quantize_colors) {
+	pixels = (*cinfo->mem->alloc_sarray)
+		((j_common_ptr) cinfo, JPOOL_IMAGE,
+		 (JDIMENSION) (outWidth * block.pixelSize), 1);
+	block.pixelPtr = (unsigned char *) pixels[0];
+    }
+
     /* Read as much of the data as we need to */
     stopY = srcY + outHeight;
     outY = destY;
     for (curY = 0; curY < stopY; curY++) {
       jpeg_read_scanlines(cinfo, buffer, 1);
       if (curY >= srcY) {
+	if (pixels != NULL) {
+	    ColormapRowJPEG(cinfo, buffer[0] + srcX, pixels[0], outWidth);
+	}
 	Tk_PhotoPutBlock(imageHandle, &block, destX, outY, outWidth, 1);
 	outY++;
       }
     }
 
+    PeakMemoryJPEG((j_common_ptr) cinfo);
+
     /* Do normal cleanup if we read the whole image; else early abort */
     if (cinfo->output_scanline == cinfo->output_height)
 	jpeg_finish_decompress(cinfo);
@@ -1111,6 +1658,8 @@ ChnWriteJPEG(interp, fileName, format, blockPtr)
     cinfo.err = jpeg_std_error(&jerror.pub);
     jerror.pub.error_exit = my_error_exit;
     jerror.pub.output_message = my_output_message;
+    jerror.pub.emit_message = my_emit_message;
+    lastWarning[0] = '\0';
 
     /* Establish the setjmp return context for my_error_exit to use. */
     if (setjmp(jerror.setjmp_buffer)) {
@@ -1179,6 +1728,8 @@ StringWriteJPEG(interp, dataPtr, format, blockPtr)
     cinfo.err = jpeg_std_error(&jerror.pub);
     jerror.pub.error_exit = my_error_exit;
     jerror.pub.output_message = my_output_message;
+    jerror.pub.emit_message = my_emit_message;
+    lastWarning[0] = '\0';
 
     /* Establish the setjmp return context for my_error_exit to use. */
     if (setjmp(jerror.setjmp_buffer)) {
@@ -1233,14 +1784,15 @@ CommonWriteJPEG(interp, cinfo, format, blockPtr)
     Tk_PhotoImageBlock *blockPtr;
 {
     static char *jpegWriteOptions[] = {"-grayscale", "-optimize",
-	"-progressive", "-quality", "-smooth", NULL};
+	"-progressive", "-quality", "-smooth", "-maxmemory", "-targetsize",
+	NULL};
     JSAMPROW row_pointer[1];	/* pointer to original data scanlines */
     JSAMPARRAY buffer;		/* Intermediate row buffer */
     JSAMPROW bufferPtr;
     int w, h;
     int greenOffset, blueOffset, alphaOffset;
     unsigned char *pixelPtr, *pixLinePtr;
-    int objc, i, index, grayscale = 0;
+    int objc, i, index, grayscale = 0, direct = 0;
     Tcl_Obj **objv = (Tcl_Obj **) NULL;
 
     greenOffset = blockPtr->offset[1] - blockPtr->offset[0];
@@ -1261,7 +1813,31 @@ CommonWriteJPEG(interp, cinfo, format, blockPtr)
     cinfo->input_components = 3;
     cinfo->in_color_space = JCS_RGB;
 
+    /* note: we assume libjpeg is configured for standard RGB pixel order. */
+    if ((greenOffset == 1) && (blueOffset == 2)
+	&& (blockPtr->pixelSize == 3)) {
+	/* No need to reformat pixels before passing data to libjpeg */
+	direct = 1;
+    }
+#ifdef JCS_ALPHA_EXTENSIONS
+    else if ((blockPtr->pixelSize == 4) && (greenOffset == blueOffset / 2)
+	    && ((blueOffset == 2) || (blueOffset == -2))) {
+	/* Red, green and blue are adjacent, either way round, so the
+	 * library can take the four-byte pixels as they are */
+	direct = 1;
+	cinfo->input_components = 4;
+	if (blueOffset == 2) {
+	    cinfo->in_color_space = (blockPtr->offset[0] == 0) ?
+		    JCS_EXT_RGBX : JCS_EXT_XRGB;
+	} else {
+	    cinfo->in_color_space = (blockPtr->offset[2] == 0) ?
+		    JCS_EXT_BGRX : JCS_EXT_XBGR;
+	}
+    }
+#endif
+
     jpeg_set_defaults(cinfo);
+    SetMemoryJPEG((j_common_ptr) cinfo);
 
     /* Parse options, if any, and alter default parameters */
 
@@ -1316,6 +1892,45 @@ CommonWriteJPEG(interp, cinfo, format, blockPtr)
 		    cinfo->smoothing_factor = smooth;
 		    break;
 		}
+		case 5: {
+		    if (++i >= objc) {
+			Tcl_AppendResult(interp, "No value for option \"",
+				Tcl_GetStringFromObj(objv[--i], (int *) NULL), "\"", (char *) NULL);
+			return TCL_ERROR;
+		    }
+		    if (GetMemoryJPEG(interp, objv[i],
+			    &cinfo->mem->max_memory_to_use) != TCL_OK) {
+			return TCL_ERROR;
+		    }
+		    break;
+		}
+		case 6: {
+		    int size = 0;
+		    if (++i >= objc) {
+			Tcl_AppendResult(interp, "No value for option \"",
+				Tcl_GetStringFromObj(objv[--i], (int *) NULL), "\"", (char *) NULL);
+			return TCL_ERROR;
+		    }
+		    if (Tcl_GetIntFromObj(interp, objv[i], &size) != TCL_OK) {
+			return TCL_ERROR;
+		    }
+		    if (size <= 0) {
+			Tcl_AppendResult(interp, "bad target size \"",
+				Tcl_GetStringFromObj(objv[i], (int *) NULL),
+				"\": should be a positive number of bytes",
+				(char *) NULL);
+			return TCL_ERROR;
+		    }
+#ifndef HAVE_JPEGLIB_H
+		    cinfo->target_size = size;
+#else
+		    /* Only the bundled libjpeg can search for a quality */
+		    Tcl_AppendResult(interp, "option \"-targetsize\" needs",
+			    " the bundled libjpeg", (char *) NULL);
+		    return TCL_ERROR;
+#endif
+		    break;
+		}
 	    }
 	}
     }
@@ -1331,12 +1946,41 @@ CommonWriteJPEG(interp, cinfo, format, blockPtr)
 
     jpeg_start_compress(cinfo, TRUE);
 
-    /* note: we assume libjpeg is configured for standard RGB pixel order. */
-    if ((greenOffset == 1) && (blueOffset == 2)
-	&& (blockPtr->pixelSize == 3)) {
-	/* No need to reformat pixels before passing data to libjpeg */
+    if (direct) {
+	buffer = NULL;
+	pixLinePtr = blockPtr->pixelPtr;
 	for (h = blockPtr->height; h > 0; h--) {
 	    row_pointer[0] = (JSAMPROW) pixLinePtr;
+	    if (alphaOffset) {
+		/* Rows with transparent pixels go through a copy in which
+		 * those are gray, as below. */
+		pixelPtr = pixLinePtr + blockPtr->offset[0];
+		for (w = blockPtr->width; w > 0; w--) {
+		    if (!pixelPtr[alphaOffset]) {
+			break;
+		    }
+		    pixelPtr += blockPtr->pixelSize;
+		}
+		if (w > 0) {
+		    if (buffer == NULL) {
+			buffer = (*cinfo->mem->alloc_sarray)
+			  ((j_common_ptr) cinfo, JPOOL_IMAGE,
+			   cinfo->image_width * cinfo->input_components, 1);
+		    }
+		    memcpy(buffer[0], pixLinePtr,
+			    cinfo->image_width * cinfo->input_components);
+		    pixelPtr = buffer[0] + blockPtr->offset[0];
+		    for (w = blockPtr->width; w > 0; w--) {
+			if (!pixelPtr[alphaOffset]) {
+			    pixelPtr[0] = 0xd9;
+			    pixelPtr[greenOffset] = 0xd9;
+			    pixelPtr[blueOffset] = 0xd9;
+			}
+			pixelPtr += blockPtr->pixelSize;
+		    }
+		    row_pointer[0] = buffer[0];
+		}
+	    }
 	    jpeg_write_scanlines(cinfo, row_pointer, 1);
 	    pixLinePtr += blockPtr->pitch;
 	}
@@ -1369,6 +2013,7 @@ CommonWriteJPEG(interp, cinfo, format, blockPtr)
     }
 
     jpeg_finish_compress(cinfo);
+    PeakMemoryJPEG((j_common_ptr) cinfo);
     return TCL_OK;
 }
 
@@ -1598,7 +2243,23 @@ my_output_message (cinfo)
 {
   /* Override libjpeg's output_message to do nothing.
    * This ensures that warning messages will not appear on stderr,
-   * even for a corrupted JPEG file.  Too bad there's no way
-   * to report a "warning" message to the calling Tcl script.
+   * even for a corrupted JPEG file.  my_emit_message keeps the
+   * first warning for ImgJpegWarning instead.
    */
 }
+
+static void
+my_emit_message (cinfo, msg_level)
+    j_common_ptr cinfo;
+    int msg_level;
+{
+  /* Keep the first warning (msg_level < 0) of the image; trace
+   * messages are dropped as before.
+   */
+  if (msg_level < 0) {
+    if (lastWarning[0] == '\0') {
+      (*cinfo->err->format_message) (cinfo, lastWarning);
+    }
+    cinfo->err->num_warnings++;
+  }
+}
@@ -157,6 +157,9 @@ usage (void)
 #ifdef C_PROGRESSIVE_SUPPORTED
   fprintf(stderr, "  -progressive   Create progressive JPEG file\n");
 #endif
+#ifdef ENTROPY_OPT_SUPPORTED
+  fprintf(stderr, "  -targetsize N  Choose quality to fit output file in N bytes\n");
+#endif
 #ifdef TARGA_SUPPORTED
   fprintf(stderr, "  -targa         Input file is Targa format (usually not needed)\n");
 #endif
@@ -407,6 +410,16 @@ parse_switches (j_compress_ptr cinfo, int argc, char **argv,
 	usage();
       cinfo->smoothing_factor = val;
 
+    } else if (keymatch(arg, "targetsize", 6)) {
+      /* Largest acceptable file size; quality is chosen to fit. */
+      long lval;
+
+      if (++argn >= argc)	/* advance to next argument */
+	usage();
+      if (sscanf(argv[argn], "%ld", &lval) != 1 || lval <= 0)
+	usage();
+      cinfo->target_size = lval;
+
     } else if (keymatch(arg, "targa", 1)) {
       /* Input file is Targa format. */
       is_targa = TRUE;
@@ -52,6 +52,13 @@ typedef struct {
 
   /* In multi-pass modes, we need a virtual block array for each component. */
   jvirt_barray_ptr whole_image[MAX_COMPONENTS];
+
+  /* In target-size mode the virtual arrays hold unquantized coefficients
+   * (see jcdctmgr.c), and each MCU is quantized into this workspace as it
+   * is sent.  NULL otherwise.
+   */
+  JBLOCKROW quant_buffer;
+  boolean save_only;		/* TRUE if first pass is not to emit data */
 } my_coef_controller;
 
 typedef my_coef_controller * my_coef_ptr;
@@ -103,6 +110,7 @@ start_pass_coef (j_compress_ptr cinfo, J_BUF_MODE pass_mode)
 
   coef->iMCU_row_num = 0;
   start_iMCU_row(cinfo);
+  coef->save_only = FALSE;
 
   switch (pass_mode) {
   case JBUF_PASS_THRU:
@@ -116,6 +124,12 @@ start_pass_coef (j_compress_ptr cinfo, J_BUF_MODE pass_mode)
       ERREXIT(cinfo, JERR_BAD_BUFFER_MODE);
     coef->pub.compress_data = compress_first_pass;
     break;
+  case JBUF_SAVE_SOURCE:
+    if (coef->whole_image[0] == NULL)
+      ERREXIT(cinfo, JERR_BAD_BUFFER_MODE);
+    coef->pub.compress_data = compress_first_pass;
+    coef->save_only = TRUE;
+    break;
   case JBUF_CRANK_DEST:
     if (coef->whole_image[0] == NULL)
       ERREXIT(cinfo, JERR_BAD_BUFFER_MODE);
@@ -232,7 +246,8 @@ compress_data (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
  *
  * We must also emit the data to the entropy encoder.  This is conveniently
  * done by calling compress_output() after we've loaded the current strip
- * of the virtual arrays.
+ * of the virtual arrays.  (In JBUF_SAVE_SOURCE mode, used when searching for
+ * a target file size, nothing is emitted until the search is done.)
  *
  * NB: input_buf contains a plane for each component in image.  All
  * components are DCT'd and loaded into the virtual arrays in this pass.
@@ -318,6 +333,12 @@ compress_first_pass (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
       }
     }
   }
+  if (coef->save_only) {
+    coef->iMCU_row_num++;
+    start_iMCU_row(cinfo);
+    return TRUE;
+  }
+
   /* NB: compress_output will increment iMCU_row_num if successful.
    * A suspension return will result in redoing all the work above next time.
    */
@@ -372,6 +393,13 @@ compress_output (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
 	start_col = MCU_col_num * compptr->MCU_width;
 	for (yindex = 0; yindex < compptr->MCU_height; yindex++) {
 	  buffer_ptr = buffer[ci][yindex+yoffset] + start_col;
+	  if (coef->quant_buffer != NULL) {
+	    /* Quantize the saved coefficients at the current quality */
+	    (*cinfo->fdct->quantize) (cinfo, compptr, buffer_ptr,
+				      coef->quant_buffer + blkn,
+				      (JDIMENSION) compptr->MCU_width);
+	    buffer_ptr = coef->quant_buffer + blkn;
+	  }
 	  for (xindex = 0; xindex < compptr->MCU_width; xindex++) {
 	    coef->MCU_buffer[blkn++] = buffer_ptr++;
 	  }
@@ -430,6 +458,11 @@ jinit_c_coef_controller (j_compress_ptr cinfo, boolean need_full_buffer)
 				(long) compptr->v_samp_factor),
 	 (JDIMENSION) compptr->v_samp_factor);
     }
+    coef->quant_buffer = NULL;
+    if (cinfo->target_size > 0)
+      coef->quant_buffer = (JBLOCKROW)
+	(*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				    C_MAX_BLOCKS_IN_MCU * SIZEOF(JBLOCK));
 #else
     ERREXIT(cinfo, JERR_BAD_BUFFER_MODE);
 #endif
@@ -445,5 +478,6 @@ jinit_c_coef_controller (j_compress_ptr cinfo, boolean need_full_buffer)
       coef->MCU_buffer[i] = buffer + i;
     }
     coef->whole_image[0] = NULL; /* flag for no virtual arrays */
+    coef->quant_buffer = NULL;
   }
 }
@@ -11,6 +11,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 
 /* Private subobject */
@@ -20,6 +21,22 @@ typedef struct {
 
   /* Private state for RGB->YCC conversion */
   INT32 * rgb_ycc_tab;		/* => table for RGB to YCbCr conversion */
+
+  /* Layout of the input pixels for RGB->YCC and RGB->gray conversion:
+   * offsets of the red, green and blue samples, and samples per pixel.
+   */
+  int rgb_red, rgb_green, rgb_blue, rgb_pixelsize;
+
+#ifdef JSIMD_SUPPORTED
+  /* SIMD routines converting the leading part of a row, or NULL.
+   * Each returns the number of columns it has done.
+   */
+  JMETHOD(JDIMENSION, rgb_ycc_row, (j_compress_ptr cinfo, JSAMPROW inptr,
+				    JSAMPROW outptr0, JSAMPROW outptr1,
+				    JSAMPROW outptr2, JDIMENSION num_cols));
+  JMETHOD(JDIMENSION, rgb_gray_row, (j_compress_ptr cinfo, JSAMPROW inptr,
+				     JSAMPROW outptr, JDIMENSION num_cols));
+#endif
 } my_color_converter;
 
 typedef my_color_converter * my_cconvert_ptr;
@@ -114,6 +131,214 @@ rgb_ycc_start (j_compress_ptr cinfo)
 }
 
 
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SIMD versions of the RGB->YCC and RGB->gray inner loops.  Rather than
+ * looking up the tables, they repeat the arithmetic that built them, in
+ * 32-bit lanes so that every result equals the C version's.  pmaddwd takes
+ * 16-bit operands, which FIX(0.58700) and FIX(0.50000) do not fit; but the
+ * Y constants sum to ONE, and each set of Cb and Cr constants sums to zero
+ * (their positive one being FIX(0.50000)), so the sums can be rewritten as
+ *	Y  = G + (FIX(0.29900) * (R-G) + FIX(0.11400) * (B-G) + ONE_HALF)
+ *		>> SCALEBITS
+ *	Cb = (FIX(0.50000)/2 * 2*(B-G) + FIX(0.16874) * (G-R)
+ *		+ CBCR_OFFSET + ONE_HALF-1) >> SCALEBITS
+ *	Cr = (FIX(0.50000)/2 * 2*(R-G) + FIX(0.08131) * (G-B)
+ *		+ CBCR_OFFSET + ONE_HALF-1) >> SCALEBITS
+ * whose operands all fit.  The pixels are loaded one to a 32-bit lane, and
+ * each color sample is shifted down to the low byte.
+ */
+
+#define K_Y		JSIMD_PAIR(FIX(0.29900), FIX(0.11400))
+#define K_CB		JSIMD_PAIR(FIX(0.50000)/2, FIX(0.16874))
+#define K_CR		JSIMD_PAIR(FIX(0.50000)/2, FIX(0.08131))
+
+/* Extract the sample at bit offset s from the pixels in p0, p1 */
+
+#define SAMPLE_SSE2(p0,p1,s)  \
+    _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(p0, s), _mm_set1_epi32(0xFF)), \
+		    _mm_and_si128(_mm_srl_epi32(p1, s), _mm_set1_epi32(0xFF)))
+#define SAMPLE_AVX2(p0,p1,s)  \
+    _mm256_packs_epi32(_mm256_and_si256(_mm256_srl_epi32(p0, s), \
+					_mm256_set1_epi32(0xFF)), \
+		       _mm256_and_si256(_mm256_srl_epi32(p1, s), \
+					_mm256_set1_epi32(0xFF)))
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+rgb_ycc_row_sse2 (j_compress_ptr cinfo, JSAMPROW inptr, JSAMPROW outptr0,
+		  JSAMPROW outptr1, JSAMPROW outptr2, JDIMENSION num_cols)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  int pixelsize = cconvert->rgb_pixelsize;
+  const __m128i sr = _mm_cvtsi32_si128(cconvert->rgb_red * 8);
+  const __m128i sg = _mm_cvtsi32_si128(cconvert->rgb_green * 8);
+  const __m128i sb = _mm_cvtsi32_si128(cconvert->rgb_blue * 8);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ybias = _mm_set1_epi32((int) ONE_HALF);
+  const __m128i cbias = _mm_set1_epi32((int) (CBCR_OFFSET + ONE_HALF-1));
+  __m128i p[4], r, g, b, d1, d2, y[2], cb[2], cr[2];
+  JDIMENSION col;
+  int h;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    if (pixelsize == 4)
+      JSIMD_LOAD_PIXELS4_SSE2(p, inptr)
+    else
+      JSIMD_LOAD_PIXELS3_SSE2(p, inptr)
+    inptr += 16 * pixelsize;
+    for (h = 0; h < 2; h++) {
+      r = SAMPLE_SSE2(p[2*h], p[2*h+1], sr);
+      g = SAMPLE_SSE2(p[2*h], p[2*h+1], sg);
+      b = SAMPLE_SSE2(p[2*h], p[2*h+1], sb);
+      d1 = _mm_sub_epi16(r, g);
+      d2 = _mm_sub_epi16(b, g);
+      y[h] = _mm_add_epi16(g, JSIMD_MADD_DESCALE_SSE2(d1, d2,
+			     _mm_set1_epi32(K_Y), ybias, SCALEBITS));
+      cb[h] = JSIMD_MADD_DESCALE_SSE2(_mm_add_epi16(d2, d2),
+				      _mm_sub_epi16(zero, d1),
+				      _mm_set1_epi32(K_CB), cbias, SCALEBITS);
+      cr[h] = JSIMD_MADD_DESCALE_SSE2(_mm_add_epi16(d1, d1),
+				      _mm_sub_epi16(zero, d2),
+				      _mm_set1_epi32(K_CR), cbias, SCALEBITS);
+    }
+    _mm_storeu_si128((__m128i *) (outptr0 + col),
+		     _mm_packus_epi16(y[0], y[1]));
+    _mm_storeu_si128((__m128i *) (outptr1 + col),
+		     _mm_packus_epi16(cb[0], cb[1]));
+    _mm_storeu_si128((__m128i *) (outptr2 + col),
+		     _mm_packus_epi16(cr[0], cr[1]));
+  }
+  return col;
+}
+
+/* In the AVX2 versions the packs interleave the 128-bit lanes; the final
+ * permutation restores the pixel order.
+ */
+
+#define UNSCRAMBLE_AVX2(x)  \
+    _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0,4,1,5,2,6,3,7))
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+rgb_ycc_row_avx2 (j_compress_ptr cinfo, JSAMPROW inptr, JSAMPROW outptr0,
+		  JSAMPROW outptr1, JSAMPROW outptr2, JDIMENSION num_cols)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  int pixelsize = cconvert->rgb_pixelsize;
+  const __m128i sr = _mm_cvtsi32_si128(cconvert->rgb_red * 8);
+  const __m128i sg = _mm_cvtsi32_si128(cconvert->rgb_green * 8);
+  const __m128i sb = _mm_cvtsi32_si128(cconvert->rgb_blue * 8);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ybias = _mm256_set1_epi32((int) ONE_HALF);
+  const __m256i cbias = _mm256_set1_epi32((int) (CBCR_OFFSET + ONE_HALF-1));
+  __m256i p[4], r, g, b, d1, d2, y[2], cb[2], cr[2];
+  JDIMENSION col;
+  int h;
+
+  for (col = 0; col + 32 <= num_cols; col += 32) {
+    if (pixelsize == 4)
+      JSIMD_LOAD_PIXELS4_AVX2(p, inptr)
+    else
+      JSIMD_LOAD_PIXELS3_AVX2(p, inptr)
+    inptr += 32 * pixelsize;
+    for (h = 0; h < 2; h++) {
+      r = SAMPLE_AVX2(p[2*h], p[2*h+1], sr);
+      g = SAMPLE_AVX2(p[2*h], p[2*h+1], sg);
+      b = SAMPLE_AVX2(p[2*h], p[2*h+1], sb);
+      d1 = _mm256_sub_epi16(r, g);
+      d2 = _mm256_sub_epi16(b, g);
+      y[h] = _mm256_add_epi16(g, JSIMD_MADD_DESCALE_AVX2(d1, d2,
+				_mm256_set1_epi32(K_Y), ybias, SCALEBITS));
+      cb[h] = JSIMD_MADD_DESCALE_AVX2(_mm256_add_epi16(d2, d2),
+				      _mm256_sub_epi16(zero, d1),
+				      _mm256_set1_epi32(K_CB), cbias, SCALEBITS);
+      cr[h] = JSIMD_MADD_DESCALE_AVX2(_mm256_add_epi16(d1, d1),
+				      _mm256_sub_epi16(zero, d2),
+				      _mm256_set1_epi32(K_CR), cbias, SCALEBITS);
+    }
+    _mm256_storeu_si256((__m256i *) (outptr0 + col),
+			UNSCRAMBLE_AVX2(_mm256_packus_epi16(y[0], y[1])));
+    _mm256_storeu_si256((__m256i *) (outptr1 + col),
+			UNSCRAMBLE_AVX2(_mm256_packus_epi16(cb[0], cb[1])));
+    _mm256_storeu_si256((__m256i *) (outptr2 + col),
+			UNSCRAMBLE_AVX2(_mm256_packus_epi16(cr[0], cr[1])));
+  }
+  return col;
+}
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+rgb_gray_row_sse2 (j_compress_ptr cinfo, JSAMPROW inptr, JSAMPROW outptr,
+		   JDIMENSION num_cols)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  int pixelsize = cconvert->rgb_pixelsize;
+  const __m128i sr = _mm_cvtsi32_si128(cconvert->rgb_red * 8);
+  const __m128i sg = _mm_cvtsi32_si128(cconvert->rgb_green * 8);
+  const __m128i sb = _mm_cvtsi32_si128(cconvert->rgb_blue * 8);
+  const __m128i ybias = _mm_set1_epi32((int) ONE_HALF);
+  __m128i p[4], g, y[2];
+  JDIMENSION col;
+  int h;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    if (pixelsize == 4)
+      JSIMD_LOAD_PIXELS4_SSE2(p, inptr)
+    else
+      JSIMD_LOAD_PIXELS3_SSE2(p, inptr)
+    inptr += 16 * pixelsize;
+    for (h = 0; h < 2; h++) {
+      g = SAMPLE_SSE2(p[2*h], p[2*h+1], sg);
+      y[h] = _mm_add_epi16(g, JSIMD_MADD_DESCALE_SSE2(
+	       _mm_sub_epi16(SAMPLE_SSE2(p[2*h], p[2*h+1], sr), g),
+	       _mm_sub_epi16(SAMPLE_SSE2(p[2*h], p[2*h+1], sb), g),
+	       _mm_set1_epi32(K_Y), ybias, SCALEBITS));
+    }
+    _mm_storeu_si128((__m128i *) (outptr + col),
+		     _mm_packus_epi16(y[0], y[1]));
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+rgb_gray_row_avx2 (j_compress_ptr cinfo, JSAMPROW inptr, JSAMPROW outptr,
+		   JDIMENSION num_cols)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  int pixelsize = cconvert->rgb_pixelsize;
+  const __m128i sr = _mm_cvtsi32_si128(cconvert->rgb_red * 8);
+  const __m128i sg = _mm_cvtsi32_si128(cconvert->rgb_green * 8);
+  const __m128i sb = _mm_cvtsi32_si128(cconvert->rgb_blue * 8);
+  const __m256i ybias = _mm256_set1_epi32((int) ONE_HALF);
+  __m256i p[4], g, y[2];
+  JDIMENSION col;
+  int h;
+
+  for (col = 0; col + 32 <= num_cols; col += 32) {
+    if (pixelsize == 4)
+      JSIMD_LOAD_PIXELS4_AVX2(p, inptr)
+    else
+      JSIMD_LOAD_PIXELS3_AVX2(p, inptr)
+    inptr += 32 * pixelsize;
+    for (h = 0; h < 2; h++) {
+      g = SAMPLE_AVX2(p[2*h], p[2*h+1], sg);
+      y[h] = _mm256_add_epi16(g, JSIMD_MADD_DESCALE_AVX2(
+	       _mm256_sub_epi16(SAMPLE_AVX2(p[2*h], p[2*h+1], sr), g),
+	       _mm256_sub_epi16(SAMPLE_AVX2(p[2*h], p[2*h+1], sb), g),
+	       _mm256_set1_epi32(K_Y), ybias, SCALEBITS));
+    }
+    _mm256_storeu_si256((__m256i *) (outptr + col),
+			UNSCRAMBLE_AVX2(_mm256_packus_epi16(y[0], y[1])));
+  }
+  return col;
+}
+
+#endif /* JSIMD_SUPPORTED */
+
+
 /*
  * Convert some rows of samples to the JPEG colorspace.
  *
@@ -138,6 +363,10 @@ rgb_ycc_convert (j_compress_ptr cinfo,
   register JSAMPROW outptr0, outptr1, outptr2;
   register JDIMENSION col;
   JDIMENSION num_cols = cinfo->image_width;
+  int rgb_red = cconvert->rgb_red;
+  int rgb_green = cconvert->rgb_green;
+  int rgb_blue = cconvert->rgb_blue;
+  int rgb_pixelsize = cconvert->rgb_pixelsize;
 
   while (--num_rows >= 0) {
     inptr = *input_buf++;
@@ -145,11 +374,19 @@ rgb_ycc_convert (j_compress_ptr cinfo,
     outptr1 = output_buf[1][output_row];
     outptr2 = output_buf[2][output_row];
     output_row++;
-    for (col = 0; col < num_cols; col++) {
-      r = GETJSAMPLE(inptr[RGB_RED]);
-      g = GETJSAMPLE(inptr[RGB_GREEN]);
-      b = GETJSAMPLE(inptr[RGB_BLUE]);
-      inptr += RGB_PIXELSIZE;
+    col = 0;
+#ifdef JSIMD_SUPPORTED
+    if (cconvert->rgb_ycc_row != NULL) {
+      col = (*cconvert->rgb_ycc_row) (cinfo, inptr, outptr0, outptr1, outptr2,
+				       num_cols);
+      inptr += col * rgb_pixelsize;
+    }
+#endif
+    for (; col < num_cols; col++) {
+      r = GETJSAMPLE(inptr[rgb_red]);
+      g = GETJSAMPLE(inptr[rgb_green]);
+      b = GETJSAMPLE(inptr[rgb_blue]);
+      inptr += rgb_pixelsize;
       /* If the inputs are 0..MAXJSAMPLE, the outputs of these equations
        * must be too; we do not need an explicit range-limiting operation.
        * Hence the value being shifted is never negative, and we don't
@@ -194,16 +431,27 @@ rgb_gray_convert (j_compress_ptr cinfo,
   register JSAMPROW outptr;
   register JDIMENSION col;
   JDIMENSION num_cols = cinfo->image_width;
+  int rgb_red = cconvert->rgb_red;
+  int rgb_green = cconvert->rgb_green;
+  int rgb_blue = cconvert->rgb_blue;
+  int rgb_pixelsize = cconvert->rgb_pixelsize;
 
   while (--num_rows >= 0) {
     inptr = *input_buf++;
     outptr = output_buf[0][output_row];
     output_row++;
-    for (col = 0; col < num_cols; col++) {
-      r = GETJSAMPLE(inptr[RGB_RED]);
-      g = GETJSAMPLE(inptr[RGB_GREEN]);
-      b = GETJSAMPLE(inptr[RGB_BLUE]);
-      inptr += RGB_PIXELSIZE;
+    col = 0;
+#ifdef JSIMD_SUPPORTED
+    if (cconvert->rgb_gray_row != NULL) {
+      col = (*cconvert->rgb_gray_row) (cinfo, inptr, outptr, num_cols);
+      inptr += col * rgb_pixelsize;
+    }
+#endif
+    for (; col < num_cols; col++) {
+      r = GETJSAMPLE(inptr[rgb_red]);
+      g = GETJSAMPLE(inptr[rgb_green]);
+      b = GETJSAMPLE(inptr[rgb_blue]);
+      inptr += rgb_pixelsize;
       /* Y */
       outptr[col] = (JSAMPLE)
 		((ctab[r+R_Y_OFF] + ctab[g+G_Y_OFF] + ctab[b+B_Y_OFF])
@@ -352,6 +600,10 @@ GLOBAL(void)
 jinit_color_converter (j_compress_ptr cinfo)
 {
   my_cconvert_ptr cconvert;
+  boolean rgb_input;		/* in_color_space is RGB or JCS_EXT_xxx */
+#ifdef JSIMD_SUPPORTED
+  int simd;
+#endif
 
   cconvert = (my_cconvert_ptr)
     (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
@@ -360,6 +612,46 @@ jinit_color_converter (j_compress_ptr cinfo)
   /* set start_pass to null method until we find out differently */
   cconvert->pub.start_pass = null_method;
 
+  /* Set the pixel layout for the RGB conversions */
+  switch (cinfo->in_color_space) {
+  case JCS_EXT_RGBX:
+  case JCS_EXT_RGBA:
+    cconvert->rgb_red = 0;
+    cconvert->rgb_green = 1;
+    cconvert->rgb_blue = 2;
+    cconvert->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_BGRX:
+  case JCS_EXT_BGRA:
+    cconvert->rgb_red = 2;
+    cconvert->rgb_green = 1;
+    cconvert->rgb_blue = 0;
+    cconvert->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_XRGB:
+  case JCS_EXT_ARGB:
+    cconvert->rgb_red = 1;
+    cconvert->rgb_green = 2;
+    cconvert->rgb_blue = 3;
+    cconvert->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_XBGR:
+  case JCS_EXT_ABGR:
+    cconvert->rgb_red = 3;
+    cconvert->rgb_green = 2;
+    cconvert->rgb_blue = 1;
+    cconvert->rgb_pixelsize = 4;
+    break;
+  default:
+    cconvert->rgb_red = RGB_RED;
+    cconvert->rgb_green = RGB_GREEN;
+    cconvert->rgb_blue = RGB_BLUE;
+    cconvert->rgb_pixelsize = RGB_PIXELSIZE;
+    break;
+  }
+  rgb_input = (cinfo->in_color_space == JCS_RGB ||
+	       cinfo->in_color_space >= JCS_EXT_RGBX);
+
   /* Make sure input_components agrees with in_color_space */
   switch (cinfo->in_color_space) {
   case JCS_GRAYSCALE:
@@ -381,6 +673,14 @@ jinit_color_converter (j_compress_ptr cinfo)
 
   case JCS_CMYK:
   case JCS_YCCK:
+  case JCS_EXT_RGBX:
+  case JCS_EXT_BGRX:
+  case JCS_EXT_RGBA:
+  case JCS_EXT_BGRA:
+  case JCS_EXT_XRGB:
+  case JCS_EXT_XBGR:
+  case JCS_EXT_ARGB:
+  case JCS_EXT_ABGR:
     if (cinfo->input_components != 4)
       ERREXIT(cinfo, JERR_BAD_IN_COLORSPACE);
     break;
@@ -398,7 +698,7 @@ jinit_color_converter (j_compress_ptr cinfo)
       ERREXIT(cinfo, JERR_BAD_J_COLORSPACE);
     if (cinfo->in_color_space == JCS_GRAYSCALE)
       cconvert->pub.color_convert = grayscale_convert;
-    else if (cinfo->in_color_space == JCS_RGB) {
+    else if (rgb_input) {
       cconvert->pub.start_pass = rgb_ycc_start;
       cconvert->pub.color_convert = rgb_gray_convert;
     } else if (cinfo->in_color_space == JCS_YCbCr)
@@ -419,7 +719,7 @@ jinit_color_converter (j_compress_ptr cinfo)
   case JCS_YCbCr:
     if (cinfo->num_components != 3)
       ERREXIT(cinfo, JERR_BAD_J_COLORSPACE);
-    if (cinfo->in_color_space == JCS_RGB) {
+    if (rgb_input) {
       cconvert->pub.start_pass = rgb_ycc_start;
       cconvert->pub.color_convert = rgb_ycc_convert;
     } else if (cinfo->in_color_space == JCS_YCbCr)
@@ -456,4 +756,25 @@ jinit_color_converter (j_compress_ptr cinfo)
     cconvert->pub.color_convert = null_convert;
     break;
   }
+
+#ifdef JSIMD_SUPPORTED
+  /* Use SIMD row converters if the CPU has them; their output is identical */
+  simd = jsimd_cpu_support();
+  cconvert->rgb_ycc_row = NULL;
+  cconvert->rgb_gray_row = NULL;
+  if (cconvert->rgb_pixelsize == 3 || cconvert->rgb_pixelsize == 4) {
+    if (simd & JSIMD_AVX2) {
+      cconvert->rgb_ycc_row = rgb_ycc_row_avx2;
+      cconvert->rgb_gray_row = rgb_gray_row_avx2;
+    } else if (simd & JSIMD_SSE2) {
+      cconvert->rgb_ycc_row = rgb_ycc_row_sse2;
+      cconvert->rgb_gray_row = rgb_gray_row_sse2;
+    }
+  }
+  if ((cconvert->pub.color_convert == rgb_ycc_convert &&
+       cconvert->rgb_ycc_row != NULL) ||
+      (cconvert->pub.color_convert == rgb_gray_convert &&
+       cconvert->rgb_gray_row != NULL))
+    jsimd_note_kernel(JSIMD_K_COLOR_IN, simd);
+#endif
 }
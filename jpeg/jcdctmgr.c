@@ -15,6 +15,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 
 /* Private subobject for this module */
@@ -31,16 +32,120 @@ typedef struct {
    */
   DCTELEM * divisors[NUM_QUANT_TBLS];
 
+  /* In target-size mode the DCT output is saved unquantized, so that
+   * each trial quality needs only a requantization of the same blocks.
+   */
+  boolean save_raw;
+
 #ifdef DCT_FLOAT_SUPPORTED
   /* Same as above for the floating-point case. */
   float_DCT_method_ptr do_float_dct;
   FAST_FLOAT * float_divisors[NUM_QUANT_TBLS];
 #endif
+
+#ifdef JSIMD_SUPPORTED
+  /* SIMD DCT routine to use instead of do_dct, or NULL; see jsimd.h */
+  jsimd_fdct_ptr do_simd_dct;
+#ifdef DCT_FLOAT_SUPPORTED
+  jsimd_float_fdct_ptr do_simd_float_dct;
+#endif
+
+  /* For quantize_sse2: the divisors in reciprocal form (see
+   * compute_reciprocals), and whether that form is exact for each table.
+   */
+  boolean simd_quantize;
+  UINT16 * reciprocals[NUM_QUANT_TBLS];
+  boolean recip_ok[NUM_QUANT_TBLS];
+#endif
 } my_fdct_controller;
 
 typedef my_fdct_controller * my_fdct_ptr;
 
 
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * Quantization by multiplication.
+ *
+ * The divide loop in forward_DCT computes (|x| + (d>>1)) / d for each
+ * coefficient x and divisor d, then restores the sign of x.  For a dividend
+ * 0 <= n < 2^15 and 2 <= d < 2^16, let l = ceil(log2(d)) and
+ * m = ceil(2^(15+l) / d); then m < 2^16, and
+ *	n / d  ==  (n * m) >> (15+l)
+ * exactly, since m exceeds 2^(15+l)/d by less than 2^l/d, which adds less
+ * than 1/d to a quotient whose fraction is at most (d-1)/d.  The shift is
+ * done as a second high multiply by 2^(17-l), which needs l >= 2 (d >= 3).
+ * This lets SSE2 quantize eight coefficients at once with pmulhuw.
+ *
+ * Each reciprocal table holds, in normal array order, DCTSIZE2 values each
+ * of m, d>>1 and 2^(17-l).  recip_ok is FALSE if some divisor is outside
+ * 3..32767; such tables (only possible with extreme quant tables) keep
+ * using the divide loop.  A block with a dividend of 2^15 or more, which
+ * cannot happen with 8-bit samples, is also left to the divide loop.
+ */
+
+LOCAL(void)
+compute_reciprocals (my_fdct_ptr fdct, int qtblno)
+{
+  DCTELEM * dtbl = fdct->divisors[qtblno];
+  UINT16 * rtbl = fdct->reciprocals[qtblno];
+  INT32 d;
+  int i, l;
+
+  fdct->recip_ok[qtblno] = FALSE;
+  for (i = 0; i < DCTSIZE2; i++) {
+    d = (INT32) dtbl[i];
+    if (d < 3 || d > 32767L)
+      return;
+    for (l = 2; (1L << l) < d; l++)
+      ;
+    rtbl[i] = (UINT16) ((((INT32) 1 << (15+l)) + d - 1) / d);
+    rtbl[DCTSIZE2 + i] = (UINT16) (d >> 1);
+    rtbl[DCTSIZE2*2 + i] = (UINT16) (1 << (17-l));
+  }
+  fdct->recip_ok[qtblno] = TRUE;
+}
+
+
+/*
+ * Quantize one block from workspace[] into output_ptr[] using a reciprocal
+ * table.  Returns FALSE, without storing anything, if some dividend is too
+ * large for the multiplication to be exact.
+ */
+
+JSIMD_TARGET("sse2")
+LOCAL(boolean)
+quantize_sse2 (DCTELEM * workspace, UINT16 * rtbl, JCOEFPTR output_ptr)
+{
+  __m128i x, sign, n, chk, q[DCTSIZE2/8];
+  int i;
+
+  chk = _mm_setzero_si128();
+  for (i = 0; i < DCTSIZE2/8; i++) {
+    /* Saturation here makes n >= 2^15, so the check below catches it */
+    x = _mm_packs_epi32(_mm_loadu_si128((__m128i *) (workspace + i*8)),
+			_mm_loadu_si128((__m128i *) (workspace + i*8 + 4)));
+    sign = _mm_srai_epi16(x, 15);
+    n = _mm_sub_epi16(_mm_xor_si128(x, sign), sign);
+    n = _mm_add_epi16(n, _mm_loadu_si128((__m128i *)
+					 (rtbl + DCTSIZE2 + i*8)));
+    chk = _mm_or_si128(chk, n);
+    n = _mm_mulhi_epu16(n, _mm_loadu_si128((__m128i *) (rtbl + i*8)));
+    n = _mm_mulhi_epu16(n, _mm_loadu_si128((__m128i *)
+					   (rtbl + DCTSIZE2*2 + i*8)));
+    q[i] = _mm_sub_epi16(_mm_xor_si128(n, sign), sign);
+  }
+  /* The top bit of any 16-bit dividend must be clear */
+  if (_mm_movemask_epi8(chk) & 0xAAAA)
+    return FALSE;
+  for (i = 0; i < DCTSIZE2/8; i++)
+    _mm_storeu_si128((__m128i *) (output_ptr + i*8), q[i]);
+  return TRUE;
+}
+
+#endif /* JSIMD_SUPPORTED */
+
+
 /*
  * Initialize for a processing pass.
  * Verify that all referenced Q-tables are present, and set up
@@ -164,6 +269,16 @@ start_pass_fdctmgr (j_compress_ptr cinfo)
       ERREXIT(cinfo, JERR_NOT_COMPILED);
       break;
     }
+#ifdef JSIMD_SUPPORTED
+    if (fdct->simd_quantize) {
+      if (fdct->reciprocals[qtblno] == NULL) {
+	fdct->reciprocals[qtblno] = (UINT16 *)
+	  (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				      DCTSIZE2 * 3 * SIZEOF(UINT16));
+      }
+      compute_reciprocals(fdct, qtblno);
+    }
+#endif
   }
 }
 
@@ -189,12 +304,25 @@ forward_DCT (j_compress_ptr cinfo, jpeg_component_info * compptr,
   DCTELEM * divisors = fdct->divisors[compptr->quant_tbl_no];
   DCTELEM workspace[DCTSIZE2];	/* work area for FDCT subroutine */
   JDIMENSION bi;
+#ifdef JSIMD_SUPPORTED
+  UINT16 * rtbl = NULL;
+
+  if (fdct->simd_quantize && fdct->recip_ok[compptr->quant_tbl_no])
+    rtbl = fdct->reciprocals[compptr->quant_tbl_no];
+#endif
 
   sample_data += start_row;	/* fold in the vertical offset once */
 
   for (bi = 0; bi < num_blocks; bi++, start_col += DCTSIZE) {
-    /* Load data into workspace, applying unsigned->signed conversion */
-    { register DCTELEM *workspaceptr;
+#ifdef JSIMD_SUPPORTED
+    if (fdct->do_simd_dct != NULL) {
+      /* The SIMD DCT loads and converts the samples itself */
+      (*fdct->do_simd_dct) (workspace, sample_data, start_col);
+    } else
+#endif
+    {
+      /* Load data into workspace, applying unsigned->signed conversion */
+      register DCTELEM *workspaceptr;
       register JSAMPROW elemptr;
       register int elemr;
 
@@ -218,10 +346,25 @@ forward_DCT (j_compress_ptr cinfo, jpeg_component_info * compptr,
 	}
 #endif
       }
+
+      /* Perform the DCT */
+      (*do_dct) (workspace);
     }
 
-    /* Perform the DCT */
-    (*do_dct) (workspace);
+    if (fdct->save_raw) {
+      /* Store the scaled coefficients for later requantization */
+      register int i;
+      register JCOEFPTR output_ptr = coef_blocks[bi];
+
+      for (i = 0; i < DCTSIZE2; i++)
+	output_ptr[i] = (JCOEF) workspace[i];
+      continue;
+    }
+
+#ifdef JSIMD_SUPPORTED
+    if (rtbl != NULL && quantize_sse2(workspace, rtbl, coef_blocks[bi]))
+      continue;
+#endif
 
     /* Quantize/descale the coefficients, and store into coef_blocks[] */
     { register DCTELEM temp, qval;
@@ -264,6 +407,60 @@ forward_DCT (j_compress_ptr cinfo, jpeg_component_info * compptr,
 }
 
 
+/*
+ * Quantize blocks saved unquantized by forward_DCT in target-size mode,
+ * using the divisors set up by the latest start_pass.  The rounding is
+ * the same as forward_DCT's, so the result is identical to what a direct
+ * compression at the current quality would produce.
+ */
+
+METHODDEF(void)
+quantize (j_compress_ptr cinfo, jpeg_component_info * compptr,
+	  JBLOCKROW raw_blocks, JBLOCKROW coef_blocks, JDIMENSION num_blocks)
+{
+  my_fdct_ptr fdct = (my_fdct_ptr) cinfo->fdct;
+  DCTELEM * divisors = fdct->divisors[compptr->quant_tbl_no];
+  register DCTELEM temp, qval;
+  register int i;
+  register JCOEFPTR input_ptr, output_ptr;
+  JDIMENSION bi;
+#ifdef JSIMD_SUPPORTED
+  UINT16 * rtbl = NULL;
+  DCTELEM workspace[DCTSIZE2];
+
+  if (fdct->simd_quantize && fdct->recip_ok[compptr->quant_tbl_no])
+    rtbl = fdct->reciprocals[compptr->quant_tbl_no];
+#endif
+
+  for (bi = 0; bi < num_blocks; bi++) {
+    input_ptr = raw_blocks[bi];
+    output_ptr = coef_blocks[bi];
+#ifdef JSIMD_SUPPORTED
+    if (rtbl != NULL) {
+      for (i = 0; i < DCTSIZE2; i++)
+	workspace[i] = (DCTELEM) input_ptr[i];
+      if (quantize_sse2(workspace, rtbl, output_ptr))
+	continue;
+    }
+#endif
+    for (i = 0; i < DCTSIZE2; i++) {
+      qval = divisors[i];
+      temp = (DCTELEM) input_ptr[i];
+      if (temp < 0) {
+	temp = -temp;
+	temp += qval>>1;	/* for rounding */
+	DIVIDE_BY(temp, qval);
+	temp = -temp;
+      } else {
+	temp += qval>>1;	/* for rounding */
+	DIVIDE_BY(temp, qval);
+      }
+      output_ptr[i] = (JCOEF) temp;
+    }
+  }
+}
+
+
 #ifdef DCT_FLOAT_SUPPORTED
 
 METHODDEF(void)
@@ -283,8 +480,15 @@ forward_DCT_float (j_compress_ptr cinfo, jpeg_component_info * compptr,
   sample_data += start_row;	/* fold in the vertical offset once */
 
   for (bi = 0; bi < num_blocks; bi++, start_col += DCTSIZE) {
-    /* Load data into workspace, applying unsigned->signed conversion */
-    { register FAST_FLOAT *workspaceptr;
+#ifdef JSIMD_SUPPORTED
+    if (fdct->do_simd_float_dct != NULL) {
+      /* The SIMD DCT loads and converts the samples itself */
+      (*fdct->do_simd_float_dct) (workspace, sample_data, start_col);
+    } else
+#endif
+    {
+      /* Load data into workspace, applying unsigned->signed conversion */
+      register FAST_FLOAT *workspaceptr;
       register JSAMPROW elemptr;
       register int elemr;
 
@@ -309,10 +513,10 @@ forward_DCT_float (j_compress_ptr cinfo, jpeg_component_info * compptr,
 	}
 #endif
       }
-    }
 
-    /* Perform the DCT */
-    (*do_dct) (workspace);
+      /* Perform the DCT */
+      (*do_dct) (workspace);
+    }
 
     /* Quantize/descale the coefficients, and store into coef_blocks[] */
     { register FAST_FLOAT temp;
@@ -346,12 +550,18 @@ jinit_forward_dct (j_compress_ptr cinfo)
 {
   my_fdct_ptr fdct;
   int i;
+#ifdef JSIMD_SUPPORTED
+  int simd;
+#endif
 
   fdct = (my_fdct_ptr)
     (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
 				SIZEOF(my_fdct_controller));
   cinfo->fdct = (struct jpeg_forward_dct *) fdct;
   fdct->pub.start_pass = start_pass_fdctmgr;
+  fdct->pub.quantize = quantize;
+  /* jcmaster.c has already excluded the float DCT in target-size mode */
+  fdct->save_raw = (cinfo->target_size > 0);
 
   switch (cinfo->dct_method) {
 #ifdef DCT_ISLOW_SUPPORTED
@@ -377,11 +587,62 @@ jinit_forward_dct (j_compress_ptr cinfo)
     break;
   }
 
+#ifdef JSIMD_SUPPORTED
+  /* Use a SIMD DCT if the CPU has one; its output is identical */
+  simd = jsimd_cpu_support();
+  fdct->do_simd_dct = NULL;
+#ifdef DCT_FLOAT_SUPPORTED
+  fdct->do_simd_float_dct = NULL;
+#endif
+  if (simd & (JSIMD_SSE2 | JSIMD_AVX2)) {
+    switch (cinfo->dct_method) {
+#ifdef DCT_ISLOW_SUPPORTED
+    case JDCT_ISLOW:
+      fdct->do_simd_dct = (simd & JSIMD_AVX2) ? jpeg_fdct_islow_avx2 :
+						jpeg_fdct_islow_sse2;
+      break;
+#endif
+#ifdef DCT_IFAST_SUPPORTED
+    case JDCT_IFAST:
+      fdct->do_simd_dct = (simd & JSIMD_AVX2) ? jpeg_fdct_ifast_avx2 :
+						jpeg_fdct_ifast_sse2;
+      break;
+#endif
+#ifdef DCT_FLOAT_SUPPORTED
+    case JDCT_FLOAT:
+      if (SIZEOF(FAST_FLOAT) == 4)
+	fdct->do_simd_float_dct = (simd & JSIMD_AVX2) ? jpeg_fdct_float_avx2 :
+							jpeg_fdct_float_sse2;
+      break;
+#endif
+    default:
+      break;
+    }
+  }
+  /* Quantize by multiplication where that is exact; the float DCT
+   * quantizes by multiplication anyway.  The 16-bit lanes must match
+   * JCOEF and UINT16.
+   */
+  fdct->simd_quantize = ((simd & JSIMD_SSE2) &&
+			 cinfo->dct_method != JDCT_FLOAT &&
+			 SIZEOF(JCOEF) == 2 && SIZEOF(UINT16) == 2);
+  jsimd_note_kernel(JSIMD_K_FDCT, fdct->do_simd_dct != NULL ? simd : 0);
+#ifdef DCT_FLOAT_SUPPORTED
+  if (fdct->do_simd_float_dct != NULL)
+    jsimd_note_kernel(JSIMD_K_FDCT, simd);
+#endif
+  jsimd_note_kernel(JSIMD_K_QUANTIZE, fdct->simd_quantize ? JSIMD_SSE2 : 0);
+#endif
+
   /* Mark divisor tables unallocated */
   for (i = 0; i < NUM_QUANT_TBLS; i++) {
     fdct->divisors[i] = NULL;
 #ifdef DCT_FLOAT_SUPPORTED
     fdct->float_divisors[i] = NULL;
+#endif
+#ifdef JSIMD_SUPPORTED
+    fdct->reciprocals[i] = NULL;
+    fdct->recip_ok[i] = FALSE;
 #endif
   }
 }
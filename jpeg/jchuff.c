@@ -18,6 +18,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jchuff.h"		/* Declarations shared with jcphuff.c */
+#include "jsimd.h"
 
 
 /* Expanded entropy encoder object for Huffman encoding.
@@ -27,7 +28,7 @@
  */
 
 typedef struct {
-  INT32 put_buffer;		/* current bit-accumulation buffer */
+  huff_buf_type put_buffer;	/* current bit-accumulation buffer */
   int put_bits;			/* # of bits now in it */
   int last_dc_val[MAX_COMPS_IN_SCAN]; /* last DC coef for each component */
 } savable_state;
@@ -69,6 +70,10 @@ typedef struct {
   long * dc_count_ptrs[NUM_HUFF_TBLS];
   long * ac_count_ptrs[NUM_HUFF_TBLS];
 #endif
+
+#ifdef HUFF_NONZERO_MASK
+  coef_mask_ptr coef_mask;	/* finds the nonzero AC coefficients */
+#endif
 } huff_entropy_encoder;
 
 typedef huff_entropy_encoder * huff_entropy_ptr;
@@ -291,61 +296,194 @@ dump_buffer (working_state * state)
 
 /* Outputting bits to the file */
 
-/* Only the right 24 bits of put_buffer are used; the valid bits are
- * left-justified in this part.  At most 16 bits can be passed to emit_bits
- * in one call, and we never retain more than 7 bits in put_buffer
- * between calls, so 24 bits are sufficient.
+/* Within encode_one_block, put_buffer and put_bits (see jchuff.h) are kept
+ * in local variables and the words are stored through outptr without any
+ * check for the end of the output buffer; encode_one_block makes sure
+ * beforehand that there is room for the largest possible block.  A word
+ * with no 0xFF byte (nearly all of them) is stored as it stands; otherwise
+ * its bytes are stored one at a time with the zero bytes stuffed in.
  */
 
-INLINE
-LOCAL(boolean)
-emit_bits (working_state * state, unsigned int code, int size)
-/* Emit some bits; return TRUE if successful, FALSE if must suspend */
-{
-  /* This routine is heavily used, so it's worth coding tightly. */
-  register INT32 put_buffer = (INT32) code;
-  register int put_bits = state->cur.put_bits;
+#define EMIT_WORD()  \
+	{ huff_buf_type c_ = (put_buffer >> (put_bits -= PUT_WORD_BITS)) & \
+			     WORD_MASK; \
+	  int s_; \
+	  if (WORD_HAS_FF(c_)) { \
+	    for (s_ = PUT_WORD_BITS - 8; s_ >= 0; s_ -= 8) { \
+	      int b_ = (int) (c_ >> s_) & 0xFF; \
+	      *outptr++ = (JOCTET) b_; \
+	      if (b_ == 0xFF) \
+		*outptr++ = 0; \
+	    } \
+	  } else { \
+	    for (s_ = PUT_WORD_BITS - 8; s_ >= 0; s_ -= 8) \
+	      *outptr++ = (JOCTET) (c_ >> s_); \
+	  } }
+
+/* Add size bits of code (which must have no bits above those) */
+
+#define EMIT_BITS(code,size)  \
+	{ put_buffer = (put_buffer << (size)) | (code); \
+	  if ((put_bits += (size)) >= PUT_WORD_BITS) \
+	    EMIT_WORD(); }
+
+/* Add the Huffman code for symbol sym of table tbl followed by the low
+ * nbits bits of value.  If the code length is 0, the table has no code for
+ * the symbol.
+ */
 
-  /* if size is 0, caller used an invalid Huffman table entry */
-  if (size == 0)
-    ERREXIT(state->cinfo, JERR_HUFF_MISSING_CODE);
+#if PUT_BUF_SIZE == 64
+#define EMIT_SYMBOL(tbl,sym,value,nbits)  \
+	{ int size_ = (tbl)->ehufsi[sym]; \
+	  if (size_ == 0) \
+	    ERREXIT(state->cinfo, JERR_HUFF_MISSING_CODE); \
+	  EMIT_BITS(((huff_buf_type) (tbl)->ehufco[sym] << (nbits)) | \
+		    (huff_buf_type) ((value) & ((1 << (nbits)) - 1)), \
+		    size_ + (nbits)); }
+#else
+#define EMIT_SYMBOL(tbl,sym,value,nbits)  \
+	{ int size_ = (tbl)->ehufsi[sym]; \
+	  if (size_ == 0) \
+	    ERREXIT(state->cinfo, JERR_HUFF_MISSING_CODE); \
+	  EMIT_BITS((huff_buf_type) (tbl)->ehufco[sym], size_); \
+	  EMIT_BITS((huff_buf_type) ((value) & ((1 << (nbits)) - 1)), nbits); }
+#endif
 
-  put_buffer &= (((INT32) 1)<<size) - 1; /* mask off any extra bits in code */
-  
-  put_bits += size;		/* new number of bits in buffer */
-  
-  put_buffer <<= 24 - put_bits; /* align incoming bits */
+/* The most bytes one block can produce, counting a word's worth of bits
+ * left over from the previous block and a stuffed zero after every byte.
+ * Each coefficient takes at most a 16-bit code and MAX_COEF_BITS+1 value
+ * bits (a ZRL code stands for 16 coefficients), plus a final EOB code.
+ */
+
+#define BLOCK_BUF_SIZE \
+  (2 * ((DCTSIZE2 * (16 + MAX_COEF_BITS + 1) + 16 + PUT_WORD_BITS) / 8 + 1))
+
+
+LOCAL(boolean)
+flush_bits (working_state * state)
+{
+  /* fill any partial byte with ones */
+  huff_buf_type put_buffer = (state->cur.put_buffer << 7) | 0x7F;
+  int put_bits = state->cur.put_bits + 7;
+  int c;
 
-  put_buffer |= state->cur.put_buffer; /* and merge with old buffer contents */
-  
   while (put_bits >= 8) {
-    int c = (int) ((put_buffer >> 16) & 0xFF);
-    
+    put_bits -= 8;
+    c = (int) (put_buffer >> put_bits) & 0xFF;
     emit_byte(state, c, return FALSE);
     if (c == 0xFF) {		/* need to stuff a zero byte? */
       emit_byte(state, 0, return FALSE);
     }
-    put_buffer <<= 8;
-    put_bits -= 8;
   }
+  state->cur.put_buffer = 0;	/* and reset bit-buffer to empty */
+  state->cur.put_bits = 0;
+  return TRUE;
+}
 
-  state->cur.put_buffer = put_buffer; /* update state variables */
-  state->cur.put_bits = put_bits;
 
-  return TRUE;
+#ifndef __GNUC__
+
+GLOBAL(int)
+jpeg_nbits (int x)
+/* Note this is also used by jcphuff.c. */
+{
+  int nbits = 0;
+
+  while (x) {
+    nbits++;
+    x >>= 1;
+  }
+  return nbits;
 }
 
+#endif
+
 
-LOCAL(boolean)
-flush_bits (working_state * state)
+#ifdef HUFF_NONZERO_MASK
+
+/* Build the bitmaps of the nonzero (and unit) coefficients Ss..Se */
+
+METHODDEF(unsigned long)
+coef_mask (JCOEFPTR block, int Ss, int Se, int Al, unsigned long * ones)
 {
-  if (! emit_bits(state, 0x7F, 7)) /* fill any partial byte with ones */
-    return FALSE;
-  state->cur.put_buffer = 0;	/* and reset bit-buffer to empty */
-  state->cur.put_bits = 0;
-  return TRUE;
+  unsigned long mask = 0, onesmask = 0;
+  int k, temp;
+
+  /* Most coefficients are zero, so testing for them first pays */
+  for (k = Ss; k <= Se; k++) {
+    if ((temp = block[jpeg_natural_order[k]]) == 0)
+      continue;
+    if (temp < 0)
+      temp = -temp;
+    temp >>= Al;
+    if (temp != 0) {
+      mask |= 1UL << k;
+      if (temp == 1)
+	onesmask |= 1UL << k;
+    }
+  }
+  if (ones != NULL)
+    *ones = onesmask;
+  return mask;
+}
+
+#ifdef JSIMD_SUPPORTED
+
+/* The same with AVX2 (really SSSE3, for pabsw and pshufb): the flags of the
+ * coefficients are packed to bytes in natural order and gathered into
+ * zigzag order by JSIMD_ZIGZAG_MOVEMASK.
+ */
+
+JSIMD_TARGET("avx2")
+METHODDEF(unsigned long)
+coef_mask_avx2 (JCOEFPTR block, int Ss, int Se, int Al,
+		unsigned long * ones)
+{
+  /* the bits for Ss..Se (2UL << 63 is 0, which is right for Se = 63) */
+  unsigned long band = (2UL << Se) - (1UL << Ss);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i shift = _mm_cvtsi32_si128(Al);
+  __m128i v[8], flags[4];
+  unsigned long mask;
+  int s;
+
+  for (s = 0; s < 8; s++)
+    v[s] = _mm_srl_epi16(
+	_mm_abs_epi16(_mm_loadu_si128((const __m128i *) (block + 8*s))),
+	shift);
+  if (ones != NULL) {
+    for (s = 0; s < 4; s++)
+      flags[s] = _mm_packs_epi16(_mm_cmpeq_epi16(v[2*s], one),
+				 _mm_cmpeq_epi16(v[2*s+1], one));
+    JSIMD_ZIGZAG_MOVEMASK(mask, flags);
+    *ones = mask & band;
+  }
+  for (s = 0; s < 4; s++)
+    flags[s] = _mm_packs_epi16(_mm_cmpeq_epi16(v[2*s], zero),
+			       _mm_cmpeq_epi16(v[2*s+1], zero));
+  JSIMD_ZIGZAG_MOVEMASK(mask, flags);
+  return ~mask & band;		/* the flags were set for zero coefficients */
+}
+
+#endif /* JSIMD_SUPPORTED */
+
+
+GLOBAL(coef_mask_ptr)
+jpeg_coef_mask_method (void)
+/* Note this is also used by jcphuff.c. */
+{
+#ifdef JSIMD_SUPPORTED
+  if (jsimd_cpu_support() & JSIMD_AVX2) {
+    jsimd_note_kernel(JSIMD_K_HUFF_ENCODE, JSIMD_AVX2);
+    return coef_mask_avx2;
+  }
+#endif
+  return coef_mask;
 }
 
+#endif /* HUFF_NONZERO_MASK */
+
 
 /* Encode a single block's worth of coefficients */
 
@@ -355,8 +493,25 @@ encode_one_block (working_state * state, JCOEFPTR block, int last_dc_val,
 {
   register int temp, temp2;
   register int nbits;
-  register int k, r, i;
-  
+  register int k, r;
+  register huff_buf_type put_buffer = state->cur.put_buffer;
+  register int put_bits = state->cur.put_bits;
+  register JOCTET * outptr;
+  JOCTET * p;
+  boolean use_localbuf;
+  JOCTET localbuf[BLOCK_BUF_SIZE];
+#ifdef HUFF_NONZERO_MASK
+  huff_entropy_ptr entropy = (huff_entropy_ptr) state->cinfo->entropy;
+  unsigned long mask;
+  int i;
+#endif
+
+  /* Write straight into the output buffer if the block is sure to fit;
+   * otherwise write into localbuf and copy that out afterwards.
+   */
+  use_localbuf = (state->free_in_buffer <= BLOCK_BUF_SIZE);
+  outptr = use_localbuf ? localbuf : state->next_output_byte;
+
   /* Encode the DC coefficient difference per section F.1.2.1 */
   
   temp = temp2 = block[0] - last_dc_val;
@@ -369,75 +524,86 @@ encode_one_block (working_state * state, JCOEFPTR block, int last_dc_val,
   }
   
   /* Find the number of bits needed for the magnitude of the coefficient */
-  nbits = 0;
-  while (temp) {
-    nbits++;
-    temp >>= 1;
-  }
+  nbits = NBITS(temp);
   /* Check for out-of-range coefficient values.
    * Since we're encoding a difference, the range limit is twice as much.
    */
   if (nbits > MAX_COEF_BITS+1)
     ERREXIT(state->cinfo, JERR_BAD_DCT_COEF);
   
-  /* Emit the Huffman-coded symbol for the number of bits */
-  if (! emit_bits(state, dctbl->ehufco[nbits], dctbl->ehufsi[nbits]))
-    return FALSE;
-
-  /* Emit that number of bits of the value, if positive, */
+  /* Emit the Huffman-coded symbol for the number of bits, followed by */
+  /* that number of bits of the value, if positive, */
   /* or the complement of its magnitude, if negative. */
-  if (nbits)			/* emit_bits rejects calls with size 0 */
-    if (! emit_bits(state, (unsigned int) temp2, nbits))
-      return FALSE;
+  EMIT_SYMBOL(dctbl, nbits, temp2, nbits);
 
   /* Encode the AC coefficients per section F.1.2.2 */
-  
+
+#ifdef HUFF_NONZERO_MASK
+  mask = (*entropy->coef_mask) (block, 1, DCTSIZE2 - 1, 0,
+				(unsigned long *) NULL);
+  i = 0;			/* zigzag index of the last coefficient coded */
+  while (mask) {
+    k = __builtin_ctzl(mask);
+    mask &= mask - 1;
+    r = k - i - 1;		/* r = run length of zeros */
+    i = k;
+    temp = block[jpeg_natural_order[k]];
+#else
   r = 0;			/* r = run length of zeros */
   
   for (k = 1; k < DCTSIZE2; k++) {
     if ((temp = block[jpeg_natural_order[k]]) == 0) {
       r++;
-    } else {
-      /* if run length > 15, must emit special run-length-16 codes (0xF0) */
-      while (r > 15) {
-	if (! emit_bits(state, actbl->ehufco[0xF0], actbl->ehufsi[0xF0]))
-	  return FALSE;
-	r -= 16;
-      }
+      continue;
+    }
+#endif
+    /* if run length > 15, must emit special run-length-16 codes (0xF0) */
+    while (r > 15) {
+      EMIT_SYMBOL(actbl, 0xF0, 0, 0);
+      r -= 16;
+    }
 
-      temp2 = temp;
-      if (temp < 0) {
-	temp = -temp;		/* temp is abs value of input */
-	/* This code assumes we are on a two's complement machine */
-	temp2--;
-      }
+    temp2 = temp;
+    if (temp < 0) {
+      temp = -temp;		/* temp is abs value of input */
+      /* This code assumes we are on a two's complement machine */
+      temp2--;
+    }
       
-      /* Find the number of bits needed for the magnitude of the coefficient */
-      nbits = 1;		/* there must be at least one 1 bit */
-      while ((temp >>= 1))
-	nbits++;
-      /* Check for out-of-range coefficient values */
-      if (nbits > MAX_COEF_BITS)
-	ERREXIT(state->cinfo, JERR_BAD_DCT_COEF);
+    /* Find the number of bits needed for the magnitude of the coefficient */
+    nbits = NBITS(temp);
+    /* Check for out-of-range coefficient values */
+    if (nbits > MAX_COEF_BITS)
+      ERREXIT(state->cinfo, JERR_BAD_DCT_COEF);
       
-      /* Emit Huffman symbol for run length / number of bits */
-      i = (r << 4) + nbits;
-      if (! emit_bits(state, actbl->ehufco[i], actbl->ehufsi[i]))
-	return FALSE;
+    /* Emit Huffman symbol for run length / number of bits, followed by */
+    /* that number of bits of the value, if positive, */
+    /* or the complement of its magnitude, if negative. */
+    EMIT_SYMBOL(actbl, (r << 4) + nbits, temp2, nbits);
 
-      /* Emit that number of bits of the value, if positive, */
-      /* or the complement of its magnitude, if negative. */
-      if (! emit_bits(state, (unsigned int) temp2, nbits))
-	return FALSE;
-      
-      r = 0;
-    }
+#ifndef HUFF_NONZERO_MASK
+    r = 0;
+#endif
   }
 
   /* If the last coef(s) were zero, emit an end-of-block code */
+#ifdef HUFF_NONZERO_MASK
+  if (i < DCTSIZE2 - 1)
+#else
   if (r > 0)
-    if (! emit_bits(state, actbl->ehufco[0], actbl->ehufsi[0]))
-      return FALSE;
+#endif
+    EMIT_SYMBOL(actbl, 0, 0, 0);
+
+  state->cur.put_buffer = put_buffer;
+  state->cur.put_bits = put_bits;
+
+  if (use_localbuf) {
+    for (p = localbuf; p < outptr; p++)
+      emit_byte(state, *p, return FALSE);
+  } else {
+    state->free_in_buffer -= outptr - state->next_output_byte;
+    state->next_output_byte = outptr;
+  }
 
   return TRUE;
 }
@@ -575,6 +741,11 @@ htest_one_block (j_compress_ptr cinfo, JCOEFPTR block, int last_dc_val,
   register int temp;
   register int nbits;
   register int k, r;
+#ifdef HUFF_NONZERO_MASK
+  huff_entropy_ptr entropy = (huff_entropy_ptr) cinfo->entropy;
+  unsigned long mask;
+  int i;
+#endif
   
   /* Encode the DC coefficient difference per section F.1.2.1 */
   
@@ -583,11 +754,7 @@ htest_one_block (j_compress_ptr cinfo, JCOEFPTR block, int last_dc_val,
     temp = -temp;
   
   /* Find the number of bits needed for the magnitude of the coefficient */
-  nbits = 0;
-  while (temp) {
-    nbits++;
-    temp >>= 1;
-  }
+  nbits = NBITS(temp);
   /* Check for out-of-range coefficient values.
    * Since we're encoding a difference, the range limit is twice as much.
    */
@@ -599,39 +766,53 @@ htest_one_block (j_compress_ptr cinfo, JCOEFPTR block, int last_dc_val,
   
   /* Encode the AC coefficients per section F.1.2.2 */
   
+#ifdef HUFF_NONZERO_MASK
+  mask = (*entropy->coef_mask) (block, 1, DCTSIZE2 - 1, 0,
+				(unsigned long *) NULL);
+  i = 0;			/* zigzag index of the last coefficient coded */
+  while (mask) {
+    k = __builtin_ctzl(mask);
+    mask &= mask - 1;
+    r = k - i - 1;		/* r = run length of zeros */
+    i = k;
+    temp = block[jpeg_natural_order[k]];
+#else
   r = 0;			/* r = run length of zeros */
   
   for (k = 1; k < DCTSIZE2; k++) {
     if ((temp = block[jpeg_natural_order[k]]) == 0) {
       r++;
-    } else {
-      /* if run length > 15, must emit special run-length-16 codes (0xF0) */
-      while (r > 15) {
-	ac_counts[0xF0]++;
-	r -= 16;
-      }
-      
-      /* Find the number of bits needed for the magnitude of the coefficient */
-      if (temp < 0)
-	temp = -temp;
-      
-      /* Find the number of bits needed for the magnitude of the coefficient */
-      nbits = 1;		/* there must be at least one 1 bit */
-      while ((temp >>= 1))
-	nbits++;
-      /* Check for out-of-range coefficient values */
-      if (nbits > MAX_COEF_BITS)
-	ERREXIT(cinfo, JERR_BAD_DCT_COEF);
+      continue;
+    }
+#endif
+    /* if run length > 15, must emit special run-length-16 codes (0xF0) */
+    while (r > 15) {
+      ac_counts[0xF0]++;
+      r -= 16;
+    }
       
-      /* Count Huffman symbol for run length / number of bits */
-      ac_counts[(r << 4) + nbits]++;
+    /* Find the number of bits needed for the magnitude of the coefficient */
+    if (temp < 0)
+      temp = -temp;
+    nbits = NBITS(temp);
+    /* Check for out-of-range coefficient values */
+    if (nbits > MAX_COEF_BITS)
+      ERREXIT(cinfo, JERR_BAD_DCT_COEF);
       
-      r = 0;
-    }
+    /* Count Huffman symbol for run length / number of bits */
+    ac_counts[(r << 4) + nbits]++;
+
+#ifndef HUFF_NONZERO_MASK
+    r = 0;
+#endif
   }
 
   /* If the last coef(s) were zero, emit an end-of-block code */
+#ifdef HUFF_NONZERO_MASK
+  if (i < DCTSIZE2 - 1)
+#else
   if (r > 0)
+#endif
     ac_counts[0]++;
 }
 
@@ -906,4 +1087,8 @@ jinit_huff_encoder (j_compress_ptr cinfo)
     entropy->dc_count_ptrs[i] = entropy->ac_count_ptrs[i] = NULL;
 #endif
   }
+
+#ifdef HUFF_NONZERO_MASK
+  entropy->coef_mask = jpeg_coef_mask_method();
+#endif
 }
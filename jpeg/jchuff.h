@@ -22,6 +22,61 @@
 #define MAX_COEF_BITS 14
 #endif
 
+/* Bits are accumulated in a put_buffer of type huff_buf_type and moved to
+ * the output a word at a time.  If long is 64 bits, as in the usual LP64
+ * data model, put_buffer holds up to 63 bits and the words are 32 bits, so
+ * that a Huffman code and the value bits following it (at most 16 + 15 bits)
+ * can be added together.  Otherwise put_buffer holds up to 31 bits and the
+ * words are 16 bits.  The valid bits are right-justified; the bits above
+ * them are garbage.
+ */
+
+typedef unsigned long huff_buf_type;	/* type of bit-accumulation buffer */
+
+#if defined(_LP64) || defined(__LP64__)
+#define PUT_BUF_SIZE  64	/* size of buffer in bits */
+#define PUT_WORD_BITS  32	/* bits moved to the output at once */
+#define WORD_BYTES_01  0x01010101UL
+#define WORD_BYTES_80  0x80808080UL
+#else
+#define PUT_BUF_SIZE  32
+#define PUT_WORD_BITS  16
+#define WORD_BYTES_01  0x0101UL
+#define WORD_BYTES_80  0x8080UL
+#endif
+
+#define WORD_MASK  ((((huff_buf_type) 1) << PUT_WORD_BITS) - 1)
+
+/* TRUE if any byte of the word x is 0xFF, so that it needs stuffing */
+
+#define WORD_HAS_FF(x)  (((~(x) - WORD_BYTES_01) & (x) & WORD_BYTES_80) != 0)
+
+/* Number of bits needed for the magnitude x of a coefficient */
+
+#ifdef __GNUC__
+#define NBITS(x)  ((x) == 0 ? 0 : 32 - __builtin_clz((unsigned int) (x)))
+#else
+#define NBITS(x)  jpeg_nbits((int) (x))
+#endif
+
+/* With a 64-bit long and GNU C, the AC coefficients are found from a bitmap
+ * of the nonzero ones (bit k for zigzag position k), which lets the zero
+ * runs be skipped with a count-trailing-zeros instruction instead of being
+ * tested coefficient by coefficient.  A coef_mask routine returns that
+ * bitmap for the coefficients Ss..Se (1 <= Ss <= Se), judged by their
+ * magnitudes after the point transform by Al (Al = 0 for sequential JPEG).
+ * If ones isn't NULL, it also stores there the bitmap of the magnitudes that
+ * are exactly 1, which AC refinement scans use to find their EOB position.
+ */
+
+#if defined(__GNUC__) && PUT_BUF_SIZE == 64
+#define HUFF_NONZERO_MASK
+
+typedef JMETHOD(unsigned long, coef_mask_ptr,
+		(JCOEFPTR block, int Ss, int Se, int Al,
+		 unsigned long * ones));
+#endif
+
 /* Derived data constructed for each Huffman table */
 
 typedef struct {
@@ -35,6 +90,8 @@ typedef struct {
 #ifdef NEED_SHORT_EXTERNAL_NAMES
 #define jpeg_make_c_derived_tbl	jMkCDerived
 #define jpeg_gen_optimal_table	jGenOptTbl
+#define jpeg_nbits		jNBits
+#define jpeg_coef_mask_method	jCoefMask
 #endif /* NEED_SHORT_EXTERNAL_NAMES */
 
 /* Expand a Huffman table definition into the derived format */
@@ -45,3 +102,13 @@ EXTERN(void) jpeg_make_c_derived_tbl
 /* Generate an optimal table definition given the specified counts */
 EXTERN(void) jpeg_gen_optimal_table
 	JPP((j_compress_ptr cinfo, JHUFF_TBL * htbl, long freq[]));
+
+#ifndef __GNUC__
+/* Count the bits in a coefficient magnitude (see NBITS) */
+EXTERN(int) jpeg_nbits JPP((int x));
+#endif
+
+#ifdef HUFF_NONZERO_MASK
+/* Choose the fastest coef_mask routine this CPU can run */
+EXTERN(coef_mask_ptr) jpeg_coef_mask_method JPP((void));
+#endif
@@ -14,6 +14,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 
 /* Private state */
@@ -33,6 +34,8 @@ typedef struct {
   int total_passes;		/* total # of passes needed */
 
   int scan_number;		/* current index in scan_info[] */
+
+  boolean search_quality;	/* TRUE if fitting output to target_size */
 } my_comp_master;
 
 typedef my_comp_master * my_master_ptr;
@@ -415,10 +418,17 @@ prepare_for_pass (j_compress_ptr cinfo)
       (*cinfo->prep->start_pass) (cinfo, JBUF_PASS_THRU);
     }
     (*cinfo->fdct->start_pass) (cinfo);
-    (*cinfo->entropy->start_pass) (cinfo, cinfo->optimize_coding);
-    (*cinfo->coef->start_pass) (cinfo,
-				(master->total_passes > 1 ?
-				 JBUF_SAVE_AND_PASS : JBUF_PASS_THRU));
+    if (master->search_quality) {
+      /* Only DCT and save the coefficients; the quality search and all
+       * output happen after the last scanline (see finish_pass_master).
+       */
+      (*cinfo->coef->start_pass) (cinfo, JBUF_SAVE_SOURCE);
+    } else {
+      (*cinfo->entropy->start_pass) (cinfo, cinfo->optimize_coding);
+      (*cinfo->coef->start_pass) (cinfo,
+				  (master->total_passes > 1 ?
+				   JBUF_SAVE_AND_PASS : JBUF_PASS_THRU));
+    }
     (*cinfo->main->start_pass) (cinfo, JBUF_PASS_THRU);
     if (cinfo->optimize_coding) {
       /* No immediate data output; postpone writing frame/scan headers */
@@ -495,6 +505,191 @@ pass_startup (j_compress_ptr cinfo)
 }
 
 
+#ifdef ENTROPY_OPT_SUPPORTED
+
+/*
+ * Target file size support.
+ *
+ * The main pass saves the unquantized DCT coefficients of the whole image
+ * (see jcdctmgr.c and jccoefct.c).  Afterwards we bisect on the quality
+ * setting; each trial only rebuilds the quantization divisors and runs
+ * the usual optimization and output passes over the saved coefficients,
+ * with the output going into a destination that merely counts bytes.
+ * Color conversion, downsampling and the DCT are done just once.
+ *
+ * The count covers everything from SOI to EOI that the library writes.
+ * Markers written by the application between jpeg_start_compress and the
+ * first jpeg_write_scanlines are already in the real destination and are
+ * not counted; the caller can subtract their length from target_size.
+ */
+
+#define COUNT_BUF_SIZE  4096	/* size of the counting dest's buffer */
+
+typedef struct {
+  struct jpeg_destination_mgr pub; /* public fields */
+
+  long count;			/* bytes passed through so far */
+  JOCTET buffer[COUNT_BUF_SIZE];
+} count_destination_mgr;
+
+METHODDEF(void)
+init_count_destination (j_compress_ptr cinfo)
+{
+  /* no work; the buffer is set up by trial_compress */
+}
+
+METHODDEF(boolean)
+empty_count_output_buffer (j_compress_ptr cinfo)
+{
+  count_destination_mgr * dest = (count_destination_mgr *) cinfo->dest;
+
+  dest->count += COUNT_BUF_SIZE;
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer = COUNT_BUF_SIZE;
+  return TRUE;
+}
+
+METHODDEF(void)
+term_count_destination (j_compress_ptr cinfo)
+{
+  /* no work */
+}
+
+
+LOCAL(void)
+set_quality (j_compress_ptr cinfo, int quality)
+/* Rescale the application's quantization tables to the given quality */
+{
+  int save_state = cinfo->global_state;
+  int scale_factor = jpeg_quality_scaling(quality);
+  unsigned int basic_table[DCTSIZE2];
+  JQUANT_TBL * qtbl;
+  int tblno, i;
+
+  /* Redo what jpeg_set_quality, or the application's own calls of
+   * jpeg_add_quant_table, did at the application's quality, with the same
+   * basic tables and force_baseline choice.  The tables are then just
+   * what a plain compression at this quality would use.
+   * jpeg_add_quant_table insists on being called before start_compress.
+   */
+  cinfo->global_state = CSTATE_START;
+  for (tblno = 0; tblno < NUM_QUANT_TBLS; tblno++) {
+    qtbl = cinfo->quant_tbl_ptrs[tblno];
+    if (qtbl == NULL || ! qtbl->basic_valid)
+      continue;
+    for (i = 0; i < DCTSIZE2; i++)
+      basic_table[i] = qtbl->basicval[i];
+    jpeg_add_quant_table(cinfo, tblno, basic_table, scale_factor,
+			 qtbl->basic_baseline);
+  }
+  cinfo->global_state = save_state;
+  (*cinfo->fdct->start_pass) (cinfo);
+}
+
+
+LOCAL(void)
+crank_pass (j_compress_ptr cinfo)
+/* Run the entropy coder over the saved coefficients for the current scan */
+{
+  JDIMENSION iMCU_row;
+
+  (*cinfo->coef->start_pass) (cinfo, JBUF_CRANK_DEST);
+  for (iMCU_row = 0; iMCU_row < cinfo->total_iMCU_rows; iMCU_row++) {
+    if (! (*cinfo->coef->compress_data) (cinfo, (JSAMPIMAGE) NULL))
+      ERREXIT(cinfo, JERR_CANT_SUSPEND);
+  }
+  (*cinfo->entropy->finish_pass) (cinfo);
+}
+
+
+LOCAL(long)
+trial_compress (j_compress_ptr cinfo, count_destination_mgr * counter)
+/* Compress the saved coefficients into the counter; return the size */
+{
+  my_master_ptr master = (my_master_ptr) cinfo->master;
+
+  counter->count = 0;
+  counter->pub.next_output_byte = counter->buffer;
+  counter->pub.free_in_buffer = COUNT_BUF_SIZE;
+
+  jpeg_suppress_tables(cinfo, FALSE);
+  (*cinfo->marker->write_file_header) (cinfo);
+  for (master->scan_number = 0; master->scan_number < cinfo->num_scans;
+       master->scan_number++) {
+    select_scan_parameters(cinfo);
+    per_scan_setup(cinfo);
+    /* Optimization pass, skipped for DC refinement as in prepare_for_pass */
+    if (cinfo->Ss != 0 || cinfo->Ah == 0 || cinfo->arith_code) {
+      (*cinfo->entropy->start_pass) (cinfo, TRUE);
+      crank_pass(cinfo);
+    }
+    (*cinfo->entropy->start_pass) (cinfo, FALSE);
+    if (master->scan_number == 0)
+      (*cinfo->marker->write_frame_header) (cinfo);
+    (*cinfo->marker->write_scan_header) (cinfo);
+    crank_pass(cinfo);
+  }
+  (*cinfo->marker->write_file_trailer) (cinfo);
+  master->scan_number = 0;
+
+  return counter->count + (long) (COUNT_BUF_SIZE - counter->pub.free_in_buffer);
+}
+
+
+LOCAL(void)
+search_quality (j_compress_ptr cinfo)
+/* Find the highest quality whose output fits in target_size bytes */
+{
+  struct jpeg_destination_mgr * real_dest = cinfo->dest;
+  count_destination_mgr * counter;
+  int save_trace = cinfo->err->trace_level;
+  boolean too_big = FALSE;
+  int lo, hi, quality;
+
+  counter = (count_destination_mgr *)
+    (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				SIZEOF(count_destination_mgr));
+  counter->pub.init_destination = init_count_destination;
+  counter->pub.empty_output_buffer = empty_count_output_buffer;
+  counter->pub.term_destination = term_count_destination;
+  cinfo->dest = &counter->pub;
+
+  /* Hush the trials' trace messages (such as the warning about 16-bit
+   * tables), which the real passes will give once.
+   */
+  cinfo->err->trace_level = -1;
+
+  /* Quality lo is known to fit (or is the floor); hi is known not to. */
+  lo = 1;
+  hi = 101;
+  while (hi - lo > 1) {
+    quality = (lo + hi) / 2;
+    set_quality(cinfo, quality);
+    if (trial_compress(cinfo, counter) <= cinfo->target_size)
+      lo = quality;
+    else
+      hi = quality;
+  }
+  if (hi == 2) {
+    set_quality(cinfo, 1);
+    too_big = (trial_compress(cinfo, counter) > cinfo->target_size);
+  }
+  set_quality(cinfo, lo);
+
+  /* The trials left the restart-interval state of jcmarker.c as of their
+   * last scan; writing one more file header into the counter resets it.
+   */
+  (*cinfo->marker->write_file_header) (cinfo);
+  jpeg_suppress_tables(cinfo, FALSE);
+  cinfo->dest = real_dest;
+  cinfo->err->trace_level = save_trace;
+  if (too_big)
+    WARNMS(cinfo, JWRN_TARGET_SIZE);
+}
+
+#endif /* ENTROPY_OPT_SUPPORTED */
+
+
 /*
  * Finish up at end of pass.
  */
@@ -504,6 +699,18 @@ finish_pass_master (j_compress_ptr cinfo)
 {
   my_master_ptr master = (my_master_ptr) cinfo->master;
 
+#ifdef ENTROPY_OPT_SUPPORTED
+  if (master->pass_type == main_pass && master->search_quality) {
+    /* All coefficients are saved; settle the quality, then write the
+     * file through the usual optimization and output passes.
+     */
+    search_quality(cinfo);
+    master->pass_type = huff_opt_pass;
+    master->pass_number++;
+    return;
+  }
+#endif
+
   /* The entropy coder always needs an end-of-pass call,
    * either to analyze statistics or to flush its output buffer.
    */
@@ -553,6 +760,11 @@ jinit_c_master_control (j_compress_ptr cinfo, boolean transcode_only)
   master->pub.finish_pass = finish_pass_master;
   master->pub.is_last_pass = FALSE;
 
+#ifdef JSIMD_SUPPORTED
+  /* The other modules, set up after this, record their SIMD choices */
+  jsimd_clear_kernels(0, JSIMD_FIRST_D_KERNEL);
+#endif
+
   /* Validate parameters, determine derived values */
   initial_setup(cinfo);
 
@@ -570,6 +782,23 @@ jinit_c_master_control (j_compress_ptr cinfo, boolean transcode_only)
   if (cinfo->progressive_mode)	/*  TEMPORARY HACK ??? */
     cinfo->optimize_coding = TRUE; /* assume default tables no good for progressive mode */
 
+  /* Searching for a target size needs the full-image buffer that Huffman
+   * optimization provides, and integer coefficients that can be saved
+   * unquantized: the float DCT is replaced by the accurate integer one.
+   * Unquantized 12-bit coefficients would not fit in a JCOEF.
+   */
+  master->search_quality = FALSE;
+#if defined(ENTROPY_OPT_SUPPORTED) && BITS_IN_JSAMPLE == 8
+  if (cinfo->target_size > 0 && ! transcode_only) {
+    master->search_quality = TRUE;
+    cinfo->optimize_coding = TRUE;
+    if (cinfo->dct_method == JDCT_FLOAT)
+      cinfo->dct_method = JDCT_ISLOW;
+  }
+#else
+  cinfo->target_size = 0;	/* not supported; tell jcdctmgr.c, jccoefct.c */
+#endif
+
   /* Initialize my private state */
   if (transcode_only) {
     /* no main pass in transcoding */
@@ -583,7 +812,9 @@ jinit_c_master_control (j_compress_ptr cinfo, boolean transcode_only)
   }
   master->scan_number = 0;
   master->pass_number = 0;
-  if (cinfo->optimize_coding)
+  if (master->search_quality)
+    master->total_passes = cinfo->num_scans * 2 + 1;
+  else if (cinfo->optimize_coding)
     master->total_passes = cinfo->num_scans * 2;
   else
     master->total_passes = cinfo->num_scans;
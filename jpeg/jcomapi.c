@@ -90,6 +90,7 @@ jpeg_alloc_quant_table (j_common_ptr cinfo)
   tbl = (JQUANT_TBL *)
     (*cinfo->mem->alloc_small) (cinfo, JPOOL_PERMANENT, SIZEOF(JQUANT_TBL));
   tbl->sent_table = FALSE;	/* make sure this is false in any new table */
+  tbl->basic_valid = FALSE;	/* and has no basic table recorded */
   return tbl;
 }
 
@@ -55,6 +55,15 @@ jpeg_add_quant_table (j_compress_ptr cinfo, int which_tbl,
     (*qtblptr)->quantval[i] = (UINT16) temp;
   }
 
+  /* Remember the unscaled table, for a target_size search (jcmaster.c) */
+  for (i = 0; i < DCTSIZE2; i++) {
+    temp = (long) basic_table[i];
+    if (temp > 65535L) temp = 65535L;
+    (*qtblptr)->basicval[i] = (UINT16) temp;
+  }
+  (*qtblptr)->basic_baseline = force_baseline;
+  (*qtblptr)->basic_valid = TRUE;
+
   /* Initialize sent_table FALSE so table will be written to JPEG file. */
   (*qtblptr)->sent_table = FALSE;
 }
@@ -326,6 +335,9 @@ jpeg_set_defaults (j_compress_ptr cinfo)
   /* DCT algorithm preference */
   cinfo->dct_method = JDCT_DEFAULT;
 
+  /* No target file size; quality is set by jpeg_set_quality above */
+  cinfo->target_size = 0;
+
   /* No restart markers */
   cinfo->restart_interval = 0;
   cinfo->restart_in_rows = 0;
@@ -363,6 +375,14 @@ jpeg_default_colorspace (j_compress_ptr cinfo)
     jpeg_set_colorspace(cinfo, JCS_GRAYSCALE);
     break;
   case JCS_RGB:
+  case JCS_EXT_RGBX:
+  case JCS_EXT_BGRX:
+  case JCS_EXT_RGBA:
+  case JCS_EXT_BGRA:
+  case JCS_EXT_XRGB:
+  case JCS_EXT_XBGR:
+  case JCS_EXT_ARGB:
+  case JCS_EXT_ABGR:
     jpeg_set_colorspace(cinfo, JCS_YCbCr);
     break;
   case JCS_YCbCr:
@@ -32,7 +32,7 @@ typedef struct {
    */
   JOCTET * next_output_byte;	/* => next byte to write in buffer */
   size_t free_in_buffer;	/* # of byte spaces remaining in buffer */
-  INT32 put_buffer;		/* current bit-accumulation buffer */
+  huff_buf_type put_buffer;	/* current bit-accumulation buffer */
   int put_bits;			/* # of bits now in it */
   j_compress_ptr cinfo;		/* link to cinfo (needed for dump_buffer) */
 
@@ -57,6 +57,10 @@ typedef struct {
 
   /* Statistics tables for optimization; again, one set is enough */
   long * count_ptrs[NUM_HUFF_TBLS];
+
+#ifdef HUFF_NONZERO_MASK
+  coef_mask_ptr coef_mask;	/* finds the nonzero AC coefficients */
+#endif
 } phuff_entropy_encoder;
 
 typedef phuff_entropy_encoder * phuff_entropy_ptr;
@@ -217,20 +221,46 @@ dump_buffer (phuff_entropy_ptr entropy)
 
 /* Outputting bits to the file */
 
-/* Only the right 24 bits of put_buffer are used; the valid bits are
- * left-justified in this part.  At most 16 bits can be passed to emit_bits
- * in one call, and we never retain more than 7 bits in put_buffer
- * between calls, so 24 bits are sufficient.
+/* put_buffer and put_bits are as in jchuff.c (see jchuff.h): at most 16 bits
+ * can be passed to emit_bits in one call, and a word is moved to the output
+ * whenever one is complete, so fewer than PUT_WORD_BITS + 16 bits are ever
+ * held.  A word with no 0xFF byte is stored as it stands if it fits in the
+ * output buffer; otherwise its bytes are emitted one at a time with the zero
+ * bytes stuffed in.
  */
 
+LOCAL(void)
+emit_word (phuff_entropy_ptr entropy, huff_buf_type word)
+{
+  register JOCTET * outptr;
+  int s, c;
+
+  if (! WORD_HAS_FF(word) && entropy->free_in_buffer > PUT_WORD_BITS / 8) {
+    outptr = entropy->next_output_byte;
+    for (s = PUT_WORD_BITS - 8; s >= 0; s -= 8)
+      *outptr++ = (JOCTET) (word >> s);
+    entropy->next_output_byte = outptr;
+    entropy->free_in_buffer -= PUT_WORD_BITS / 8;
+  } else {
+    for (s = PUT_WORD_BITS - 8; s >= 0; s -= 8) {
+      c = (int) (word >> s) & 0xFF;
+      emit_byte(entropy, c);
+      if (c == 0xFF) {		/* need to stuff a zero byte? */
+	emit_byte(entropy, 0);
+      }
+    }
+  }
+}
+
+
 INLINE
 LOCAL(void)
 emit_bits (phuff_entropy_ptr entropy, unsigned int code, int size)
 /* Emit some bits, unless we are in gather mode */
 {
   /* This routine is heavily used, so it's worth coding tightly. */
-  register INT32 put_buffer = (INT32) code;
-  register int put_bits = entropy->put_bits;
+  register huff_buf_type put_buffer;
+  register int put_bits;
 
   /* if size is 0, caller used an invalid Huffman table entry */
   if (size == 0)
@@ -239,23 +269,14 @@ emit_bits (phuff_entropy_ptr entropy, unsigned int code, int size)
   if (entropy->gather_statistics)
     return;			/* do nothing if we're only getting stats */
 
-  put_buffer &= (((INT32) 1)<<size) - 1; /* mask off any extra bits in code */
-  
-  put_bits += size;		/* new number of bits in buffer */
-  
-  put_buffer <<= 24 - put_bits; /* align incoming bits */
-
-  put_buffer |= entropy->put_buffer; /* and merge with old buffer contents */
+  /* merge the new bits, masking off any extra bits in code */
+  put_buffer = (entropy->put_buffer << size) |
+	       ((huff_buf_type) code & ((((huff_buf_type) 1) << size) - 1));
+  put_bits = entropy->put_bits + size;
 
-  while (put_bits >= 8) {
-    int c = (int) ((put_buffer >> 16) & 0xFF);
-    
-    emit_byte(entropy, c);
-    if (c == 0xFF) {		/* need to stuff a zero byte? */
-      emit_byte(entropy, 0);
-    }
-    put_buffer <<= 8;
-    put_bits -= 8;
+  if (put_bits >= PUT_WORD_BITS) {
+    put_bits -= PUT_WORD_BITS;
+    emit_word(entropy, (put_buffer >> put_bits) & WORD_MASK);
   }
 
   entropy->put_buffer = put_buffer; /* update variables */
@@ -266,8 +287,20 @@ emit_bits (phuff_entropy_ptr entropy, unsigned int code, int size)
 LOCAL(void)
 flush_bits (phuff_entropy_ptr entropy)
 {
-  emit_bits(entropy, 0x7F, 7); /* fill any partial byte with ones */
-  entropy->put_buffer = 0;     /* and reset bit-buffer to empty */
+  /* fill any partial byte with ones */
+  huff_buf_type put_buffer = (entropy->put_buffer << 7) | 0x7F;
+  int put_bits = entropy->put_bits + 7;
+  int c;
+
+  while (put_bits >= 8) {
+    put_bits -= 8;
+    c = (int) (put_buffer >> put_bits) & 0xFF;
+    emit_byte(entropy, c);
+    if (c == 0xFF) {		/* need to stuff a zero byte? */
+      emit_byte(entropy, 0);
+    }
+  }
+  entropy->put_buffer = 0;	/* and reset bit-buffer to empty */
   entropy->put_bits = 0;
 }
 
@@ -297,13 +330,20 @@ LOCAL(void)
 emit_buffered_bits (phuff_entropy_ptr entropy, char * bufstart,
 		    unsigned int nbits)
 {
+  register unsigned int code, n, i;
+
   if (entropy->gather_statistics)
     return;			/* no real work */
 
+  /* Pack the bits into groups of up to 16 and emit those */
   while (nbits > 0) {
-    emit_bits(entropy, (unsigned int) (*bufstart), 1);
-    bufstart++;
-    nbits--;
+    n = (nbits < 16) ? nbits : 16;
+    code = 0;
+    for (i = 0; i < n; i++)
+      code = (code << 1) | (unsigned int) bufstart[i];
+    emit_bits(entropy, code, (int) n);
+    bufstart += n;
+    nbits -= n;
   }
 }
 
@@ -319,9 +359,7 @@ emit_eobrun (phuff_entropy_ptr entropy)
 
   if (entropy->EOBRUN > 0) {	/* if there is any pending EOBRUN */
     temp = entropy->EOBRUN;
-    nbits = 0;
-    while ((temp >>= 1))
-      nbits++;
+    nbits = NBITS(temp) - 1;
     /* safety check: shouldn't happen given limited correction-bit buffer */
     if (nbits > 14)
       ERREXIT(entropy->cinfo, JERR_HUFF_MISSING_CODE);
@@ -418,11 +456,7 @@ encode_mcu_DC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
     }
     
     /* Find the number of bits needed for the magnitude of the coefficient */
-    nbits = 0;
-    while (temp) {
-      nbits++;
-      temp >>= 1;
-    }
+    nbits = NBITS(temp);
     /* Check for out-of-range coefficient values.
      * Since we're encoding a difference, the range limit is twice as much.
      */
@@ -470,6 +504,10 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   int Se = cinfo->Se;
   int Al = cinfo->Al;
   JBLOCKROW block;
+#ifdef HUFF_NONZERO_MASK
+  unsigned long mask;
+  int i;
+#endif
 
   entropy->next_output_byte = cinfo->dest->next_output_byte;
   entropy->free_in_buffer = cinfo->dest->free_in_buffer;
@@ -484,6 +522,18 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
 
   /* Encode the AC coefficients per section G.1.2.2, fig. G.3 */
   
+#ifdef HUFF_NONZERO_MASK
+  /* The bitmap skips the coefficients that are zero after the transform */
+  mask = (*entropy->coef_mask) (*block, cinfo->Ss, Se, Al,
+				(unsigned long *) NULL);
+  i = cinfo->Ss - 1;		/* zigzag index of the last coefficient coded */
+  while (mask) {
+    k = __builtin_ctzl(mask);
+    mask &= mask - 1;
+    r = k - i - 1;		/* r = run length of zeros */
+    i = k;
+    temp = (*block)[jpeg_natural_order[k]];
+#else
   r = 0;			/* r = run length of zeros */
    
   for (k = cinfo->Ss; k <= Se; k++) {
@@ -491,6 +541,7 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
       r++;
       continue;
     }
+#endif
     /* We must apply the point transform by Al.  For AC coefficients this
      * is an integer division with rounding towards 0.  To do this portably
      * in C, we shift after obtaining the absolute value; so the code is
@@ -505,11 +556,13 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
       temp >>= Al;		/* apply the point transform */
       temp2 = temp;
     }
+#ifndef HUFF_NONZERO_MASK
     /* Watch out for case that nonzero coef is zero after point transform */
     if (temp == 0) {
       r++;
       continue;
     }
+#endif
 
     /* Emit any pending EOBRUN */
     if (entropy->EOBRUN > 0)
@@ -521,9 +574,7 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
     }
 
     /* Find the number of bits needed for the magnitude of the coefficient */
-    nbits = 1;			/* there must be at least one 1 bit */
-    while ((temp >>= 1))
-      nbits++;
+    nbits = NBITS(temp);
     /* Check for out-of-range coefficient values */
     if (nbits > MAX_COEF_BITS)
       ERREXIT(cinfo, JERR_BAD_DCT_COEF);
@@ -535,10 +586,16 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
     /* or the complement of its magnitude, if negative. */
     emit_bits(entropy, (unsigned int) temp2, nbits);
 
+#ifndef HUFF_NONZERO_MASK
     r = 0;			/* reset zero run length */
+#endif
   }
 
+#ifdef HUFF_NONZERO_MASK
+  if (i < Se) {			/* If there are trailing zeroes, */
+#else
   if (r > 0) {			/* If there are trailing zeroes, */
+#endif
     entropy->EOBRUN++;		/* count an EOB */
     if (entropy->EOBRUN == 0x7FFF)
       emit_eobrun(entropy);	/* force it out to avoid overflow */
@@ -626,7 +683,12 @@ encode_mcu_AC_refine (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   int Se = cinfo->Se;
   int Al = cinfo->Al;
   JBLOCKROW block;
+#ifdef HUFF_NONZERO_MASK
+  unsigned long mask, ones;
+  int i;
+#else
   int absvalues[DCTSIZE2];
+#endif
 
   entropy->next_output_byte = cinfo->dest->next_output_byte;
   entropy->free_in_buffer = cinfo->dest->free_in_buffer;
@@ -639,6 +701,14 @@ encode_mcu_AC_refine (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   /* Encode the MCU data block */
   block = MCU_data[0];
 
+#ifdef HUFF_NONZERO_MASK
+  /* The bitmaps of the transformed coefficients that are nonzero and that
+   * are 1 give the coefficients to visit and the EOB position.
+   */
+  mask = (*entropy->coef_mask) (*block, cinfo->Ss, Se, Al, &ones);
+  /* EOB = index of last newly-nonzero coef */
+  EOB = ones ? (DCTSIZE2 - 1) - __builtin_clzl(ones) : 0;
+#else
   /* It is convenient to make a pre-pass to determine the transformed
    * coefficients' absolute values and the EOB position.
    */
@@ -656,6 +726,7 @@ encode_mcu_AC_refine (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
     if (temp == 1)
       EOB = k;			/* EOB = index of last newly-nonzero coef */
   }
+#endif
 
   /* Encode the AC coefficients per section G.1.2.3, fig. G.7 */
   
@@ -663,16 +734,30 @@ encode_mcu_AC_refine (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   BR = 0;			/* BR = count of buffered bits added now */
   BR_buffer = entropy->bit_buffer + entropy->BE; /* Append bits to buffer */
 
+#ifdef HUFF_NONZERO_MASK
+  i = cinfo->Ss - 1;		/* zigzag index of the last nonzero coef */
+  while (mask) {
+    k = __builtin_ctzl(mask);
+    mask &= mask - 1;
+    r += k - i - 1;		/* count the zeros skipped */
+    i = k;
+    temp = (*block)[jpeg_natural_order[k]];
+    if (temp < 0)
+      temp = -temp;		/* temp is abs value of input */
+    temp >>= Al;		/* apply the point transform */
+#else
   for (k = cinfo->Ss; k <= Se; k++) {
     if ((temp = absvalues[k]) == 0) {
       r++;
       continue;
     }
+#endif
 
     /* Emit any required ZRLs, but not if they can be folded into EOB */
     while (r > 15 && k <= EOB) {
       /* emit any pending EOBRUN and the BE correction bits */
-      emit_eobrun(entropy);
+      if (entropy->EOBRUN > 0)
+	emit_eobrun(entropy);
       /* Emit ZRL */
       emit_symbol(entropy, entropy->ac_tbl_no, 0xF0);
       r -= 16;
@@ -694,7 +779,8 @@ encode_mcu_AC_refine (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
     }
 
     /* Emit any pending EOBRUN and the BE correction bits */
-    emit_eobrun(entropy);
+    if (entropy->EOBRUN > 0)
+      emit_eobrun(entropy);
 
     /* Count/emit Huffman symbol for run length / number of bits */
     emit_symbol(entropy, entropy->ac_tbl_no, (r << 4) + 1);
@@ -709,6 +795,9 @@ encode_mcu_AC_refine (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
     BR = 0;
     r = 0;			/* reset zero run length */
   }
+#ifdef HUFF_NONZERO_MASK
+  r += Se - i;			/* count the trailing zeros */
+#endif
 
   if (r > 0 || BR > 0) {	/* If there are trailing zeroes, */
     entropy->EOBRUN++;		/* count an EOB */
@@ -828,6 +917,9 @@ jinit_phuff_encoder (j_compress_ptr cinfo)
     entropy->count_ptrs[i] = NULL;
   }
   entropy->bit_buffer = NULL;	/* needed only in AC refinement scan */
+#ifdef HUFF_NONZERO_MASK
+  entropy->coef_mask = jpeg_coef_mask_method();
+#endif
 }
 
 #endif /* C_PROGRESSIVE_SUPPORTED */
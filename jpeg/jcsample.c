@@ -48,6 +48,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 
 /* Pointer to routine to downsample a single component */
@@ -62,6 +63,25 @@ typedef struct {
 
   /* Downsampling method pointers, one per component */
   downsample1_ptr methods[MAX_COMPONENTS];
+
+#ifdef JSIMD_SUPPORTED
+  /* SIMD routines doing the leading part of a row, or NULL.  Each returns
+   * the number of output columns it has done.  The smoothing routines do
+   * the general-case columns and are given the rows at the first of them:
+   * above, the member row(s) and below.
+   */
+  JMETHOD(JDIMENSION, h2v1_row, (JSAMPROW inptr, JSAMPROW outptr,
+				 JDIMENSION num_cols));
+  JMETHOD(JDIMENSION, h2v2_row, (JSAMPROW inptr0, JSAMPROW inptr1,
+				 JSAMPROW outptr, JDIMENSION num_cols));
+  JMETHOD(JDIMENSION, h2v2_smooth_row, (JSAMPROW inptr[4], JSAMPROW outptr,
+					JDIMENSION num_cols,
+					int memberscale, int neighscale));
+  JMETHOD(JDIMENSION, fullsize_smooth_row, (JSAMPROW inptr[3],
+					    JSAMPROW outptr,
+					    JDIMENSION num_cols,
+					    int neighscale));
+#endif
 } my_downsampler;
 
 typedef my_downsampler * my_downsample_ptr;
@@ -196,6 +216,264 @@ fullsize_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
 }
 
 
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SIMD versions of the inner loops below.  The sums are formed in 16-bit
+ * lanes (adding the even and odd samples of each pair where the routine
+ * downsamples horizontally), the alternating biases are constant vectors,
+ * and the smoothing products are formed with pmaddwd in 32 bits exactly as
+ * the C code forms them, so the output is the same.
+ */
+
+/* Sum the even and odd samples of a register of pairs */
+
+#define PAIRSUM_SSE2(v) \
+  _mm_add_epi16(_mm_and_si128(v, _mm_set1_epi16(0xFF)), _mm_srli_epi16(v, 8))
+#define PAIRSUM_AVX2(v) \
+  _mm256_add_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0xFF)), \
+		   _mm256_srli_epi16(v, 8))
+
+/* Even and odd samples of a register, widened */
+
+#define EVEN_SSE2(v)  _mm_and_si128(v, _mm_set1_epi16(0xFF))
+#define ODD_SSE2(v)   _mm_srli_epi16(v, 8)
+#define EVEN_AVX2(v)  _mm256_and_si256(v, _mm256_set1_epi16(0xFF))
+#define ODD_AVX2(v)   _mm256_srli_epi16(v, 8)
+
+/* Pack 16 words of an AVX2 register to bytes, keeping them in order */
+
+#define PACK16_AVX2(v)  _mm_packus_epi16(_mm256_castsi256_si128(v), \
+					 _mm256_extracti128_si256(v, 1))
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+h2v1_row_sse2 (JSAMPROW inptr, JSAMPROW outptr, JDIMENSION num_cols)
+{
+  const __m128i bias = _mm_set1_epi32(0x00010000); /* 0,1,0,1,... */
+  __m128i sum;
+  JDIMENSION col;
+
+  for (col = 0; col + 8 <= num_cols; col += 8) {
+    sum = PAIRSUM_SSE2(_mm_loadu_si128((const __m128i *) (inptr + 2 * col)));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, bias), 1);
+    _mm_storel_epi64((__m128i *) (outptr + col), _mm_packus_epi16(sum, sum));
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+h2v1_row_avx2 (JSAMPROW inptr, JSAMPROW outptr, JDIMENSION num_cols)
+{
+  const __m256i bias = _mm256_set1_epi32(0x00010000); /* 0,1,0,1,... */
+  __m256i sum;
+  JDIMENSION col;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    sum = PAIRSUM_AVX2(_mm256_loadu_si256((const __m256i *)
+					  (inptr + 2 * col)));
+    sum = _mm256_srli_epi16(_mm256_add_epi16(sum, bias), 1);
+    _mm_storeu_si128((__m128i *) (outptr + col), PACK16_AVX2(sum));
+  }
+  return col;
+}
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+h2v2_row_sse2 (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW outptr,
+	       JDIMENSION num_cols)
+{
+  const __m128i bias = _mm_set1_epi32(0x00020001); /* 1,2,1,2,... */
+  __m128i sum;
+  JDIMENSION col;
+
+  for (col = 0; col + 8 <= num_cols; col += 8) {
+    sum = _mm_add_epi16(
+	    PAIRSUM_SSE2(_mm_loadu_si128((const __m128i *) (inptr0 + 2 * col))),
+	    PAIRSUM_SSE2(_mm_loadu_si128((const __m128i *) (inptr1 + 2 * col))));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, bias), 2);
+    _mm_storel_epi64((__m128i *) (outptr + col), _mm_packus_epi16(sum, sum));
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+h2v2_row_avx2 (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW outptr,
+	       JDIMENSION num_cols)
+{
+  const __m256i bias = _mm256_set1_epi32(0x00020001); /* 1,2,1,2,... */
+  __m256i sum;
+  JDIMENSION col;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    sum = _mm256_add_epi16(
+	    PAIRSUM_AVX2(_mm256_loadu_si256((const __m256i *)
+					    (inptr0 + 2 * col))),
+	    PAIRSUM_AVX2(_mm256_loadu_si256((const __m256i *)
+					    (inptr1 + 2 * col))));
+    sum = _mm256_srli_epi16(_mm256_add_epi16(sum, bias), 2);
+    _mm_storeu_si128((__m128i *) (outptr + col), PACK16_AVX2(sum));
+  }
+  return col;
+}
+
+#ifdef INPUT_SMOOTHING_SUPPORTED
+
+/* In h2v2_smooth_row, for each row the pair sum of output column j is
+ * row[2j] + row[2j+1], and the outer sum is row[2j-1] + row[2j+2]: the
+ * even samples of a load starting at 2j-1 plus the odd samples of one
+ * starting at 2j+1.
+ */
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+h2v2_smooth_row_sse2 (JSAMPROW inptr[4], JSAMPROW outptr, JDIMENSION num_cols,
+		      int memberscale, int neighscale)
+{
+  const __m128i scale = _mm_set1_epi32(JSIMD_PAIR(memberscale, neighscale));
+  const __m128i half = _mm_set1_epi32(32768);
+  __m128i pair[4], outer[4], membersum, neighsum, out;
+  JDIMENSION col;
+  int r;
+
+  for (col = 0; col + 8 <= num_cols; col += 8) {
+    for (r = 0; r < 4; r++) {	/* above, inptr0, inptr1, below */
+      pair[r] = PAIRSUM_SSE2(_mm_loadu_si128((const __m128i *)
+					     (inptr[r] + 2 * col)));
+      outer[r] = _mm_add_epi16(
+	EVEN_SSE2(_mm_loadu_si128((const __m128i *) (inptr[r] + 2*col - 1))),
+	ODD_SSE2(_mm_loadu_si128((const __m128i *) (inptr[r] + 2*col + 1))));
+    }
+    membersum = _mm_add_epi16(pair[1], pair[2]);
+    neighsum = _mm_add_epi16(_mm_add_epi16(pair[0], pair[3]),
+			     _mm_add_epi16(outer[1], outer[2]));
+    neighsum = _mm_add_epi16(_mm_add_epi16(neighsum, neighsum),
+			     _mm_add_epi16(outer[0], outer[3]));
+    out = JSIMD_MADD_DESCALE_SSE2(membersum, neighsum, scale, half, 16);
+    _mm_storel_epi64((__m128i *) (outptr + col), _mm_packus_epi16(out, out));
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+h2v2_smooth_row_avx2 (JSAMPROW inptr[4], JSAMPROW outptr, JDIMENSION num_cols,
+		      int memberscale, int neighscale)
+{
+  const __m256i scale = _mm256_set1_epi32(JSIMD_PAIR(memberscale,
+						     neighscale));
+  const __m256i half = _mm256_set1_epi32(32768);
+  __m256i pair[4], outer[4], membersum, neighsum, out;
+  JDIMENSION col;
+  int r;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    for (r = 0; r < 4; r++) {	/* above, inptr0, inptr1, below */
+      pair[r] = PAIRSUM_AVX2(_mm256_loadu_si256((const __m256i *)
+						(inptr[r] + 2 * col)));
+      outer[r] = _mm256_add_epi16(
+	EVEN_AVX2(_mm256_loadu_si256((const __m256i *)
+				     (inptr[r] + 2*col - 1))),
+	ODD_AVX2(_mm256_loadu_si256((const __m256i *)
+				    (inptr[r] + 2*col + 1))));
+    }
+    membersum = _mm256_add_epi16(pair[1], pair[2]);
+    neighsum = _mm256_add_epi16(_mm256_add_epi16(pair[0], pair[3]),
+				_mm256_add_epi16(outer[1], outer[2]));
+    neighsum = _mm256_add_epi16(_mm256_add_epi16(neighsum, neighsum),
+				_mm256_add_epi16(outer[0], outer[3]));
+    /* the in-lane unpacks and pack of this keep the columns in order */
+    out = JSIMD_MADD_DESCALE_AVX2(membersum, neighsum, scale, half, 16);
+    _mm_storeu_si128((__m128i *) (outptr + col), PACK16_AVX2(out));
+  }
+  return col;
+}
+
+/* The memberscale of fullsize_smooth_downsample, 65536 - 8 * neighscale,
+ * does not fit in 16 bits.  But since membersum * 65536 adds nothing to
+ * the fraction, the C code's result is also
+ *	membersum + ((neighsum - 8*membersum) * neighscale + 32768) >> 16
+ * and that is what we compute, with 32768 multiplied in as 2 * 16384.
+ */
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+fullsize_smooth_row_sse2 (JSAMPROW inptr[3], JSAMPROW outptr,
+			  JDIMENSION num_cols, int neighscale)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+  const __m128i scale = _mm_set1_epi32(JSIMD_PAIR(neighscale, 16384));
+  __m128i colsum[3], member, diff, out;
+  JDIMENSION col;
+  int i;
+
+  for (col = 0; col + 8 <= num_cols; col += 8) {
+    for (i = 0; i < 3; i++) {	/* last, this and next colsums */
+      colsum[i] = _mm_add_epi16(_mm_add_epi16(
+	_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					  (inptr[0] + col + i - 1)), zero),
+	_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					  (inptr[1] + col + i - 1)), zero)),
+	_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					  (inptr[2] + col + i - 1)), zero));
+    }
+    member = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					       (inptr[1] + col)), zero);
+    /* neighsum - 8*membersum = colsums - 9*membersum */
+    diff = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(colsum[0], colsum[1]),
+				       colsum[2]),
+			 _mm_add_epi16(member, _mm_slli_epi16(member, 3)));
+    out = _mm_add_epi16(member,
+			JSIMD_MADD_DESCALE_SSE2(diff, two, scale, zero, 16));
+    _mm_storel_epi64((__m128i *) (outptr + col), _mm_packus_epi16(out, out));
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+fullsize_smooth_row_avx2 (JSAMPROW inptr[3], JSAMPROW outptr,
+			  JDIMENSION num_cols, int neighscale)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i two = _mm256_set1_epi16(2);
+  const __m256i scale = _mm256_set1_epi32(JSIMD_PAIR(neighscale, 16384));
+  __m256i colsum[3], member, diff, out;
+  JDIMENSION col;
+  int i;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    for (i = 0; i < 3; i++) {	/* last, this and next colsums */
+      colsum[i] = _mm256_add_epi16(_mm256_add_epi16(
+	_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+					     (inptr[0] + col + i - 1))),
+	_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+					     (inptr[1] + col + i - 1)))),
+	_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+					     (inptr[2] + col + i - 1))));
+    }
+    member = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+						  (inptr[1] + col)));
+    diff = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(colsum[0],
+							      colsum[1]),
+					     colsum[2]),
+			    _mm256_add_epi16(member,
+					     _mm256_slli_epi16(member, 3)));
+    out = _mm256_add_epi16(member,
+			   JSIMD_MADD_DESCALE_AVX2(diff, two, scale, zero, 16));
+    _mm_storeu_si128((__m128i *) (outptr + col), PACK16_AVX2(out));
+  }
+  return col;
+}
+
+#endif /* INPUT_SMOOTHING_SUPPORTED */
+
+#endif /* JSIMD_SUPPORTED */
+
+
 /*
  * Downsample pixel values of a single component.
  * This version handles the common case of 2:1 horizontal and 1:1 vertical,
@@ -212,6 +490,9 @@ METHODDEF(void)
 h2v1_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
 		 JSAMPARRAY input_data, JSAMPARRAY output_data)
 {
+#ifdef JSIMD_SUPPORTED
+  my_downsample_ptr downsample = (my_downsample_ptr) cinfo->downsample;
+#endif
   int outrow;
   JDIMENSION outcol;
   JDIMENSION output_cols = compptr->width_in_blocks * DCTSIZE;
@@ -229,7 +510,16 @@ h2v1_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
     outptr = output_data[outrow];
     inptr = input_data[outrow];
     bias = 0;			/* bias = 0,1,0,1,... for successive samples */
-    for (outcol = 0; outcol < output_cols; outcol++) {
+    outcol = 0;
+#ifdef JSIMD_SUPPORTED
+    if (downsample->h2v1_row != NULL) {
+      /* This does an even number of columns, so the bias still starts at 0 */
+      outcol = (*downsample->h2v1_row) (inptr, outptr, output_cols);
+      inptr += 2 * outcol;
+      outptr += outcol;
+    }
+#endif
+    for (; outcol < output_cols; outcol++) {
       *outptr++ = (JSAMPLE) ((GETJSAMPLE(*inptr) + GETJSAMPLE(inptr[1])
 			      + bias) >> 1);
       bias ^= 1;		/* 0=>1, 1=>0 */
@@ -249,6 +539,9 @@ METHODDEF(void)
 h2v2_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
 		 JSAMPARRAY input_data, JSAMPARRAY output_data)
 {
+#ifdef JSIMD_SUPPORTED
+  my_downsample_ptr downsample = (my_downsample_ptr) cinfo->downsample;
+#endif
   int inrow, outrow;
   JDIMENSION outcol;
   JDIMENSION output_cols = compptr->width_in_blocks * DCTSIZE;
@@ -268,7 +561,16 @@ h2v2_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
     inptr0 = input_data[inrow];
     inptr1 = input_data[inrow+1];
     bias = 1;			/* bias = 1,2,1,2,... for successive samples */
-    for (outcol = 0; outcol < output_cols; outcol++) {
+    outcol = 0;
+#ifdef JSIMD_SUPPORTED
+    if (downsample->h2v2_row != NULL) {
+      /* This does an even number of columns, so the bias still starts at 1 */
+      outcol = (*downsample->h2v2_row) (inptr0, inptr1, outptr, output_cols);
+      inptr0 += 2 * outcol; inptr1 += 2 * outcol;
+      outptr += outcol;
+    }
+#endif
+    for (; outcol < output_cols; outcol++) {
       *outptr++ = (JSAMPLE) ((GETJSAMPLE(*inptr0) + GETJSAMPLE(inptr0[1]) +
 			      GETJSAMPLE(*inptr1) + GETJSAMPLE(inptr1[1])
 			      + bias) >> 2);
@@ -292,6 +594,11 @@ METHODDEF(void)
 h2v2_smooth_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
 			JSAMPARRAY input_data, JSAMPARRAY output_data)
 {
+#ifdef JSIMD_SUPPORTED
+  my_downsample_ptr downsample = (my_downsample_ptr) cinfo->downsample;
+  JSAMPROW simdptr[4];
+  JDIMENSION done;
+#endif
   int inrow, outrow;
   JDIMENSION colctr;
   JDIMENSION output_cols = compptr->width_in_blocks * DCTSIZE;
@@ -343,7 +650,21 @@ h2v2_smooth_downsample (j_compress_ptr cinfo, jpeg_component_info * compptr,
     *outptr++ = (JSAMPLE) ((membersum + 32768) >> 16);
     inptr0 += 2; inptr1 += 2; above_ptr += 2; below_ptr += 2;
 
-    for (colctr = output_cols - 2; colctr > 0; colctr--) {
+    colctr = output_cols - 2;
+#ifdef JSIMD_SUPPORTED
+    if (downsample->h2v2_smooth_row != NULL) {
+      simdptr[0] = above_ptr; simdptr[1] = inptr0;
+      simdptr[2] = inptr1; simdptr[3] = below_ptr;
+      done = (*downsample->h2v2_smooth_row) (simdptr, outptr, colctr,
+					     (int) memberscale,
+					     (int) neighscale);
+      inptr0 += 2 * done; inptr1 += 2 * done;
+      above_ptr += 2 * done; below_ptr += 2 * done;
+      outptr += done;
+      colctr -= done;
+    }
+#endif
+    for (; colctr > 0; colctr--) {
       /* sum of pixels directly mapped to this output element */
       membersum = GETJSAMPLE(*inptr0) + GETJSAMPLE(inptr0[1]) +
 		  GETJSAMPLE(*inptr1) + GETJSAMPLE(inptr1[1]);
@@ -398,6 +719,11 @@ fullsize_smooth_downsample (j_compress_ptr cinfo, jpeg_component_info *compptr,
   register JSAMPROW inptr, above_ptr, below_ptr, outptr;
   INT32 membersum, neighsum, memberscale, neighscale;
   int colsum, lastcolsum, nextcolsum;
+#ifdef JSIMD_SUPPORTED
+  my_downsample_ptr downsample = (my_downsample_ptr) cinfo->downsample;
+  JSAMPROW simdptr[3];
+  JDIMENSION done;
+#endif
 
   /* Expand input data enough to let all the output samples be generated
    * by the standard loop.  Special-casing padded output would be more
@@ -432,7 +758,24 @@ fullsize_smooth_downsample (j_compress_ptr cinfo, jpeg_component_info *compptr,
     *outptr++ = (JSAMPLE) ((membersum + 32768) >> 16);
     lastcolsum = colsum; colsum = nextcolsum;
 
-    for (colctr = output_cols - 2; colctr > 0; colctr--) {
+    colctr = output_cols - 2;
+#ifdef JSIMD_SUPPORTED
+    if (downsample->fullsize_smooth_row != NULL) {
+      simdptr[0] = above_ptr; simdptr[1] = inptr; simdptr[2] = below_ptr;
+      done = (*downsample->fullsize_smooth_row) (simdptr, outptr, colctr,
+						 (int) neighscale);
+      if (done > 0) {
+	inptr += done; above_ptr += done; below_ptr += done;
+	outptr += done;
+	colctr -= done;
+	lastcolsum = GETJSAMPLE(above_ptr[-1]) + GETJSAMPLE(below_ptr[-1]) +
+		     GETJSAMPLE(inptr[-1]);
+	colsum = GETJSAMPLE(*above_ptr) + GETJSAMPLE(*below_ptr) +
+		 GETJSAMPLE(*inptr);
+      }
+    }
+#endif
+    for (; colctr > 0; colctr--) {
       membersum = GETJSAMPLE(*inptr++);
       above_ptr++; below_ptr++;
       nextcolsum = GETJSAMPLE(*above_ptr) + GETJSAMPLE(*below_ptr) +
@@ -467,6 +810,9 @@ jinit_downsampler (j_compress_ptr cinfo)
   int ci;
   jpeg_component_info * compptr;
   boolean smoothok = TRUE;
+#ifdef JSIMD_SUPPORTED
+  int simd;
+#endif
 
   downsample = (my_downsample_ptr)
     (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
@@ -479,6 +825,37 @@ jinit_downsampler (j_compress_ptr cinfo)
   if (cinfo->CCIR601_sampling)
     ERREXIT(cinfo, JERR_CCIR601_NOTIMPL);
 
+#ifdef JSIMD_SUPPORTED
+  /* Use SIMD row routines if the CPU has them; their output is identical */
+  simd = jsimd_cpu_support();
+  if (simd & JSIMD_AVX2) {
+    downsample->h2v1_row = h2v1_row_avx2;
+    downsample->h2v2_row = h2v2_row_avx2;
+  } else if (simd & JSIMD_SSE2) {
+    downsample->h2v1_row = h2v1_row_sse2;
+    downsample->h2v2_row = h2v2_row_sse2;
+  } else {
+    downsample->h2v1_row = NULL;
+    downsample->h2v2_row = NULL;
+  }
+  downsample->h2v2_smooth_row = NULL;
+  downsample->fullsize_smooth_row = NULL;
+#ifdef INPUT_SMOOTHING_SUPPORTED
+  /* The scale factors fit pmaddwd's 16-bit operands for the documented
+   * smoothing_factor range of 1..100 only.
+   */
+  if (cinfo->smoothing_factor > 0 && cinfo->smoothing_factor <= 100) {
+    if (simd & JSIMD_AVX2) {
+      downsample->h2v2_smooth_row = h2v2_smooth_row_avx2;
+      downsample->fullsize_smooth_row = fullsize_smooth_row_avx2;
+    } else if (simd & JSIMD_SSE2) {
+      downsample->h2v2_smooth_row = h2v2_smooth_row_sse2;
+      downsample->fullsize_smooth_row = fullsize_smooth_row_sse2;
+    }
+  }
+#endif
+#endif
+
   /* Verify we can handle the sampling factors, and set up method pointers */
   for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
        ci++, compptr++) {
@@ -512,6 +889,23 @@ jinit_downsampler (j_compress_ptr cinfo)
       ERREXIT(cinfo, JERR_FRACT_SAMPLE_NOTIMPL);
   }
 
+#ifdef JSIMD_SUPPORTED
+  /* Record the SIMD choice if some component's method will use it */
+  for (ci = 0; ci < cinfo->num_components; ci++) {
+    if ((downsample->methods[ci] == h2v1_downsample &&
+	 downsample->h2v1_row != NULL) ||
+#ifdef INPUT_SMOOTHING_SUPPORTED
+	(downsample->methods[ci] == h2v2_smooth_downsample &&
+	 downsample->h2v2_smooth_row != NULL) ||
+	(downsample->methods[ci] == fullsize_smooth_downsample &&
+	 downsample->fullsize_smooth_row != NULL) ||
+#endif
+	(downsample->methods[ci] == h2v2_downsample &&
+	 downsample->h2v2_row != NULL))
+      jsimd_note_kernel(JSIMD_K_DOWNSAMPLE, simd);
+  }
+#endif
+
 #ifdef INPUT_SMOOTHING_SUPPORTED
   if (cinfo->smoothing_factor && !smoothok)
     TRACEMS(cinfo, 0, JTRC_SMOOTH_NOTIMPL);
@@ -61,6 +61,11 @@ typedef struct {
 
 typedef my_coef_controller * my_coef_ptr;
 
+/* Zigzag positions 0..QUAD_LAST_INDEX all lie in the upper-left 4x4
+ * quadrant of the block.
+ */
+#define QUAD_LAST_INDEX  9
+
 /* Forward declarations */
 METHODDEF(int) decompress_onepass
 	JPP((j_decompress_ptr cinfo, JSAMPIMAGE output_buf));
@@ -154,18 +159,31 @@ decompress_onepass (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
   JSAMPARRAY output_ptr;
   JDIMENSION start_col, output_col;
   jpeg_component_info *compptr;
-  inverse_DCT_method_ptr inverse_DCT;
+  inverse_DCT_method_ptr inverse_DCT, inverse_DCT_dc, inverse_DCT_quad;
+  inverse_DCT_method_ptr method_ptr;
+  int * last_index = cinfo->entropy->last_index;
+  int k;
 
   /* Loop to process as much as one whole iMCU row */
   for (yoffset = coef->MCU_vert_offset; yoffset < coef->MCU_rows_per_iMCU_row;
        yoffset++) {
     for (MCU_col_num = coef->MCU_ctr; MCU_col_num <= last_MCU_col;
 	 MCU_col_num++) {
-      /* Try to fetch an MCU.  Entropy decoder expects buffer to be zeroed. */
-      jzero_far((void FAR *) coef->MCU_buffer[0],
-		(size_t) (cinfo->blocks_in_MCU * SIZEOF(JBLOCK)));
+      /* Try to fetch an MCU.  Entropy decoder expects buffer to be zeroed.
+       * If it reports the last coefficient it stored in each block, the
+       * buffer is kept zeroed by clearing just those coefficients after
+       * the IDCT; otherwise we clear the whole buffer here.
+       */
+      if (last_index == NULL)
+	jzero_far((void FAR *) coef->MCU_buffer[0],
+		  (size_t) (cinfo->blocks_in_MCU * SIZEOF(JBLOCK)));
       if (! (*cinfo->entropy->decode_mcu) (cinfo, coef->MCU_buffer)) {
-	/* Suspension forced; update state counters and exit */
+	/* Suspension forced; update state counters and exit.
+	 * The partly decoded MCU must not be left behind in the buffer.
+	 */
+	if (last_index != NULL)
+	  jzero_far((void FAR *) coef->MCU_buffer[0],
+		    (size_t) (cinfo->blocks_in_MCU * SIZEOF(JBLOCK)));
 	coef->MCU_vert_offset = yoffset;
 	coef->MCU_ctr = MCU_col_num;
 	return JPEG_SUSPENDED;
@@ -184,6 +202,9 @@ decompress_onepass (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
 	  continue;
 	}
 	inverse_DCT = cinfo->idct->inverse_DCT[compptr->component_index];
+	inverse_DCT_dc = cinfo->idct->inverse_DCT_dc[compptr->component_index];
+	inverse_DCT_quad =
+	  cinfo->idct->inverse_DCT_quad[compptr->component_index];
 	useful_width = (MCU_col_num < last_MCU_col) ? compptr->MCU_width
 						    : compptr->last_col_width;
 	output_ptr = output_buf[compptr->component_index] +
@@ -194,9 +215,18 @@ decompress_onepass (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
 	      yoffset+yindex < compptr->last_row_height) {
 	    output_col = start_col;
 	    for (xindex = 0; xindex < useful_width; xindex++) {
-	      (*inverse_DCT) (cinfo, compptr,
-			      (JCOEFPTR) coef->MCU_buffer[blkn+xindex],
-			      output_ptr, output_col);
+	      /* Use a shortcut IDCT if the block is sparse enough */
+	      method_ptr = inverse_DCT;
+	      if (last_index != NULL) {
+		k = last_index[blkn+xindex];
+		if (k == 0 && inverse_DCT_dc != NULL)
+		  method_ptr = inverse_DCT_dc;
+		else if (k <= QUAD_LAST_INDEX && inverse_DCT_quad != NULL)
+		  method_ptr = inverse_DCT_quad;
+	      }
+	      (*method_ptr) (cinfo, compptr,
+			     (JCOEFPTR) coef->MCU_buffer[blkn+xindex],
+			     output_ptr, output_col);
 	      output_col += compptr->DCT_scaled_size;
 	    }
 	  }
@@ -204,6 +234,17 @@ decompress_onepass (j_decompress_ptr cinfo, JSAMPIMAGE output_buf)
 	  output_ptr += compptr->DCT_scaled_size;
 	}
       }
+      /* Re-zero the coefficients the entropy decoder stored */
+      if (last_index != NULL) {
+	for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
+	  k = last_index[blkn];
+	  if (k <= QUAD_LAST_INDEX) {
+	    for (; k >= 0; k--)
+	      coef->MCU_buffer[blkn][0][jpeg_natural_order[k]] = 0;
+	  } else
+	    jzero_far((void FAR *) coef->MCU_buffer[blkn], SIZEOF(JBLOCK));
+	}
+      }
     }
     /* Completed an MCU row, but perhaps not an iMCU row */
     coef->MCU_ctr = 0;
@@ -729,6 +770,8 @@ jinit_d_coef_controller (j_decompress_ptr cinfo, boolean need_full_buffer)
     for (i = 0; i < D_MAX_BLOCKS_IN_MCU; i++) {
       coef->MCU_buffer[i] = buffer + i;
     }
+    /* decompress_onepass may keep the buffer zeroed from here on */
+    jzero_far((void FAR *) buffer, D_MAX_BLOCKS_IN_MCU * SIZEOF(JBLOCK));
     coef->pub.consume_data = dummy_consume_data;
     coef->pub.decompress_data = decompress_onepass;
     coef->pub.coef_arrays = NULL; /* flag for no virtual arrays */
@@ -11,6 +11,12 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
+
+/* The SIMD row converters know only the pixel layouts in jsimd.h. */
+#ifdef JSIMD_SUPPORTED
+#define SIMD_RGB_SUPPORTED
+#endif
 
 
 /* Private subobject */
@@ -23,6 +29,24 @@ typedef struct {
   int * Cb_b_tab;		/* => table for Cb to B conversion */
   INT32 * Cr_g_tab;		/* => table for Cr to G conversion */
   INT32 * Cb_g_tab;		/* => table for Cb to G conversion */
+
+  /* Layout of the RGB output pixels.  rgb_alpha is the offset of the byte
+   * set to MAXJSAMPLE in four-byte pixels; for three-byte pixels it equals
+   * rgb_red, and as it is stored first the red sample overwrites it.
+   */
+  int rgb_red, rgb_green, rgb_blue, rgb_alpha, rgb_pixelsize;
+
+#ifdef SIMD_RGB_SUPPORTED
+  /* SIMD routines converting the leading part of a row, or NULL.
+   * Each returns the number of columns it has done.
+   */
+  JMETHOD(JDIMENSION, ycc_rgb_row, (JSAMPROW inptr0, JSAMPROW inptr1,
+				    JSAMPROW inptr2, JSAMPROW outptr,
+				    JDIMENSION num_cols, int layout));
+  JMETHOD(JDIMENSION, gray_rgb_row, (JSAMPROW inptr, JSAMPROW outptr,
+				     JDIMENSION num_cols, int layout));
+  int simd_layout;		/* JSIMD_RGB etc. for the above */
+#endif
 } my_color_deconverter;
 
 typedef my_color_deconverter * my_cconvert_ptr;
@@ -105,6 +129,100 @@ build_ycc_rgb_table (j_decompress_ptr cinfo)
 }
 
 
+#ifdef SIMD_RGB_SUPPORTED
+
+/*
+ * SIMD versions of the YCC->RGB inner loop.  The chroma terms are computed
+ * exactly as the tables hold them (see JSIMD_YCC_TERMS_SSE2 in jsimd.h),
+ * and the saturating pack to bytes then does what range_limit[] does.
+ */
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+ycc_rgb_row_sse2 (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+		  JSAMPROW outptr, JDIMENSION num_cols, int layout)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i center = _mm_set1_epi16(CENTERJSAMPLE);
+  __m128i y, cb, cr, yw, xb, xr, rt, gt, bt, r[2], g[2], b[2], c[3];
+  JDIMENSION col;
+  int pixelsize = JSIMD_LAYOUT_PIXELSIZE(layout);
+  int h;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    y = _mm_loadu_si128((const __m128i *) (inptr0 + col));
+    cb = _mm_loadu_si128((const __m128i *) (inptr1 + col));
+    cr = _mm_loadu_si128((const __m128i *) (inptr2 + col));
+    for (h = 0; h < 2; h++) {
+      if (h == 0) {
+	yw = _mm_unpacklo_epi8(y, zero);
+	xb = _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero), center);
+	xr = _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero), center);
+      } else {
+	yw = _mm_unpackhi_epi8(y, zero);
+	xb = _mm_sub_epi16(_mm_unpackhi_epi8(cb, zero), center);
+	xr = _mm_sub_epi16(_mm_unpackhi_epi8(cr, zero), center);
+      }
+      JSIMD_YCC_TERMS_SSE2(xb, xr, rt, gt, bt);
+      r[h] = _mm_add_epi16(yw, rt);
+      g[h] = _mm_add_epi16(yw, gt);
+      b[h] = _mm_add_epi16(yw, bt);
+    }
+    c[0] = _mm_packus_epi16(r[0], r[1]);
+    c[1] = _mm_packus_epi16(g[0], g[1]);
+    c[2] = _mm_packus_epi16(b[0], b[1]);
+    JSIMD_STORE_RGB_SSE2(outptr, layout, c[0], c[1], c[2]);
+    outptr += 16 * pixelsize;
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+ycc_rgb_row_avx2 (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+		  JSAMPROW outptr, JDIMENSION num_cols, int layout)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i center = _mm256_set1_epi16(CENTERJSAMPLE);
+  __m256i y, cb, cr, yw, xb, xr, rt, gt, bt, r[2], g[2], b[2], c[3];
+  JDIMENSION col;
+  int pixelsize = JSIMD_LAYOUT_PIXELSIZE(layout);
+  int h;
+
+  /* The unpacks and packs work within 128-bit lanes, but as they pair up
+   * the pixels end up in their original order.
+   */
+  for (col = 0; col + 32 <= num_cols; col += 32) {
+    y = _mm256_loadu_si256((const __m256i *) (inptr0 + col));
+    cb = _mm256_loadu_si256((const __m256i *) (inptr1 + col));
+    cr = _mm256_loadu_si256((const __m256i *) (inptr2 + col));
+    for (h = 0; h < 2; h++) {
+      if (h == 0) {
+	yw = _mm256_unpacklo_epi8(y, zero);
+	xb = _mm256_sub_epi16(_mm256_unpacklo_epi8(cb, zero), center);
+	xr = _mm256_sub_epi16(_mm256_unpacklo_epi8(cr, zero), center);
+      } else {
+	yw = _mm256_unpackhi_epi8(y, zero);
+	xb = _mm256_sub_epi16(_mm256_unpackhi_epi8(cb, zero), center);
+	xr = _mm256_sub_epi16(_mm256_unpackhi_epi8(cr, zero), center);
+      }
+      JSIMD_YCC_TERMS_AVX2(xb, xr, rt, gt, bt);
+      r[h] = _mm256_add_epi16(yw, rt);
+      g[h] = _mm256_add_epi16(yw, gt);
+      b[h] = _mm256_add_epi16(yw, bt);
+    }
+    c[0] = _mm256_packus_epi16(r[0], r[1]);
+    c[1] = _mm256_packus_epi16(g[0], g[1]);
+    c[2] = _mm256_packus_epi16(b[0], b[1]);
+    JSIMD_STORE_RGB_AVX2(outptr, layout, c[0], c[1], c[2]);
+    outptr += 32 * pixelsize;
+  }
+  return col;
+}
+
+#endif /* SIMD_RGB_SUPPORTED */
+
+
 /*
  * Convert some rows of samples to the output colorspace.
  *
@@ -133,6 +251,9 @@ ycc_rgb_convert (j_decompress_ptr cinfo,
   register int * Cbbtab = cconvert->Cb_b_tab;
   register INT32 * Crgtab = cconvert->Cr_g_tab;
   register INT32 * Cbgtab = cconvert->Cb_g_tab;
+  int rred = cconvert->rgb_red, rgreen = cconvert->rgb_green;
+  int rblue = cconvert->rgb_blue, ralpha = cconvert->rgb_alpha;
+  int rsize = cconvert->rgb_pixelsize;
   SHIFT_TEMPS
 
   while (--num_rows >= 0) {
@@ -141,17 +262,26 @@ ycc_rgb_convert (j_decompress_ptr cinfo,
     inptr2 = input_buf[2][input_row];
     input_row++;
     outptr = *output_buf++;
-    for (col = 0; col < num_cols; col++) {
+    col = 0;
+#ifdef SIMD_RGB_SUPPORTED
+    if (cconvert->ycc_rgb_row != NULL) {
+      col = (*cconvert->ycc_rgb_row) (inptr0, inptr1, inptr2, outptr,
+				       num_cols, cconvert->simd_layout);
+      outptr += col * rsize;
+    }
+#endif
+    for (; col < num_cols; col++) {
       y  = GETJSAMPLE(inptr0[col]);
       cb = GETJSAMPLE(inptr1[col]);
       cr = GETJSAMPLE(inptr2[col]);
+      outptr[ralpha] = MAXJSAMPLE;
       /* Range-limiting is essential due to noise introduced by DCT losses. */
-      outptr[RGB_RED] =   range_limit[y + Crrtab[cr]];
-      outptr[RGB_GREEN] = range_limit[y +
+      outptr[rred] =   range_limit[y + Crrtab[cr]];
+      outptr[rgreen] = range_limit[y +
 			      ((int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr],
 						 SCALEBITS))];
-      outptr[RGB_BLUE] =  range_limit[y + Cbbtab[cb]];
-      outptr += RGB_PIXELSIZE;
+      outptr[rblue] =  range_limit[y + Cbbtab[cb]];
+      outptr += rsize;
     }
   }
 }
@@ -213,22 +343,109 @@ grayscale_convert (j_decompress_ptr cinfo,
  * with grayscale as a separate case.
  */
 
+#ifdef SIMD_RGB_SUPPORTED
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+gray_rgb_row_sse2 (JSAMPROW inptr, JSAMPROW outptr, JDIMENSION num_cols,
+		   int layout)
+{
+  __m128i g;
+  JDIMENSION col;
+  int pixelsize = JSIMD_LAYOUT_PIXELSIZE(layout);
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    g = _mm_loadu_si128((const __m128i *) (inptr + col));
+    JSIMD_STORE_RGB_SSE2(outptr, layout, g, g, g);
+    outptr += 16 * pixelsize;
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+gray_rgb_row_avx2 (JSAMPROW inptr, JSAMPROW outptr, JDIMENSION num_cols,
+		   int layout)
+{
+  __m256i g;
+  JDIMENSION col;
+  int pixelsize = JSIMD_LAYOUT_PIXELSIZE(layout);
+
+  for (col = 0; col + 32 <= num_cols; col += 32) {
+    g = _mm256_loadu_si256((const __m256i *) (inptr + col));
+    JSIMD_STORE_RGB_AVX2(outptr, layout, g, g, g);
+    outptr += 32 * pixelsize;
+  }
+  return col;
+}
+
+#endif /* SIMD_RGB_SUPPORTED */
+
 METHODDEF(void)
 gray_rgb_convert (j_decompress_ptr cinfo,
 		  JSAMPIMAGE input_buf, JDIMENSION input_row,
 		  JSAMPARRAY output_buf, int num_rows)
 {
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
   register JSAMPROW inptr, outptr;
   register JDIMENSION col;
   JDIMENSION num_cols = cinfo->output_width;
+  int rred = cconvert->rgb_red, rgreen = cconvert->rgb_green;
+  int rblue = cconvert->rgb_blue, ralpha = cconvert->rgb_alpha;
+  int rsize = cconvert->rgb_pixelsize;
 
   while (--num_rows >= 0) {
     inptr = input_buf[0][input_row++];
     outptr = *output_buf++;
+    col = 0;
+#ifdef SIMD_RGB_SUPPORTED
+    if (cconvert->gray_rgb_row != NULL) {
+      col = (*cconvert->gray_rgb_row) (inptr, outptr, num_cols,
+					cconvert->simd_layout);
+      outptr += col * rsize;
+    }
+#endif
+    for (; col < num_cols; col++) {
+      outptr[ralpha] = MAXJSAMPLE;
+      /* We can dispense with GETJSAMPLE() here */
+      outptr[rred] = outptr[rgreen] = outptr[rblue] = inptr[col];
+      outptr += rsize;
+    }
+  }
+}
+
+
+/*
+ * Convert RGB to RGB with a different pixel layout, as when a four-byte
+ * output color space is requested from an RGB file.
+ */
+
+METHODDEF(void)
+rgb_rgb_convert (j_decompress_ptr cinfo,
+		 JSAMPIMAGE input_buf, JDIMENSION input_row,
+		 JSAMPARRAY output_buf, int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  register JSAMPROW inptr0, inptr1, inptr2, outptr;
+  register JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+  int rred = cconvert->rgb_red, rgreen = cconvert->rgb_green;
+  int rblue = cconvert->rgb_blue, ralpha = cconvert->rgb_alpha;
+  int rsize = cconvert->rgb_pixelsize;
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
     for (col = 0; col < num_cols; col++) {
+      outptr[ralpha] = MAXJSAMPLE;
       /* We can dispense with GETJSAMPLE() here */
-      outptr[RGB_RED] = outptr[RGB_GREEN] = outptr[RGB_BLUE] = inptr[col];
-      outptr += RGB_PIXELSIZE;
+      outptr[rred] = inptr0[col];
+      outptr[rgreen] = inptr1[col];
+      outptr[rblue] = inptr2[col];
+      outptr += rsize;
     }
   }
 }
@@ -305,6 +522,9 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
 {
   my_cconvert_ptr cconvert;
   int ci;
+#ifdef SIMD_RGB_SUPPORTED
+  int simd;
+#endif
 
   cconvert = (my_cconvert_ptr)
     (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
@@ -312,6 +532,77 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
   cinfo->cconvert = (struct jpeg_color_deconverter *) cconvert;
   cconvert->pub.start_pass = start_pass_dcolor;
 
+  /* Set the pixel layout for the RGB conversions */
+  switch (cinfo->out_color_space) {
+  case JCS_EXT_RGBX:
+  case JCS_EXT_RGBA:
+    cconvert->rgb_red = 0;
+    cconvert->rgb_green = 1;
+    cconvert->rgb_blue = 2;
+    cconvert->rgb_alpha = 3;
+    cconvert->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_BGRX:
+  case JCS_EXT_BGRA:
+    cconvert->rgb_red = 2;
+    cconvert->rgb_green = 1;
+    cconvert->rgb_blue = 0;
+    cconvert->rgb_alpha = 3;
+    cconvert->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_XRGB:
+  case JCS_EXT_ARGB:
+    cconvert->rgb_red = 1;
+    cconvert->rgb_green = 2;
+    cconvert->rgb_blue = 3;
+    cconvert->rgb_alpha = 0;
+    cconvert->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_XBGR:
+  case JCS_EXT_ABGR:
+    cconvert->rgb_red = 3;
+    cconvert->rgb_green = 2;
+    cconvert->rgb_blue = 1;
+    cconvert->rgb_alpha = 0;
+    cconvert->rgb_pixelsize = 4;
+    break;
+  default:
+    cconvert->rgb_red = RGB_RED;
+    cconvert->rgb_green = RGB_GREEN;
+    cconvert->rgb_blue = RGB_BLUE;
+    cconvert->rgb_alpha = RGB_RED;
+    cconvert->rgb_pixelsize = RGB_PIXELSIZE;
+    break;
+  }
+
+#ifdef SIMD_RGB_SUPPORTED
+  /* Use SIMD row converters if the CPU has them and they know the layout;
+   * their output is identical.
+   */
+  simd = jsimd_cpu_support();
+  cconvert->simd_layout = -1;
+  if (cconvert->rgb_green == 1) {
+    if (cconvert->rgb_pixelsize == 3)
+      cconvert->simd_layout = cconvert->rgb_red ? JSIMD_BGR : JSIMD_RGB;
+    else if (cconvert->rgb_pixelsize == 4 && cconvert->rgb_alpha == 3)
+      cconvert->simd_layout = cconvert->rgb_red ? JSIMD_BGRX : JSIMD_RGBX;
+  } else if (cconvert->rgb_green == 2 && cconvert->rgb_pixelsize == 4 &&
+	     cconvert->rgb_alpha == 0)
+    cconvert->simd_layout = cconvert->rgb_red == 3 ? JSIMD_XBGR : JSIMD_XRGB;
+  if (cconvert->simd_layout < 0)
+    simd = 0;
+  if (simd & JSIMD_AVX2) {
+    cconvert->ycc_rgb_row = ycc_rgb_row_avx2;
+    cconvert->gray_rgb_row = gray_rgb_row_avx2;
+  } else if (simd & JSIMD_SSE2) {
+    cconvert->ycc_rgb_row = ycc_rgb_row_sse2;
+    cconvert->gray_rgb_row = gray_rgb_row_sse2;
+  } else {
+    cconvert->ycc_rgb_row = NULL;
+    cconvert->gray_rgb_row = NULL;
+  }
+#endif
+
   /* Make sure num_components agrees with jpeg_color_space */
   switch (cinfo->jpeg_color_space) {
   case JCS_GRAYSCALE:
@@ -356,14 +647,25 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
     break;
 
   case JCS_RGB:
-    cinfo->out_color_components = RGB_PIXELSIZE;
+  case JCS_EXT_RGBX:
+  case JCS_EXT_BGRX:
+  case JCS_EXT_RGBA:
+  case JCS_EXT_BGRA:
+  case JCS_EXT_XRGB:
+  case JCS_EXT_XBGR:
+  case JCS_EXT_ARGB:
+  case JCS_EXT_ABGR:
+    cinfo->out_color_components = cconvert->rgb_pixelsize;
     if (cinfo->jpeg_color_space == JCS_YCbCr) {
       cconvert->pub.color_convert = ycc_rgb_convert;
       build_ycc_rgb_table(cinfo);
     } else if (cinfo->jpeg_color_space == JCS_GRAYSCALE) {
       cconvert->pub.color_convert = gray_rgb_convert;
-    } else if (cinfo->jpeg_color_space == JCS_RGB && RGB_PIXELSIZE == 3) {
-      cconvert->pub.color_convert = null_convert;
+    } else if (cinfo->jpeg_color_space == JCS_RGB) {
+      if (cinfo->out_color_space == JCS_RGB && RGB_PIXELSIZE == 3)
+	cconvert->pub.color_convert = null_convert;
+      else
+	cconvert->pub.color_convert = rgb_rgb_convert;
     } else
       ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
     break;
@@ -393,4 +695,12 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
     cinfo->output_components = 1; /* single colormapped output component */
   else
     cinfo->output_components = cinfo->out_color_components;
+
+#ifdef SIMD_RGB_SUPPORTED
+  if ((cconvert->pub.color_convert == ycc_rgb_convert &&
+       cconvert->ycc_rgb_row != NULL) ||
+      (cconvert->pub.color_convert == gray_rgb_convert &&
+       cconvert->gray_rgb_row != NULL))
+    jsimd_note_kernel(JSIMD_K_COLOR_OUT, simd);
+#endif
 }
@@ -19,6 +19,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 
 /*
@@ -79,6 +80,88 @@ typedef union {
 #endif
 
 
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * Substitute SIMD versions of the full-size IDCTs where the CPU has them.
+ * The integer SIMD IDCTs dequantize with 16x16->32 bit multiplies, so
+ * they need 32-bit multiplier table entries in the range 0..32767 (which
+ * all baseline and extended quant tables give); the float ones need a
+ * float multiplier table.  Any other component keeps the C routine.
+ * All of the SIMD IDCTs produce exactly the same output as the C code.
+ */
+
+LOCAL(void)
+select_simd_idct (j_decompress_ptr cinfo)
+{
+  my_idct_ptr idct = (my_idct_ptr) cinfo->idct;
+  int ci, i, simd;
+  jpeg_component_info *compptr;
+  inverse_DCT_method_ptr method_ptr, quad_ptr;
+
+  simd = jsimd_cpu_support();
+  if (! (simd & (JSIMD_SSE2 | JSIMD_AVX2)) || SIZEOF(JCOEF) != 2)
+    return;
+
+  for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
+       ci++, compptr++) {
+    if (compptr->DCT_scaled_size != DCTSIZE)
+      continue;
+    method_ptr = quad_ptr = NULL;
+    switch (cinfo->dct_method) {
+#ifdef DCT_ISLOW_SUPPORTED
+    case JDCT_ISLOW:
+      if (SIZEOF(ISLOW_MULT_TYPE) == 4) {
+	ISLOW_MULT_TYPE * ismtbl = (ISLOW_MULT_TYPE *) compptr->dct_table;
+	for (i = 0; i < DCTSIZE2; i++) {
+	  if (ismtbl[i] < 0 || ismtbl[i] > 32767)
+	    break;
+	}
+	if (i == DCTSIZE2) {
+	  method_ptr = (simd & JSIMD_AVX2) ? jpeg_idct_islow_avx2 :
+					     jpeg_idct_islow_sse2;
+	  quad_ptr = (simd & JSIMD_AVX2) ? jpeg_idct_islow_quad_avx2 :
+					   jpeg_idct_islow_quad_sse2;
+	}
+      }
+      break;
+#endif
+#ifdef DCT_IFAST_SUPPORTED
+    case JDCT_IFAST:
+      if (SIZEOF(IFAST_MULT_TYPE) == 4) {
+	IFAST_MULT_TYPE * ifmtbl = (IFAST_MULT_TYPE *) compptr->dct_table;
+	for (i = 0; i < DCTSIZE2; i++) {
+	  if (ifmtbl[i] < 0 || ifmtbl[i] > 32767)
+	    break;
+	}
+	if (i == DCTSIZE2)
+	  method_ptr = (simd & JSIMD_AVX2) ? jpeg_idct_ifast_avx2 :
+					     jpeg_idct_ifast_sse2;
+      }
+      break;
+#endif
+#ifdef DCT_FLOAT_SUPPORTED
+    case JDCT_FLOAT:
+      if (SIZEOF(FLOAT_MULT_TYPE) == 4)
+	method_ptr = (simd & JSIMD_AVX2) ? jpeg_idct_float_avx2 :
+					   jpeg_idct_float_sse2;
+      break;
+#endif
+    default:
+      break;
+    }
+    if (method_ptr != NULL) {
+      idct->pub.inverse_DCT[ci] = method_ptr;
+      jsimd_note_kernel(JSIMD_K_IDCT, simd);
+    }
+    if (quad_ptr != NULL)
+      idct->pub.inverse_DCT_quad[ci] = quad_ptr;
+  }
+}
+
+#endif /* JSIMD_SUPPORTED */
+
+
 /*
  * Prepare for an output pass.
  * Here we select the proper IDCT routine for each component and build
@@ -93,11 +176,15 @@ start_pass (j_decompress_ptr cinfo)
   jpeg_component_info *compptr;
   int method = 0;
   inverse_DCT_method_ptr method_ptr = NULL;
+  inverse_DCT_method_ptr dc_ptr, quad_ptr;
   JQUANT_TBL * qtbl;
 
   for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
        ci++, compptr++) {
-    /* Select the proper IDCT routine for this component's scaling */
+    /* Select the proper IDCT routine for this component's scaling,
+     * along with any shortcut versions for sparse blocks.
+     */
+    dc_ptr = quad_ptr = NULL;
     switch (compptr->DCT_scaled_size) {
 #ifdef IDCT_SCALING_SUPPORTED
     case 1:
@@ -118,18 +205,22 @@ start_pass (j_decompress_ptr cinfo)
 #ifdef DCT_ISLOW_SUPPORTED
       case JDCT_ISLOW:
 	method_ptr = jpeg_idct_islow;
+	dc_ptr = jpeg_idct_islow_dc;
+	quad_ptr = jpeg_idct_islow_quad;
 	method = JDCT_ISLOW;
 	break;
 #endif
 #ifdef DCT_IFAST_SUPPORTED
       case JDCT_IFAST:
 	method_ptr = jpeg_idct_ifast;
+	dc_ptr = jpeg_idct_ifast_dc;
 	method = JDCT_IFAST;
 	break;
 #endif
 #ifdef DCT_FLOAT_SUPPORTED
       case JDCT_FLOAT:
 	method_ptr = jpeg_idct_float;
+	dc_ptr = jpeg_idct_float_dc;
 	method = JDCT_FLOAT;
 	break;
 #endif
@@ -143,6 +234,8 @@ start_pass (j_decompress_ptr cinfo)
       break;
     }
     idct->pub.inverse_DCT[ci] = method_ptr;
+    idct->pub.inverse_DCT_dc[ci] = dc_ptr;
+    idct->pub.inverse_DCT_quad[ci] = quad_ptr;
     /* Create multiplier table from quant table.
      * However, we can skip this if the component is uninteresting
      * or if we already built the table.  Also, if no quant table
@@ -236,6 +329,9 @@ start_pass (j_decompress_ptr cinfo)
       break;
     }
   }
+#ifdef JSIMD_SUPPORTED
+  select_simd_idct(cinfo);
+#endif
 }
 
 
@@ -73,6 +73,9 @@ typedef struct {
   /* Whether we care about the DC and AC coefficient values for each block */
   boolean dc_needed[D_MAX_BLOCKS_IN_MCU];
   boolean ac_needed[D_MAX_BLOCKS_IN_MCU];
+
+  /* Highest zigzag index stored in each block by the last decode_mcu */
+  int last_index[D_MAX_BLOCKS_IN_MCU];
 } huff_entropy_decoder;
 
 typedef huff_entropy_decoder * huff_entropy_ptr;
@@ -250,6 +253,37 @@ jpeg_make_d_derived_tbl (j_decompress_ptr cinfo, boolean isDC, int tblno,
     }
   }
 
+  /* Compute the combined lookahead table.  Every code of up to
+   * HUFF_LOOKAHEAD_VAL bits gets its length and symbol; if the value bits
+   * that follow also fit (for AC tables, the size is the low 4 bits of
+   * the symbol), the entry includes them and their extended value.
+   */
+
+  MEMZERO(dtbl->look_val, SIZEOF(dtbl->look_val));
+
+  p = 0;
+  for (l = 1; l <= HUFF_LOOKAHEAD_VAL; l++) {
+    for (i = 1; i <= (int) htbl->bits[l]; i++, p++) {
+      int sym = htbl->huffval[p];
+      int s = isDC ? sym : (sym & 15);
+      int extra = HUFF_LOOKAHEAD_VAL - l; /* bits following the code */
+      int v;
+
+      lookbits = huffcode[p] << extra;
+      for (ctr = 0; ctr < (1 << extra); ctr++) {
+	if (s <= extra) {
+	  v = (s == 0) ? 0 : (ctr >> (extra - s)) & ((1 << s) - 1);
+	  if (s != 0 && v < (1 << (s-1)))
+	    v -= (1 << s) - 1;	/* Figure F.12: extend sign bit */
+	  dtbl->look_val[lookbits + ctr] =
+	    LOOK_VAL_ENTRY(l + s, sym, v) | LOOK_VAL_FULL;
+	} else {
+	  dtbl->look_val[lookbits + ctr] = LOOK_VAL_ENTRY(l, sym, 0);
+	}
+      }
+    }
+  }
+
   /* Validate symbols as being reasonable.
    * For AC tables, we make no check, but accept all byte values 0..255.
    * For DC tables, we require the symbols to be in range 0..15.
@@ -271,22 +305,9 @@ jpeg_make_d_derived_tbl (j_decompress_ptr cinfo, boolean isDC, int tblno,
  * See jdhuff.h for info about usage.
  * Note: current values of get_buffer and bits_left are passed as parameters,
  * but are returned in the corresponding fields of the state struct.
- *
- * On most machines MIN_GET_BITS should be 25 to allow the full 32-bit width
- * of get_buffer to be used.  (On machines with wider words, an even larger
- * buffer could be used.)  However, on some machines 32-bit shifts are
- * quite slow and take time proportional to the number of places shifted.
- * (This is true with most PC compilers, for instance.)  In this case it may
- * be a win to set MIN_GET_BITS to the minimum value of 15.  This reduces the
- * average shift distance at the cost of more calls to jpeg_fill_bit_buffer.
+ * MIN_GET_BITS is defined in jdhuff.h.
  */
 
-#ifdef SLOW_SHIFT_32
-#define MIN_GET_BITS  15	/* minimum allowable value */
-#else
-#define MIN_GET_BITS  (BIT_BUF_SIZE-7)
-#endif
-
 
 GLOBAL(boolean)
 jpeg_fill_bit_buffer (bitread_working_state * state,
@@ -304,6 +325,19 @@ jpeg_fill_bit_buffer (bitread_working_state * state,
   /* We fail to do so only if we hit a marker or are forced to suspend. */
 
   if (cinfo->unread_marker == 0) {	/* cannot advance past a marker */
+    /* Fast path: enough bytes are buffered that we need not check for
+     * running out; go byte by byte only from the first 0xFF on.
+     */
+    if (bytes_in_buffer >= BIT_BUF_SIZE/8) {
+      register const JOCTET * start = next_input_byte;
+
+      while (bits_left < MIN_GET_BITS && GETJOCTET(*next_input_byte) != 0xFF) {
+	get_buffer = (get_buffer << 8) | GETJOCTET(*next_input_byte++);
+	bits_left += 8;
+      }
+      bytes_in_buffer -= (size_t) (next_input_byte - start);
+    }
+
     while (bits_left < MIN_GET_BITS) {
       register int c;
 
@@ -531,7 +565,10 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   /* If we've run out of data, just leave the MCU set to zeroes.
    * This way, we return uniform gray for the remainder of the segment.
    */
-  if (! entropy->pub.insufficient_data) {
+  if (entropy->pub.insufficient_data) {
+    for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++)
+      entropy->last_index[blkn] = 0;
+  } else {
 
     /* Load up working state */
     BITREAD_LOAD_STATE(cinfo,entropy->bitstate);
@@ -544,15 +581,29 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
       d_derived_tbl * dctbl = entropy->dc_cur_tbls[blkn];
       d_derived_tbl * actbl = entropy->ac_cur_tbls[blkn];
       register int s, k, r;
+      register INT32 e;
+      int last = 0;
 
       /* Decode a single block's worth of coefficients */
 
       /* Section F.2.2.1: decode the DC coefficient difference */
-      HUFF_DECODE(s, br_state, dctbl, return FALSE, label1);
-      if (s) {
-	CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	r = GET_BITS(s);
-	s = HUFF_EXTEND(r, s);
+      HUFF_LOOK_VAL(e, br_state, dctbl, return FALSE);
+      if (e & LOOK_VAL_FULL) {
+	/* Code and value bits all in the lookahead: one step */
+	DROP_BITS(LOOK_VAL_NBITS(e));
+	s = LOOK_VAL_VALUE(e);
+      } else {
+	if (e) {
+	  DROP_BITS(LOOK_VAL_NBITS(e));
+	  s = LOOK_VAL_SYM(e);
+	} else {
+	  HUFF_DECODE(s, br_state, dctbl, return FALSE, label1);
+	}
+	if (s) {
+	  CHECK_BIT_BUFFER(br_state, s, return FALSE);
+	  r = GET_BITS(s);
+	  s = HUFF_EXTEND(r, s);
+	}
       }
 
       if (entropy->dc_needed[blkn]) {
@@ -569,21 +620,32 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	/* Section F.2.2.2: decode the AC coefficients */
 	/* Since zeroes are skipped, output area must be cleared beforehand */
 	for (k = 1; k < DCTSIZE2; k++) {
-	  HUFF_DECODE(s, br_state, actbl, return FALSE, label2);
+	  HUFF_LOOK_VAL(e, br_state, actbl, return FALSE);
+	  if (e) {
+	    DROP_BITS(LOOK_VAL_NBITS(e));
+	    s = LOOK_VAL_SYM(e);
+	  } else {
+	    HUFF_DECODE(s, br_state, actbl, return FALSE, label2);
+	  }
       
 	  r = s >> 4;
 	  s &= 15;
       
 	  if (s) {
 	    k += r;
-	    CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	    r = GET_BITS(s);
-	    s = HUFF_EXTEND(r, s);
+	    if (e & LOOK_VAL_FULL) {
+	      s = LOOK_VAL_VALUE(e);
+	    } else {
+	      CHECK_BIT_BUFFER(br_state, s, return FALSE);
+	      r = GET_BITS(s);
+	      s = HUFF_EXTEND(r, s);
+	    }
 	    /* Output coefficient in natural (dezigzagged) order.
 	     * Note: the extra entries in jpeg_natural_order[] will save us
 	     * if k >= DCTSIZE2, which could happen if the data is corrupted.
 	     */
 	    (*block)[jpeg_natural_order[k]] = (JCOEF) s;
+	    last = k;
 	  } else {
 	    if (r != 15)
 	      break;
@@ -596,15 +658,23 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	/* Section F.2.2.2: decode the AC coefficients */
 	/* In this path we just discard the values */
 	for (k = 1; k < DCTSIZE2; k++) {
-	  HUFF_DECODE(s, br_state, actbl, return FALSE, label3);
+	  HUFF_LOOK_VAL(e, br_state, actbl, return FALSE);
+	  if (e) {
+	    DROP_BITS(LOOK_VAL_NBITS(e));
+	    s = LOOK_VAL_SYM(e);
+	  } else {
+	    HUFF_DECODE(s, br_state, actbl, return FALSE, label3);
+	  }
       
 	  r = s >> 4;
 	  s &= 15;
       
 	  if (s) {
 	    k += r;
-	    CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	    DROP_BITS(s);
+	    if (! (e & LOOK_VAL_FULL)) {
+	      CHECK_BIT_BUFFER(br_state, s, return FALSE);
+	      DROP_BITS(s);
+	    }
 	  } else {
 	    if (r != 15)
 	      break;
@@ -613,6 +683,9 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	}
 
       }
+
+      /* Corrupt data can carry k past the end; such writes land at 63 */
+      entropy->last_index[blkn] = MIN(last, DCTSIZE2-1);
     }
 
     /* Completed MCU, so update state */
@@ -643,6 +716,7 @@ jinit_huff_decoder (j_decompress_ptr cinfo)
   cinfo->entropy = (struct jpeg_entropy_decoder *) entropy;
   entropy->pub.start_pass = start_pass_huff_decoder;
   entropy->pub.decode_mcu = decode_mcu;
+  entropy->pub.last_index = entropy->last_index;
 
   /* Mark tables unallocated */
   for (i = 0; i < NUM_HUFF_TBLS; i++) {
@@ -22,6 +22,7 @@
 /* Derived data constructed for each Huffman table */
 
 #define HUFF_LOOKAHEAD	8	/* # of bits of lookahead */
+#define HUFF_LOOKAHEAD_VAL 10	/* # of bits of code+value lookahead */
 
 typedef struct {
   /* Basic tables: (element [0] of each array is unused) */
@@ -43,8 +44,25 @@ typedef struct {
    */
   int look_nbits[1<<HUFF_LOOKAHEAD]; /* # bits, or 0 if too long */
   UINT8 look_sym[1<<HUFF_LOOKAHEAD]; /* symbol, or unused */
+
+  /* Combined lookahead table for the sequential decoder: indexed by the
+   * next HUFF_LOOKAHEAD_VAL bits, it gives the code length and symbol,
+   * and when the following value bits are also within those bits, the
+   * sign-extended coefficient value too; see the LOOK_VAL macros below.
+   * 0 means the code is too long.
+   */
+  INT32 look_val[1<<HUFF_LOOKAHEAD_VAL];
 } d_derived_tbl;
 
+/* Fields of a look_val[] entry */
+#define LOOK_VAL_FULL	0x80	/* flag: NBITS includes the value bits */
+#define LOOK_VAL_NBITS(e)  ((int) ((e) & 0x1F))
+#define LOOK_VAL_SYM(e)    ((int) (((e) >> 8) & 0xFF))
+#define LOOK_VAL_VALUE(e)  ((int) ((e) >> 16) - (1 << HUFF_LOOKAHEAD_VAL))
+#define LOOK_VAL_ENTRY(nbits,sym,value) \
+	((INT32) (nbits) | ((INT32) (sym) << 8) | \
+	 ((INT32) ((value) + (1 << HUFF_LOOKAHEAD_VAL)) << 16))
+
 /* Expand a Huffman table definition into the derived format */
 EXTERN(void) jpeg_make_d_derived_tbl
 	JPP((j_decompress_ptr cinfo, boolean isDC, int tblno,
@@ -69,16 +87,36 @@ EXTERN(void) jpeg_make_d_derived_tbl
  * necessary.
  */
 
-typedef INT32 bit_buf_type;	/* type of bit-extraction buffer */
-#define BIT_BUF_SIZE  32	/* size of buffer in bits */
-
 /* If long is > 32 bits on your machine, and shifting/masking longs is
  * reasonably fast, making bit_buf_type be long and setting BIT_BUF_SIZE
- * appropriately should be a win.  Unfortunately we can't define the size
- * with something like  #define BIT_BUF_SIZE (sizeof(bit_buf_type)*8)
+ * appropriately is a win: refills are needed only about every 7 bytes.
+ * We do so for the usual LP64 data model.  Unfortunately we can't define
+ * the size with something like  #define BIT_BUF_SIZE (sizeof(bit_buf_type)*8)
  * because not all machines measure sizeof in 8-bit bytes.
  */
 
+#if defined(_LP64) || defined(__LP64__)
+typedef unsigned long bit_buf_type; /* type of bit-extraction buffer */
+#define BIT_BUF_SIZE  64	/* size of buffer in bits */
+#else
+typedef INT32 bit_buf_type;	/* type of bit-extraction buffer */
+#define BIT_BUF_SIZE  32	/* size of buffer in bits */
+#endif
+
+/* On most machines MIN_GET_BITS should be BIT_BUF_SIZE-7 to allow the full
+ * width of get_buffer to be used.  However, on some machines 32-bit shifts
+ * are quite slow and take time proportional to the number of places shifted.
+ * (This is true with most PC compilers, for instance.)  In this case it may
+ * be a win to set MIN_GET_BITS to the minimum value of 15.  This reduces the
+ * average shift distance at the cost of more calls to jpeg_fill_bit_buffer.
+ */
+
+#ifdef SLOW_SHIFT_32
+#define MIN_GET_BITS  15	/* minimum allowable value */
+#else
+#define MIN_GET_BITS  (BIT_BUF_SIZE-7)
+#endif
+
 typedef struct {		/* Bitreading state saved across MCUs */
   bit_buf_type get_buffer;	/* current bit-extraction buffer */
   int bits_left;		/* # of unused bits in it */
@@ -150,6 +188,23 @@ typedef struct {		/* Bitreading working state within an MCU */
 #define DROP_BITS(nbits) \
 	(bits_left -= (nbits))
 
+/*
+ * In-line refill for the common case: while there are plenty of bytes in
+ * the source buffer, load whole bytes up to MIN_GET_BITS, stopping short
+ * of any 0xFF (stuffed byte or marker), which jpeg_fill_bit_buffer must
+ * handle.  This may load nothing, so callers test bits_left afterwards.
+ */
+
+#define FILL_BIT_BUFFER_FAST(state) \
+	{ if ((state).bytes_in_buffer >= BIT_BUF_SIZE/8 &&  \
+	      (state).cinfo->unread_marker == 0) {  \
+	    register const JOCTET * fillptr = (state).next_input_byte;  \
+	    while (bits_left < MIN_GET_BITS && GETJOCTET(*fillptr) != 0xFF) {  \
+	      get_buffer = (get_buffer << 8) | GETJOCTET(*fillptr++);  \
+	      bits_left += 8; }  \
+	    (state).bytes_in_buffer -= (size_t) (fillptr - (state).next_input_byte);  \
+	    (state).next_input_byte = fillptr; } }
+
 /* Load up the bit buffer to a depth of at least nbits */
 EXTERN(boolean) jpeg_fill_bit_buffer
 	JPP((bitread_working_state * state, register bit_buf_type get_buffer,
@@ -195,6 +250,24 @@ slowlabel: \
   } \
 }
 
+/*
+ * HUFF_LOOK_VAL fetches the look_val[] entry for the next code, or 0 if
+ * the code is too long or too few bits remain before a marker; the caller
+ * then falls back to HUFF_DECODE.  Nothing is removed from the buffer.
+ */
+
+#define HUFF_LOOK_VAL(entry,state,htbl,failaction) \
+{ if (bits_left < HUFF_LOOKAHEAD_VAL) { \
+    FILL_BIT_BUFFER_FAST(state); \
+    if (bits_left < HUFF_LOOKAHEAD_VAL) { \
+      if (! jpeg_fill_bit_buffer(&state,get_buffer,bits_left, 0)) {failaction;} \
+      get_buffer = state.get_buffer; bits_left = state.bits_left; \
+    } \
+  } \
+  entry = (bits_left >= HUFF_LOOKAHEAD_VAL) ? \
+	  htbl->look_val[PEEK_BITS(HUFF_LOOKAHEAD_VAL)] : 0; \
+}
+
 /* Out-of-line case for Huffman code fetching */
 EXTERN(int) jpeg_huff_decode
 	JPP((bitread_working_state * state, register bit_buf_type get_buffer,
@@ -14,6 +14,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 
 /* Private state */
@@ -44,14 +45,33 @@ LOCAL(boolean)
 use_merged_upsample (j_decompress_ptr cinfo)
 {
 #ifdef UPSAMPLE_MERGING_SUPPORTED
-  /* Merging is the equivalent of plain box-filter upsampling */
-  if (cinfo->do_fancy_upsampling || cinfo->CCIR601_sampling)
+  /* Merging is the equivalent of plain box-filter upsampling, except in
+   * the 2h2v case, which jdmerge.c can also do with fancy upsampling
+   */
+  if (cinfo->CCIR601_sampling)
     return FALSE;
   /* jdmerge.c only supports YCC=>RGB color conversion */
-  if (cinfo->jpeg_color_space != JCS_YCbCr || cinfo->num_components != 3 ||
-      cinfo->out_color_space != JCS_RGB ||
-      cinfo->out_color_components != RGB_PIXELSIZE)
+  if (cinfo->jpeg_color_space != JCS_YCbCr || cinfo->num_components != 3)
+    return FALSE;
+  switch (cinfo->out_color_space) {
+  case JCS_RGB:
+    if (cinfo->out_color_components != RGB_PIXELSIZE)
+      return FALSE;
+    break;
+  case JCS_EXT_RGBX:
+  case JCS_EXT_BGRX:
+  case JCS_EXT_RGBA:
+  case JCS_EXT_BGRA:
+  case JCS_EXT_XRGB:
+  case JCS_EXT_XBGR:
+  case JCS_EXT_ARGB:
+  case JCS_EXT_ABGR:
+    if (cinfo->out_color_components != 4)
+      return FALSE;
+    break;
+  default:
     return FALSE;
+  }
   /* and it only handles 2h1v or 2h2v sampling ratios */
   if (cinfo->comp_info[0].h_samp_factor != 2 ||
       cinfo->comp_info[1].h_samp_factor != 1 ||
@@ -65,6 +85,13 @@ use_merged_upsample (j_decompress_ptr cinfo)
       cinfo->comp_info[1].DCT_scaled_size != cinfo->min_DCT_scaled_size ||
       cinfo->comp_info[2].DCT_scaled_size != cinfo->min_DCT_scaled_size)
     return FALSE;
+  /* jdmerge.c does fancy upsampling only at 2h2v, and needs the same */
+  /* conditions as jdsample.c has for it */
+  if (cinfo->do_fancy_upsampling &&
+      (cinfo->comp_info[0].v_samp_factor != 2 ||
+       cinfo->min_DCT_scaled_size <= 1 ||
+       cinfo->comp_info[1].downsampled_width <= 2))
+    return FALSE;
   /* ??? also need to test for upsample-time rescaling, when & if supported */
   return TRUE;			/* by golly, it'll work... */
 #else
@@ -184,6 +211,14 @@ jpeg_calc_output_dimensions (j_decompress_ptr cinfo)
     break;
   case JCS_CMYK:
   case JCS_YCCK:
+  case JCS_EXT_RGBX:
+  case JCS_EXT_BGRX:
+  case JCS_EXT_RGBA:
+  case JCS_EXT_BGRA:
+  case JCS_EXT_XRGB:
+  case JCS_EXT_XBGR:
+  case JCS_EXT_ARGB:
+  case JCS_EXT_ABGR:
     cinfo->out_color_components = 4;
     break;
   default:			/* else must be same colorspace as in file */
@@ -318,6 +353,9 @@ master_selection (j_decompress_ptr cinfo)
   if (cinfo->quantize_colors) {
     if (cinfo->raw_data_out)
       ERREXIT(cinfo, JERR_NOTIMPL);
+    /* The quantizers know nothing of the filler byte of JCS_EXT_xxx */
+    if (cinfo->out_color_space >= JCS_EXT_RGBX)
+      ERREXIT(cinfo, JERR_CONVERSION_NOTIMPL);
     /* 2-pass quantizer only works in 3-component color space. */
     if (cinfo->out_color_components != 3) {
       cinfo->enable_1pass_quant = TRUE;
@@ -553,5 +591,10 @@ jinit_master_decompress (j_decompress_ptr cinfo)
 
   master->pub.is_dummy_pass = FALSE;
 
+#ifdef JSIMD_SUPPORTED
+  /* The modules set up below record their SIMD choices afresh */
+  jsimd_clear_kernels(JSIMD_FIRST_D_KERNEL, JSIMD_NUM_KERNELS);
+#endif
+
   master_selection(cinfo);
 }
@@ -22,9 +22,16 @@
  * At typical sampling ratios, this eliminates half or three-quarters of the
  * multiplications needed for color conversion.
  *
+ * For 2h2v sampling we also provide fancy (triangle filter) upsampling,
+ * computing each chroma sample exactly as jdsample.c's h2v2_fancy_upsample
+ * does and color converting it at once.  This does not save any arithmetic,
+ * but it avoids writing full-size chroma rows out to memory and reading
+ * them back in again, which is what costs the time in the separate steps.
+ *
  * This file currently provides implementations for the following cases:
- *	YCbCr => RGB color conversion only.
- *	Sampling ratios of 2h1v or 2h2v.
+ *	YCbCr => RGB color conversion only (including the four-byte
+ *	JCS_EXT_xxx layouts).
+ *	Sampling ratios of 2h1v or 2h2v (2h2v only for fancy upsampling).
  *	No scaling needed at upsample time.
  *	Corner-aligned (non-CCIR601) sampling alignment.
  * Other special cases could be added, but in most applications these are
@@ -35,9 +42,15 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef UPSAMPLE_MERGING_SUPPORTED
 
+/* The SIMD row converters know only the pixel layouts in jsimd.h. */
+#ifdef JSIMD_SUPPORTED
+#define SIMD_RGB_SUPPORTED
+#endif
+
 
 /* Private subobject */
 
@@ -55,6 +68,25 @@ typedef struct {
   INT32 * Cr_g_tab;		/* => table for Cr to G conversion */
   INT32 * Cb_g_tab;		/* => table for Cb to G conversion */
 
+  /* Layout of the output pixels, as in jdcolor.c */
+  int rgb_red, rgb_green, rgb_blue, rgb_alpha, rgb_pixelsize;
+
+#ifdef SIMD_RGB_SUPPORTED
+  /* SIMD routines doing the leading part of a row (of a pair of rows for
+   * merged_row, if inptr01 is not NULL), or NULL.  merged_row returns the
+   * number of output columns it has done; fancy_row does the general-case
+   * chroma columns of h2v2_fancy_merged_row and returns how many it did.
+   */
+  JMETHOD(JDIMENSION, merged_row, (JSAMPROW inptr00, JSAMPROW inptr01,
+				   JSAMPROW inptr1, JSAMPROW inptr2,
+				   JSAMPROW outptr0, JSAMPROW outptr1,
+				   JDIMENSION num_cols, int layout));
+  JMETHOD(JDIMENSION, fancy_row, (JSAMPROW inptr0, JSAMPROW inptr1[2],
+				  JSAMPROW inptr2[2], JSAMPROW outptr,
+				  JDIMENSION num_cols, int layout));
+  int simd_layout;		/* JSIMD_RGB etc. for the above */
+#endif
+
   /* For 2:1 vertical sampling, we produce two output rows at a time.
    * We need a "spare" row buffer to hold the second output row if the
    * application provides just a one-row buffer; we also use the spare
@@ -218,6 +250,242 @@ merged_1v_upsample (j_decompress_ptr cinfo,
  */
 
 
+#ifdef SIMD_RGB_SUPPORTED
+
+/*
+ * SIMD versions of the inner loops.  The chroma terms are computed exactly
+ * as the tables hold them (see JSIMD_YCC_TERMS_SSE2 in jsimd.h), and for
+ * the fancy case the upsampled chroma exactly as h2v2_fancy_upsample does;
+ * the saturating pack to bytes then does what range_limit[] does.
+ */
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+merged_row_sse2 (JSAMPROW inptr00, JSAMPROW inptr01,
+		 JSAMPROW inptr1, JSAMPROW inptr2,
+		 JSAMPROW outptr0, JSAMPROW outptr1, JDIMENSION num_cols,
+		 int layout)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i center = _mm_set1_epi16(CENTERJSAMPLE);
+  __m128i y, yw, xb, xr, rt, gt, bt, term[3][2], c[3];
+  JDIMENSION col;
+  int pixelsize = JSIMD_LAYOUT_PIXELSIZE(layout);
+  int h;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    xb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					   (inptr1 + col / 2)), zero), center);
+    xr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					   (inptr2 + col / 2)), zero), center);
+    JSIMD_YCC_TERMS_SSE2(xb, xr, rt, gt, bt);
+    /* Each chroma term serves two adjacent pixels */
+    term[0][0] = _mm_unpacklo_epi16(rt, rt);
+    term[0][1] = _mm_unpackhi_epi16(rt, rt);
+    term[1][0] = _mm_unpacklo_epi16(gt, gt);
+    term[1][1] = _mm_unpackhi_epi16(gt, gt);
+    term[2][0] = _mm_unpacklo_epi16(bt, bt);
+    term[2][1] = _mm_unpackhi_epi16(bt, bt);
+    y = _mm_loadu_si128((const __m128i *) (inptr00 + col));
+    for (h = 0; h < 3; h++) {
+      yw = _mm_unpacklo_epi8(y, zero);
+      c[h] = _mm_packus_epi16(_mm_add_epi16(yw, term[h][0]),
+			      _mm_add_epi16(_mm_unpackhi_epi8(y, zero),
+					    term[h][1]));
+    }
+    JSIMD_STORE_RGB_SSE2(outptr0 + col * pixelsize, layout, c[0], c[1], c[2]);
+    if (inptr01 != NULL) {
+      y = _mm_loadu_si128((const __m128i *) (inptr01 + col));
+      for (h = 0; h < 3; h++) {
+	yw = _mm_unpacklo_epi8(y, zero);
+	c[h] = _mm_packus_epi16(_mm_add_epi16(yw, term[h][0]),
+				_mm_add_epi16(_mm_unpackhi_epi8(y, zero),
+					      term[h][1]));
+      }
+      JSIMD_STORE_RGB_SSE2(outptr1 + col * pixelsize, layout,
+			   c[0], c[1], c[2]);
+    }
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+merged_row_avx2 (JSAMPROW inptr00, JSAMPROW inptr01,
+		 JSAMPROW inptr1, JSAMPROW inptr2,
+		 JSAMPROW outptr0, JSAMPROW outptr1, JDIMENSION num_cols,
+		 int layout)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i center = _mm256_set1_epi16(CENTERJSAMPLE);
+  __m256i y, yw, xb, xr, rt, gt, bt, term[3][2], c[3];
+  JDIMENSION col;
+  int pixelsize = JSIMD_LAYOUT_PIXELSIZE(layout);
+  int h;
+
+  /* The chroma is widened in order, so the in-lane unpacks pair each term
+   * with the same pixels as the in-lane unpacks of the Y samples do, and
+   * the pack puts those back in order.
+   */
+  for (col = 0; col + 32 <= num_cols; col += 32) {
+    xb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(
+			    (const __m128i *) (inptr1 + col / 2))), center);
+    xr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(
+			    (const __m128i *) (inptr2 + col / 2))), center);
+    JSIMD_YCC_TERMS_AVX2(xb, xr, rt, gt, bt);
+    term[0][0] = _mm256_unpacklo_epi16(rt, rt);
+    term[0][1] = _mm256_unpackhi_epi16(rt, rt);
+    term[1][0] = _mm256_unpacklo_epi16(gt, gt);
+    term[1][1] = _mm256_unpackhi_epi16(gt, gt);
+    term[2][0] = _mm256_unpacklo_epi16(bt, bt);
+    term[2][1] = _mm256_unpackhi_epi16(bt, bt);
+    y = _mm256_loadu_si256((const __m256i *) (inptr00 + col));
+    for (h = 0; h < 3; h++) {
+      yw = _mm256_unpacklo_epi8(y, zero);
+      c[h] = _mm256_packus_epi16(_mm256_add_epi16(yw, term[h][0]),
+				 _mm256_add_epi16(_mm256_unpackhi_epi8(y, zero),
+						  term[h][1]));
+    }
+    JSIMD_STORE_RGB_AVX2(outptr0 + col * pixelsize, layout, c[0], c[1], c[2]);
+    if (inptr01 != NULL) {
+      y = _mm256_loadu_si256((const __m256i *) (inptr01 + col));
+      for (h = 0; h < 3; h++) {
+	yw = _mm256_unpacklo_epi8(y, zero);
+	c[h] = _mm256_packus_epi16(_mm256_add_epi16(yw, term[h][0]),
+			_mm256_add_epi16(_mm256_unpackhi_epi8(y, zero),
+					 term[h][1]));
+      }
+      JSIMD_STORE_RGB_AVX2(outptr1 + col * pixelsize, layout,
+			   c[0], c[1], c[2]);
+    }
+  }
+  return col;
+}
+
+/* For fancy_row: given the nearer and further chroma rows (row[0], row[1])
+ * at the first of the columns wanted, compute the upsampled chroma of the
+ * even and odd output pixels less CENTERJSAMPLE (colsums as in jdsample.c).
+ */
+
+#define FANCY_CHROMA_SSE2(row,col,even,odd)  { \
+    __m128i s_[3], t_; int i_; \
+    for (i_ = 0; i_ < 3; i_++) { \
+      t_ = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) \
+			       (row[0] + (col) + i_ - 1)), zero); \
+      s_[i_] = _mm_add_epi16(_mm_add_epi16(t_, _mm_add_epi16(t_, t_)), \
+		 _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) \
+				     (row[1] + (col) + i_ - 1)), zero)); \
+    } \
+    t_ = _mm_add_epi16(s_[1], _mm_add_epi16(s_[1], s_[1])); \
+    even = _mm_sub_epi16(_mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t_, \
+		s_[0]), _mm_set1_epi16(8)), 4), center); \
+    odd = _mm_sub_epi16(_mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t_, \
+		s_[2]), _mm_set1_epi16(7)), 4), center); }
+
+#define FANCY_CHROMA_AVX2(row,col,even,odd)  { \
+    __m256i s_[3], t_; int i_; \
+    for (i_ = 0; i_ < 3; i_++) { \
+      t_ = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) \
+				  (row[0] + (col) + i_ - 1))); \
+      s_[i_] = _mm256_add_epi16(_mm256_add_epi16(t_, \
+				  _mm256_add_epi16(t_, t_)), \
+		 _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) \
+					(row[1] + (col) + i_ - 1)))); \
+    } \
+    t_ = _mm256_add_epi16(s_[1], _mm256_add_epi16(s_[1], s_[1])); \
+    even = _mm256_sub_epi16(_mm256_srli_epi16(_mm256_add_epi16( \
+		_mm256_add_epi16(t_, s_[0]), _mm256_set1_epi16(8)), 4), center); \
+    odd = _mm256_sub_epi16(_mm256_srli_epi16(_mm256_add_epi16( \
+		_mm256_add_epi16(t_, s_[2]), _mm256_set1_epi16(7)), 4), center); }
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+fancy_row_sse2 (JSAMPROW inptr0, JSAMPROW inptr1[2], JSAMPROW inptr2[2],
+		JSAMPROW outptr, JDIMENSION num_cols, int layout)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i center = _mm_set1_epi16(CENTERJSAMPLE);
+  __m128i y, yw, be, bo, re, ro, xb, xr, rt, gt, bt;
+  __m128i r[2], g[2], b[2], c[3];
+  JDIMENSION col;
+  int pixelsize = JSIMD_LAYOUT_PIXELSIZE(layout);
+  int h;
+
+  for (col = 0; col + 8 <= num_cols; col += 8) {
+    FANCY_CHROMA_SSE2(inptr1, col, be, bo);
+    FANCY_CHROMA_SSE2(inptr2, col, re, ro);
+    y = _mm_loadu_si128((const __m128i *) (inptr0 + 2 * col));
+    for (h = 0; h < 2; h++) {
+      if (h == 0) {
+	yw = _mm_unpacklo_epi8(y, zero);
+	xb = _mm_unpacklo_epi16(be, bo);
+	xr = _mm_unpacklo_epi16(re, ro);
+      } else {
+	yw = _mm_unpackhi_epi8(y, zero);
+	xb = _mm_unpackhi_epi16(be, bo);
+	xr = _mm_unpackhi_epi16(re, ro);
+      }
+      JSIMD_YCC_TERMS_SSE2(xb, xr, rt, gt, bt);
+      r[h] = _mm_add_epi16(yw, rt);
+      g[h] = _mm_add_epi16(yw, gt);
+      b[h] = _mm_add_epi16(yw, bt);
+    }
+    c[0] = _mm_packus_epi16(r[0], r[1]);
+    c[1] = _mm_packus_epi16(g[0], g[1]);
+    c[2] = _mm_packus_epi16(b[0], b[1]);
+    JSIMD_STORE_RGB_SSE2(outptr + 2 * col * pixelsize, layout,
+			 c[0], c[1], c[2]);
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+fancy_row_avx2 (JSAMPROW inptr0, JSAMPROW inptr1[2], JSAMPROW inptr2[2],
+		JSAMPROW outptr, JDIMENSION num_cols, int layout)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i center = _mm256_set1_epi16(CENTERJSAMPLE);
+  __m256i y, yw, be, bo, re, ro, xb, xr, rt, gt, bt;
+  __m256i r[2], g[2], b[2], c[3];
+  JDIMENSION col;
+  int pixelsize = JSIMD_LAYOUT_PIXELSIZE(layout);
+  int h;
+
+  /* As in merged_row_avx2, the in-lane unpacks of the even and odd chroma
+   * and of the Y samples pair up the same pixels.
+   */
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    FANCY_CHROMA_AVX2(inptr1, col, be, bo);
+    FANCY_CHROMA_AVX2(inptr2, col, re, ro);
+    y = _mm256_loadu_si256((const __m256i *) (inptr0 + 2 * col));
+    for (h = 0; h < 2; h++) {
+      if (h == 0) {
+	yw = _mm256_unpacklo_epi8(y, zero);
+	xb = _mm256_unpacklo_epi16(be, bo);
+	xr = _mm256_unpacklo_epi16(re, ro);
+      } else {
+	yw = _mm256_unpackhi_epi8(y, zero);
+	xb = _mm256_unpackhi_epi16(be, bo);
+	xr = _mm256_unpackhi_epi16(re, ro);
+      }
+      JSIMD_YCC_TERMS_AVX2(xb, xr, rt, gt, bt);
+      r[h] = _mm256_add_epi16(yw, rt);
+      g[h] = _mm256_add_epi16(yw, gt);
+      b[h] = _mm256_add_epi16(yw, bt);
+    }
+    c[0] = _mm256_packus_epi16(r[0], r[1]);
+    c[1] = _mm256_packus_epi16(g[0], g[1]);
+    c[2] = _mm256_packus_epi16(b[0], b[1]);
+    JSIMD_STORE_RGB_AVX2(outptr + 2 * col * pixelsize, layout,
+			 c[0], c[1], c[2]);
+  }
+  return col;
+}
+
+#endif /* SIMD_RGB_SUPPORTED */
+
+
 /*
  * Upsample and color convert for the case of 2:1 horizontal and 1:1 vertical.
  */
@@ -232,21 +500,37 @@ h2v1_merged_upsample (j_decompress_ptr cinfo,
   int cb, cr;
   register JSAMPROW outptr;
   JSAMPROW inptr0, inptr1, inptr2;
-  JDIMENSION col;
+  JDIMENSION col, done;
   /* copy these pointers into registers if possible */
   register JSAMPLE * range_limit = cinfo->sample_range_limit;
   int * Crrtab = upsample->Cr_r_tab;
   int * Cbbtab = upsample->Cb_b_tab;
   INT32 * Crgtab = upsample->Cr_g_tab;
   INT32 * Cbgtab = upsample->Cb_g_tab;
+  int rred = upsample->rgb_red, rgreen = upsample->rgb_green;
+  int rblue = upsample->rgb_blue, ralpha = upsample->rgb_alpha;
+  int rsize = upsample->rgb_pixelsize;
   SHIFT_TEMPS
 
   inptr0 = input_buf[0][in_row_group_ctr];
   inptr1 = input_buf[1][in_row_group_ctr];
   inptr2 = input_buf[2][in_row_group_ctr];
   outptr = output_buf[0];
+  done = 0;
+#ifdef SIMD_RGB_SUPPORTED
+  if (upsample->merged_row != NULL) {
+    /* This does an even number of output columns */
+    done = (*upsample->merged_row) (inptr0, (JSAMPROW) NULL, inptr1, inptr2,
+				    outptr, (JSAMPROW) NULL,
+				    cinfo->output_width, upsample->simd_layout);
+    inptr0 += done;
+    inptr1 += done >> 1;
+    inptr2 += done >> 1;
+    outptr += done * rsize;
+  }
+#endif
   /* Loop for each pair of output pixels */
-  for (col = cinfo->output_width >> 1; col > 0; col--) {
+  for (col = (cinfo->output_width - done) >> 1; col > 0; col--) {
     /* Do the chroma part of the calculation */
     cb = GETJSAMPLE(*inptr1++);
     cr = GETJSAMPLE(*inptr2++);
@@ -255,15 +539,17 @@ h2v1_merged_upsample (j_decompress_ptr cinfo,
     cblue = Cbbtab[cb];
     /* Fetch 2 Y values and emit 2 pixels */
     y  = GETJSAMPLE(*inptr0++);
-    outptr[RGB_RED] =   range_limit[y + cred];
-    outptr[RGB_GREEN] = range_limit[y + cgreen];
-    outptr[RGB_BLUE] =  range_limit[y + cblue];
-    outptr += RGB_PIXELSIZE;
+    outptr[ralpha] = MAXJSAMPLE;
+    outptr[rred] =   range_limit[y + cred];
+    outptr[rgreen] = range_limit[y + cgreen];
+    outptr[rblue] =  range_limit[y + cblue];
+    outptr += rsize;
     y  = GETJSAMPLE(*inptr0++);
-    outptr[RGB_RED] =   range_limit[y + cred];
-    outptr[RGB_GREEN] = range_limit[y + cgreen];
-    outptr[RGB_BLUE] =  range_limit[y + cblue];
-    outptr += RGB_PIXELSIZE;
+    outptr[ralpha] = MAXJSAMPLE;
+    outptr[rred] =   range_limit[y + cred];
+    outptr[rgreen] = range_limit[y + cgreen];
+    outptr[rblue] =  range_limit[y + cblue];
+    outptr += rsize;
   }
   /* If image width is odd, do the last output column separately */
   if (cinfo->output_width & 1) {
@@ -273,9 +559,10 @@ h2v1_merged_upsample (j_decompress_ptr cinfo,
     cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
     cblue = Cbbtab[cb];
     y  = GETJSAMPLE(*inptr0);
-    outptr[RGB_RED] =   range_limit[y + cred];
-    outptr[RGB_GREEN] = range_limit[y + cgreen];
-    outptr[RGB_BLUE] =  range_limit[y + cblue];
+    outptr[ralpha] = MAXJSAMPLE;
+    outptr[rred] =   range_limit[y + cred];
+    outptr[rgreen] = range_limit[y + cgreen];
+    outptr[rblue] =  range_limit[y + cblue];
   }
 }
 
@@ -294,13 +581,16 @@ h2v2_merged_upsample (j_decompress_ptr cinfo,
   int cb, cr;
   register JSAMPROW outptr0, outptr1;
   JSAMPROW inptr00, inptr01, inptr1, inptr2;
-  JDIMENSION col;
+  JDIMENSION col, done;
   /* copy these pointers into registers if possible */
   register JSAMPLE * range_limit = cinfo->sample_range_limit;
   int * Crrtab = upsample->Cr_r_tab;
   int * Cbbtab = upsample->Cb_b_tab;
   INT32 * Crgtab = upsample->Cr_g_tab;
   INT32 * Cbgtab = upsample->Cb_g_tab;
+  int rred = upsample->rgb_red, rgreen = upsample->rgb_green;
+  int rblue = upsample->rgb_blue, ralpha = upsample->rgb_alpha;
+  int rsize = upsample->rgb_pixelsize;
   SHIFT_TEMPS
 
   inptr00 = input_buf[0][in_row_group_ctr*2];
@@ -309,8 +599,23 @@ h2v2_merged_upsample (j_decompress_ptr cinfo,
   inptr2 = input_buf[2][in_row_group_ctr];
   outptr0 = output_buf[0];
   outptr1 = output_buf[1];
+  done = 0;
+#ifdef SIMD_RGB_SUPPORTED
+  if (upsample->merged_row != NULL) {
+    /* This does an even number of output columns */
+    done = (*upsample->merged_row) (inptr00, inptr01, inptr1, inptr2,
+				    outptr0, outptr1, cinfo->output_width,
+				    upsample->simd_layout);
+    inptr00 += done;
+    inptr01 += done;
+    inptr1 += done >> 1;
+    inptr2 += done >> 1;
+    outptr0 += done * rsize;
+    outptr1 += done * rsize;
+  }
+#endif
   /* Loop for each group of output pixels */
-  for (col = cinfo->output_width >> 1; col > 0; col--) {
+  for (col = (cinfo->output_width - done) >> 1; col > 0; col--) {
     /* Do the chroma part of the calculation */
     cb = GETJSAMPLE(*inptr1++);
     cr = GETJSAMPLE(*inptr2++);
@@ -319,25 +624,29 @@ h2v2_merged_upsample (j_decompress_ptr cinfo,
     cblue = Cbbtab[cb];
     /* Fetch 4 Y values and emit 4 pixels */
     y  = GETJSAMPLE(*inptr00++);
-    outptr0[RGB_RED] =   range_limit[y + cred];
-    outptr0[RGB_GREEN] = range_limit[y + cgreen];
-    outptr0[RGB_BLUE] =  range_limit[y + cblue];
-    outptr0 += RGB_PIXELSIZE;
+    outptr0[ralpha] = MAXJSAMPLE;
+    outptr0[rred] =   range_limit[y + cred];
+    outptr0[rgreen] = range_limit[y + cgreen];
+    outptr0[rblue] =  range_limit[y + cblue];
+    outptr0 += rsize;
     y  = GETJSAMPLE(*inptr00++);
-    outptr0[RGB_RED] =   range_limit[y + cred];
-    outptr0[RGB_GREEN] = range_limit[y + cgreen];
-    outptr0[RGB_BLUE] =  range_limit[y + cblue];
-    outptr0 += RGB_PIXELSIZE;
+    outptr0[ralpha] = MAXJSAMPLE;
+    outptr0[rred] =   range_limit[y + cred];
+    outptr0[rgreen] = range_limit[y + cgreen];
+    outptr0[rblue] =  range_limit[y + cblue];
+    outptr0 += rsize;
     y  = GETJSAMPLE(*inptr01++);
-    outptr1[RGB_RED] =   range_limit[y + cred];
-    outptr1[RGB_GREEN] = range_limit[y + cgreen];
-    outptr1[RGB_BLUE] =  range_limit[y + cblue];
-    outptr1 += RGB_PIXELSIZE;
+    outptr1[ralpha] = MAXJSAMPLE;
+    outptr1[rred] =   range_limit[y + cred];
+    outptr1[rgreen] = range_limit[y + cgreen];
+    outptr1[rblue] =  range_limit[y + cblue];
+    outptr1 += rsize;
     y  = GETJSAMPLE(*inptr01++);
-    outptr1[RGB_RED] =   range_limit[y + cred];
-    outptr1[RGB_GREEN] = range_limit[y + cgreen];
-    outptr1[RGB_BLUE] =  range_limit[y + cblue];
-    outptr1 += RGB_PIXELSIZE;
+    outptr1[ralpha] = MAXJSAMPLE;
+    outptr1[rred] =   range_limit[y + cred];
+    outptr1[rgreen] = range_limit[y + cgreen];
+    outptr1[rblue] =  range_limit[y + cblue];
+    outptr1 += rsize;
   }
   /* If image width is odd, do the last output column separately */
   if (cinfo->output_width & 1) {
@@ -347,13 +656,155 @@ h2v2_merged_upsample (j_decompress_ptr cinfo,
     cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
     cblue = Cbbtab[cb];
     y  = GETJSAMPLE(*inptr00);
-    outptr0[RGB_RED] =   range_limit[y + cred];
-    outptr0[RGB_GREEN] = range_limit[y + cgreen];
-    outptr0[RGB_BLUE] =  range_limit[y + cblue];
+    outptr0[ralpha] = MAXJSAMPLE;
+    outptr0[rred] =   range_limit[y + cred];
+    outptr0[rgreen] = range_limit[y + cgreen];
+    outptr0[rblue] =  range_limit[y + cblue];
     y  = GETJSAMPLE(*inptr01);
-    outptr1[RGB_RED] =   range_limit[y + cred];
-    outptr1[RGB_GREEN] = range_limit[y + cgreen];
-    outptr1[RGB_BLUE] =  range_limit[y + cblue];
+    outptr1[ralpha] = MAXJSAMPLE;
+    outptr1[rred] =   range_limit[y + cred];
+    outptr1[rgreen] = range_limit[y + cgreen];
+    outptr1[rblue] =  range_limit[y + cblue];
+  }
+}
+
+
+/*
+ * Fancy upsample and color convert one output row for the case of 2:1
+ * horizontal and 2:1 vertical.  inptr1[0] and inptr2[0] point to the
+ * nearest chroma rows, inptr1[1] and inptr2[1] to the next nearest.
+ * The chroma arithmetic is that of h2v2_fancy_upsample in jdsample.c,
+ * including its special cases for the first and last columns.
+ */
+
+LOCAL(void)
+h2v2_fancy_merged_row (j_decompress_ptr cinfo, JSAMPROW inptr0,
+		       JSAMPROW inptr1[2], JSAMPROW inptr2[2],
+		       JSAMPROW outptr)
+{
+  my_upsample_ptr upsample = (my_upsample_ptr) cinfo->upsample;
+  register int y, cred, cgreen, cblue;
+  int cb, cr;
+#if BITS_IN_JSAMPLE == 8
+  int thiscb, lastcb, nextcb, thiscr, lastcr, nextcr;
+#else
+  INT32 thiscb, lastcb, nextcb, thiscr, lastcr, nextcr;
+#endif
+  JDIMENSION col, num_cols;
+#ifdef SIMD_RGB_SUPPORTED
+  JSAMPROW simdptr1[2], simdptr2[2];
+  JDIMENSION done;
+#endif
+  /* copy these pointers into registers if possible */
+  register JSAMPLE * range_limit = cinfo->sample_range_limit;
+  int * Crrtab = upsample->Cr_r_tab;
+  int * Cbbtab = upsample->Cb_b_tab;
+  INT32 * Crgtab = upsample->Cr_g_tab;
+  INT32 * Cbgtab = upsample->Cb_g_tab;
+  int rred = upsample->rgb_red, rgreen = upsample->rgb_green;
+  int rblue = upsample->rgb_blue, ralpha = upsample->rgb_alpha;
+  int rsize = upsample->rgb_pixelsize;
+  SHIFT_TEMPS
+
+#define COLSUM(inptr,col)  \
+  (GETJSAMPLE(inptr[0][col]) * 3 + GETJSAMPLE(inptr[1][col]))
+
+  num_cols = cinfo->comp_info[1].downsampled_width;
+  /* The first column is its own left neighbor */
+  thiscb = lastcb = COLSUM(inptr1, 0);
+  thiscr = lastcr = COLSUM(inptr2, 0);
+  for (col = 0; col < num_cols; col++) {
+    /* and the last column its own right neighbor */
+    if (col + 1 < num_cols) {
+      nextcb = COLSUM(inptr1, col + 1);
+      nextcr = COLSUM(inptr2, col + 1);
+    } else {
+      nextcb = thiscb;
+      nextcr = thiscr;
+    }
+    /* Left output pixel: 3/4 * this column + 1/4 * the one to the left */
+    cb = (int) ((thiscb * 3 + lastcb + 8) >> 4);
+    cr = (int) ((thiscr * 3 + lastcr + 8) >> 4);
+    cred = Crrtab[cr];
+    cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+    cblue = Cbbtab[cb];
+    y  = GETJSAMPLE(*inptr0++);
+    outptr[ralpha] = MAXJSAMPLE;
+    outptr[rred] =   range_limit[y + cred];
+    outptr[rgreen] = range_limit[y + cgreen];
+    outptr[rblue] =  range_limit[y + cblue];
+    outptr += rsize;
+    /* Right output pixel, unless the image width is odd and this is the
+     * last column
+     */
+    if (col * 2 + 1 < cinfo->output_width) {
+      cb = (int) ((thiscb * 3 + nextcb + 7) >> 4);
+      cr = (int) ((thiscr * 3 + nextcr + 7) >> 4);
+      cred = Crrtab[cr];
+      cgreen = (int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS);
+      cblue = Cbbtab[cb];
+      y  = GETJSAMPLE(*inptr0++);
+      outptr[ralpha] = MAXJSAMPLE;
+      outptr[rred] =   range_limit[y + cred];
+      outptr[rgreen] = range_limit[y + cgreen];
+      outptr[rblue] =  range_limit[y + cblue];
+      outptr += rsize;
+    }
+    lastcb = thiscb; thiscb = nextcb;
+    lastcr = thiscr; thiscr = nextcr;
+#ifdef SIMD_RGB_SUPPORTED
+    if (col == 0 && upsample->fancy_row != NULL) {
+      /* Do the general-case columns that we can with SIMD code */
+      simdptr1[0] = inptr1[0] + 1;  simdptr1[1] = inptr1[1] + 1;
+      simdptr2[0] = inptr2[0] + 1;  simdptr2[1] = inptr2[1] + 1;
+      done = (*upsample->fancy_row) (inptr0, simdptr1, simdptr2, outptr,
+				     num_cols - 2, upsample->simd_layout);
+      if (done > 0) {
+	col += done;
+	inptr0 += 2 * done;
+	outptr += 2 * done * rsize;
+	lastcb = COLSUM(inptr1, col);
+	thiscb = COLSUM(inptr1, col + 1);
+	lastcr = COLSUM(inptr2, col);
+	thiscr = COLSUM(inptr2, col + 1);
+      }
+    }
+#endif
+  }
+}
+
+
+/*
+ * Fancy upsample and color convert for the case of 2:1 horizontal and
+ * 2:1 vertical.
+ *
+ * It is OK for us to reference the adjacent input rows because we demanded
+ * context from the main buffer controller (see initialization code).
+ */
+
+METHODDEF(void)
+h2v2_fancy_merged_upsample (j_decompress_ptr cinfo,
+			    JSAMPIMAGE input_buf, JDIMENSION in_row_group_ctr,
+			    JSAMPARRAY output_buf)
+{
+  JSAMPARRAY input_data1 = input_buf[1] + in_row_group_ctr;
+  JSAMPARRAY input_data2 = input_buf[2] + in_row_group_ctr;
+  JSAMPROW inptr1[2], inptr2[2];
+  int v;
+
+  /* inptrN[0] points to nearest input row, inptrN[1] to next nearest */
+  inptr1[0] = input_data1[0];
+  inptr2[0] = input_data2[0];
+  for (v = 0; v < 2; v++) {
+    if (v == 0) {		/* next nearest is row above */
+      inptr1[1] = input_data1[-1];
+      inptr2[1] = input_data2[-1];
+    } else {			/* next nearest is row below */
+      inptr1[1] = input_data1[1];
+      inptr2[1] = input_data2[1];
+    }
+    h2v2_fancy_merged_row(cinfo, input_buf[0][in_row_group_ctr*2 + v],
+			  inptr1, inptr2, output_buf[v]);
   }
 }
 
@@ -370,6 +821,9 @@ GLOBAL(void)
 jinit_merged_upsampler (j_decompress_ptr cinfo)
 {
   my_upsample_ptr upsample;
+#ifdef SIMD_RGB_SUPPORTED
+  int simd;
+#endif
 
   upsample = (my_upsample_ptr)
     (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
@@ -382,7 +836,11 @@ jinit_merged_upsampler (j_decompress_ptr cinfo)
 
   if (cinfo->max_v_samp_factor == 2) {
     upsample->pub.upsample = merged_2v_upsample;
-    upsample->upmethod = h2v2_merged_upsample;
+    if (cinfo->do_fancy_upsampling) {
+      upsample->upmethod = h2v2_fancy_merged_upsample;
+      upsample->pub.need_context_rows = TRUE;
+    } else
+      upsample->upmethod = h2v2_merged_upsample;
     /* Allocate a spare row buffer */
     upsample->spare_row = (JSAMPROW)
       (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
@@ -395,6 +853,78 @@ jinit_merged_upsampler (j_decompress_ptr cinfo)
   }
 
   build_ycc_rgb_table(cinfo);
+
+  /* Set the pixel layout */
+  switch (cinfo->out_color_space) {
+  case JCS_EXT_RGBX:
+  case JCS_EXT_RGBA:
+    upsample->rgb_red = 0;
+    upsample->rgb_green = 1;
+    upsample->rgb_blue = 2;
+    upsample->rgb_alpha = 3;
+    upsample->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_BGRX:
+  case JCS_EXT_BGRA:
+    upsample->rgb_red = 2;
+    upsample->rgb_green = 1;
+    upsample->rgb_blue = 0;
+    upsample->rgb_alpha = 3;
+    upsample->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_XRGB:
+  case JCS_EXT_ARGB:
+    upsample->rgb_red = 1;
+    upsample->rgb_green = 2;
+    upsample->rgb_blue = 3;
+    upsample->rgb_alpha = 0;
+    upsample->rgb_pixelsize = 4;
+    break;
+  case JCS_EXT_XBGR:
+  case JCS_EXT_ABGR:
+    upsample->rgb_red = 3;
+    upsample->rgb_green = 2;
+    upsample->rgb_blue = 1;
+    upsample->rgb_alpha = 0;
+    upsample->rgb_pixelsize = 4;
+    break;
+  default:
+    upsample->rgb_red = RGB_RED;
+    upsample->rgb_green = RGB_GREEN;
+    upsample->rgb_blue = RGB_BLUE;
+    upsample->rgb_alpha = RGB_RED;
+    upsample->rgb_pixelsize = RGB_PIXELSIZE;
+    break;
+  }
+
+#ifdef SIMD_RGB_SUPPORTED
+  /* Use SIMD row converters if the CPU has them and they know the layout;
+   * their output is identical.
+   */
+  simd = jsimd_cpu_support();
+  upsample->simd_layout = -1;
+  if (upsample->rgb_green == 1) {
+    if (upsample->rgb_pixelsize == 3)
+      upsample->simd_layout = upsample->rgb_red ? JSIMD_BGR : JSIMD_RGB;
+    else if (upsample->rgb_pixelsize == 4 && upsample->rgb_alpha == 3)
+      upsample->simd_layout = upsample->rgb_red ? JSIMD_BGRX : JSIMD_RGBX;
+  } else if (upsample->rgb_green == 2 && upsample->rgb_pixelsize == 4 &&
+	     upsample->rgb_alpha == 0)
+    upsample->simd_layout = upsample->rgb_red == 3 ? JSIMD_XBGR : JSIMD_XRGB;
+  if (upsample->simd_layout < 0)
+    simd = 0;
+  if (simd & JSIMD_AVX2) {
+    upsample->merged_row = merged_row_avx2;
+    upsample->fancy_row = fancy_row_avx2;
+  } else if (simd & JSIMD_SSE2) {
+    upsample->merged_row = merged_row_sse2;
+    upsample->fancy_row = fancy_row_sse2;
+  } else {
+    upsample->merged_row = NULL;
+    upsample->fancy_row = NULL;
+  }
+  jsimd_note_kernel(JSIMD_K_MERGED_UPSAMPLE, simd);
+#endif
 }
 
 #endif /* UPSAMPLE_MERGING_SUPPORTED */
@@ -18,10 +18,23 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdhuff.h"		/* Declarations shared with jdhuff.c */
+#include "jsimd.h"
 
 
 #ifdef D_PROGRESSIVE_SUPPORTED
 
+/* With AVX2 and a 64-bit long, an AC refinement scan finds the block's
+ * already-nonzero coefficients from a bitmap (bit k for zigzag position k)
+ * made once per block, instead of testing each coefficient as it goes; the
+ * correction bits are then read for the set bits only, and the zero runs are
+ * counted off in the complementary bits.  Building the bitmap a coefficient
+ * at a time costs more than it saves, so other CPUs keep the plain loop.
+ */
+
+#if defined(JSIMD_SUPPORTED) && (defined(_LP64) || defined(__LP64__))
+#define REFINE_NONZERO_MASK
+#endif
+
 /*
  * Expanded entropy decoder object for progressive Huffman decoding.
  *
@@ -82,6 +95,10 @@ METHODDEF(boolean) decode_mcu_DC_refine JPP((j_decompress_ptr cinfo,
 					     JBLOCKROW *MCU_data));
 METHODDEF(boolean) decode_mcu_AC_refine JPP((j_decompress_ptr cinfo,
 					     JBLOCKROW *MCU_data));
+#ifdef REFINE_NONZERO_MASK
+METHODDEF(boolean) decode_mcu_AC_refine_avx2 JPP((j_decompress_ptr cinfo,
+						  JBLOCKROW *MCU_data));
+#endif
 
 
 /*
@@ -154,8 +171,15 @@ start_pass_phuff_decoder (j_decompress_ptr cinfo)
   } else {
     if (is_DC_band)
       entropy->pub.decode_mcu = decode_mcu_DC_refine;
-    else
+    else {
       entropy->pub.decode_mcu = decode_mcu_AC_refine;
+#ifdef REFINE_NONZERO_MASK
+      if (jsimd_cpu_support() & JSIMD_AVX2) {
+	entropy->pub.decode_mcu = decode_mcu_AC_refine_avx2;
+	jsimd_note_kernel(JSIMD_K_HUFF_DECODE, JSIMD_AVX2);
+      }
+#endif
+    }
   }
 
   for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
@@ -288,6 +312,7 @@ decode_mcu_DC_first (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   phuff_entropy_ptr entropy = (phuff_entropy_ptr) cinfo->entropy;
   int Al = cinfo->Al;
   register int s, r;
+  register INT32 e;
   int blkn, ci;
   JBLOCKROW block;
   BITREAD_STATE_VARS;
@@ -322,11 +347,23 @@ decode_mcu_DC_first (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
       /* Decode a single block's worth of coefficients */
 
       /* Section F.2.2.1: decode the DC coefficient difference */
-      HUFF_DECODE(s, br_state, tbl, return FALSE, label1);
-      if (s) {
-	CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	r = GET_BITS(s);
-	s = HUFF_EXTEND(r, s);
+      HUFF_LOOK_VAL(e, br_state, tbl, return FALSE);
+      if (e & LOOK_VAL_FULL) {
+	/* Code and value bits all in the lookahead: one step */
+	DROP_BITS(LOOK_VAL_NBITS(e));
+	s = LOOK_VAL_VALUE(e);
+      } else {
+	if (e) {
+	  DROP_BITS(LOOK_VAL_NBITS(e));
+	  s = LOOK_VAL_SYM(e);
+	} else {
+	  HUFF_DECODE(s, br_state, tbl, return FALSE, label1);
+	}
+	if (s) {
+	  CHECK_BIT_BUFFER(br_state, s, return FALSE);
+	  r = GET_BITS(s);
+	  s = HUFF_EXTEND(r, s);
+	}
       }
 
       /* Convert DC difference to actual value, update last_dc_val */
@@ -360,6 +397,7 @@ decode_mcu_AC_first (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   int Se = cinfo->Se;
   int Al = cinfo->Al;
   register int s, k, r;
+  register INT32 e;
   unsigned int EOBRUN;
   JBLOCKROW block;
   BITREAD_STATE_VARS;
@@ -392,14 +430,24 @@ decode_mcu_AC_first (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
       tbl = entropy->ac_derived_tbl;
 
       for (k = cinfo->Ss; k <= Se; k++) {
-	HUFF_DECODE(s, br_state, tbl, return FALSE, label2);
+	HUFF_LOOK_VAL(e, br_state, tbl, return FALSE);
+	if (e) {
+	  DROP_BITS(LOOK_VAL_NBITS(e));
+	  s = LOOK_VAL_SYM(e);
+	} else {
+	  HUFF_DECODE(s, br_state, tbl, return FALSE, label2);
+	}
 	r = s >> 4;
 	s &= 15;
 	if (s) {
 	  k += r;
-	  CHECK_BIT_BUFFER(br_state, s, return FALSE);
-	  r = GET_BITS(s);
-	  s = HUFF_EXTEND(r, s);
+	  if (e & LOOK_VAL_FULL) {
+	    s = LOOK_VAL_VALUE(e);
+	  } else {
+	    CHECK_BIT_BUFFER(br_state, s, return FALSE);
+	    r = GET_BITS(s);
+	    s = HUFF_EXTEND(r, s);
+	  }
 	  /* Scale and output coefficient in natural (dezigzagged) order */
 	  (*block)[jpeg_natural_order[k]] = (JCOEF) (s << Al);
 	} else {
@@ -633,6 +681,204 @@ undoit:
 }
 
 
+#ifdef REFINE_NONZERO_MASK
+
+/* Build the bitmap of the nonzero coefficients Ss..Se of a block.  With
+ * AVX2 (really SSSE3, for pshufb) the zero flags of the coefficients are
+ * packed to bytes in natural order and gathered into zigzag order by
+ * JSIMD_ZIGZAG_MOVEMASK.
+ */
+
+JSIMD_TARGET("avx2")
+METHODDEF(unsigned long)
+nonzero_mask_avx2 (JCOEFPTR block, int Ss, int Se)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i flags[4];
+  unsigned long mask;
+  int s;
+
+  for (s = 0; s < 4; s++)
+    flags[s] = _mm_packs_epi16(
+	_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) (block + 16*s)),
+			zero),
+	_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) (block + 16*s + 8)),
+			zero));
+  JSIMD_ZIGZAG_MOVEMASK(mask, flags);
+  /* the flags were set for zero coefficients; 2UL << 63 is 0 */
+  return ~mask & ((2UL << Se) - (1UL << Ss));
+}
+
+METHODDEF(boolean)
+decode_mcu_AC_refine_avx2 (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
+{
+  phuff_entropy_ptr entropy = (phuff_entropy_ptr) cinfo->entropy;
+  int Se = cinfo->Se;
+  int p1 = 1 << cinfo->Al;	/* 1 in the bit position being coded */
+  int m1 = (-1) << cinfo->Al;	/* -1 in the bit position being coded */
+  register int s, k, r;
+  unsigned int EOBRUN;
+  JBLOCKROW block;
+  JCOEFPTR thiscoef;
+  BITREAD_STATE_VARS;
+  d_derived_tbl * tbl;
+  unsigned long nonzero;	/* already-nonzero coefs at or after k */
+  unsigned long zeros, corr;
+  unsigned long newnz;		/* natural positions of newly nonzero coefs */
+
+  /* Process restart marker if needed; may have to suspend */
+  if (cinfo->restart_interval) {
+    if (entropy->restarts_to_go == 0)
+      if (! process_restart(cinfo))
+	return FALSE;
+  }
+
+  /* If we've run out of data, don't modify the MCU.
+   */
+  if (! entropy->pub.insufficient_data) {
+
+    /* There is always only one block per MCU */
+    block = MCU_data[0];
+    tbl = entropy->ac_derived_tbl;
+    EOBRUN = entropy->saved.EOBRUN; /* only part of saved state we need */
+
+    /* initialize coefficient loop counter to start of band */
+    k = cinfo->Ss;
+
+    nonzero = nonzero_mask_avx2(*block, k, Se);
+
+    /* Within an EOB run, a block with no nonzero coefficients in the band
+     * has no correction bits, so there is nothing to read.
+     */
+    if (EOBRUN > 0 && nonzero == 0) {
+      entropy->saved.EOBRUN = EOBRUN - 1;
+      entropy->restarts_to_go--;
+      return TRUE;
+    }
+
+    /* Load up working state */
+    BITREAD_LOAD_STATE(cinfo,entropy->bitstate);
+
+    /* If we are forced to suspend, we must undo the assignments to any newly
+     * nonzero coefficients in the block, because otherwise we'd get confused
+     * next time about which coefficients were already nonzero.
+     * But we need not undo addition of bits to already-nonzero coefficients;
+     * instead, we can test the current bit to see if we already did it.
+     */
+    newnz = 0;
+
+    if (EOBRUN == 0) {
+      for (; k <= Se; k++) {
+	HUFF_DECODE(s, br_state, tbl, goto undoit, label3);
+	r = s >> 4;
+	s &= 15;
+	if (s) {
+	  if (s != 1)		/* size of new coef should always be 1 */
+	    WARNMS(cinfo, JWRN_HUFF_BAD_CODE);
+	  CHECK_BIT_BUFFER(br_state, 1, goto undoit);
+	  if (GET_BITS(1))
+	    s = p1;		/* newly nonzero coef is positive */
+	  else
+	    s = m1;		/* newly nonzero coef is negative */
+	} else {
+	  if (r != 15) {
+	    EOBRUN = 1 << r;	/* EOBr, run length is 2^r + appended bits */
+	    if (r) {
+	      CHECK_BIT_BUFFER(br_state, r, goto undoit);
+	      r = GET_BITS(r);
+	      EOBRUN += r;
+	    }
+	    break;		/* rest of block is handled by EOB logic */
+	  }
+	  /* note s = 0 for processing ZRL */
+	}
+	/* Advance over already-nonzero coefs and r still-zero coefs,
+	 * appending correction bits to the nonzeroes.  A correction bit is 1
+	 * if the absolute value of the coefficient must be increased.
+	 * The target zero coefficient is the lowest zero bit left after
+	 * clearing r of them; if there is none, we run to the end of band.
+	 */
+	nonzero &= ~0UL << k;
+	zeros = ~nonzero & (~0UL << k) & ((2UL << Se) - 1);
+	while (r-- > 0 && zeros)
+	  zeros &= zeros - 1;
+	if (zeros) {
+	  corr = nonzero & (zeros ^ (zeros - 1)); /* bits below the target */
+	  k = __builtin_ctzl(zeros);
+	} else {
+	  corr = nonzero;
+	  k = Se + 1;
+	}
+	while (corr) {
+	  thiscoef = *block + jpeg_natural_order[__builtin_ctzl(corr)];
+	  corr &= corr - 1;
+	  CHECK_BIT_BUFFER(br_state, 1, goto undoit);
+	  if (GET_BITS(1)) {
+	    if ((*thiscoef & p1) == 0) { /* do nothing if already set it */
+	      if (*thiscoef >= 0)
+		*thiscoef += p1;
+	      else
+		*thiscoef += m1;
+	    }
+	  }
+	}
+	if (s) {
+	  int pos = jpeg_natural_order[k];
+	  /* Output newly nonzero coefficient */
+	  (*block)[pos] = (JCOEF) s;
+	  /* Remember its position in case we have to suspend */
+	  newnz |= 1UL << pos;
+	}
+      }
+    }
+
+    if (EOBRUN > 0) {
+      /* Scan any remaining coefficient positions after the end-of-band
+       * (the last newly nonzero coefficient, if any).  Append a correction
+       * bit to each already-nonzero coefficient.  A correction bit is 1
+       * if the absolute value of the coefficient must be increased.
+       */
+      corr = (k <= Se) ? nonzero & (~0UL << k) : 0;
+      while (corr) {
+	thiscoef = *block + jpeg_natural_order[__builtin_ctzl(corr)];
+	corr &= corr - 1;
+	CHECK_BIT_BUFFER(br_state, 1, goto undoit);
+	if (GET_BITS(1)) {
+	  if ((*thiscoef & p1) == 0) { /* do nothing if already changed it */
+	    if (*thiscoef >= 0)
+	      *thiscoef += p1;
+	    else
+	      *thiscoef += m1;
+	  }
+	}
+      }
+      /* Count one block completed in EOB run */
+      EOBRUN--;
+    }
+
+    /* Completed MCU, so update state */
+    BITREAD_SAVE_STATE(cinfo,entropy->bitstate);
+    entropy->saved.EOBRUN = EOBRUN; /* only part of saved state we need */
+  }
+
+  /* Account for restart interval (no-op if not using restarts) */
+  entropy->restarts_to_go--;
+
+  return TRUE;
+
+undoit:
+  /* Re-zero any output coefficients that we made newly nonzero */
+  while (newnz) {
+    (*block)[__builtin_ctzl(newnz)] = 0;
+    newnz &= newnz - 1;
+  }
+
+  return FALSE;
+}
+
+#endif /* REFINE_NONZERO_MASK */
+
+
 /*
  * Module initialization routine for progressive Huffman entropy decoding.
  */
@@ -649,6 +895,7 @@ jinit_phuff_decoder (j_decompress_ptr cinfo)
 				SIZEOF(phuff_entropy_decoder));
   cinfo->entropy = (struct jpeg_entropy_decoder *) entropy;
   entropy->pub.start_pass = start_pass_phuff_decoder;
+  entropy->pub.last_index = NULL; /* blocks are not decoded in one call */
 
   /* Mark derived tables unallocated */
   for (i = 0; i < NUM_HUFF_TBLS; i++) {
@@ -21,6 +21,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 
 /* Pointer to routine to upsample a single component */
@@ -56,6 +57,17 @@ typedef struct {
    */
   UINT8 h_expand[MAX_COMPONENTS];
   UINT8 v_expand[MAX_COMPONENTS];
+
+#ifdef JSIMD_SUPPORTED
+  /* SIMD routines doing the leading part of the general-case columns of
+   * the fancy upsamplers, or NULL.  Each returns the number of input
+   * columns it has done.
+   */
+  JMETHOD(JDIMENSION, h2v1_fancy_row, (JSAMPROW inptr, JSAMPROW outptr,
+				       JDIMENSION num_cols));
+  JMETHOD(JDIMENSION, h2v2_fancy_row, (JSAMPROW inptr0, JSAMPROW inptr1,
+				       JSAMPROW outptr, JDIMENSION num_cols));
+#endif
 } my_upsampler;
 
 typedef my_upsampler * my_upsample_ptr;
@@ -285,6 +297,141 @@ h2v2_upsample (j_decompress_ptr cinfo, jpeg_component_info * compptr,
 }
 
 
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SIMD versions of the general-case loops of the fancy upsamplers below.
+ * They are given pointers to input column 1 and the number of general-case
+ * columns, and read one column on either side of those they do.  The even
+ * and odd outputs are computed in 16-bit lanes and interleaved by the
+ * unpacks; the colsums of the h2v2 case are at most 4*MAXJSAMPLE, so even
+ * 3*thiscolsum + lastcolsum + 8 fits.
+ */
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+h2v1_fancy_row_sse2 (JSAMPROW inptr, JSAMPROW outptr, JDIMENSION num_cols)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(1), two = _mm_set1_epi16(2);
+  __m128i last, cur, next, even, odd;
+  JDIMENSION col;
+
+  for (col = 0; col + 8 <= num_cols; col += 8) {
+    last = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					      (inptr + col - 1)), zero);
+    cur = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					     (inptr + col)), zero);
+    next = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					      (inptr + col + 1)), zero);
+    cur = _mm_add_epi16(cur, _mm_add_epi16(cur, cur));
+    even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(cur, last), one), 2);
+    odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(cur, next), two), 2);
+    _mm_storeu_si128((__m128i *) (outptr + 2 * col),
+		     _mm_packus_epi16(_mm_unpacklo_epi16(even, odd),
+				      _mm_unpackhi_epi16(even, odd)));
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+h2v1_fancy_row_avx2 (JSAMPROW inptr, JSAMPROW outptr, JDIMENSION num_cols)
+{
+  const __m256i one = _mm256_set1_epi16(1), two = _mm256_set1_epi16(2);
+  __m256i last, cur, next, even, odd;
+  JDIMENSION col;
+
+  /* Widening keeps the columns in order across the two 128-bit lanes, and
+   * the in-lane unpacks and pack then put the outputs back in order.
+   */
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    last = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+						 (inptr + col - 1)));
+    cur = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+						(inptr + col)));
+    next = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+						 (inptr + col + 1)));
+    cur = _mm256_add_epi16(cur, _mm256_add_epi16(cur, cur));
+    even = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(cur, last),
+					      one), 2);
+    odd = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(cur, next),
+					     two), 2);
+    _mm256_storeu_si256((__m256i *) (outptr + 2 * col),
+			_mm256_packus_epi16(_mm256_unpacklo_epi16(even, odd),
+					    _mm256_unpackhi_epi16(even, odd)));
+  }
+  return col;
+}
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+h2v2_fancy_row_sse2 (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW outptr,
+		     JDIMENSION num_cols)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i seven = _mm_set1_epi16(7), eight = _mm_set1_epi16(8);
+  __m128i colsum[3], cur, even, odd;
+  JDIMENSION col;
+  int i;
+
+  for (col = 0; col + 8 <= num_cols; col += 8) {
+    for (i = 0; i < 3; i++) {	/* last, this and next colsums */
+      cur = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					       (inptr0 + col + i - 1)), zero);
+      colsum[i] = _mm_add_epi16(_mm_add_epi16(cur, _mm_add_epi16(cur, cur)),
+		    _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)
+					(inptr1 + col + i - 1)), zero));
+    }
+    cur = _mm_add_epi16(colsum[1], _mm_add_epi16(colsum[1], colsum[1]));
+    even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(cur, colsum[0]),
+					eight), 4);
+    odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(cur, colsum[2]),
+				       seven), 4);
+    _mm_storeu_si128((__m128i *) (outptr + 2 * col),
+		     _mm_packus_epi16(_mm_unpacklo_epi16(even, odd),
+				      _mm_unpackhi_epi16(even, odd)));
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+h2v2_fancy_row_avx2 (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW outptr,
+		     JDIMENSION num_cols)
+{
+  const __m256i seven = _mm256_set1_epi16(7), eight = _mm256_set1_epi16(8);
+  __m256i colsum[3], cur, even, odd;
+  JDIMENSION col;
+  int i;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    for (i = 0; i < 3; i++) {	/* last, this and next colsums */
+      cur = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+						  (inptr0 + col + i - 1)));
+      colsum[i] = _mm256_add_epi16(_mm256_add_epi16(cur,
+				     _mm256_add_epi16(cur, cur)),
+		    _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+					   (inptr1 + col + i - 1))));
+    }
+    cur = _mm256_add_epi16(colsum[1],
+			   _mm256_add_epi16(colsum[1], colsum[1]));
+    even = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(cur,
+							       colsum[0]),
+					      eight), 4);
+    odd = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(cur,
+							      colsum[2]),
+					     seven), 4);
+    _mm256_storeu_si256((__m256i *) (outptr + 2 * col),
+			_mm256_packus_epi16(_mm256_unpacklo_epi16(even, odd),
+					    _mm256_unpackhi_epi16(even, odd)));
+  }
+  return col;
+}
+
+#endif /* JSIMD_SUPPORTED */
+
+
 /*
  * Fancy processing for the common case of 2:1 horizontal and 1:1 vertical.
  *
@@ -304,6 +451,10 @@ METHODDEF(void)
 h2v1_fancy_upsample (j_decompress_ptr cinfo, jpeg_component_info * compptr,
 		     JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
 {
+#ifdef JSIMD_SUPPORTED
+  my_upsample_ptr upsample = (my_upsample_ptr) cinfo->upsample;
+  JDIMENSION done;
+#endif
   JSAMPARRAY output_data = *output_data_ptr;
   register JSAMPROW inptr, outptr;
   register int invalue;
@@ -318,7 +469,16 @@ h2v1_fancy_upsample (j_decompress_ptr cinfo, jpeg_component_info * compptr,
     *outptr++ = (JSAMPLE) invalue;
     *outptr++ = (JSAMPLE) ((invalue * 3 + GETJSAMPLE(*inptr) + 2) >> 2);
 
-    for (colctr = compptr->downsampled_width - 2; colctr > 0; colctr--) {
+    colctr = compptr->downsampled_width - 2;
+#ifdef JSIMD_SUPPORTED
+    if (upsample->h2v1_fancy_row != NULL) {
+      done = (*upsample->h2v1_fancy_row) (inptr, outptr, colctr);
+      inptr += done;
+      outptr += 2 * done;
+      colctr -= done;
+    }
+#endif
+    for (; colctr > 0; colctr--) {
       /* General case: 3/4 * nearer pixel + 1/4 * further pixel */
       invalue = GETJSAMPLE(*inptr++) * 3;
       *outptr++ = (JSAMPLE) ((invalue + GETJSAMPLE(inptr[-2]) + 1) >> 2);
@@ -345,6 +505,10 @@ METHODDEF(void)
 h2v2_fancy_upsample (j_decompress_ptr cinfo, jpeg_component_info * compptr,
 		     JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
 {
+#ifdef JSIMD_SUPPORTED
+  my_upsample_ptr upsample = (my_upsample_ptr) cinfo->upsample;
+  JDIMENSION done;
+#endif
   JSAMPARRAY output_data = *output_data_ptr;
   register JSAMPROW inptr0, inptr1, outptr;
 #if BITS_IN_JSAMPLE == 8
@@ -373,7 +537,23 @@ h2v2_fancy_upsample (j_decompress_ptr cinfo, jpeg_component_info * compptr,
       *outptr++ = (JSAMPLE) ((thiscolsum * 3 + nextcolsum + 7) >> 4);
       lastcolsum = thiscolsum; thiscolsum = nextcolsum;
 
-      for (colctr = compptr->downsampled_width - 2; colctr > 0; colctr--) {
+      colctr = compptr->downsampled_width - 2;
+#ifdef JSIMD_SUPPORTED
+      if (upsample->h2v2_fancy_row != NULL) {
+	/* The input pointers are one column ahead of the output here */
+	done = (*upsample->h2v2_fancy_row) (inptr0 - 1, inptr1 - 1,
+					    outptr, colctr);
+	if (done > 0) {
+	  inptr0 += done;
+	  inptr1 += done;
+	  outptr += 2 * done;
+	  colctr -= done;
+	  lastcolsum = GETJSAMPLE(inptr0[-2]) * 3 + GETJSAMPLE(inptr1[-2]);
+	  thiscolsum = GETJSAMPLE(inptr0[-1]) * 3 + GETJSAMPLE(inptr1[-1]);
+	}
+      }
+#endif
+      for (; colctr > 0; colctr--) {
 	/* General case: 3/4 * nearer pixel + 1/4 * further pixel in each */
 	/* dimension, thus 9/16, 3/16, 3/16, 1/16 overall */
 	nextcolsum = GETJSAMPLE(*inptr0++) * 3 + GETJSAMPLE(*inptr1++);
@@ -403,6 +583,9 @@ jinit_upsampler (j_decompress_ptr cinfo)
   jpeg_component_info * compptr;
   boolean need_buffer, do_fancy;
   int h_in_group, v_in_group, h_out_group, v_out_group;
+#ifdef JSIMD_SUPPORTED
+  int simd;
+#endif
 
   upsample = (my_upsample_ptr)
     (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
@@ -415,6 +598,21 @@ jinit_upsampler (j_decompress_ptr cinfo)
   if (cinfo->CCIR601_sampling)	/* this isn't supported */
     ERREXIT(cinfo, JERR_CCIR601_NOTIMPL);
 
+#ifdef JSIMD_SUPPORTED
+  /* Use SIMD fancy upsampling if the CPU has it; its output is identical */
+  simd = jsimd_cpu_support();
+  if (simd & JSIMD_AVX2) {
+    upsample->h2v1_fancy_row = h2v1_fancy_row_avx2;
+    upsample->h2v2_fancy_row = h2v2_fancy_row_avx2;
+  } else if (simd & JSIMD_SSE2) {
+    upsample->h2v1_fancy_row = h2v1_fancy_row_sse2;
+    upsample->h2v2_fancy_row = h2v2_fancy_row_sse2;
+  } else {
+    upsample->h2v1_fancy_row = NULL;
+    upsample->h2v2_fancy_row = NULL;
+  }
+#endif
+
   /* jdmainct.c doesn't support context rows when min_DCT_scaled_size = 1,
    * so don't ask for it.
    */
@@ -474,5 +672,13 @@ jinit_upsampler (j_decompress_ptr cinfo)
 				(long) cinfo->max_h_samp_factor),
 	 (JDIMENSION) cinfo->max_v_samp_factor);
     }
+#ifdef JSIMD_SUPPORTED
+    /* Record the SIMD choice if this component's method will use it */
+    if ((upsample->methods[ci] == h2v1_fancy_upsample &&
+	 upsample->h2v1_fancy_row != NULL) ||
+	(upsample->methods[ci] == h2v2_fancy_upsample &&
+	 upsample->h2v2_fancy_row != NULL))
+      jsimd_note_kernel(JSIMD_K_UPSAMPLE, simd);
+#endif
   }
 }
@@ -38,6 +38,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef DCT_FLOAT_SUPPORTED
 
@@ -165,4 +166,114 @@ jpeg_fdct_float (FAST_FLOAT * data)
   }
 }
 
+
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SSE2 and AVX2 versions of jpeg_fdct_float, which also load the samples.
+ * Each single-precision vector lane handles one row (pass 1) or one column
+ * (pass 2), performing the C code's operations in the same order, so the
+ * results are identical to the C code's wherever that code computes in
+ * single precision without fused multiply-adds (as it does on x86-64).
+ * The caller guarantees that FAST_FLOAT is float.
+ */
+
+/* One 1-D DCT on the eight vectors d[0..7] (cf. the C code above). */
+
+#define FLOAT_1D(VT,ADD,SUB,MUL,SET1,d)  { \
+    VT tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7; \
+    VT tmp10, tmp11, tmp12, tmp13, z1, z2, z3, z4, z5, z11, z13; \
+    tmp0 = ADD(d[0], d[7]); \
+    tmp7 = SUB(d[0], d[7]); \
+    tmp1 = ADD(d[1], d[6]); \
+    tmp6 = SUB(d[1], d[6]); \
+    tmp2 = ADD(d[2], d[5]); \
+    tmp5 = SUB(d[2], d[5]); \
+    tmp3 = ADD(d[3], d[4]); \
+    tmp4 = SUB(d[3], d[4]); \
+    tmp10 = ADD(tmp0, tmp3); \
+    tmp13 = SUB(tmp0, tmp3); \
+    tmp11 = ADD(tmp1, tmp2); \
+    tmp12 = SUB(tmp1, tmp2); \
+    d[0] = ADD(tmp10, tmp11); \
+    d[4] = SUB(tmp10, tmp11); \
+    z1 = MUL(ADD(tmp12, tmp13), SET1((float) 0.707106781)); \
+    d[2] = ADD(tmp13, z1); \
+    d[6] = SUB(tmp13, z1); \
+    tmp10 = ADD(tmp4, tmp5); \
+    tmp11 = ADD(tmp5, tmp6); \
+    tmp12 = ADD(tmp6, tmp7); \
+    z5 = MUL(SUB(tmp10, tmp12), SET1((float) 0.382683433)); \
+    z2 = ADD(MUL(SET1((float) 0.541196100), tmp10), z5); \
+    z4 = ADD(MUL(SET1((float) 1.306562965), tmp12), z5); \
+    z3 = MUL(tmp11, SET1((float) 0.707106781)); \
+    z11 = ADD(tmp7, z3); \
+    z13 = SUB(tmp7, z3); \
+    d[5] = ADD(z13, z2); \
+    d[3] = SUB(z13, z2); \
+    d[1] = ADD(z11, z4); \
+    d[7] = SUB(z11, z4); }
+
+
+JSIMD_TARGET("sse2")
+GLOBAL(void)
+jpeg_fdct_float_sse2 (FAST_FLOAT * data, JSAMPARRAY sample_data,
+		      JDIMENSION start_col)
+{
+  __m128i ilo[DCTSIZE], ihi[DCTSIZE];
+  __m128 lo[DCTSIZE], hi[DCTSIZE]; /* left and right halves of rows */
+  int ctr;
+
+  JSIMD_LOAD8X8_SSE2(ilo, ihi, sample_data, start_col);
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    lo[ctr] = _mm_cvtepi32_ps(ilo[ctr]);
+    hi[ctr] = _mm_cvtepi32_ps(ihi[ctr]);
+  }
+
+  /* Pass 1: process rows. */
+  JSIMD_TRANSPOSE8_PS_SSE2(lo, hi);
+  FLOAT_1D(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, lo);
+  FLOAT_1D(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, hi);
+
+  /* Pass 2: process columns. */
+  JSIMD_TRANSPOSE8_PS_SSE2(lo, hi);
+  FLOAT_1D(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, lo);
+  FLOAT_1D(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, hi);
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    _mm_storeu_ps((float *) data + ctr*DCTSIZE, lo[ctr]);
+    _mm_storeu_ps((float *) data + ctr*DCTSIZE + 4, hi[ctr]);
+  }
+}
+
+
+JSIMD_TARGET("avx2")
+GLOBAL(void)
+jpeg_fdct_float_avx2 (FAST_FLOAT * data, JSAMPARRAY sample_data,
+		      JDIMENSION start_col)
+{
+  __m256i id[DCTSIZE];
+  __m256 d[DCTSIZE];		/* working rows */
+  int ctr;
+
+  JSIMD_LOAD8X8_AVX2(id, sample_data, start_col);
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    d[ctr] = _mm256_cvtepi32_ps(id[ctr]);
+
+  /* Pass 1: process rows. */
+  JSIMD_TRANSPOSE8_PS_AVX2(d);
+  FLOAT_1D(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps,
+	   _mm256_set1_ps, d);
+
+  /* Pass 2: process columns. */
+  JSIMD_TRANSPOSE8_PS_AVX2(d);
+  FLOAT_1D(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps,
+	   _mm256_set1_ps, d);
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    _mm256_storeu_ps((float *) data + ctr*DCTSIZE, d[ctr]);
+}
+
+#endif /* JSIMD_SUPPORTED */
+
 #endif /* DCT_FLOAT_SUPPORTED */
@@ -34,6 +34,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef DCT_IFAST_SUPPORTED
 
@@ -221,4 +222,119 @@ jpeg_fdct_ifast (DCTELEM * data)
   }
 }
 
+
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SSE2 and AVX2 versions of jpeg_fdct_ifast, which also load the samples.
+ * Each 32-bit vector lane handles one row (pass 1) or one column (pass 2)
+ * with the C code's arithmetic, so the results are identical.  With 8-bit
+ * samples all multiplied values fit in 16 bits, allowing pmaddwd for SSE2.
+ */
+
+#ifdef USE_ACCURATE_ROUNDING
+#define SIMD_ROUND  (1 << (CONST_BITS-1))
+#else
+#define SIMD_ROUND  0
+#endif
+
+/* MULTIPLY for vector lanes */
+#define MUL_SSE2(x,c)  \
+    _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(x, \
+				   _mm_set1_epi32((int) ((c) & 0xFFFF))), \
+				 _mm_set1_epi32(SIMD_ROUND)), CONST_BITS)
+#define MUL_AVX2(x,c)  \
+    _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(x, \
+					 _mm256_set1_epi32((int) (c))), \
+				       _mm256_set1_epi32(SIMD_ROUND)), \
+		      CONST_BITS)
+
+/* One 1-D DCT on the eight vectors d[0..7] (cf. the C code above). */
+
+#define IFAST_1D(VT,ADD,SUB,MUL,d)  { \
+    VT tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7; \
+    VT tmp10, tmp11, tmp12, tmp13, z1, z2, z3, z4, z5, z11, z13; \
+    tmp0 = ADD(d[0], d[7]); \
+    tmp7 = SUB(d[0], d[7]); \
+    tmp1 = ADD(d[1], d[6]); \
+    tmp6 = SUB(d[1], d[6]); \
+    tmp2 = ADD(d[2], d[5]); \
+    tmp5 = SUB(d[2], d[5]); \
+    tmp3 = ADD(d[3], d[4]); \
+    tmp4 = SUB(d[3], d[4]); \
+    tmp10 = ADD(tmp0, tmp3); \
+    tmp13 = SUB(tmp0, tmp3); \
+    tmp11 = ADD(tmp1, tmp2); \
+    tmp12 = SUB(tmp1, tmp2); \
+    d[0] = ADD(tmp10, tmp11); \
+    d[4] = SUB(tmp10, tmp11); \
+    z1 = MUL(ADD(tmp12, tmp13), FIX_0_707106781); \
+    d[2] = ADD(tmp13, z1); \
+    d[6] = SUB(tmp13, z1); \
+    tmp10 = ADD(tmp4, tmp5); \
+    tmp11 = ADD(tmp5, tmp6); \
+    tmp12 = ADD(tmp6, tmp7); \
+    z5 = MUL(SUB(tmp10, tmp12), FIX_0_382683433); \
+    z2 = ADD(MUL(tmp10, FIX_0_541196100), z5); \
+    z4 = ADD(MUL(tmp12, FIX_1_306562965), z5); \
+    z3 = MUL(tmp11, FIX_0_707106781); \
+    z11 = ADD(tmp7, z3); \
+    z13 = SUB(tmp7, z3); \
+    d[5] = ADD(z13, z2); \
+    d[3] = SUB(z13, z2); \
+    d[1] = ADD(z11, z4); \
+    d[7] = SUB(z11, z4); }
+
+
+JSIMD_TARGET("sse2")
+GLOBAL(void)
+jpeg_fdct_ifast_sse2 (DCTELEM * data, JSAMPARRAY sample_data,
+		      JDIMENSION start_col)
+{
+  __m128i lo[DCTSIZE], hi[DCTSIZE]; /* left and right halves of rows */
+  int ctr;
+
+  JSIMD_LOAD8X8_SSE2(lo, hi, sample_data, start_col);
+
+  /* Pass 1: process rows. */
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  IFAST_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, lo);
+  IFAST_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, hi);
+
+  /* Pass 2: process columns. */
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  IFAST_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, lo);
+  IFAST_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, hi);
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    _mm_storeu_si128((__m128i *) (data + ctr*DCTSIZE), lo[ctr]);
+    _mm_storeu_si128((__m128i *) (data + ctr*DCTSIZE + 4), hi[ctr]);
+  }
+}
+
+
+JSIMD_TARGET("avx2")
+GLOBAL(void)
+jpeg_fdct_ifast_avx2 (DCTELEM * data, JSAMPARRAY sample_data,
+		      JDIMENSION start_col)
+{
+  __m256i d[DCTSIZE];		/* working rows */
+  int ctr;
+
+  JSIMD_LOAD8X8_AVX2(d, sample_data, start_col);
+
+  /* Pass 1: process rows. */
+  JSIMD_TRANSPOSE8_EPI32(d);
+  IFAST_1D(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2, d);
+
+  /* Pass 2: process columns. */
+  JSIMD_TRANSPOSE8_EPI32(d);
+  IFAST_1D(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2, d);
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    _mm256_storeu_si256((__m256i *) (data + ctr*DCTSIZE), d[ctr]);
+}
+
+#endif /* JSIMD_SUPPORTED */
+
 #endif /* DCT_IFAST_SUPPORTED */
@@ -27,6 +27,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef DCT_ISLOW_SUPPORTED
 
@@ -280,4 +281,131 @@ jpeg_fdct_islow (DCTELEM * data)
   }
 }
 
+
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SSE2 and AVX2 versions of jpeg_fdct_islow, which also load the samples.
+ *
+ * These do the C code's integer arithmetic in 32-bit vector lanes, each
+ * lane handling one row (pass 1) or one column (pass 2), so the results
+ * are identical.  As explained above, every value that is multiplied fits
+ * in 16 bits when the inputs are 8-bit samples, so the SSE2 version can
+ * multiply with pmaddwd.
+ */
+
+/* One 1-D DCT on the eight vectors d[0..7]; EVEN scales outputs 0 and 4,
+ * and the others are descaled by n bits.
+ */
+
+#define ISLOW_1D(VT,ADD,SUB,MUL,SRAI,SET1,EVEN,d,n)  { \
+    VT tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7; \
+    VT tmp10, tmp11, tmp12, tmp13, z1, z2, z3, z4, z5, rnd; \
+    tmp0 = ADD(d[0], d[7]); \
+    tmp7 = SUB(d[0], d[7]); \
+    tmp1 = ADD(d[1], d[6]); \
+    tmp6 = SUB(d[1], d[6]); \
+    tmp2 = ADD(d[2], d[5]); \
+    tmp5 = SUB(d[2], d[5]); \
+    tmp3 = ADD(d[3], d[4]); \
+    tmp4 = SUB(d[3], d[4]); \
+    tmp10 = ADD(tmp0, tmp3); \
+    tmp13 = SUB(tmp0, tmp3); \
+    tmp11 = ADD(tmp1, tmp2); \
+    tmp12 = SUB(tmp1, tmp2); \
+    rnd = SET1(1 << ((n)-1)); \
+    d[0] = EVEN(ADD(tmp10, tmp11)); \
+    d[4] = EVEN(SUB(tmp10, tmp11)); \
+    z1 = MUL(ADD(tmp12, tmp13), FIX_0_541196100); \
+    d[2] = SRAI(ADD(ADD(z1, MUL(tmp13, FIX_0_765366865)), rnd), n); \
+    d[6] = SRAI(ADD(ADD(z1, MUL(tmp12, - FIX_1_847759065)), rnd), n); \
+    z1 = ADD(tmp4, tmp7); \
+    z2 = ADD(tmp5, tmp6); \
+    z3 = ADD(tmp4, tmp6); \
+    z4 = ADD(tmp5, tmp7); \
+    z5 = MUL(ADD(z3, z4), FIX_1_175875602); \
+    tmp4 = MUL(tmp4, FIX_0_298631336); \
+    tmp5 = MUL(tmp5, FIX_2_053119869); \
+    tmp6 = MUL(tmp6, FIX_3_072711026); \
+    tmp7 = MUL(tmp7, FIX_1_501321110); \
+    z1 = MUL(z1, - FIX_0_899976223); \
+    z2 = MUL(z2, - FIX_2_562915447); \
+    z3 = ADD(MUL(z3, - FIX_1_961570560), z5); \
+    z4 = ADD(MUL(z4, - FIX_0_390180644), z5); \
+    d[7] = SRAI(ADD(ADD(tmp4, ADD(z1, z3)), rnd), n); \
+    d[5] = SRAI(ADD(ADD(tmp5, ADD(z2, z4)), rnd), n); \
+    d[3] = SRAI(ADD(ADD(tmp6, ADD(z2, z3)), rnd), n); \
+    d[1] = SRAI(ADD(ADD(tmp7, ADD(z1, z4)), rnd), n); }
+
+#define MUL_SSE2(x,c)  _mm_madd_epi16(x, _mm_set1_epi32((int) ((c) & 0xFFFF)))
+#define MUL_AVX2(x,c)  _mm256_mullo_epi32(x, _mm256_set1_epi32((int) (c)))
+
+/* Scaling of outputs 0 and 4 in each pass */
+#define EVEN1_SSE2(x)  _mm_slli_epi32(x, PASS1_BITS)
+#define EVEN2_SSE2(x)  _mm_srai_epi32(_mm_add_epi32(x, \
+			 _mm_set1_epi32(1 << (PASS1_BITS-1))), PASS1_BITS)
+#define EVEN1_AVX2(x)  _mm256_slli_epi32(x, PASS1_BITS)
+#define EVEN2_AVX2(x)  _mm256_srai_epi32(_mm256_add_epi32(x, \
+			 _mm256_set1_epi32(1 << (PASS1_BITS-1))), PASS1_BITS)
+
+
+JSIMD_TARGET("sse2")
+GLOBAL(void)
+jpeg_fdct_islow_sse2 (DCTELEM * data, JSAMPARRAY sample_data,
+		      JDIMENSION start_col)
+{
+  __m128i lo[DCTSIZE], hi[DCTSIZE]; /* left and right halves of rows */
+  int ctr;
+
+  JSIMD_LOAD8X8_SSE2(lo, hi, sample_data, start_col);
+
+  /* Pass 1: process rows. */
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  ISLOW_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, _mm_srai_epi32,
+	   _mm_set1_epi32, EVEN1_SSE2, lo, CONST_BITS-PASS1_BITS);
+  ISLOW_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, _mm_srai_epi32,
+	   _mm_set1_epi32, EVEN1_SSE2, hi, CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: process columns. */
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  ISLOW_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, _mm_srai_epi32,
+	   _mm_set1_epi32, EVEN2_SSE2, lo, CONST_BITS+PASS1_BITS);
+  ISLOW_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, _mm_srai_epi32,
+	   _mm_set1_epi32, EVEN2_SSE2, hi, CONST_BITS+PASS1_BITS);
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    _mm_storeu_si128((__m128i *) (data + ctr*DCTSIZE), lo[ctr]);
+    _mm_storeu_si128((__m128i *) (data + ctr*DCTSIZE + 4), hi[ctr]);
+  }
+}
+
+
+JSIMD_TARGET("avx2")
+GLOBAL(void)
+jpeg_fdct_islow_avx2 (DCTELEM * data, JSAMPARRAY sample_data,
+		      JDIMENSION start_col)
+{
+  __m256i d[DCTSIZE];		/* working rows */
+  int ctr;
+
+  JSIMD_LOAD8X8_AVX2(d, sample_data, start_col);
+
+  /* Pass 1: process rows. */
+  JSIMD_TRANSPOSE8_EPI32(d);
+  ISLOW_1D(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2,
+	   _mm256_srai_epi32, _mm256_set1_epi32, EVEN1_AVX2,
+	   d, CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: process columns. */
+  JSIMD_TRANSPOSE8_EPI32(d);
+  ISLOW_1D(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2,
+	   _mm256_srai_epi32, _mm256_set1_epi32, EVEN2_AVX2,
+	   d, CONST_BITS+PASS1_BITS);
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    _mm256_storeu_si256((__m256i *) (data + ctr*DCTSIZE), d[ctr]);
+}
+
+#endif /* JSIMD_SUPPORTED */
+
 #endif /* DCT_ISLOW_SUPPORTED */
@@ -40,6 +40,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef DCT_FLOAT_SUPPORTED
 
@@ -239,4 +240,218 @@ jpeg_idct_float (j_decompress_ptr cinfo, jpeg_component_info * compptr,
   }
 }
 
+
+
+/*
+ * Shortcut version of jpeg_idct_float for blocks whose only nonzero coefficient
+ * is the DC term; the output is exactly that of jpeg_idct_float.
+ */
+
+GLOBAL(void)
+jpeg_idct_float_dc (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		    JCOEFPTR coef_block,
+		    JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  FLOAT_MULT_TYPE * quantptr = (FLOAT_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  JSAMPROW outptr;
+  JSAMPLE dcval;
+  int ctr;
+  FAST_FLOAT wsval;
+  SHIFT_TEMPS
+
+  /* Pass 1 passes the dequantized DC term through to every workspace
+   * entry of column 0; pass 2 then passes it through to every output.
+   */
+  wsval = DEQUANTIZE(coef_block[0], quantptr[0]);
+  dcval = range_limit[(int) DESCALE((INT32) wsval, 3) & RANGE_MASK];
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+    outptr[0] = dcval;
+    outptr[1] = dcval;
+    outptr[2] = dcval;
+    outptr[3] = dcval;
+    outptr[4] = dcval;
+    outptr[5] = dcval;
+    outptr[6] = dcval;
+    outptr[7] = dcval;
+  }
+}
+
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SSE2 and AVX2 versions of jpeg_idct_float.
+ *
+ * Each single-precision vector lane processes one column (pass 1) or one
+ * row (pass 2), performing the same operations in the same order as the
+ * C code, so the results are identical to the C code's wherever that code
+ * does its arithmetic in single precision without fused multiply-adds (as
+ * it does on x86-64).  A result too large for the (INT32) conversion makes
+ * the block go to the C routine; this happens only with corrupt data.
+ * The caller guarantees that FAST_FLOAT is float.
+ */
+
+/* One 1-D IDCT on the eight vectors d[0..7] (cf. the C code above). */
+
+#define FLOAT_1D(VT,ADD,SUB,MUL,SET1,d)  { \
+    VT tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7; \
+    VT tmp10, tmp11, tmp12, tmp13, z5, z10, z11, z12, z13; \
+    tmp10 = ADD(d[0], d[4]); \
+    tmp11 = SUB(d[0], d[4]); \
+    tmp13 = ADD(d[2], d[6]); \
+    tmp12 = SUB(MUL(SUB(d[2], d[6]), SET1((float) 1.414213562)), tmp13); \
+    tmp0 = ADD(tmp10, tmp13); \
+    tmp3 = SUB(tmp10, tmp13); \
+    tmp1 = ADD(tmp11, tmp12); \
+    tmp2 = SUB(tmp11, tmp12); \
+    z13 = ADD(d[5], d[3]); \
+    z10 = SUB(d[5], d[3]); \
+    z11 = ADD(d[1], d[7]); \
+    z12 = SUB(d[1], d[7]); \
+    tmp7 = ADD(z11, z13); \
+    tmp11 = MUL(SUB(z11, z13), SET1((float) 1.414213562)); \
+    z5 = MUL(ADD(z10, z12), SET1((float) 1.847759065)); \
+    tmp10 = SUB(MUL(SET1((float) 1.082392200), z12), z5); \
+    tmp12 = ADD(MUL(SET1((float) -2.613125930), z10), z5); \
+    tmp6 = SUB(tmp12, tmp7); \
+    tmp5 = SUB(tmp11, tmp6); \
+    tmp4 = ADD(tmp10, tmp5); \
+    d[0] = ADD(tmp0, tmp7); \
+    d[7] = SUB(tmp0, tmp7); \
+    d[1] = ADD(tmp1, tmp6); \
+    d[6] = SUB(tmp1, tmp6); \
+    d[2] = ADD(tmp2, tmp5); \
+    d[5] = SUB(tmp2, tmp5); \
+    d[4] = ADD(tmp3, tmp4); \
+    d[3] = SUB(tmp3, tmp4); }
+
+
+JSIMD_TARGET("sse2")
+GLOBAL(void)
+jpeg_idct_float_sse2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m128i rows[DCTSIZE];	/* coefficient rows */
+  __m128 lo[DCTSIZE], hi[DCTSIZE]; /* left and right halves of rows */
+  __m128i ilo[DCTSIZE], ihi[DCTSIZE];
+  __m128i zero = _mm_setzero_si128();
+  __m128i bad = _mm_set1_epi32((int) 0x80000000); /* cvttps2dq overflow */
+  __m128i chk = zero;
+  __m128i rnd = _mm_set1_epi32(1 << 2);
+  FLOAT_MULT_TYPE * quantptr = (FLOAT_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  boolean dc_only;
+  int ctr;
+  SHIFT_TEMPS
+
+  JSIMD_LOAD_COEFS(rows, coef_block, dc_only);
+  if (dc_only) {
+    /* All outputs equal the descaled DC term, as they do in the C code. */
+    FAST_FLOAT dcval = DEQUANTIZE(coef_block[0], quantptr[0]);
+
+    JSIMD_FILL8X8(output_buf, output_col,
+		  range_limit[(int) DESCALE((INT32) dcval, 3) & RANGE_MASK]);
+    return;
+  }
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    lo[ctr] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(
+			   _mm_unpacklo_epi16(zero, rows[ctr]), 16)),
+			 _mm_loadu_ps((const float *) quantptr + ctr*DCTSIZE));
+    hi[ctr] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(
+			   _mm_unpackhi_epi16(zero, rows[ctr]), 16)),
+			 _mm_loadu_ps((const float *) quantptr + ctr*DCTSIZE
+				      + 4));
+  }
+
+  /* Pass 1: process columns. */
+  FLOAT_1D(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, lo);
+  FLOAT_1D(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, hi);
+
+  /* Pass 2: process rows. */
+  JSIMD_TRANSPOSE8_PS_SSE2(lo, hi);
+  FLOAT_1D(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, lo);
+  FLOAT_1D(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, hi);
+
+  /* Final output stage: convert, scale down by 8 and range-limit */
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    ilo[ctr] = _mm_cvttps_epi32(lo[ctr]);
+    ihi[ctr] = _mm_cvttps_epi32(hi[ctr]);
+    chk = _mm_or_si128(chk, _mm_or_si128(_mm_cmpeq_epi32(ilo[ctr], bad),
+					 _mm_cmpeq_epi32(ihi[ctr], bad)));
+    ilo[ctr] = JSIMD_RANGE_FOLD_SSE2(_mm_srai_epi32(_mm_add_epi32(ilo[ctr],
+								  rnd), 3));
+    ihi[ctr] = JSIMD_RANGE_FOLD_SSE2(_mm_srai_epi32(_mm_add_epi32(ihi[ctr],
+								  rnd), 3));
+  }
+  if (_mm_movemask_epi8(chk) != 0) {
+    jpeg_idct_float(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+  JSIMD_TRANSPOSE8_SSE2(ilo, ihi);
+  JSIMD_STORE8X8_SSE2(ilo, ihi, output_buf, output_col);
+}
+
+
+JSIMD_TARGET("avx2")
+GLOBAL(void)
+jpeg_idct_float_avx2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m128i rows[DCTSIZE];	/* coefficient rows */
+  __m256 d[DCTSIZE];		/* working rows */
+  __m256i id[DCTSIZE];
+  __m256i bad = _mm256_set1_epi32((int) 0x80000000); /* overflow result */
+  __m256i chk = _mm256_setzero_si256();
+  __m256i rnd = _mm256_set1_epi32(1 << 2);
+  FLOAT_MULT_TYPE * quantptr = (FLOAT_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  boolean dc_only;
+  int ctr;
+  SHIFT_TEMPS
+
+  JSIMD_LOAD_COEFS(rows, coef_block, dc_only);
+  if (dc_only) {
+    FAST_FLOAT dcval = DEQUANTIZE(coef_block[0], quantptr[0]);
+
+    JSIMD_FILL8X8(output_buf, output_col,
+		  range_limit[(int) DESCALE((INT32) dcval, 3) & RANGE_MASK]);
+    return;
+  }
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    d[ctr] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(rows[ctr])),
+			   _mm256_loadu_ps((const float *) quantptr
+					   + ctr*DCTSIZE));
+
+  /* Pass 1: process columns. */
+  FLOAT_1D(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps,
+	   _mm256_set1_ps, d);
+
+  /* Pass 2: process rows. */
+  JSIMD_TRANSPOSE8_PS_AVX2(d);
+  FLOAT_1D(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps,
+	   _mm256_set1_ps, d);
+
+  /* Final output stage: convert, scale down by 8 and range-limit */
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    id[ctr] = _mm256_cvttps_epi32(d[ctr]);
+    chk = _mm256_or_si256(chk, _mm256_cmpeq_epi32(id[ctr], bad));
+    id[ctr] = JSIMD_RANGE_FOLD_AVX2(_mm256_srai_epi32(
+		_mm256_add_epi32(id[ctr], rnd), 3));
+  }
+  if (! _mm256_testz_si256(chk, chk)) {
+    jpeg_idct_float(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+  JSIMD_TRANSPOSE8_EPI32(id);
+  JSIMD_STORE8X8_AVX2(id, output_buf, output_col);
+}
+
+#endif /* JSIMD_SUPPORTED */
+
 #endif /* DCT_FLOAT_SUPPORTED */
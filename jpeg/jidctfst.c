@@ -36,6 +36,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef DCT_IFAST_SUPPORTED
 
@@ -365,4 +366,226 @@ jpeg_idct_ifast (j_decompress_ptr cinfo, jpeg_component_info * compptr,
   }
 }
 
+
+
+/*
+ * Shortcut version of jpeg_idct_ifast for blocks whose only nonzero coefficient
+ * is the DC term; the output is exactly that of jpeg_idct_ifast.
+ */
+
+GLOBAL(void)
+jpeg_idct_ifast_dc (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		    JCOEFPTR coef_block,
+		    JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  IFAST_MULT_TYPE * quantptr = (IFAST_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  JSAMPROW outptr;
+  JSAMPLE dcval;
+  int ctr;
+  int wsval;
+  ISHIFT_TEMPS
+
+  /* Every column, then every row, takes the all-AC-zero shortcut. */
+  wsval = (int) DEQUANTIZE(coef_block[0], quantptr[0]);
+  dcval = range_limit[IDESCALE(wsval, PASS1_BITS+3) & RANGE_MASK];
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+    outptr[0] = dcval;
+    outptr[1] = dcval;
+    outptr[2] = dcval;
+    outptr[3] = dcval;
+    outptr[4] = dcval;
+    outptr[5] = dcval;
+    outptr[6] = dcval;
+    outptr[7] = dcval;
+  }
+}
+
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SSE2 and AVX2 versions of jpeg_idct_ifast.
+ *
+ * As in jidctint.c, each 32-bit vector lane processes one column (pass 1)
+ * or one row (pass 2), doing exactly the arithmetic of the C code; blocks
+ * whose dequantized coefficients (and, for SSE2, pass 1 outputs) fall
+ * outside -8192..8191 are given to the C routine, so that no multiply
+ * input overflows 16 bits and pass 1 cannot overflow at all.
+ */
+
+#ifdef USE_ACCURATE_ROUNDING
+#define SIMD_ROUND(n)  (1 << ((n)-1))
+#else
+#define SIMD_ROUND(n)  0
+#endif
+
+/* MULTIPLY for lanes holding 16-bit signed values. */
+#define MUL_SSE2(x,c)  \
+    _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(x, \
+				   _mm_set1_epi32((int) ((c) & 0xFFFF))), \
+				 _mm_set1_epi32(SIMD_ROUND(CONST_BITS))), \
+		   CONST_BITS)
+#define MUL_AVX2(x,c)  \
+    _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(x, \
+					 _mm256_set1_epi32((int) (c))), \
+				       _mm256_set1_epi32(SIMD_ROUND(CONST_BITS))), \
+		      CONST_BITS)
+
+/* One 1-D IDCT on the eight vectors d[0..7] (cf. the C code above). */
+
+#define IFAST_1D(VT,ADD,SUB,MUL,d)  { \
+    VT tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7; \
+    VT tmp10, tmp11, tmp12, tmp13, z5, z10, z11, z12, z13; \
+    tmp10 = ADD(d[0], d[4]); \
+    tmp11 = SUB(d[0], d[4]); \
+    tmp13 = ADD(d[2], d[6]); \
+    tmp12 = SUB(MUL(SUB(d[2], d[6]), FIX_1_414213562), tmp13); \
+    tmp0 = ADD(tmp10, tmp13); \
+    tmp3 = SUB(tmp10, tmp13); \
+    tmp1 = ADD(tmp11, tmp12); \
+    tmp2 = SUB(tmp11, tmp12); \
+    z13 = ADD(d[5], d[3]); \
+    z10 = SUB(d[5], d[3]); \
+    z11 = ADD(d[1], d[7]); \
+    z12 = SUB(d[1], d[7]); \
+    tmp7 = ADD(z11, z13); \
+    tmp11 = MUL(SUB(z11, z13), FIX_1_414213562); \
+    z5 = MUL(ADD(z10, z12), FIX_1_847759065); \
+    tmp10 = SUB(MUL(z12, FIX_1_082392200), z5); \
+    tmp12 = ADD(MUL(z10, - FIX_2_613125930), z5); \
+    tmp6 = SUB(tmp12, tmp7); \
+    tmp5 = SUB(tmp11, tmp6); \
+    tmp4 = ADD(tmp10, tmp5); \
+    d[0] = ADD(tmp0, tmp7); \
+    d[7] = SUB(tmp0, tmp7); \
+    d[1] = ADD(tmp1, tmp6); \
+    d[6] = SUB(tmp1, tmp6); \
+    d[2] = ADD(tmp2, tmp5); \
+    d[5] = SUB(tmp2, tmp5); \
+    d[4] = ADD(tmp3, tmp4); \
+    d[3] = SUB(tmp3, tmp4); }
+
+
+JSIMD_TARGET("sse2")
+GLOBAL(void)
+jpeg_idct_ifast_sse2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m128i rows[DCTSIZE];	/* coefficient rows */
+  __m128i lo[DCTSIZE], hi[DCTSIZE]; /* left and right halves of rows */
+  __m128i zero = _mm_setzero_si128();
+  __m128i chk = zero;
+  __m128i rnd = _mm_set1_epi32(SIMD_ROUND(PASS1_BITS+3));
+  IFAST_MULT_TYPE * quantptr = (IFAST_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  boolean dc_only;
+  int ctr;
+  ISHIFT_TEMPS
+
+  JSIMD_LOAD_COEFS(rows, coef_block, dc_only);
+  if (dc_only) {
+    /* All outputs equal the descaled DC term, as with the C code's
+     * zero-column and zero-row shortcuts.
+     */
+    int dcval = (int) DEQUANTIZE(coef_block[0], quantptr[0]);
+
+    JSIMD_FILL8X8(output_buf, output_col,
+		  range_limit[IDESCALE(dcval, PASS1_BITS+3) & RANGE_MASK]);
+    return;
+  }
+
+  /* Dequantize: pmaddwd of (coef,0) by (quantval,0) pairs. */
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    lo[ctr] = _mm_madd_epi16(_mm_unpacklo_epi16(rows[ctr], zero),
+			     _mm_loadu_si128((const __m128i *)
+					     (quantptr + ctr*DCTSIZE)));
+    hi[ctr] = _mm_madd_epi16(_mm_unpackhi_epi16(rows[ctr], zero),
+			     _mm_loadu_si128((const __m128i *)
+					     (quantptr + ctr*DCTSIZE + 4)));
+    JSIMD_CHECK13_SSE2(chk, lo[ctr]);
+    JSIMD_CHECK13_SSE2(chk, hi[ctr]);
+  }
+
+  /* Pass 1: process columns. */
+  IFAST_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, lo);
+  IFAST_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, hi);
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    JSIMD_CHECK13_SSE2(chk, lo[ctr]);
+    JSIMD_CHECK13_SSE2(chk, hi[ctr]);
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(chk, zero)) != 0xFFFF) {
+    jpeg_idct_ifast(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 2: process rows. */
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  IFAST_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, lo);
+  IFAST_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2, hi);
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    lo[ctr] = JSIMD_RANGE_FOLD_SSE2(_mm_srai_epi32(_mm_add_epi32(lo[ctr], rnd),
+						   PASS1_BITS+3));
+    hi[ctr] = JSIMD_RANGE_FOLD_SSE2(_mm_srai_epi32(_mm_add_epi32(hi[ctr], rnd),
+						   PASS1_BITS+3));
+  }
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  JSIMD_STORE8X8_SSE2(lo, hi, output_buf, output_col);
+}
+
+
+JSIMD_TARGET("avx2")
+GLOBAL(void)
+jpeg_idct_ifast_avx2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m128i rows[DCTSIZE];	/* coefficient rows */
+  __m256i d[DCTSIZE];		/* working rows */
+  __m256i chk = _mm256_setzero_si256();
+  __m256i rnd = _mm256_set1_epi32(SIMD_ROUND(PASS1_BITS+3));
+  IFAST_MULT_TYPE * quantptr = (IFAST_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  boolean dc_only;
+  int ctr;
+  ISHIFT_TEMPS
+
+  JSIMD_LOAD_COEFS(rows, coef_block, dc_only);
+  if (dc_only) {
+    int dcval = (int) DEQUANTIZE(coef_block[0], quantptr[0]);
+
+    JSIMD_FILL8X8(output_buf, output_col,
+		  range_limit[IDESCALE(dcval, PASS1_BITS+3) & RANGE_MASK]);
+    return;
+  }
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    d[ctr] = _mm256_mullo_epi32(_mm256_cvtepi16_epi32(rows[ctr]),
+				_mm256_loadu_si256((const __m256i *)
+						   (quantptr + ctr*DCTSIZE)));
+    JSIMD_CHECK13_AVX2(chk, d[ctr]);
+  }
+  if (! _mm256_testz_si256(chk, chk)) {
+    jpeg_idct_ifast(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: process columns. */
+  IFAST_1D(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2, d);
+
+  /* Pass 2: process rows. */
+  JSIMD_TRANSPOSE8_EPI32(d);
+  IFAST_1D(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2, d);
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    d[ctr] = JSIMD_RANGE_FOLD_AVX2(_mm256_srai_epi32(_mm256_add_epi32(d[ctr],
+								      rnd),
+						     PASS1_BITS+3));
+  JSIMD_TRANSPOSE8_EPI32(d);
+  JSIMD_STORE8X8_AVX2(d, output_buf, output_col);
+}
+
+#endif /* JSIMD_SUPPORTED */
+
 #endif /* DCT_IFAST_SUPPORTED */
@@ -29,6 +29,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef DCT_ISLOW_SUPPORTED
 
@@ -386,4 +387,558 @@ jpeg_idct_islow (j_decompress_ptr cinfo, jpeg_component_info * compptr,
   }
 }
 
+
+
+/*
+ * Shortcut versions of jpeg_idct_islow, used by the coefficient controller
+ * when the entropy decoder reports that a block's nonzero coefficients are
+ * confined to the DC term, or to the first 10 zigzag positions (which lie
+ * in the upper-left 4x4 quadrant).  Both give exactly the same output as
+ * jpeg_idct_islow; they just leave out the terms that are known to be zero.
+ */
+
+GLOBAL(void)
+jpeg_idct_islow_dc (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		    JCOEFPTR coef_block,
+		    JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  JSAMPROW outptr;
+  JSAMPLE dcval;
+  int ctr, wsval;
+  SHIFT_TEMPS
+
+  /* Every column, then every row, takes the all-AC-zero shortcut. */
+  wsval = DEQUANTIZE(coef_block[0], quantptr[0]) << PASS1_BITS;
+  dcval = range_limit[(int) DESCALE((INT32) wsval, PASS1_BITS+3)
+		      & RANGE_MASK];
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+    outptr[0] = dcval;
+    outptr[1] = dcval;
+    outptr[2] = dcval;
+    outptr[3] = dcval;
+    outptr[4] = dcval;
+    outptr[5] = dcval;
+    outptr[6] = dcval;
+    outptr[7] = dcval;
+  }
+}
+
+
+GLOBAL(void)
+jpeg_idct_islow_quad (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  INT32 tmp0, tmp1, tmp2, tmp3;
+  INT32 tmp10, tmp11, tmp12, tmp13;
+  INT32 z1, z2, z3, z4, z5;
+  JCOEFPTR inptr;
+  ISLOW_MULT_TYPE * quantptr;
+  int * wsptr;
+  JSAMPROW outptr;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  int ctr;
+  int workspace[DCTSIZE2];	/* buffers data between passes */
+  SHIFT_TEMPS
+
+  /* Pass 1: process columns 0..3, in which only rows 0..3 can be nonzero.
+   * Columns 4..7 are all zero, and so are their results.
+   */
+
+  inptr = coef_block;
+  quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  wsptr = workspace;
+  for (ctr = 4; ctr > 0; ctr--) {
+    if (inptr[DCTSIZE*1] == 0 && inptr[DCTSIZE*2] == 0 &&
+	inptr[DCTSIZE*3] == 0) {
+      /* AC terms all zero */
+      int dcval = DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]) << PASS1_BITS;
+      
+      wsptr[DCTSIZE*0] = dcval;
+      wsptr[DCTSIZE*1] = dcval;
+      wsptr[DCTSIZE*2] = dcval;
+      wsptr[DCTSIZE*3] = dcval;
+      wsptr[DCTSIZE*4] = dcval;
+      wsptr[DCTSIZE*5] = dcval;
+      wsptr[DCTSIZE*6] = dcval;
+      wsptr[DCTSIZE*7] = dcval;
+      
+      inptr++;			/* advance pointers to next column */
+      quantptr++;
+      wsptr++;
+      continue;
+    }
+    
+    /* Even part, with inputs 4 and 6 zero */
+    
+    z2 = DEQUANTIZE(inptr[DCTSIZE*2], quantptr[DCTSIZE*2]);
+    
+    tmp2 = MULTIPLY(z2, FIX_0_541196100);
+    tmp3 = tmp2 + MULTIPLY(z2, FIX_0_765366865);
+    
+    tmp0 = DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]);
+    tmp0 <<= CONST_BITS;
+    
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp0 + tmp2;
+    tmp12 = tmp0 - tmp2;
+    
+    /* Odd part, with inputs 5 and 7 zero */
+    
+    z2 = DEQUANTIZE(inptr[DCTSIZE*3], quantptr[DCTSIZE*3]);
+    z1 = DEQUANTIZE(inptr[DCTSIZE*1], quantptr[DCTSIZE*1]);
+    
+    z5 = MULTIPLY(z2 + z1, FIX_1_175875602); /* sqrt(2) * c3 */
+    
+    tmp2 = MULTIPLY(z2, FIX_3_072711026); /* sqrt(2) * ( c1+c3+c5-c7) */
+    tmp3 = MULTIPLY(z1, FIX_1_501321110); /* sqrt(2) * ( c1+c3-c5-c7) */
+    z3 = MULTIPLY(z2, - FIX_1_961570560) + z5; /* sqrt(2) * (-c3-c5) */
+    z4 = MULTIPLY(z1, - FIX_0_390180644) + z5; /* sqrt(2) * (c5-c3) */
+    z1 = MULTIPLY(z1, - FIX_0_899976223); /* sqrt(2) * (c7-c3) */
+    z2 = MULTIPLY(z2, - FIX_2_562915447); /* sqrt(2) * (-c1-c3) */
+    
+    tmp0 = z1 + z3;
+    tmp1 = z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+    
+    /* Final output stage: inputs are tmp10..tmp13, tmp0..tmp3 */
+    
+    wsptr[DCTSIZE*0] = (int) DESCALE(tmp10 + tmp3, CONST_BITS-PASS1_BITS);
+    wsptr[DCTSIZE*7] = (int) DESCALE(tmp10 - tmp3, CONST_BITS-PASS1_BITS);
+    wsptr[DCTSIZE*1] = (int) DESCALE(tmp11 + tmp2, CONST_BITS-PASS1_BITS);
+    wsptr[DCTSIZE*6] = (int) DESCALE(tmp11 - tmp2, CONST_BITS-PASS1_BITS);
+    wsptr[DCTSIZE*2] = (int) DESCALE(tmp12 + tmp1, CONST_BITS-PASS1_BITS);
+    wsptr[DCTSIZE*5] = (int) DESCALE(tmp12 - tmp1, CONST_BITS-PASS1_BITS);
+    wsptr[DCTSIZE*3] = (int) DESCALE(tmp13 + tmp0, CONST_BITS-PASS1_BITS);
+    wsptr[DCTSIZE*4] = (int) DESCALE(tmp13 - tmp0, CONST_BITS-PASS1_BITS);
+    
+    inptr++;			/* advance pointers to next column */
+    quantptr++;
+    wsptr++;
+  }
+  
+  /* Pass 2: process rows from work array, store into output array.
+   * Entries 4..7 of each row are zero.
+   */
+
+  wsptr = workspace;
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+    
+#ifndef NO_ZERO_ROW_TEST
+    if (wsptr[1] == 0 && wsptr[2] == 0 && wsptr[3] == 0) {
+      /* AC terms all zero */
+      JSAMPLE dcval = range_limit[(int) DESCALE((INT32) wsptr[0], PASS1_BITS+3)
+				  & RANGE_MASK];
+      
+      outptr[0] = dcval;
+      outptr[1] = dcval;
+      outptr[2] = dcval;
+      outptr[3] = dcval;
+      outptr[4] = dcval;
+      outptr[5] = dcval;
+      outptr[6] = dcval;
+      outptr[7] = dcval;
+
+      wsptr += DCTSIZE;		/* advance pointer to next row */
+      continue;
+    }
+#endif
+    
+    /* Even part */
+    
+    z2 = (INT32) wsptr[2];
+    
+    tmp2 = MULTIPLY(z2, FIX_0_541196100);
+    tmp3 = tmp2 + MULTIPLY(z2, FIX_0_765366865);
+    
+    tmp0 = ((INT32) wsptr[0]) << CONST_BITS;
+    
+    tmp10 = tmp0 + tmp3;
+    tmp13 = tmp0 - tmp3;
+    tmp11 = tmp0 + tmp2;
+    tmp12 = tmp0 - tmp2;
+    
+    /* Odd part */
+    
+    z2 = (INT32) wsptr[3];
+    z1 = (INT32) wsptr[1];
+    
+    z5 = MULTIPLY(z2 + z1, FIX_1_175875602); /* sqrt(2) * c3 */
+    
+    tmp2 = MULTIPLY(z2, FIX_3_072711026); /* sqrt(2) * ( c1+c3+c5-c7) */
+    tmp3 = MULTIPLY(z1, FIX_1_501321110); /* sqrt(2) * ( c1+c3-c5-c7) */
+    z3 = MULTIPLY(z2, - FIX_1_961570560) + z5; /* sqrt(2) * (-c3-c5) */
+    z4 = MULTIPLY(z1, - FIX_0_390180644) + z5; /* sqrt(2) * (c5-c3) */
+    z1 = MULTIPLY(z1, - FIX_0_899976223); /* sqrt(2) * (c7-c3) */
+    z2 = MULTIPLY(z2, - FIX_2_562915447); /* sqrt(2) * (-c1-c3) */
+    
+    tmp0 = z1 + z3;
+    tmp1 = z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+    
+    /* Final output stage: inputs are tmp10..tmp13, tmp0..tmp3 */
+    
+    outptr[0] = range_limit[(int) DESCALE(tmp10 + tmp3,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[7] = range_limit[(int) DESCALE(tmp10 - tmp3,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[1] = range_limit[(int) DESCALE(tmp11 + tmp2,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[6] = range_limit[(int) DESCALE(tmp11 - tmp2,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[2] = range_limit[(int) DESCALE(tmp12 + tmp1,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[5] = range_limit[(int) DESCALE(tmp12 - tmp1,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[3] = range_limit[(int) DESCALE(tmp13 + tmp0,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[4] = range_limit[(int) DESCALE(tmp13 - tmp0,
+					  CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    
+    wsptr += DCTSIZE;		/* advance pointer to next row */
+  }
+}
+
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * SSE2 and AVX2 versions of jpeg_idct_islow.
+ *
+ * These do the same arithmetic as the C code, in 32-bit vector lanes that
+ * each process one column (pass 1) or one row (pass 2) of the block.
+ * For exact agreement with the C code, pass 1 must not overflow; that is
+ * guaranteed if every dequantized coefficient lies within -8192..8191,
+ * which is true of all valid data.  A block failing this test (corrupt
+ * data) is passed to the C routine.  Pass 2 may wrap around in 32 bits
+ * with no harm, since only the bits kept by the RANGE_MASK step matter.
+ *
+ * The SSE2 version multiplies with pmaddwd, which takes 16-bit inputs;
+ * so it must also check that the pass 1 outputs lie within -8192..8191,
+ * making every sum fed to a multiply fit in 16 bits.  Also, multiplier
+ * table entries must fit in 15 bits for the dequantization multiply;
+ * jddctmgr.c selects these routines only when they do.
+ */
+
+/* One 1-D IDCT on the eight vectors d[0..7], descaling the outputs by n bits
+ * (cf. the C code above).
+ */
+
+#define ISLOW_1D(VT,ADD,SUB,MUL,SLLI,SRAI,SET1,d,n)  { \
+    VT z1, z2, z3, z4, z5, rnd; \
+    VT tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13; \
+    z1 = MUL(ADD(d[2], d[6]), FIX_0_541196100); \
+    tmp2 = ADD(z1, MUL(d[6], - FIX_1_847759065)); \
+    tmp3 = ADD(z1, MUL(d[2], FIX_0_765366865)); \
+    tmp0 = SLLI(ADD(d[0], d[4]), CONST_BITS); \
+    tmp1 = SLLI(SUB(d[0], d[4]), CONST_BITS); \
+    tmp10 = ADD(tmp0, tmp3); \
+    tmp13 = SUB(tmp0, tmp3); \
+    tmp11 = ADD(tmp1, tmp2); \
+    tmp12 = SUB(tmp1, tmp2); \
+    z1 = ADD(d[7], d[1]); \
+    z2 = ADD(d[5], d[3]); \
+    z3 = ADD(d[7], d[3]); \
+    z4 = ADD(d[5], d[1]); \
+    z5 = MUL(ADD(z3, z4), FIX_1_175875602); \
+    tmp0 = MUL(d[7], FIX_0_298631336); \
+    tmp1 = MUL(d[5], FIX_2_053119869); \
+    tmp2 = MUL(d[3], FIX_3_072711026); \
+    tmp3 = MUL(d[1], FIX_1_501321110); \
+    z1 = MUL(z1, - FIX_0_899976223); \
+    z2 = MUL(z2, - FIX_2_562915447); \
+    z3 = ADD(MUL(z3, - FIX_1_961570560), z5); \
+    z4 = ADD(MUL(z4, - FIX_0_390180644), z5); \
+    tmp0 = ADD(tmp0, ADD(z1, z3)); \
+    tmp1 = ADD(tmp1, ADD(z2, z4)); \
+    tmp2 = ADD(tmp2, ADD(z2, z3)); \
+    tmp3 = ADD(tmp3, ADD(z1, z4)); \
+    ISLOW_1D_OUTPUT(ADD,SUB,SRAI,SET1,d,n); }
+
+/* The same, when d[4..7] are known to be zero. */
+
+#define ISLOW_1D_QUAD(VT,ADD,SUB,MUL,SLLI,SRAI,SET1,d,n)  { \
+    VT z1, z2, z3, z4, z5, rnd; \
+    VT tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13; \
+    tmp2 = MUL(d[2], FIX_0_541196100); \
+    tmp3 = ADD(tmp2, MUL(d[2], FIX_0_765366865)); \
+    tmp0 = SLLI(d[0], CONST_BITS); \
+    tmp10 = ADD(tmp0, tmp3); \
+    tmp13 = SUB(tmp0, tmp3); \
+    tmp11 = ADD(tmp0, tmp2); \
+    tmp12 = SUB(tmp0, tmp2); \
+    z5 = MUL(ADD(d[3], d[1]), FIX_1_175875602); \
+    tmp2 = MUL(d[3], FIX_3_072711026); \
+    tmp3 = MUL(d[1], FIX_1_501321110); \
+    z1 = MUL(d[1], - FIX_0_899976223); \
+    z2 = MUL(d[3], - FIX_2_562915447); \
+    z3 = ADD(MUL(d[3], - FIX_1_961570560), z5); \
+    z4 = ADD(MUL(d[1], - FIX_0_390180644), z5); \
+    tmp0 = ADD(z1, z3); \
+    tmp1 = ADD(z2, z4); \
+    tmp2 = ADD(tmp2, ADD(z2, z3)); \
+    tmp3 = ADD(tmp3, ADD(z1, z4)); \
+    ISLOW_1D_OUTPUT(ADD,SUB,SRAI,SET1,d,n); }
+
+#define ISLOW_1D_OUTPUT(ADD,SUB,SRAI,SET1,d,n)  \
+    rnd = SET1(1 << ((n)-1)); \
+    d[0] = SRAI(ADD(ADD(tmp10, tmp3), rnd), n); \
+    d[7] = SRAI(ADD(SUB(tmp10, tmp3), rnd), n); \
+    d[1] = SRAI(ADD(ADD(tmp11, tmp2), rnd), n); \
+    d[6] = SRAI(ADD(SUB(tmp11, tmp2), rnd), n); \
+    d[2] = SRAI(ADD(ADD(tmp12, tmp1), rnd), n); \
+    d[5] = SRAI(ADD(SUB(tmp12, tmp1), rnd), n); \
+    d[3] = SRAI(ADD(ADD(tmp13, tmp0), rnd), n); \
+    d[4] = SRAI(ADD(SUB(tmp13, tmp0), rnd), n)
+
+/* Multiply lanes holding 16-bit signed values by a 16-bit constant. */
+#define MUL_SSE2(x,c)  _mm_madd_epi16(x, _mm_set1_epi32((int) ((c) & 0xFFFF)))
+#define MUL_AVX2(x,c)  _mm256_mullo_epi32(x, _mm256_set1_epi32((int) (c)))
+
+
+JSIMD_TARGET("sse2")
+GLOBAL(void)
+jpeg_idct_islow_sse2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m128i rows[DCTSIZE];	/* coefficient rows */
+  __m128i lo[DCTSIZE], hi[DCTSIZE]; /* left and right halves of rows */
+  __m128i zero = _mm_setzero_si128();
+  __m128i chk = zero;
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  boolean dc_only;
+  int ctr;
+  SHIFT_TEMPS
+
+  JSIMD_LOAD_COEFS(rows, coef_block, dc_only);
+  if (dc_only) {
+    /* All outputs equal the descaled DC term, as with the C code's
+     * zero-column and zero-row shortcuts.
+     */
+    int dcval = DEQUANTIZE(coef_block[0], quantptr[0]) << PASS1_BITS;
+
+    JSIMD_FILL8X8(output_buf, output_col,
+		  range_limit[(int) DESCALE((INT32) dcval, PASS1_BITS+3)
+			      & RANGE_MASK]);
+    return;
+  }
+
+  /* Dequantize: pmaddwd of (coef,0) by (quantval,0) pairs. */
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    lo[ctr] = _mm_madd_epi16(_mm_unpacklo_epi16(rows[ctr], zero),
+			     _mm_loadu_si128((const __m128i *)
+					     (quantptr + ctr*DCTSIZE)));
+    hi[ctr] = _mm_madd_epi16(_mm_unpackhi_epi16(rows[ctr], zero),
+			     _mm_loadu_si128((const __m128i *)
+					     (quantptr + ctr*DCTSIZE + 4)));
+    JSIMD_CHECK13_SSE2(chk, lo[ctr]);
+    JSIMD_CHECK13_SSE2(chk, hi[ctr]);
+  }
+
+  /* Pass 1: process columns. */
+  ISLOW_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2,
+	   _mm_slli_epi32, _mm_srai_epi32, _mm_set1_epi32,
+	   lo, CONST_BITS-PASS1_BITS);
+  ISLOW_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2,
+	   _mm_slli_epi32, _mm_srai_epi32, _mm_set1_epi32,
+	   hi, CONST_BITS-PASS1_BITS);
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    JSIMD_CHECK13_SSE2(chk, lo[ctr]);
+    JSIMD_CHECK13_SSE2(chk, hi[ctr]);
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(chk, zero)) != 0xFFFF) {
+    jpeg_idct_islow(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 2: process rows. */
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  ISLOW_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2,
+	   _mm_slli_epi32, _mm_srai_epi32, _mm_set1_epi32,
+	   lo, CONST_BITS+PASS1_BITS+3);
+  ISLOW_1D(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2,
+	   _mm_slli_epi32, _mm_srai_epi32, _mm_set1_epi32,
+	   hi, CONST_BITS+PASS1_BITS+3);
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    lo[ctr] = JSIMD_RANGE_FOLD_SSE2(lo[ctr]);
+    hi[ctr] = JSIMD_RANGE_FOLD_SSE2(hi[ctr]);
+  }
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  JSIMD_STORE8X8_SSE2(lo, hi, output_buf, output_col);
+}
+
+
+JSIMD_TARGET("avx2")
+GLOBAL(void)
+jpeg_idct_islow_avx2 (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m128i rows[DCTSIZE];	/* coefficient rows */
+  __m256i d[DCTSIZE];		/* working rows */
+  __m256i chk = _mm256_setzero_si256();
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  boolean dc_only;
+  int ctr;
+  SHIFT_TEMPS
+
+  JSIMD_LOAD_COEFS(rows, coef_block, dc_only);
+  if (dc_only) {
+    int dcval = DEQUANTIZE(coef_block[0], quantptr[0]) << PASS1_BITS;
+
+    JSIMD_FILL8X8(output_buf, output_col,
+		  range_limit[(int) DESCALE((INT32) dcval, PASS1_BITS+3)
+			      & RANGE_MASK]);
+    return;
+  }
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    d[ctr] = _mm256_mullo_epi32(_mm256_cvtepi16_epi32(rows[ctr]),
+				_mm256_loadu_si256((const __m256i *)
+						   (quantptr + ctr*DCTSIZE)));
+    JSIMD_CHECK13_AVX2(chk, d[ctr]);
+  }
+  if (! _mm256_testz_si256(chk, chk)) {
+    jpeg_idct_islow(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: process columns. */
+  ISLOW_1D(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2,
+	   _mm256_slli_epi32, _mm256_srai_epi32, _mm256_set1_epi32,
+	   d, CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: process rows. */
+  JSIMD_TRANSPOSE8_EPI32(d);
+  ISLOW_1D(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2,
+	   _mm256_slli_epi32, _mm256_srai_epi32, _mm256_set1_epi32,
+	   d, CONST_BITS+PASS1_BITS+3);
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    d[ctr] = JSIMD_RANGE_FOLD_AVX2(d[ctr]);
+  JSIMD_TRANSPOSE8_EPI32(d);
+  JSIMD_STORE8X8_AVX2(d, output_buf, output_col);
+}
+
+
+
+/*
+ * SSE2 and AVX2 versions of jpeg_idct_islow_quad.  Only rows 0..3 of the
+ * left half of the block are loaded; the right half of pass 1 and the
+ * upper half of each 1-D IDCT input are known to be zero.
+ */
+
+JSIMD_TARGET("sse2")
+GLOBAL(void)
+jpeg_idct_islow_quad_sse2 (j_decompress_ptr cinfo,
+			   jpeg_component_info * compptr, JCOEFPTR coef_block,
+			   JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m128i lo[DCTSIZE], hi[DCTSIZE]; /* left and right halves of rows */
+  __m128i zero = _mm_setzero_si128();
+  __m128i chk = zero;
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  int ctr;
+
+  for (ctr = 0; ctr < 4; ctr++) {
+    lo[ctr] = _mm_madd_epi16(_mm_unpacklo_epi16(_mm_loadl_epi64(
+			       (const __m128i *) (coef_block + ctr*DCTSIZE)),
+						zero),
+			     _mm_loadu_si128((const __m128i *)
+					     (quantptr + ctr*DCTSIZE)));
+    JSIMD_CHECK13_SSE2(chk, lo[ctr]);
+  }
+  for (ctr = 4; ctr < DCTSIZE; ctr++)
+    lo[ctr] = zero;
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    hi[ctr] = zero;
+
+  /* Pass 1: process columns 0..3. */
+  ISLOW_1D_QUAD(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2,
+		_mm_slli_epi32, _mm_srai_epi32, _mm_set1_epi32,
+		lo, CONST_BITS-PASS1_BITS);
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    JSIMD_CHECK13_SSE2(chk, lo[ctr]);
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(chk, zero)) != 0xFFFF) {
+    jpeg_idct_islow_quad(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 2: process rows. */
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  ISLOW_1D_QUAD(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2,
+		_mm_slli_epi32, _mm_srai_epi32, _mm_set1_epi32,
+		lo, CONST_BITS+PASS1_BITS+3);
+  ISLOW_1D_QUAD(__m128i, _mm_add_epi32, _mm_sub_epi32, MUL_SSE2,
+		_mm_slli_epi32, _mm_srai_epi32, _mm_set1_epi32,
+		hi, CONST_BITS+PASS1_BITS+3);
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    lo[ctr] = JSIMD_RANGE_FOLD_SSE2(lo[ctr]);
+    hi[ctr] = JSIMD_RANGE_FOLD_SSE2(hi[ctr]);
+  }
+  JSIMD_TRANSPOSE8_SSE2(lo, hi);
+  JSIMD_STORE8X8_SSE2(lo, hi, output_buf, output_col);
+}
+
+
+JSIMD_TARGET("avx2")
+GLOBAL(void)
+jpeg_idct_islow_quad_avx2 (j_decompress_ptr cinfo,
+			   jpeg_component_info * compptr, JCOEFPTR coef_block,
+			   JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  __m256i d[DCTSIZE];		/* working rows */
+  __m256i chk = _mm256_setzero_si256();
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  int ctr;
+
+  for (ctr = 0; ctr < 4; ctr++) {
+    d[ctr] = _mm256_mullo_epi32(_mm256_cvtepi16_epi32(_mm_loadu_si128(
+				  (const __m128i *) (coef_block + ctr*DCTSIZE))),
+				_mm256_loadu_si256((const __m256i *)
+						   (quantptr + ctr*DCTSIZE)));
+    JSIMD_CHECK13_AVX2(chk, d[ctr]);
+  }
+  if (! _mm256_testz_si256(chk, chk)) {
+    jpeg_idct_islow_quad(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+  for (ctr = 4; ctr < DCTSIZE; ctr++)
+    d[ctr] = _mm256_setzero_si256();
+
+  /* Pass 1: process columns. */
+  ISLOW_1D_QUAD(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2,
+		_mm256_slli_epi32, _mm256_srai_epi32, _mm256_set1_epi32,
+		d, CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: process rows; columns 4..7 of pass 1's output are zero. */
+  JSIMD_TRANSPOSE8_EPI32(d);
+  ISLOW_1D_QUAD(__m256i, _mm256_add_epi32, _mm256_sub_epi32, MUL_AVX2,
+		_mm256_slli_epi32, _mm256_srai_epi32, _mm256_set1_epi32,
+		d, CONST_BITS+PASS1_BITS+3);
+  for (ctr = 0; ctr < DCTSIZE; ctr++)
+    d[ctr] = JSIMD_RANGE_FOLD_AVX2(d[ctr]);
+  JSIMD_TRANSPOSE8_EPI32(d);
+  JSIMD_STORE8X8_AVX2(d, output_buf, output_col);
+}
+
+#endif /* JSIMD_SUPPORTED */
+
 #endif /* DCT_ISLOW_SUPPORTED */
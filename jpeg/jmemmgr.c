@@ -73,6 +73,18 @@ extern char * getenv JPP((const char * name));
 #define ALIGN_TYPE  double
 #endif
 
+/*
+ * Sample rows made by alloc_sarray additionally start on SAMPLE_ROW_ALIGN
+ * byte boundaries, and are padded out to a multiple of that many bytes,
+ * so that vectorized loops can use aligned loads and run a little past the
+ * end of the row.  This must be a power of 2; define it as 0 to get the
+ * old packed layout.
+ */
+
+#ifndef SAMPLE_ROW_ALIGN	/* so can override from jconfig.h */
+#define SAMPLE_ROW_ALIGN  64	/* a cache line, and an AVX-512 register */
+#endif
+
 
 /*
  * We allocate objects from "pools", where each pool is gotten with a single
@@ -304,6 +316,8 @@ alloc_small (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
 	out_of_memory(cinfo, 2); /* jpeg_get_small failed */
     }
     mem->total_space_allocated += min_request + slop;
+    if (mem->total_space_allocated > mem->pub.peak_memory_used)
+      mem->pub.peak_memory_used = mem->total_space_allocated;
     /* Success, initialize the new pool header and add to end of list */
     hdr_ptr->hdr.next = NULL;
     hdr_ptr->hdr.bytes_used = 0;
@@ -364,6 +378,8 @@ alloc_large (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
   if (hdr_ptr == NULL)
     out_of_memory(cinfo, 4);	/* jpeg_get_large failed */
   mem->total_space_allocated += sizeofobject + SIZEOF(large_pool_hdr);
+  if (mem->total_space_allocated > mem->pub.peak_memory_used)
+    mem->pub.peak_memory_used = mem->total_space_allocated;
 
   /* Success, initialize the new pool header and add to list */
   hdr_ptr->hdr.next = mem->large_list[pool_id];
@@ -378,6 +394,22 @@ alloc_large (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
 }
 
 
+/*
+ * Round a sample row width up for SAMPLE_ROW_ALIGN.
+ */
+
+LOCAL(JDIMENSION)
+pad_sample_row (JDIMENSION samplesperrow)
+{
+#if SAMPLE_ROW_ALIGN > 0
+  return (JDIMENSION) jround_up((long) samplesperrow,
+				(long) (SAMPLE_ROW_ALIGN / SIZEOF(JSAMPLE)));
+#else
+  return samplesperrow;
+#endif
+}
+
+
 /*
  * Creation of 2-D sample arrays.
  * The pointers are in near heap, the samples themselves in FAR heap.
@@ -402,8 +434,10 @@ alloc_sarray (j_common_ptr cinfo, int pool_id,
   JDIMENSION rowsperchunk, currow, i;
   long ltemp;
 
+  samplesperrow = pad_sample_row(samplesperrow);
+
   /* Calculate max # of rows allowed in one allocation chunk */
-  ltemp = (MAX_ALLOC_CHUNK-SIZEOF(large_pool_hdr)) /
+  ltemp = (MAX_ALLOC_CHUNK-SIZEOF(large_pool_hdr)-SAMPLE_ROW_ALIGN) /
 	  ((long) samplesperrow * SIZEOF(JSAMPLE));
   if (ltemp <= 0)
     ERREXIT(cinfo, JERR_WIDTH_OVERFLOW);
@@ -423,7 +457,11 @@ alloc_sarray (j_common_ptr cinfo, int pool_id,
     rowsperchunk = MIN(rowsperchunk, numrows - currow);
     workspace = (JSAMPROW) alloc_large(cinfo, pool_id,
 	(size_t) ((size_t) rowsperchunk * (size_t) samplesperrow
-		  * SIZEOF(JSAMPLE)));
+		  * SIZEOF(JSAMPLE) + SAMPLE_ROW_ALIGN));
+#if SAMPLE_ROW_ALIGN > 0
+    workspace = (JSAMPROW) (((size_t) workspace + (SAMPLE_ROW_ALIGN-1)) &
+			    ~((size_t) (SAMPLE_ROW_ALIGN-1)));
+#endif
     for (i = rowsperchunk; i > 0; i--) {
       result[currow++] = workspace;
       workspace += samplesperrow;
@@ -538,7 +576,7 @@ request_virt_sarray (j_common_ptr cinfo, int pool_id, boolean pre_zero,
 
   result->mem_buffer = NULL;	/* marks array not yet realized */
   result->rows_in_array = numrows;
-  result->samplesperrow = samplesperrow;
+  result->samplesperrow = pad_sample_row(samplesperrow);
   result->maxaccess = maxaccess;
   result->pre_zero = pre_zero;
   result->b_s_open = FALSE;	/* no associated backing-store object */
@@ -1090,6 +1128,8 @@ jinit_memory_mgr (j_common_ptr cinfo)
   mem->virt_barray_list = NULL;
 
   mem->total_space_allocated = SIZEOF(my_memory_mgr);
+  mem->pub.peak_memory_used = mem->total_space_allocated;
+  mem->pub.temp_directory = NULL;
 
   /* Declare ourselves open for business */
   cinfo->mem = & mem->pub;
@@ -113,7 +113,9 @@ EXTERN(long) jpeg_mem_available JPP((j_common_ptr cinfo,
  * are private to the system-dependent backing store routines.
  */
 
-#define TEMP_NAME_LENGTH   64	/* max length of a temporary file's name */
+#ifndef TEMP_NAME_LENGTH	/* may be overridden in jconfig.h */
+#define TEMP_NAME_LENGTH   256	/* max length of a temporary file's name */
+#endif
 
 
 #ifdef USE_MSDOS_MEMMGR		/* DOS-specific junk */
@@ -0,0 +1,609 @@
+/*
+ * jmemtmp.c
+ *
+ * Copyright (C) 1992-1997, Thomas G. Lane.
+ * This file is part of the Independent JPEG Group's software.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file provides a generic implementation of the system-dependent
+ * portion of the JPEG memory manager, along the lines of jmemname.c.
+ * The differences are:
+ *  1.  No memory limit is imposed unless the application (or the JPEGMEM
+ *      environment variable) sets max_memory_to_use; with a limit set,
+ *      virtual arrays that don't fit are spilled to a temporary file.
+ *  2.  The temporary files are created in cinfo->mem->temp_directory if
+ *      the application sets it, else in $TMPDIR, else in TEMP_DIRECTORY.
+ *  3.  Where mkstemp() is available it is used to create the file, and the
+ *      file is unlinked as soon as it is open, so nothing is left behind
+ *      even if the process dies.
+ *  4.  With GCC-compatible compilers, memory comes from a per-thread arena
+ *      rather than straight from malloc(); see below.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jmemsys.h"		/* import the system-dependent declarations */
+
+#ifndef HAVE_STDLIB_H		/* <stdlib.h> should declare malloc(),free() */
+extern void * malloc JPP((size_t size));
+extern void free JPP((void *ptr));
+extern char * getenv JPP((const char * name));
+#endif
+
+#ifndef SEEK_SET		/* pre-ANSI systems may not define this; */
+#define SEEK_SET  0		/* if not, assume 0 is correct */
+#endif
+
+#ifdef DONT_USE_B_MODE		/* define mode parameters for fopen() */
+#define RW_BINARY	"w+"
+#else
+#define RW_BINARY	"w+b"
+#endif
+
+#if defined(_WIN32) && !defined(NO_MKSTEMP)
+#define NO_MKSTEMP		/* Windows C libraries lack mkstemp() */
+#endif
+
+#if !defined(__GNUC__) && !defined(NO_ARENA)
+#define NO_ARENA		/* need __thread and __atomic builtins */
+#endif
+
+#ifndef NO_ARENA
+#include <pthread.h>
+/* Weak, so that programs need not link with -lpthread */
+#pragma weak pthread_once
+#pragma weak pthread_key_create
+#pragma weak pthread_setspecific
+#endif
+
+#if defined(__linux__) && !defined(NO_ARENA) && !defined(NO_HUGE_PAGES)
+#define USE_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
+#ifndef NO_MKSTEMP
+extern int mkstemp JPP((char * tmpl));
+extern int unlink JPP((const char * path));
+extern int close JPP((int fd));
+extern FILE * fdopen JPP((int fd, const char * mode));
+#endif
+
+
+/*
+ * Selection of a file name for a temporary file.
+ *
+ * TEMP_DIRECTORY is only the last resort; see above.  Unlike jmemname.c
+ * it need not end with a directory separator, one is added if missing.
+ */
+
+#ifndef TEMP_DIRECTORY		/* can override from jconfig.h or Makefile */
+#define TEMP_DIRECTORY  "/tmp/"	/* recommended setting for Unix */
+#endif
+
+#ifndef NO_MKSTEMP
+#define TEMP_FILE_NAME  "JPGXXXXXX" /* mkstemp wants six trailing X's */
+#else
+#define TEMP_FILE_NAME  "JPG%03d.TMP"
+static int next_file_num;	/* to distinguish among several temp files */
+#endif
+
+LOCAL(void)
+select_file_name (j_common_ptr cinfo, char * fname)
+{
+  const char * dir = cinfo->mem->temp_directory;
+  size_t len;
+
+#ifndef NO_GETENV
+  if (dir == NULL || *dir == '\0')
+    dir = getenv("TMPDIR");
+#endif
+  if (dir == NULL || *dir == '\0')
+    dir = TEMP_DIRECTORY;
+
+  /* Leave room for a separator and the file name itself */
+  len = strlen(dir);
+  if (len + 1 + 12 >= TEMP_NAME_LENGTH)
+    ERREXITS(cinfo, JERR_TFILE_CREATE, dir);
+  MEMCOPY(fname, dir, len);
+  if (fname[len-1] != '/' && fname[len-1] != '\\')
+    fname[len++] = '/';
+#ifndef NO_MKSTEMP
+  strcpy(fname + len, TEMP_FILE_NAME);
+#else
+  next_file_num++;		/* advance counter */
+  sprintf(fname + len, TEMP_FILE_NAME, next_file_num);
+#endif
+}
+
+
+#ifdef NO_ARENA
+
+/*
+ * Memory allocation and freeing are controlled by the regular library
+ * routines malloc() and free().
+ */
+
+GLOBAL(void *)
+jpeg_get_small (j_common_ptr cinfo, size_t sizeofobject)
+{
+  return (void *) malloc(sizeofobject);
+}
+
+GLOBAL(void)
+jpeg_free_small (j_common_ptr cinfo, void * object, size_t sizeofobject)
+{
+  free(object);
+}
+
+#else /* !NO_ARENA */
+
+/*
+ * The per-thread arena.
+ *
+ * jmemmgr.c asks for a handful of big pool blocks per image, and the next
+ * image in a batch usually asks for exactly the same sizes again.  Each
+ * request is rounded up to a size class (four per power of 2), and freed
+ * blocks go on a free list for their class, so that the next image finds
+ * its blocks ready and already paged in.
+ *
+ * Blocks up to ARENA_BUMP_MAX bytes are cut from ARENA_CHUNK_SIZE chunks.
+ * When the last block of a thread is freed, normally by jpeg_destroy, the
+ * chunks are rewound and the free lists emptied at once; the chunks are
+ * kept for the next image.  Bigger blocks (mostly the coefficient arrays
+ * of progressive and multi-pass images) are allocated individually, with
+ * huge pages on Linux when they are large enough.  They are cached on
+ * their own free lists, and at rewind time any cached block the image
+ * just finished did not use is given back to the system.
+ *
+ * A JPEG object may be destroyed by another thread than the one that
+ * created it; the blocks then only leave the owning arena's count (small
+ * ones) or go straight back to the system (big ones).  The owning thread
+ * itself holds one count, dropped when it exits, and the arena is freed
+ * by whichever thread drops the count to zero.
+ */
+
+#ifndef ARENA_CHUNK_SIZE	/* can override from jconfig.h or Makefile */
+#define ARENA_CHUNK_SIZE  1048576L
+#endif
+#ifndef ARENA_BUMP_MAX
+#define ARENA_BUMP_MAX  (ARENA_CHUNK_SIZE/4)
+#endif
+#define HUGE_PAGE_SIZE  2097152L /* 2MB pages on x86-64 and most ARM64 */
+#define ARENA_ALIGN  64		/* blocks start on a cache line */
+#define ARENA_CLASSES  256	/* enough for any size_t */
+
+typedef struct arena_struct * arena_ptr;
+typedef struct chunk_struct * chunk_ptr;
+typedef union block_union * block_ptr;
+
+struct chunk_struct {
+  chunk_ptr next;		/* next chunk, or NULL */
+  size_t size;			/* usable bytes after this header */
+  double dummy;			/* keep the usable space aligned */
+};
+
+union block_union {
+  struct {
+    block_ptr next;		/* free list link */
+    arena_ptr owner;		/* arena the block came from */
+    size_t size;		/* bytes after this header */
+    int size_class;		/* index into the free lists */
+    int kind;			/* BLOCK_xxx, below */
+    long gen;			/* arena generation it was last used in */
+  } hdr;
+  char dummy[ARENA_ALIGN];	/* keep the payload aligned */
+};
+
+#define BLOCK_BUMP  0		/* cut from a chunk */
+#define BLOCK_HEAP  1		/* from malloc */
+#define BLOCK_MMAP  2		/* from mmap, with huge pages */
+
+struct arena_struct {
+  chunk_ptr first_chunk;	/* all chunks, in order of use */
+  chunk_ptr cur_chunk;		/* chunk being cut up, or NULL */
+  size_t cur_used;		/* bytes of cur_chunk given out */
+  long live;			/* blocks in use, plus 1 for the thread */
+  long gen;			/* bumped at each rewind */
+  block_ptr small_free[ARENA_CLASSES];
+  block_ptr big_free[ARENA_CLASSES];
+};
+
+static __thread arena_ptr thread_arena;
+static pthread_key_t arena_key;	/* only for its destructor */
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Round a request up to its size class: 4, 5, 6 or 7 times a power of 2,
+ * so no more than a quarter of a block is ever wasted.
+ */
+
+LOCAL(int)
+size_class (size_t size, size_t * class_size)
+{
+  int shift = 4;
+  size_t mult;
+
+  while (shift < (int) (SIZEOF(size_t)*8 - 4) && ((size_t) 8 << shift) < size)
+    shift++;
+  mult = (size + ((size_t) 1 << shift) - 1) >> shift;
+  if (mult < 4)
+    mult = 4;
+  *class_size = mult << shift;
+  return (shift-4) * 4 + (int) (mult-4);
+}
+
+
+LOCAL(void *)
+align_up (void * ptr)
+{
+  return (void *) (((size_t) ptr + (ARENA_ALIGN-1)) &
+		   ~((size_t) (ARENA_ALIGN-1)));
+}
+
+
+/*
+ * Rewind an arena once none of its blocks are in use.
+ */
+
+LOCAL(void)
+release_big (block_ptr block)
+{
+#ifdef USE_HUGE_PAGES
+  if (block->hdr.kind == BLOCK_MMAP) {
+    size_t len = block->hdr.size + SIZEOF(union block_union);
+    munmap((void *) block, (len + HUGE_PAGE_SIZE-1) &
+			   ~((size_t) HUGE_PAGE_SIZE-1));
+    return;
+  }
+#endif
+  free(*((void **) block - 1));	/* the pointer malloc returned */
+}
+
+LOCAL(void)
+rewind_arena (arena_ptr arena)
+{
+  block_ptr block, next, * link;
+  int i;
+
+  arena->cur_chunk = arena->first_chunk;
+  arena->cur_used = 0;
+  MEMZERO(arena->small_free, SIZEOF(arena->small_free));
+  for (i = 0; i < ARENA_CLASSES; i++) {
+    link = &arena->big_free[i];
+    for (block = *link; block != NULL; block = next) {
+      next = block->hdr.next;
+      if (block->hdr.gen != arena->gen) {
+	*link = next;		/* not wanted by the last image */
+	release_big(block);
+      } else
+	link = &block->hdr.next;
+    }
+  }
+  arena->gen++;
+}
+
+LOCAL(void)
+free_arena (arena_ptr arena)
+{
+  chunk_ptr chunk, next;
+
+  arena->gen++;			/* so rewind releases all big blocks */
+  rewind_arena(arena);
+  for (chunk = arena->first_chunk; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free((void *) chunk);
+  }
+  free((void *) arena);
+}
+
+LOCAL(void)
+drop_arena_ref (arena_ptr arena)
+{
+  if (__atomic_sub_fetch(&arena->live, 1L, __ATOMIC_ACQ_REL) == 0)
+    free_arena(arena);
+}
+
+METHODDEF(void)
+thread_exit (void * arg)
+{
+  thread_arena = NULL;		/* in case of later use in this thread */
+  drop_arena_ref((arena_ptr) arg);
+}
+
+METHODDEF(void)
+make_arena_key (void)
+{
+  pthread_key_create(&arena_key, thread_exit);
+}
+
+
+/*
+ * Get a fresh block of the given class.
+ */
+
+LOCAL(block_ptr)
+new_bump_block (arena_ptr arena, size_t class_size)
+{
+  chunk_ptr chunk = arena->cur_chunk;
+  size_t need = (class_size + SIZEOF(union block_union) + (ARENA_ALIGN-1)) &
+		~((size_t) (ARENA_ALIGN-1));
+  block_ptr block;
+
+  /* Move on to the next chunk if this one is too full, making one if
+   * necessary.  What is left of the old one stays unused until rewind.
+   */
+  while (chunk == NULL || arena->cur_used + need > chunk->size) {
+    if (chunk != NULL && chunk->next != NULL) {
+      chunk = chunk->next;
+    } else {
+      chunk_ptr fresh = (chunk_ptr) malloc(SIZEOF(struct chunk_struct) +
+					   ARENA_CHUNK_SIZE + ARENA_ALIGN);
+      if (fresh == NULL)
+	return NULL;
+      fresh->next = NULL;
+      fresh->size = ARENA_CHUNK_SIZE;
+      if (chunk != NULL)
+	chunk->next = fresh;
+      else			/* only before the first chunk is made */
+	arena->first_chunk = fresh;
+      chunk = fresh;
+    }
+    arena->cur_chunk = chunk;
+    arena->cur_used = 0;
+  }
+
+  block = (block_ptr) align_up((void *) (chunk + 1));
+  block = (block_ptr) ((char *) block + arena->cur_used);
+  arena->cur_used += need;
+  block->hdr.kind = BLOCK_BUMP;
+  return block;
+}
+
+LOCAL(block_ptr)
+new_big_block (size_t class_size)
+{
+  size_t need = class_size + SIZEOF(union block_union);
+  block_ptr block;
+  void * raw;
+
+#ifdef USE_HUGE_PAGES
+  if (need >= (size_t) HUGE_PAGE_SIZE) {
+    need = (need + HUGE_PAGE_SIZE-1) & ~((size_t) HUGE_PAGE_SIZE-1);
+    raw = mmap(NULL, need, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+      (void) madvise(raw, need, MADV_HUGEPAGE); /* only a hint */
+#endif
+      block = (block_ptr) raw;
+      block->hdr.kind = BLOCK_MMAP;
+      return block;
+    }
+  }
+#endif
+  /* Over-allocate to align, and keep the malloc pointer just below */
+  raw = malloc(need + ARENA_ALIGN + SIZEOF(void *));
+  if (raw == NULL)
+    return NULL;
+  block = (block_ptr) align_up((void *) ((void **) raw + 1));
+  *((void **) block - 1) = raw;
+  block->hdr.kind = BLOCK_HEAP;
+  return block;
+}
+
+
+GLOBAL(void *)
+jpeg_get_small (j_common_ptr cinfo, size_t sizeofobject)
+{
+  arena_ptr arena = thread_arena;
+  block_ptr block, * freelist;
+  size_t class_size;
+  int cls;
+
+  if (arena == NULL) {
+    arena = (arena_ptr) malloc(SIZEOF(struct arena_struct));
+    if (arena == NULL)
+      return NULL;
+    MEMZERO(arena, SIZEOF(struct arena_struct));
+    arena->live = 1;		/* this thread's own count */
+    thread_arena = arena;
+    if (pthread_key_create != NULL) {
+      pthread_once(&arena_once, make_arena_key);
+      pthread_setspecific(arena_key, (void *) arena);
+    }
+  }
+  /* Catch up on a rewind missed because another thread did the last free */
+  if (__atomic_load_n(&arena->live, __ATOMIC_ACQUIRE) == 1 &&
+      (arena->cur_chunk != arena->first_chunk || arena->cur_used != 0))
+    rewind_arena(arena);
+
+  cls = size_class(sizeofobject, &class_size);
+  if (cls >= ARENA_CLASSES)
+    return NULL;
+  freelist = (class_size <= (size_t) ARENA_BUMP_MAX) ?
+	     &arena->small_free[cls] : &arena->big_free[cls];
+  if ((block = *freelist) != NULL) {
+    *freelist = block->hdr.next;
+  } else {
+    if (class_size <= (size_t) ARENA_BUMP_MAX)
+      block = new_bump_block(arena, class_size);
+    else
+      block = new_big_block(class_size);
+    if (block == NULL)
+      return NULL;
+    block->hdr.owner = arena;
+    block->hdr.size = class_size;
+    block->hdr.size_class = cls;
+  }
+  block->hdr.gen = arena->gen;
+  __atomic_add_fetch(&arena->live, 1L, __ATOMIC_RELAXED);
+  return (void *) (block + 1);
+}
+
+GLOBAL(void)
+jpeg_free_small (j_common_ptr cinfo, void * object, size_t sizeofobject)
+{
+  block_ptr block = (block_ptr) object - 1;
+  arena_ptr arena = block->hdr.owner;
+  int cls = block->hdr.size_class;
+
+  if (arena != thread_arena) {
+    /* Freed by a foreign thread: don't touch the owner's free lists */
+    if (block->hdr.kind != BLOCK_BUMP)
+      release_big(block);
+    drop_arena_ref(arena);
+    return;
+  }
+  if (block->hdr.kind == BLOCK_BUMP) {
+    block->hdr.next = arena->small_free[cls];
+    arena->small_free[cls] = block;
+  } else {
+    block->hdr.next = arena->big_free[cls];
+    arena->big_free[cls] = block;
+  }
+  if (__atomic_sub_fetch(&arena->live, 1L, __ATOMIC_ACQ_REL) == 1)
+    rewind_arena(arena);
+}
+
+#endif /* NO_ARENA */
+
+
+/*
+ * "Large" objects are treated the same as "small" ones.
+ */
+
+GLOBAL(void FAR *)
+jpeg_get_large (j_common_ptr cinfo, size_t sizeofobject)
+{
+  return (void FAR *) jpeg_get_small(cinfo, sizeofobject);
+}
+
+GLOBAL(void)
+jpeg_free_large (j_common_ptr cinfo, void FAR * object, size_t sizeofobject)
+{
+  jpeg_free_small(cinfo, (void *) object, sizeofobject);
+}
+
+
+/*
+ * This routine computes the total memory space available for allocation.
+ * A max_memory_to_use of zero (the default) means there is no limit, so
+ * everything is kept in memory as with jmemnobs.c.
+ */
+
+GLOBAL(long)
+jpeg_mem_available (j_common_ptr cinfo, long min_bytes_needed,
+		    long max_bytes_needed, long already_allocated)
+{
+  if (cinfo->mem->max_memory_to_use <= 0)
+    return max_bytes_needed;
+  return cinfo->mem->max_memory_to_use - already_allocated;
+}
+
+
+/*
+ * Backing store (temporary file) management.
+ * Backing store objects are only used when the value returned by
+ * jpeg_mem_available is less than the total space needed.
+ */
+
+
+METHODDEF(void)
+read_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+		    void FAR * buffer_address,
+		    long file_offset, long byte_count)
+{
+  if (fseek(info->temp_file, file_offset, SEEK_SET))
+    ERREXIT(cinfo, JERR_TFILE_SEEK);
+  if (JFREAD(info->temp_file, buffer_address, byte_count)
+      != (size_t) byte_count)
+    ERREXIT(cinfo, JERR_TFILE_READ);
+}
+
+
+METHODDEF(void)
+write_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+		     void FAR * buffer_address,
+		     long file_offset, long byte_count)
+{
+  if (fseek(info->temp_file, file_offset, SEEK_SET))
+    ERREXIT(cinfo, JERR_TFILE_SEEK);
+  if (JFWRITE(info->temp_file, buffer_address, byte_count)
+      != (size_t) byte_count)
+    ERREXIT(cinfo, JERR_TFILE_WRITE);
+}
+
+
+METHODDEF(void)
+close_backing_store (j_common_ptr cinfo, backing_store_ptr info)
+{
+  fclose(info->temp_file);	/* close the file */
+#ifdef NO_MKSTEMP
+  remove(info->temp_name);	/* delete the file */
+#endif
+  TRACEMSS(cinfo, 1, JTRC_TFILE_CLOSE, info->temp_name);
+}
+
+
+/*
+ * Initial opening of a backing-store object.
+ */
+
+GLOBAL(void)
+jpeg_open_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+			 long total_bytes_needed)
+{
+#ifndef NO_MKSTEMP
+  int fd;
+
+  select_file_name(cinfo, info->temp_name);
+  if ((fd = mkstemp(info->temp_name)) < 0)
+    ERREXITS(cinfo, JERR_TFILE_CREATE, info->temp_name);
+  if ((info->temp_file = fdopen(fd, RW_BINARY)) == NULL) {
+    close(fd);
+    unlink(info->temp_name);
+    ERREXITS(cinfo, JERR_TFILE_CREATE, info->temp_name);
+  }
+  unlink(info->temp_name);	/* file lives on until it is closed */
+#else
+  FILE * tfile;
+
+  /* Keep generating file names till we find one that's not in use */
+  for (;;) {
+    select_file_name(cinfo, info->temp_name);
+    if ((tfile = fopen(info->temp_name, "rb")) == NULL)
+      break;
+    fclose(tfile);		/* oops, it's there; close tfile & try again */
+  }
+  if ((info->temp_file = fopen(info->temp_name, RW_BINARY)) == NULL)
+    ERREXITS(cinfo, JERR_TFILE_CREATE, info->temp_name);
+#endif
+  info->read_backing_store = read_backing_store;
+  info->write_backing_store = write_backing_store;
+  info->close_backing_store = close_backing_store;
+  TRACEMSS(cinfo, 1, JTRC_TFILE_OPEN, info->temp_name);
+}
+
+
+/*
+ * These routines take care of any system-dependent initialization and
+ * cleanup required.
+ */
+
+GLOBAL(long)
+jpeg_mem_init (j_common_ptr cinfo)
+{
+#ifdef DEFAULT_MAX_MEM		/* set by configure --enable-maxmem */
+  return DEFAULT_MAX_MEM;
+#else
+  return 0L;			/* no limit */
+#endif
+}
+
+GLOBAL(void)
+jpeg_mem_term (j_common_ptr cinfo)
+{
+  /* no work */
+}
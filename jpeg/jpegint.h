@@ -107,6 +107,11 @@ struct jpeg_forward_dct {
 			      JSAMPARRAY sample_data, JBLOCKROW coef_blocks,
 			      JDIMENSION start_row, JDIMENSION start_col,
 			      JDIMENSION num_blocks));
+  /* requantize blocks saved by forward_DCT in target-size mode */
+  JMETHOD(void, quantize, (j_compress_ptr cinfo,
+			   jpeg_component_info * compptr,
+			   JBLOCKROW raw_blocks, JBLOCKROW coef_blocks,
+			   JDIMENSION num_blocks));
 };
 
 /* Entropy encoding */
@@ -214,6 +219,13 @@ struct jpeg_entropy_decoder {
   /* This is here to share code between baseline and progressive decoders; */
   /* other modules probably should not use it */
   boolean insufficient_data;	/* set TRUE after emitting warning */
+
+  /* If not NULL, decode_mcu stores here the highest zigzag index it wrote
+   * in each block of the MCU (0 if only the DC term, or nothing, was
+   * stored).  The coefficient controller uses this to pick a cheaper IDCT
+   * and to re-zero only the coefficients that were written.
+   */
+  int * last_index;
 };
 
 /* Inverse DCT (also performs dequantization) */
@@ -226,6 +238,12 @@ struct jpeg_inverse_dct {
   JMETHOD(void, start_pass, (j_decompress_ptr cinfo));
   /* It is useful to allow each component to have a separate IDCT method. */
   inverse_DCT_method_ptr inverse_DCT[MAX_COMPONENTS];
+  /* Optional equivalents of inverse_DCT[] (NULL if none) for blocks whose
+   * only nonzero coefficient is the DC term, and for blocks whose nonzero
+   * coefficients all lie in the upper-left 4x4 quadrant.
+   */
+  inverse_DCT_method_ptr inverse_DCT_dc[MAX_COMPONENTS];
+  inverse_DCT_method_ptr inverse_DCT_quad[MAX_COMPONENTS];
 };
 
 /* Upsampling (note that upsampler must also call color converter) */
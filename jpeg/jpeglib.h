@@ -92,6 +92,14 @@ typedef struct {
    * (See jpeg_suppress_tables for an example.)
    */
   boolean sent_table;		/* TRUE when table has been output */
+  /* jpeg_add_quant_table also records the basic table and force_baseline
+   * flag it was given, so that a compressor searching for target_size can
+   * rescale the table to other qualities.  basic_valid is FALSE in tables
+   * made any other way; the search leaves those as they are.
+   */
+  boolean basic_valid;		/* TRUE if the next two fields are set */
+  boolean basic_baseline;	/* force_baseline given with basicval */
+  UINT16 basicval[DCTSIZE2];	/* basic table before scaling */
 } JQUANT_TBL;
 
 
@@ -209,9 +217,26 @@ typedef enum {
 	JCS_RGB,		/* red/green/blue */
 	JCS_YCbCr,		/* Y/Cb/Cr (also known as YUV) */
 	JCS_CMYK,		/* C/M/Y/K */
-	JCS_YCCK		/* Y/Cb/Cr/K */
+	JCS_YCCK,		/* Y/Cb/Cr/K */
+	/* Variants of RGB with four bytes per pixel (e.g. Tk photo pixels).
+	 * On input the filler byte is ignored; on output it is set to
+	 * MAXJSAMPLE, i.e. opaque alpha.  Not valid as JPEG color spaces.
+	 */
+	JCS_EXT_RGBX,		/* red/green/blue/x */
+	JCS_EXT_BGRX,		/* blue/green/red/x */
+	JCS_EXT_RGBA,		/* red/green/blue/alpha */
+	JCS_EXT_BGRA,		/* blue/green/red/alpha */
+	JCS_EXT_XRGB,		/* x/red/green/blue */
+	JCS_EXT_XBGR,		/* x/blue/green/red */
+	JCS_EXT_ARGB,		/* alpha/red/green/blue */
+	JCS_EXT_ABGR		/* alpha/blue/green/red */
 } J_COLOR_SPACE;
 
+/* Applications can test this to see whether JCS_EXT_RGBA and friends exist
+ * (the name is that used by libjpeg-turbo for the same color spaces).
+ */
+#define JCS_ALPHA_EXTENSIONS	1
+
 /* DCT/IDCT algorithm options. */
 
 typedef enum {
@@ -323,6 +348,7 @@ struct jpeg_compress_struct {
   boolean CCIR601_sampling;	/* TRUE=first samples are cosited */
   int smoothing_factor;		/* 1..100, or 0 for no input smoothing */
   J_DCT_METHOD dct_method;	/* DCT algorithm selector */
+  long target_size;		/* if > 0, max file size: quality is chosen */
 
   /* The restart interval can be specified in absolute MCUs by setting
    * restart_interval, or in MCU rows by setting restart_in_rows
@@ -800,6 +826,14 @@ struct jpeg_memory_mgr {
 
   /* Maximum allocation request accepted by alloc_large. */
   long max_alloc_chunk;
+
+  /* Directory for backing-store files, or NULL for the system default.
+   * Only consulted by memory managers that construct file names (jmemtmp.c).
+   */
+  const char * temp_directory;
+
+  /* High-water mark of the space allocated so far, for statistics only. */
+  long peak_memory_used;
 };
 
 
@@ -877,6 +911,7 @@ typedef JMETHOD(boolean, jpeg_marker_parser_method, (j_decompress_ptr cinfo));
 #define jpeg_abort		jAbort
 #define jpeg_destroy		jDestroy
 #define jpeg_resync_to_restart	jResyncRestart
+#define jpeg_simd_kernel	jSimdKernel
 #endif /* NEED_SHORT_EXTERNAL_NAMES */
 
 
@@ -1037,6 +1072,9 @@ EXTERN(void) jpeg_destroy JPP((j_common_ptr cinfo));
 EXTERN(boolean) jpeg_resync_to_restart JPP((j_decompress_ptr cinfo,
 					    int desired));
 
+/* Report the SIMD kernels chosen for this CPU (see libjpeg.doc) */
+EXTERN(const char *) jpeg_simd_kernel JPP((int which, const char ** iset));
+
 
 /* These marker codes are exported since applications and data source modules
  * are likely to want to use them.
@@ -13,6 +13,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef QUANT_1PASS_SUPPORTED
 
@@ -135,6 +136,25 @@ typedef INT32 LOCFSERROR;	/* be sure calculation temps are big enough */
 typedef FSERROR FAR *FSERRPTR;	/* pointer to error array (in FAR storage!) */
 
 
+/* Declarations for the SIMD versions of color_quantize3 and
+ * quantize3_ord_dither.
+ *
+ * These cannot look up colorindex[] for a vector of pixels, so instead they
+ * use the fact that each component's entry steps up by the same amount
+ * (the stride of that component in the colormap) at each of a few input
+ * values, its "limits": colorindex[i][j] is that step times the number of
+ * limits below j.  A pixel's colormap index is then formed by counting the
+ * limits below each component value, one compare per limit.  With 3 components there are only a few limits
+ * each, as the colormap has no more than MAXJSAMPLE+1 entries.
+ */
+
+#ifdef JSIMD_SUPPORTED
+#define SIMD_INDEX_SUPPORTED
+#endif
+
+#define MAX_SIMD_LIMITS 16	/* most limits per component for SIMD */
+
+
 /* Private subobject */
 
 #define MAX_Q_COMPS 4		/* max components I can handle */
@@ -162,6 +182,15 @@ typedef struct {
   /* Variables for Floyd-Steinberg dithering */
   FSERRPTR fserrors[MAX_Q_COMPS]; /* accumulated errors */
   boolean on_odd_row;		/* flag to remember which row we are on */
+
+#ifdef SIMD_INDEX_SUPPORTED
+  /* Variables for the SIMD paths, set up by create_colorindex */
+  int simd;			/* usable JSIMD_xxx sets, 0 if none */
+  int nlimits[3];		/* # of limits for each component */
+  /* Each step and limit is repeated for the 16 lanes of an AVX2 vector */
+  INT16 index_step[3][16];
+  INT16 index_limit[3][MAX_SIMD_LIMITS][16];
+#endif
 } my_cquantizer;
 
 typedef my_cquantizer * my_cquantize_ptr;
@@ -338,10 +367,13 @@ create_colorindex (j_decompress_ptr cinfo)
 
   /* For ordered dither, we pad the color index tables by MAXJSAMPLE in
    * each direction (input index values can be -MAXJSAMPLE .. 2*MAXJSAMPLE).
-   * This is not necessary in the other dithering modes.  However, we
-   * flag whether it was done in case user changes dithering mode.
+   * quantize3_fs_dither uses the padding too.  It is not necessary in the
+   * other cases.  However, we flag whether it was done in case user
+   * changes dithering mode.
    */
-  if (cinfo->dither_mode == JDITHER_ORDERED) {
+  if (cinfo->dither_mode == JDITHER_ORDERED ||
+      (cinfo->dither_mode == JDITHER_FS &&
+       cinfo->out_color_components == 3)) {
     pad = MAXJSAMPLE*2;
     cquantize->is_padded = TRUE;
   } else {
@@ -384,6 +416,34 @@ create_colorindex (j_decompress_ptr cinfo)
 	indexptr[MAXJSAMPLE+j] = indexptr[MAXJSAMPLE];
       }
   }
+
+#ifdef SIMD_INDEX_SUPPORTED
+  /* Find the limits for the SIMD paths */
+  cquantize->simd = 0;
+  if (cinfo->out_color_components == 3) {
+    cquantize->simd = jsimd_cpu_support();
+    for (i = 0; i < 3; i++) {
+      indexptr = cquantize->colorindex[i];
+      nci = 0;
+      for (j = 0; j < MAXJSAMPLE; j++) {
+	if (indexptr[j+1] == indexptr[j])
+	  continue;
+	val = GETJSAMPLE(indexptr[j+1]) - GETJSAMPLE(indexptr[j]);
+	if (nci >= MAX_SIMD_LIMITS ||
+	    (nci > 0 && val != cquantize->index_step[i][0])) {
+	  cquantize->simd = 0;	/* not as expected; just use the plain C */
+	  break;
+	}
+	for (k = 0; k < 16; k++) {
+	  cquantize->index_limit[i][nci][k] = (INT16) j;
+	  cquantize->index_step[i][k] = (INT16) val;
+	}
+	nci++;
+      }
+      cquantize->nlimits[i] = nci;
+    }
+  }
+#endif
 }
 
 
@@ -483,6 +543,145 @@ color_quantize (j_decompress_ptr cinfo, JSAMPARRAY input_buf,
 }
 
 
+#ifdef SIMD_INDEX_SUPPORTED
+
+/*
+ * SIMD versions of the inner loops of color_quantize3 and
+ * quantize3_ord_dither, which give the same results.  Each does whole
+ * groups of 16 (SSE2) or 32 (AVX2) pixels and returns how many columns it
+ * did.  dither[i] holds the dither values for component i at 16 columns
+ * (all zero for no dithering), in the lane order the routine needs; see
+ * quantize3_row_simd.  As 16 is ODITHER_SIZE, the same values serve for
+ * every group.
+ */
+
+JSIMD_TARGET("sse2")
+LOCAL(JDIMENSION)
+quantize3_row_sse2 (my_cquantize_ptr cquantize, JSAMPROW inptr,
+		    JSAMPROW outptr, JDIMENSION num_cols,
+		    INT16 dither[3][16])
+{
+  const __m128i bytemask = _mm_set1_epi32(0xFF);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i maxval = _mm_set1_epi16(MAXJSAMPLE);
+  __m128i p[4], x0, x1, n0, n1, lim, step, code0, code1;
+  JDIMENSION col;
+  int ci, j;
+
+  for (col = 0; col + 16 <= num_cols; col += 16) {
+    JSIMD_LOAD_PIXELS3_SSE2(p, inptr)
+    code0 = code1 = zero;
+    for (ci = 0; ci < 3; ci++) {
+      /* Component ci of the 16 pixels, plus dither, range-limited */
+      x0 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p[0], 8*ci),
+					 bytemask),
+			   _mm_and_si128(_mm_srli_epi32(p[1], 8*ci),
+					 bytemask));
+      x1 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p[2], 8*ci),
+					 bytemask),
+			   _mm_and_si128(_mm_srli_epi32(p[3], 8*ci),
+					 bytemask));
+      x0 = _mm_add_epi16(x0, _mm_loadu_si128((const __m128i *) dither[ci]));
+      x1 = _mm_add_epi16(x1, _mm_loadu_si128((const __m128i *)
+					     (dither[ci] + 8)));
+      x0 = _mm_max_epi16(_mm_min_epi16(x0, maxval), zero);
+      x1 = _mm_max_epi16(_mm_min_epi16(x1, maxval), zero);
+      /* Count the limits below each value (a compare gives -1) */
+      n0 = n1 = zero;
+      for (j = 0; j < cquantize->nlimits[ci]; j++) {
+	lim = _mm_loadu_si128((const __m128i *) cquantize->index_limit[ci][j]);
+	n0 = _mm_sub_epi16(n0, _mm_cmpgt_epi16(x0, lim));
+	n1 = _mm_sub_epi16(n1, _mm_cmpgt_epi16(x1, lim));
+      }
+      step = _mm_loadu_si128((const __m128i *) cquantize->index_step[ci]);
+      code0 = _mm_add_epi16(code0, _mm_mullo_epi16(n0, step));
+      code1 = _mm_add_epi16(code1, _mm_mullo_epi16(n1, step));
+    }
+    _mm_storeu_si128((__m128i *) (outptr + col),
+		     _mm_packus_epi16(code0, code1));
+    inptr += 16 * 3;
+  }
+  return col;
+}
+
+JSIMD_TARGET("avx2")
+LOCAL(JDIMENSION)
+quantize3_row_avx2 (my_cquantize_ptr cquantize, JSAMPROW inptr,
+		    JSAMPROW outptr, JDIMENSION num_cols,
+		    INT16 dither[3][16])
+{
+  const __m256i bytemask = _mm256_set1_epi32(0xFF);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i maxval = _mm256_set1_epi16(MAXJSAMPLE);
+  __m256i p[4], x0, x1, n0, n1, dith, lim, step, code0, code1;
+  JDIMENSION col;
+  int ci, j;
+
+  for (col = 0; col + 32 <= num_cols; col += 32) {
+    JSIMD_LOAD_PIXELS3_AVX2(p, inptr)
+    code0 = code1 = zero;
+    for (ci = 0; ci < 3; ci++) {
+      /* The packs leave columns 0-3, 8-11, 4-7, 12-15 (plus 16 for x1) */
+      x0 = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p[0], 8*ci),
+					       bytemask),
+			      _mm256_and_si256(_mm256_srli_epi32(p[1], 8*ci),
+					       bytemask));
+      x1 = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p[2], 8*ci),
+					       bytemask),
+			      _mm256_and_si256(_mm256_srli_epi32(p[3], 8*ci),
+					       bytemask));
+      dith = _mm256_loadu_si256((const __m256i *) dither[ci]);
+      x0 = _mm256_max_epi16(_mm256_min_epi16(_mm256_add_epi16(x0, dith),
+					     maxval), zero);
+      x1 = _mm256_max_epi16(_mm256_min_epi16(_mm256_add_epi16(x1, dith),
+					     maxval), zero);
+      n0 = n1 = zero;
+      for (j = 0; j < cquantize->nlimits[ci]; j++) {
+	lim = _mm256_loadu_si256((const __m256i *)
+				 cquantize->index_limit[ci][j]);
+	n0 = _mm256_sub_epi16(n0, _mm256_cmpgt_epi16(x0, lim));
+	n1 = _mm256_sub_epi16(n1, _mm256_cmpgt_epi16(x1, lim));
+      }
+      step = _mm256_loadu_si256((const __m256i *) cquantize->index_step[ci]);
+      code0 = _mm256_add_epi16(code0, _mm256_mullo_epi16(n0, step));
+      code1 = _mm256_add_epi16(code1, _mm256_mullo_epi16(n1, step));
+    }
+    /* Pack to bytes and put the columns back in order */
+    x0 = _mm256_packus_epi16(code0, code1);
+    x0 = _mm256_permutevar8x32_epi32(x0, _mm256_setr_epi32(0,4,1,5,2,6,3,7));
+    _mm256_storeu_si256((__m256i *) (outptr + col), x0);
+    inptr += 32 * 3;
+  }
+  return col;
+}
+
+LOCAL(JDIMENSION)
+quantize3_row_simd (my_cquantize_ptr cquantize, JSAMPROW inptr,
+		    JSAMPROW outptr, JDIMENSION num_cols, int * dither[3])
+/* Run the best SIMD routine; dither[] are rows of the dither matrices, */
+/* or NULL for no dithering */
+{
+  /* Lane order of the columns for each routine */
+  static const int sse2_order[16] =
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+  static const int avx2_order[16] =
+    { 0, 1, 2, 3, 8, 9, 10, 11, 4, 5, 6, 7, 12, 13, 14, 15 };
+  INT16 lanes[3][16];
+  const int * order;
+  int ci, k;
+
+  order = (cquantize->simd & JSIMD_AVX2) ? avx2_order : sse2_order;
+  for (ci = 0; ci < 3; ci++)
+    for (k = 0; k < 16; k++)
+      lanes[ci][k] = (INT16) (dither[ci] ? dither[ci][order[k]] : 0);
+  if (cquantize->simd & JSIMD_AVX2)
+    return quantize3_row_avx2(cquantize, inptr, outptr, num_cols, lanes);
+  return quantize3_row_sse2(cquantize, inptr, outptr, num_cols, lanes);
+}
+
+#endif /* SIMD_INDEX_SUPPORTED */
+
+
 METHODDEF(void)
 color_quantize3 (j_decompress_ptr cinfo, JSAMPARRAY input_buf,
 		 JSAMPARRAY output_buf, int num_rows)
@@ -501,7 +700,21 @@ color_quantize3 (j_decompress_ptr cinfo, JSAMPARRAY input_buf,
   for (row = 0; row < num_rows; row++) {
     ptrin = input_buf[row];
     ptrout = output_buf[row];
-    for (col = width; col > 0; col--) {
+    col = width;
+#ifdef SIMD_INDEX_SUPPORTED
+    /* Without dithering, the SSE2 version is no faster than the lookups */
+    if (cquantize->simd & JSIMD_AVX2) {
+      int * no_dither[3];
+      JDIMENSION done;
+
+      no_dither[0] = no_dither[1] = no_dither[2] = NULL;
+      done = quantize3_row_simd(cquantize, ptrin, ptrout, width, no_dither);
+      ptrin += done * 3;
+      ptrout += done;
+      col -= done;
+    }
+#endif
+    for (; col > 0; col--) {
       pixcode  = GETJSAMPLE(colorindex0[GETJSAMPLE(*ptrin++)]);
       pixcode += GETJSAMPLE(colorindex1[GETJSAMPLE(*ptrin++)]);
       pixcode += GETJSAMPLE(colorindex2[GETJSAMPLE(*ptrin++)]);
@@ -589,8 +802,26 @@ quantize3_ord_dither (j_decompress_ptr cinfo, JSAMPARRAY input_buf,
     dither1 = cquantize->odither[1][row_index];
     dither2 = cquantize->odither[2][row_index];
     col_index = 0;
-
-    for (col = width; col > 0; col--) {
+    col = width;
+#ifdef SIMD_INDEX_SUPPORTED
+    if (cquantize->simd) {
+      /* This does whole groups of ODITHER_SIZE columns, so col_index is
+       * still right for the rest.
+       */
+      int * dither[3];
+      JDIMENSION done;
+
+      dither[0] = dither0;
+      dither[1] = dither1;
+      dither[2] = dither2;
+      done = quantize3_row_simd(cquantize, input_ptr, output_ptr, width,
+				dither);
+      input_ptr += done * 3;
+      output_ptr += done;
+      col -= done;
+    }
+#endif
+    for (; col > 0; col--) {
       pixcode  = GETJSAMPLE(colorindex0[GETJSAMPLE(*input_ptr++) +
 					dither0[col_index]]);
       pixcode += GETJSAMPLE(colorindex1[GETJSAMPLE(*input_ptr++) +
@@ -714,6 +945,130 @@ quantize_fs_dither (j_decompress_ptr cinfo, JSAMPARRAY input_buf,
 }
 
 
+METHODDEF(void)
+quantize3_fs_dither (j_decompress_ptr cinfo, JSAMPARRAY input_buf,
+		     JSAMPARRAY output_buf, int num_rows)
+/* Fast path for out_color_components==3, with Floyd-Steinberg dithering */
+{
+  my_cquantize_ptr cquantize = (my_cquantize_ptr) cinfo->cquantize;
+  register LOCFSERROR cur0, cur1, cur2;	/* current error or pixel value */
+  LOCFSERROR belowerr0, belowerr1, belowerr2; /* error for pixel below cur */
+  LOCFSERROR bpreverr0, bpreverr1, bpreverr2; /* error for below/prev col */
+  LOCFSERROR bnexterr, delta;
+  FSERRPTR errorptr0, errorptr1, errorptr2; /* => fserrors[] at column before current */
+  register JSAMPROW input_ptr;
+  register JSAMPROW output_ptr;
+  JSAMPROW colorindex0 = cquantize->colorindex[0];
+  JSAMPROW colorindex1 = cquantize->colorindex[1];
+  JSAMPROW colorindex2 = cquantize->colorindex[2];
+  JSAMPROW colormap0 = cquantize->sv_colormap[0];
+  JSAMPROW colormap1 = cquantize->sv_colormap[1];
+  JSAMPROW colormap2 = cquantize->sv_colormap[2];
+  int pixcode0, pixcode1, pixcode2;
+  int dir;			/* 1 for left-to-right, -1 for right-to-left */
+  int dir3;			/* 3*dir, for advancing input_ptr */
+  int row;
+  JDIMENSION col;
+  JDIMENSION width = cinfo->output_width;
+  JSAMPLE *range_limit = cinfo->sample_range_limit;
+  SHIFT_TEMPS
+
+  /* This is quantize_fs_dither with the three components' loops merged.
+   * The components do not interact, so the result is the same, but the
+   * three error chains can now proceed in parallel.
+   */
+  for (row = 0; row < num_rows; row++) {
+    input_ptr = input_buf[row];
+    output_ptr = output_buf[row];
+    if (cquantize->on_odd_row) {
+      /* work right to left in this row */
+      input_ptr += (width-1) * 3; /* so point to rightmost pixel */
+      output_ptr += width-1;
+      dir = -1;
+      dir3 = -3;
+      errorptr0 = cquantize->fserrors[0] + (width+1); /* => entry after last column */
+      errorptr1 = cquantize->fserrors[1] + (width+1);
+      errorptr2 = cquantize->fserrors[2] + (width+1);
+      cquantize->on_odd_row = FALSE; /* flip for next time */
+    } else {
+      /* work left to right in this row */
+      dir = 1;
+      dir3 = 3;
+      errorptr0 = cquantize->fserrors[0]; /* => entry before first column */
+      errorptr1 = cquantize->fserrors[1];
+      errorptr2 = cquantize->fserrors[2];
+      cquantize->on_odd_row = TRUE; /* flip for next time */
+    }
+    /* Preset error values: no error propagated to first pixel from left */
+    cur0 = cur1 = cur2 = 0;
+    /* and no error propagated to row below yet */
+    belowerr0 = belowerr1 = belowerr2 = 0;
+    bpreverr0 = bpreverr1 = bpreverr2 = 0;
+
+    for (col = width; col > 0; col--) {
+      /* Form the complete error correction term for this pixel and add
+       * it to the pixel value, as in quantize_fs_dither.
+       */
+      cur0 = RIGHT_SHIFT(cur0 + errorptr0[dir] + 8, 4);
+      cur1 = RIGHT_SHIFT(cur1 + errorptr1[dir] + 8, 4);
+      cur2 = RIGHT_SHIFT(cur2 + errorptr2[dir] + 8, 4);
+      cur0 += GETJSAMPLE(input_ptr[0]);
+      cur1 += GETJSAMPLE(input_ptr[1]);
+      cur2 += GETJSAMPLE(input_ptr[2]);
+      /* Select output values and form the output code for this pixel.
+       * The padded colorindex does the range-limiting, so only the error
+       * computation below waits for range_limit[].
+       */
+      pixcode0 = GETJSAMPLE(colorindex0[cur0]);
+      pixcode1 = GETJSAMPLE(colorindex1[cur1]);
+      pixcode2 = GETJSAMPLE(colorindex2[cur2]);
+      *output_ptr = (JSAMPLE) (pixcode0 + pixcode1 + pixcode2);
+      cur0 = GETJSAMPLE(range_limit[cur0]);
+      cur1 = GETJSAMPLE(range_limit[cur1]);
+      cur2 = GETJSAMPLE(range_limit[cur2]);
+      /* Compute actual representation errors at this pixel */
+      cur0 -= GETJSAMPLE(colormap0[pixcode0]);
+      cur1 -= GETJSAMPLE(colormap1[pixcode1]);
+      cur2 -= GETJSAMPLE(colormap2[pixcode2]);
+      /* Propagate the error fractions, as in quantize_fs_dither */
+      bnexterr = cur0;		/* Process component 0 */
+      delta = cur0 * 2;
+      cur0 += delta;		/* form error * 3 */
+      errorptr0[0] = (FSERROR) (bpreverr0 + cur0);
+      cur0 += delta;		/* form error * 5 */
+      bpreverr0 = belowerr0 + cur0;
+      belowerr0 = bnexterr;
+      cur0 += delta;		/* form error * 7 */
+      bnexterr = cur1;		/* Process component 1 */
+      delta = cur1 * 2;
+      cur1 += delta;		/* form error * 3 */
+      errorptr1[0] = (FSERROR) (bpreverr1 + cur1);
+      cur1 += delta;		/* form error * 5 */
+      bpreverr1 = belowerr1 + cur1;
+      belowerr1 = bnexterr;
+      cur1 += delta;		/* form error * 7 */
+      bnexterr = cur2;		/* Process component 2 */
+      delta = cur2 * 2;
+      cur2 += delta;		/* form error * 3 */
+      errorptr2[0] = (FSERROR) (bpreverr2 + cur2);
+      cur2 += delta;		/* form error * 5 */
+      bpreverr2 = belowerr2 + cur2;
+      belowerr2 = bnexterr;
+      cur2 += delta;		/* form error * 7 */
+      input_ptr += dir3;	/* advance input ptr to next column */
+      output_ptr += dir;	/* advance output ptr to next column */
+      errorptr0 += dir;		/* advance errorptrs to current column */
+      errorptr1 += dir;
+      errorptr2 += dir;
+    }
+    /* Post-loop cleanup: unload the final error values */
+    errorptr0[0] = (FSERROR) bpreverr0;
+    errorptr1[0] = (FSERROR) bpreverr1;
+    errorptr2[0] = (FSERROR) bpreverr2;
+  }
+}
+
+
 /*
  * Allocate workspace for Floyd-Steinberg errors.
  */
@@ -773,7 +1128,13 @@ start_pass_1_quant (j_decompress_ptr cinfo, boolean is_pre_scan)
       create_odither_tables(cinfo);
     break;
   case JDITHER_FS:
-    cquantize->pub.color_quantize = quantize_fs_dither;
+    if (cinfo->out_color_components == 3) {
+      cquantize->pub.color_quantize = quantize3_fs_dither;
+      /* This needs the padded color index table too */
+      if (! cquantize->is_padded)
+	create_colorindex(cinfo);
+    } else
+      cquantize->pub.color_quantize = quantize_fs_dither;
     cquantize->on_odd_row = FALSE; /* initialize state for F-S dither */
     /* Allocate Floyd-Steinberg workspace if didn't already. */
     if (cquantize->fserrors[0] == NULL)
@@ -787,6 +1148,16 @@ start_pass_1_quant (j_decompress_ptr cinfo, boolean is_pre_scan)
     ERREXIT(cinfo, JERR_NOT_COMPILED);
     break;
   }
+
+#ifdef SIMD_INDEX_SUPPORTED
+  /* Record the SIMD choice (without dithering, only AVX2 is used) */
+  if (cquantize->pub.color_quantize == quantize3_ord_dither)
+    jsimd_note_kernel(JSIMD_K_COLOR_INDEX, cquantize->simd);
+  else if (cquantize->pub.color_quantize == color_quantize3)
+    jsimd_note_kernel(JSIMD_K_COLOR_INDEX, cquantize->simd & JSIMD_AVX2);
+  else
+    jsimd_note_kernel(JSIMD_K_COLOR_INDEX, 0);
+#endif
 }
 
 
@@ -20,6 +20,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* Private declarations for SIMD routines */
 
 #ifdef QUANT_2PASS_SUPPORTED
 
@@ -152,6 +153,33 @@ typedef histcell hist1d[HIST_C2_ELEMS]; /* typedefs for the array */
 typedef hist1d FAR * hist2d;	/* type for the 2nd-level pointers */
 typedef hist2d * hist3d;	/* type for top-level pointer */
 
+/* Where far pointers are not needed, the 2-D arrays are allocated as one
+ * chunk, and the per-pixel loops index that as a flat array instead of
+ * loading a row pointer for every pixel.  Both forms are written with
+ * HIST_CELL, which takes histogram indexes and expects a local hist3d
+ * named histogram; declare HIST_TEMPS after it.
+ */
+
+#ifndef NEED_FAR_POINTERS
+#define HIST_FLAT
+#endif
+
+#ifdef HIST_FLAT
+#define HIST_TEMPS	histptr histcells = histogram[0][0];
+#define HIST_CELL(c0,c1,c2)  \
+	(histcells + (((((c0) << HIST_C1_BITS) + (c1)) << HIST_C2_BITS) + (c2)))
+#else
+#define HIST_TEMPS
+#define HIST_CELL(c0,c1,c2)  (& histogram[c0][c1][c2])
+#endif
+
+/* The SSE2 nearest-color search handles one row of an update box (see
+ * below) per vector, which needs rows of 4 cells.
+ */
+#if defined(JSIMD_SUPPORTED) && HIST_C2_BITS == 5
+#define SIMD_SEARCH_SUPPORTED
+#endif
+
 
 /* Declarations for Floyd-Steinberg dithering.
  *
@@ -202,6 +230,15 @@ typedef struct {
 
   boolean needs_zeroed;		/* TRUE if next pass must zero histogram */
 
+#ifdef SIMD_SEARCH_SUPPORTED
+  /* The colormap as 16-bit values for the SSE2 nearest-color search,
+   * padded out to a multiple of 8 entries with colors far outside the
+   * RGB cube.  Set up by start_pass_2_quant when simd_search is TRUE.
+   */
+  boolean simd_search;
+  INT16 cmap16[3][MAXNUMCOLORS];
+#endif
+
   /* Variables for Floyd-Steinberg dithering */
   FSERRPTR fserrors;		/* accumulated errors */
   boolean on_odd_row;		/* flag to remember which row we are on */
@@ -231,14 +268,15 @@ prescan_quantize (j_decompress_ptr cinfo, JSAMPARRAY input_buf,
   int row;
   JDIMENSION col;
   JDIMENSION width = cinfo->output_width;
+  HIST_TEMPS
 
   for (row = 0; row < num_rows; row++) {
     ptr = input_buf[row];
     for (col = width; col > 0; col--) {
       /* get pixel value and index into the histogram */
-      histp = & histogram[GETJSAMPLE(ptr[0]) >> C0_SHIFT]
-			 [GETJSAMPLE(ptr[1]) >> C1_SHIFT]
-			 [GETJSAMPLE(ptr[2]) >> C2_SHIFT];
+      histp = HIST_CELL(GETJSAMPLE(ptr[0]) >> C0_SHIFT,
+			GETJSAMPLE(ptr[1]) >> C1_SHIFT,
+			GETJSAMPLE(ptr[2]) >> C2_SHIFT);
       /* increment, check for overflow and undo increment if so. */
       if (++(*histp) <= 0)
 	(*histp)--;
@@ -851,6 +889,174 @@ find_best_colors (j_decompress_ptr cinfo, int minc0, int minc1, int minc2,
 }
 
 
+#ifdef SIMD_SEARCH_SUPPORTED
+
+/*
+ * SSE2 versions of the two search routines, giving exactly the same
+ * results.  find_nearby_colors_sse2 takes eight colormap entries at a time
+ * from the 16-bit copy of the colormap; the distance terms fit in 16 bits,
+ * and pmaddwd squares and sums them into 32 bits.  find_best_colors_sse2
+ * holds one row of BOX_C2_ELEMS cells per vector, and for each candidate
+ * color steps the distance from row to row by Thomas' method as above.
+ */
+
+JSIMD_TARGET("sse2")
+LOCAL(int)
+find_nearby_colors_sse2 (j_decompress_ptr cinfo, int minc0, int minc1,
+			 int minc2, JSAMPLE colorlist[])
+{
+  my_cquantize_ptr cquantize = (my_cquantize_ptr) cinfo->cquantize;
+  int numcolors = cinfo->actual_number_of_colors;
+  int i, k, ncolors, minmaxdist;
+  int mindist[MAXNUMCOLORS];	/* min distance to colormap entry i */
+  const __m128i zero = _mm_setzero_si128();
+  __m128i minc[3], maxc[3], centerc[3], scale[3];
+  __m128i x, y, sel, dmin[3], dmax[3], d, gt, minmax;
+
+  /* Box bounds and center, computed as in find_nearby_colors */
+  minc[0] = _mm_set1_epi16((short) minc0);
+  maxc[0] = _mm_set1_epi16((short) (minc0 + ((1 << BOX_C0_SHIFT) -
+					      (1 << C0_SHIFT))));
+  minc[1] = _mm_set1_epi16((short) minc1);
+  maxc[1] = _mm_set1_epi16((short) (minc1 + ((1 << BOX_C1_SHIFT) -
+					      (1 << C1_SHIFT))));
+  minc[2] = _mm_set1_epi16((short) minc2);
+  maxc[2] = _mm_set1_epi16((short) (minc2 + ((1 << BOX_C2_SHIFT) -
+					      (1 << C2_SHIFT))));
+  for (k = 0; k < 3; k++)
+    centerc[k] = _mm_srai_epi16(_mm_add_epi16(minc[k], maxc[k]), 1);
+  scale[0] = _mm_set1_epi16(C0_SCALE);
+  scale[1] = _mm_set1_epi16(C1_SCALE);
+  scale[2] = _mm_set1_epi16(C2_SCALE);
+
+  minmax = _mm_set1_epi32(0x7FFFFFFF);
+  for (i = 0; i < numcolors; i += 8) {
+    for (k = 0; k < 3; k++) {
+      x = _mm_loadu_si128((const __m128i *) (cquantize->cmap16[k] + i));
+      /* Distance to the nearest side of the box, 0 if within it */
+      d = _mm_min_epi16(_mm_max_epi16(x, minc[k]), maxc[k]);
+      dmin[k] = _mm_mullo_epi16(_mm_sub_epi16(x, d), scale[k]);
+      /* Distance to the far side, chosen by the center as before */
+      sel = _mm_cmpgt_epi16(x, centerc[k]);
+      d = _mm_or_si128(_mm_and_si128(sel, minc[k]),
+		       _mm_andnot_si128(sel, maxc[k]));
+      dmax[k] = _mm_mullo_epi16(_mm_sub_epi16(x, d), scale[k]);
+    }
+    /* Square and sum the terms for each half of the eight entries */
+    for (k = 0; k < 2; k++) {
+      if (k == 0) {
+	x = _mm_unpacklo_epi16(dmin[0], dmin[1]);
+	y = _mm_unpacklo_epi16(dmin[2], zero);
+      } else {
+	x = _mm_unpackhi_epi16(dmin[0], dmin[1]);
+	y = _mm_unpackhi_epi16(dmin[2], zero);
+      }
+      d = _mm_add_epi32(_mm_madd_epi16(x, x), _mm_madd_epi16(y, y));
+      _mm_storeu_si128((__m128i *) (mindist + i + 4*k), d);
+      if (k == 0) {
+	x = _mm_unpacklo_epi16(dmax[0], dmax[1]);
+	y = _mm_unpacklo_epi16(dmax[2], zero);
+      } else {
+	x = _mm_unpackhi_epi16(dmax[0], dmax[1]);
+	y = _mm_unpackhi_epi16(dmax[2], zero);
+      }
+      d = _mm_add_epi32(_mm_madd_epi16(x, x), _mm_madd_epi16(y, y));
+      gt = _mm_cmpgt_epi32(minmax, d);
+      minmax = _mm_or_si128(_mm_and_si128(gt, d),
+			    _mm_andnot_si128(gt, minmax));
+    }
+  }
+  /* Reduce to the smallest maximum distance */
+  for (k = 8; k > 2; k >>= 1) {
+    d = _mm_srli_si128(minmax, k);
+    gt = _mm_cmpgt_epi32(minmax, d);
+    minmax = _mm_or_si128(_mm_and_si128(gt, d),
+			  _mm_andnot_si128(gt, minmax));
+  }
+  minmaxdist = _mm_cvtsi128_si32(minmax);
+
+  /* Keep the candidates, without a hard-to-predict branch per color */
+  ncolors = 0;
+  for (i = 0; i < numcolors; i++) {
+    colorlist[ncolors] = (JSAMPLE) i;
+    ncolors += (mindist[i] <= minmaxdist);
+  }
+  return ncolors;
+}
+
+
+JSIMD_TARGET("sse2")
+LOCAL(void)
+find_best_colors_sse2 (j_decompress_ptr cinfo, int minc0, int minc1,
+		       int minc2, int numcolors, JSAMPLE colorlist[],
+		       JSAMPLE bestcolor[])
+{
+  int ic0, ic1, i, icolor, row;
+  INT32 dist0, dist1;		/* initial distance values */
+  INT32 xx0, xx1;		/* distance increments */
+  INT32 inc0, inc1, inc2;	/* initial values for increments */
+  __m128i steps, color, dist2, better;
+  /* Best distance and color so far for each row of cells */
+  __m128i bestdist[BOX_C0_ELEMS * BOX_C1_ELEMS];
+  __m128i bestidx[BOX_C0_ELEMS * BOX_C1_ELEMS];
+
+  for (row = 0; row < BOX_C0_ELEMS * BOX_C1_ELEMS; row++) {
+    bestdist[row] = _mm_set1_epi32(0x7FFFFFFF);
+    bestidx[row] = _mm_setzero_si128();
+  }
+
+  for (i = 0; i < numcolors; i++) {
+    icolor = GETJSAMPLE(colorlist[i]);
+    /* Compute (square of) distance from minc0/c1/c2 to this color */
+    inc0 = (minc0 - GETJSAMPLE(cinfo->colormap[0][icolor])) * C0_SCALE;
+    dist0 = inc0*inc0;
+    inc1 = (minc1 - GETJSAMPLE(cinfo->colormap[1][icolor])) * C1_SCALE;
+    dist0 += inc1*inc1;
+    inc2 = (minc2 - GETJSAMPLE(cinfo->colormap[2][icolor])) * C2_SCALE;
+    dist0 += inc2*inc2;
+    /* Form the initial difference increments */
+    inc0 = inc0 * (2 * STEP_C0) + STEP_C0 * STEP_C0;
+    inc1 = inc1 * (2 * STEP_C1) + STEP_C1 * STEP_C1;
+    inc2 = inc2 * (2 * STEP_C2) + STEP_C2 * STEP_C2;
+    /* Distances along a row, relative to its first cell */
+    steps = _mm_setr_epi32(0, (int) inc2,
+			   (int) (2 * inc2 + 2 * STEP_C2 * STEP_C2),
+			   (int) (3 * inc2 + 6 * STEP_C2 * STEP_C2));
+    color = _mm_set1_epi32(icolor);
+    row = 0;
+    xx0 = inc0;
+    for (ic0 = BOX_C0_ELEMS-1; ic0 >= 0; ic0--) {
+      dist1 = dist0;
+      xx1 = inc1;
+      for (ic1 = BOX_C1_ELEMS-1; ic1 >= 0; ic1--) {
+	dist2 = _mm_add_epi32(_mm_set1_epi32((int) dist1), steps);
+	better = _mm_cmpgt_epi32(bestdist[row], dist2);
+	bestdist[row] = _mm_or_si128(_mm_and_si128(better, dist2),
+				     _mm_andnot_si128(better, bestdist[row]));
+	bestidx[row] = _mm_or_si128(_mm_and_si128(better, color),
+				    _mm_andnot_si128(better, bestidx[row]));
+	row++;
+	dist1 += xx1;
+	xx1 += 2 * STEP_C1 * STEP_C1;
+      }
+      dist0 += xx0;
+      xx0 += 2 * STEP_C0 * STEP_C0;
+    }
+  }
+
+  /* Pack the color indexes into bestcolor[], four rows at a time */
+  for (row = 0; row < BOX_C0_ELEMS * BOX_C1_ELEMS; row += 4) {
+    _mm_storeu_si128((__m128i *) (bestcolor + row * BOX_C2_ELEMS),
+		     _mm_packus_epi16(_mm_packs_epi32(bestidx[row],
+						      bestidx[row+1]),
+				      _mm_packs_epi32(bestidx[row+2],
+						      bestidx[row+3])));
+  }
+}
+
+#endif /* SIMD_SEARCH_SUPPORTED */
+
+
 LOCAL(void)
 fill_inverse_cmap (j_decompress_ptr cinfo, int c0, int c1, int c2)
 /* Fill the inverse-colormap entries in the update box that contains */
@@ -885,11 +1091,21 @@ fill_inverse_cmap (j_decompress_ptr cinfo, int c0, int c1, int c2)
   /* Determine which colormap entries are close enough to be candidates
    * for the nearest entry to some cell in the update box.
    */
-  numcolors = find_nearby_colors(cinfo, minc0, minc1, minc2, colorlist);
+#ifdef SIMD_SEARCH_SUPPORTED
+  if (cquantize->simd_search) {
+    numcolors = find_nearby_colors_sse2(cinfo, minc0, minc1, minc2,
+					colorlist);
+    find_best_colors_sse2(cinfo, minc0, minc1, minc2, numcolors, colorlist,
+			  bestcolor);
+  } else
+#endif
+  {
+    numcolors = find_nearby_colors(cinfo, minc0, minc1, minc2, colorlist);
 
-  /* Determine the actually nearest colors. */
-  find_best_colors(cinfo, minc0, minc1, minc2, numcolors, colorlist,
-		   bestcolor);
+    /* Determine the actually nearest colors. */
+    find_best_colors(cinfo, minc0, minc1, minc2, numcolors, colorlist,
+		     bestcolor);
+  }
 
   /* Save the best color numbers (plus 1) in the main cache array */
   c0 <<= BOX_C0_LOG;		/* convert ID back to base cell indexes */
@@ -924,6 +1140,7 @@ pass2_no_dither (j_decompress_ptr cinfo,
   int row;
   JDIMENSION col;
   JDIMENSION width = cinfo->output_width;
+  HIST_TEMPS
 
   for (row = 0; row < num_rows; row++) {
     inptr = input_buf[row];
@@ -933,7 +1150,7 @@ pass2_no_dither (j_decompress_ptr cinfo,
       c0 = GETJSAMPLE(*inptr++) >> C0_SHIFT;
       c1 = GETJSAMPLE(*inptr++) >> C1_SHIFT;
       c2 = GETJSAMPLE(*inptr++) >> C2_SHIFT;
-      cachep = & histogram[c0][c1][c2];
+      cachep = HIST_CELL(c0, c1, c2);
       /* If we have not seen this color before, find nearest colormap entry */
       /* and update the cache */
       if (*cachep == 0)
@@ -969,6 +1186,7 @@ pass2_fs_dither (j_decompress_ptr cinfo,
   JSAMPROW colormap0 = cinfo->colormap[0];
   JSAMPROW colormap1 = cinfo->colormap[1];
   JSAMPROW colormap2 = cinfo->colormap[2];
+  HIST_TEMPS
   SHIFT_TEMPS
 
   for (row = 0; row < num_rows; row++) {
@@ -1024,7 +1242,7 @@ pass2_fs_dither (j_decompress_ptr cinfo,
       cur1 = GETJSAMPLE(range_limit[cur1]);
       cur2 = GETJSAMPLE(range_limit[cur2]);
       /* Index into the cache with adjusted pixel value */
-      cachep = & histogram[cur0>>C0_SHIFT][cur1>>C1_SHIFT][cur2>>C2_SHIFT];
+      cachep = HIST_CELL(cur0>>C0_SHIFT, cur1>>C1_SHIFT, cur2>>C2_SHIFT);
       /* If we have not seen this color before, find nearest colormap */
       /* entry and update the cache */
       if (*cachep == 0)
@@ -1210,6 +1428,19 @@ start_pass_2_quant (j_decompress_ptr cinfo, boolean is_pre_scan)
       cquantize->on_odd_row = FALSE;
     }
 
+#ifdef SIMD_SEARCH_SUPPORTED
+    /* Make the padded 16-bit copy of the colormap */
+    if (cquantize->simd_search) {
+      int c;
+
+      for (c = 0; c < 3; c++) {
+	for (i = 0; i < cinfo->actual_number_of_colors; i++)
+	  cquantize->cmap16[c][i] = (INT16) GETJSAMPLE(cinfo->colormap[c][i]);
+	for (; i < MAXNUMCOLORS; i++)
+	  cquantize->cmap16[c][i] = 4 * MAXNUMCOLORS;
+      }
+    }
+#endif
   }
   /* Zero the histogram or inverse color map, if necessary */
   if (cquantize->needs_zeroed) {
@@ -1254,6 +1485,11 @@ jinit_2pass_quantizer (j_decompress_ptr cinfo)
   cquantize->pub.new_color_map = new_color_map_2_quant;
   cquantize->fserrors = NULL;	/* flag optional arrays not allocated */
   cquantize->error_limiter = NULL;
+#ifdef SIMD_SEARCH_SUPPORTED
+  cquantize->simd_search = (jsimd_cpu_support() & JSIMD_SSE2) != 0;
+  jsimd_note_kernel(JSIMD_K_COLOR_SEARCH,
+		    cquantize->simd_search ? JSIMD_SSE2 : 0);
+#endif
 
   /* Make sure jdmaster didn't give me a case I can't handle */
   if (cinfo->out_color_components != 3)
@@ -1262,11 +1498,19 @@ jinit_2pass_quantizer (j_decompress_ptr cinfo)
   /* Allocate the histogram/inverse colormap storage */
   cquantize->histogram = (hist3d) (*cinfo->mem->alloc_small)
     ((j_common_ptr) cinfo, JPOOL_IMAGE, HIST_C0_ELEMS * SIZEOF(hist2d));
+#ifdef HIST_FLAT
+  cquantize->histogram[0] = (hist2d) (*cinfo->mem->alloc_large)
+    ((j_common_ptr) cinfo, JPOOL_IMAGE,
+     HIST_C0_ELEMS*HIST_C1_ELEMS*HIST_C2_ELEMS * SIZEOF(histcell));
+  for (i = 1; i < HIST_C0_ELEMS; i++)
+    cquantize->histogram[i] = cquantize->histogram[i-1] + HIST_C1_ELEMS;
+#else
   for (i = 0; i < HIST_C0_ELEMS; i++) {
     cquantize->histogram[i] = (hist2d) (*cinfo->mem->alloc_large)
       ((j_common_ptr) cinfo, JPOOL_IMAGE,
        HIST_C1_ELEMS*HIST_C2_ELEMS * SIZEOF(histcell));
   }
+#endif
   cquantize->needs_zeroed = TRUE; /* histogram is garbage now */
 
   /* Allocate storage for the completed colormap, if required.
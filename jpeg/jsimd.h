@@ -0,0 +1,585 @@
+/*
+ * jsimd.h
+ *
+ * Copyright (C) 1994-1996, Thomas G. Lane.
+ * This file is part of the Independent JPEG Group's software.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This include file contains declarations for the SIMD (SSE2/AVX2) versions
+ * of selected library routines.  It is private to the JPEG library; it is
+ * included by the modules that provide or select SIMD code, after jdct.h
+ * in the case of the DCT modules (the DCT declarations need it).
+ *
+ * The SIMD code is written with compiler intrinsics, and each routine is
+ * compiled for its instruction set with a per-function target attribute.
+ * Thus the library as a whole still runs on any CPU of the family; the
+ * SIMD routines are used only when jsimd_cpu_support() reports that the
+ * CPU (and operating system) can execute them.  At present this needs GCC
+ * 4.9 or later (or clang) on x86 or x86-64, and 8-bit samples.  Define
+ * NO_SIMD in jconfig.h to leave the SIMD code out.
+ */
+
+#ifndef NO_SIMD
+#if BITS_IN_JSAMPLE == 8 && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || \
+     defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define JSIMD_SUPPORTED
+#endif
+#endif
+
+#ifdef JSIMD_SUPPORTED
+
+#include <immintrin.h>
+
+/* Instruction set bits returned by jsimd_cpu_support() */
+
+#define JSIMD_SSE2	0x01
+#define JSIMD_AVX2	0x02
+
+/* Kernel numbers for jsimd_note_kernel, in the order of the names in
+ * jutils.c.  The compression kernels come first.
+ */
+
+#define JSIMD_K_FDCT		0	/* jcdctmgr.c */
+#define JSIMD_K_QUANTIZE	1	/* jcdctmgr.c */
+#define JSIMD_K_HUFF_ENCODE	2	/* jchuff.c, for jc*huff.c */
+#define JSIMD_K_COLOR_IN	3	/* jccolor.c */
+#define JSIMD_K_DOWNSAMPLE	4	/* jcsample.c */
+#define JSIMD_K_IDCT		5	/* jddctmgr.c */
+#define JSIMD_K_COLOR_OUT	6	/* jdcolor.c */
+#define JSIMD_K_UPSAMPLE	7	/* jdsample.c */
+#define JSIMD_K_MERGED_UPSAMPLE	8	/* jdmerge.c */
+#define JSIMD_K_HUFF_DECODE	9	/* jdphuff.c */
+#define JSIMD_K_COLOR_INDEX	10	/* jquant1.c */
+#define JSIMD_K_COLOR_SEARCH	11	/* jquant2.c */
+#define JSIMD_NUM_KERNELS	12
+#define JSIMD_FIRST_D_KERNEL	JSIMD_K_IDCT
+
+/* Compile a routine for the given instruction set, e.g. JSIMD_TARGET("sse2") */
+
+#define JSIMD_TARGET(isa)  __attribute__((target(isa)))
+
+
+/*
+ * Helpers shared by the SIMD routines.  These are macros rather than
+ * functions because an inline function would need its own target attribute.
+ */
+
+/* Transpose a 4x4 block of 32-bit elements held in four SSE2 registers. */
+
+#define JSIMD_TRANSPOSE4_EPI32(r0,r1,r2,r3)  { \
+    __m128i t0_ = _mm_unpacklo_epi32(r0, r1); \
+    __m128i t1_ = _mm_unpacklo_epi32(r2, r3); \
+    __m128i t2_ = _mm_unpackhi_epi32(r0, r1); \
+    __m128i t3_ = _mm_unpackhi_epi32(r2, r3); \
+    r0 = _mm_unpacklo_epi64(t0_, t1_); \
+    r1 = _mm_unpackhi_epi64(t0_, t1_); \
+    r2 = _mm_unpacklo_epi64(t2_, t3_); \
+    r3 = _mm_unpackhi_epi64(t2_, t3_); }
+
+/* Transpose an 8x8 block of 32-bit elements held in sixteen SSE2 registers:
+ * lo[i] holds elements 0-3 of row i and hi[i] holds elements 4-7.
+ */
+
+#define JSIMD_TRANSPOSE8_SSE2(lo,hi)  { \
+    __m128i s_; int k_; \
+    JSIMD_TRANSPOSE4_EPI32(lo[0], lo[1], lo[2], lo[3]); \
+    JSIMD_TRANSPOSE4_EPI32(lo[4], lo[5], lo[6], lo[7]); \
+    JSIMD_TRANSPOSE4_EPI32(hi[0], hi[1], hi[2], hi[3]); \
+    JSIMD_TRANSPOSE4_EPI32(hi[4], hi[5], hi[6], hi[7]); \
+    for (k_ = 0; k_ < 4; k_++) { \
+      s_ = lo[4+k_]; lo[4+k_] = hi[k_]; hi[k_] = s_; \
+    } }
+
+/* The same for single-precision elements. */
+
+#define JSIMD_TRANSPOSE8_PS_SSE2(lo,hi)  { \
+    __m128 s_; int k_; \
+    _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]); \
+    _MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]); \
+    _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]); \
+    _MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]); \
+    for (k_ = 0; k_ < 4; k_++) { \
+      s_ = lo[4+k_]; lo[4+k_] = hi[k_]; hi[k_] = s_; \
+    } }
+
+/* Transpose an 8x8 block of 32-bit elements held in eight AVX2 registers. */
+
+#define JSIMD_TRANSPOSE8_EPI32(r)  { \
+    __m256i t0_ = _mm256_unpacklo_epi32(r[0], r[1]); \
+    __m256i t1_ = _mm256_unpackhi_epi32(r[0], r[1]); \
+    __m256i t2_ = _mm256_unpacklo_epi32(r[2], r[3]); \
+    __m256i t3_ = _mm256_unpackhi_epi32(r[2], r[3]); \
+    __m256i t4_ = _mm256_unpacklo_epi32(r[4], r[5]); \
+    __m256i t5_ = _mm256_unpackhi_epi32(r[4], r[5]); \
+    __m256i t6_ = _mm256_unpacklo_epi32(r[6], r[7]); \
+    __m256i t7_ = _mm256_unpackhi_epi32(r[6], r[7]); \
+    __m256i u0_ = _mm256_unpacklo_epi64(t0_, t2_); \
+    __m256i u1_ = _mm256_unpackhi_epi64(t0_, t2_); \
+    __m256i u2_ = _mm256_unpacklo_epi64(t1_, t3_); \
+    __m256i u3_ = _mm256_unpackhi_epi64(t1_, t3_); \
+    __m256i u4_ = _mm256_unpacklo_epi64(t4_, t6_); \
+    __m256i u5_ = _mm256_unpackhi_epi64(t4_, t6_); \
+    __m256i u6_ = _mm256_unpacklo_epi64(t5_, t7_); \
+    __m256i u7_ = _mm256_unpackhi_epi64(t5_, t7_); \
+    r[0] = _mm256_permute2x128_si256(u0_, u4_, 0x20); \
+    r[1] = _mm256_permute2x128_si256(u1_, u5_, 0x20); \
+    r[2] = _mm256_permute2x128_si256(u2_, u6_, 0x20); \
+    r[3] = _mm256_permute2x128_si256(u3_, u7_, 0x20); \
+    r[4] = _mm256_permute2x128_si256(u0_, u4_, 0x31); \
+    r[5] = _mm256_permute2x128_si256(u1_, u5_, 0x31); \
+    r[6] = _mm256_permute2x128_si256(u2_, u6_, 0x31); \
+    r[7] = _mm256_permute2x128_si256(u3_, u7_, 0x31); }
+
+/* The same for single-precision elements. */
+
+#define JSIMD_TRANSPOSE8_PS_AVX2(r)  { \
+    __m256i i_[DCTSIZE]; int k_; \
+    for (k_ = 0; k_ < DCTSIZE; k_++) \
+      i_[k_] = _mm256_castps_si256(r[k_]); \
+    JSIMD_TRANSPOSE8_EPI32(i_); \
+    for (k_ = 0; k_ < DCTSIZE; k_++) \
+      r[k_] = _mm256_castsi256_ps(i_[k_]); }
+
+/*
+ * The IDCTs range-limit their outputs with the table built by
+ * prepare_range_limit_table (jdmaster.c): for a descaled value x,
+ * the sample is table[x & RANGE_MASK].  The same mapping is obtained
+ * without the table by folding x into [-384,639] and letting the
+ * saturating packs clamp to [0,255]; these macros perform the fold.
+ */
+
+#define JSIMD_RANGE_FOLD_SSE2(x)  \
+    _mm_sub_epi32(_mm_and_si128(_mm_add_epi32(x, _mm_set1_epi32(512)), \
+				_mm_set1_epi32(RANGE_MASK)), \
+		  _mm_set1_epi32(384))
+#define JSIMD_RANGE_FOLD_AVX2(x)  \
+    _mm256_sub_epi32(_mm256_and_si256(_mm256_add_epi32(x, \
+						       _mm256_set1_epi32(512)), \
+				      _mm256_set1_epi32(RANGE_MASK)), \
+		     _mm256_set1_epi32(384))
+
+/* Pack folded rows of 32-bit samples (as from JSIMD_TRANSPOSE8_SSE2) with
+ * unsigned saturation and store them as an 8x8 block of output samples.
+ */
+
+#define JSIMD_STORE8X8_SSE2(lo,hi,output_buf,output_col)  { \
+    __m128i p_; int r_; \
+    for (r_ = 0; r_ < DCTSIZE; r_ += 2) { \
+      p_ = _mm_packus_epi16(_mm_packs_epi32(lo[r_], hi[r_]), \
+			    _mm_packs_epi32(lo[r_+1], hi[r_+1])); \
+      _mm_storel_epi64((__m128i *) (output_buf[r_] + (output_col)), p_); \
+      _mm_storel_epi64((__m128i *) (output_buf[r_+1] + (output_col)), \
+		       _mm_srli_si128(p_, 8)); \
+    } }
+
+/* Likewise for eight AVX2 registers each holding one row. */
+
+#define JSIMD_STORE8X8_AVX2(r,output_buf,output_col)  { \
+    __m256i p_; __m128i h_; int r_; \
+    for (r_ = 0; r_ < DCTSIZE; r_ += 4) { \
+      p_ = _mm256_packus_epi16(_mm256_packs_epi32(r[r_], r[r_+1]), \
+			       _mm256_packs_epi32(r[r_+2], r[r_+3])); \
+      p_ = _mm256_permutevar8x32_epi32(p_, \
+				       _mm256_setr_epi32(0,4,1,5,2,6,3,7)); \
+      h_ = _mm256_castsi256_si128(p_); \
+      _mm_storel_epi64((__m128i *) (output_buf[r_] + (output_col)), h_); \
+      _mm_storel_epi64((__m128i *) (output_buf[r_+1] + (output_col)), \
+		       _mm_srli_si128(h_, 8)); \
+      h_ = _mm256_extracti128_si256(p_, 1); \
+      _mm_storel_epi64((__m128i *) (output_buf[r_+2] + (output_col)), h_); \
+      _mm_storel_epi64((__m128i *) (output_buf[r_+3] + (output_col)), \
+		       _mm_srli_si128(h_, 8)); \
+    } }
+
+/* Fill an 8x8 block of output samples with one value. */
+
+#define JSIMD_FILL8X8(output_buf,output_col,value)  { \
+    __m128i v_ = _mm_set1_epi8((char) (value)); int r_; \
+    for (r_ = 0; r_ < DCTSIZE; r_++) \
+      _mm_storel_epi64((__m128i *) (output_buf[r_] + (output_col)), v_); }
+
+/* Load the eight rows of a coefficient block, and test whether all its
+ * AC coefficients are zero (as they are in most blocks of smooth areas).
+ */
+
+#define JSIMD_LOAD_COEFS(rows,coef_block,dc_only)  { \
+    __m128i ac_; int r_; \
+    for (r_ = 0; r_ < DCTSIZE; r_++) \
+      rows[r_] = _mm_loadu_si128((const __m128i *) \
+				 ((coef_block) + r_ * DCTSIZE)); \
+    ac_ = _mm_srli_si128(rows[0], 2); \
+    for (r_ = 1; r_ < DCTSIZE; r_++) \
+      ac_ = _mm_or_si128(ac_, rows[r_]); \
+    dc_only = (_mm_movemask_epi8(_mm_cmpeq_epi16(ac_, _mm_setzero_si128())) \
+	       == 0xFFFF); }
+
+/* Load an 8x8 block of samples (rows of sample_data, starting at column
+ * start_col) as 32-bit values, applying the unsigned->signed conversion.
+ * The SSE2 form leaves the left and right halves of row i in lo[i], hi[i].
+ */
+
+#define JSIMD_LOAD8X8_SSE2(lo,hi,sample_data,start_col)  { \
+    __m128i w_; int r_; \
+    for (r_ = 0; r_ < DCTSIZE; r_++) { \
+      w_ = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) \
+				(sample_data[r_] + (start_col))), \
+					   _mm_setzero_si128()), \
+			 _mm_set1_epi16(CENTERJSAMPLE)); \
+      lo[r_] = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), w_), 16); \
+      hi[r_] = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), w_), 16); \
+    } }
+
+#define JSIMD_LOAD8X8_AVX2(d,sample_data,start_col)  { \
+    int r_; \
+    for (r_ = 0; r_ < DCTSIZE; r_++) \
+      d[r_] = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64( \
+		(const __m128i *) (sample_data[r_] + (start_col)))), \
+			       _mm256_set1_epi32(CENTERJSAMPLE)); }
+
+/* Accumulate into chk a nonzero lane if any element of x is outside
+ * -8192..8191 (the range in which the integer IDCTs cannot overflow).
+ */
+
+#define JSIMD_CHECK13_SSE2(chk,x)  \
+    (chk = _mm_or_si128(chk, _mm_srli_epi32(_mm_add_epi32(x, \
+					    _mm_set1_epi32(8192)), 14)))
+#define JSIMD_CHECK13_AVX2(chk,x)  \
+    (chk = _mm256_or_si256(chk, _mm256_srli_epi32(_mm256_add_epi32(x, \
+						  _mm256_set1_epi32(8192)), 14)))
+
+/* Interleave three byte vectors into three-byte pixels (c0 is the first
+ * byte of each pixel) and store them at outptr: 16 pixels, 48 bytes, for
+ * SSE2, and 32 pixels for AVX2.  The pixels are first built with a zero
+ * fourth byte and then squeezed four at a time into 12 bytes.  The 16-byte
+ * stores overlap, but the last one is cut to 12 bytes so that nothing
+ * beyond the pixels is written.  Its last four bytes go through MEMCOPY,
+ * since outptr need not be aligned.
+ */
+
+#define JSIMD_STORE_PIXELS3_SSE2(outptr,c0,c1,c2)  { \
+    __m128i a_ = _mm_unpacklo_epi8(c0, c1), b_ = _mm_unpackhi_epi8(c0, c1); \
+    __m128i e_ = _mm_unpacklo_epi8(c2, _mm_setzero_si128()); \
+    __m128i f_ = _mm_unpackhi_epi8(c2, _mm_setzero_si128()); \
+    __m128i p_[4]; int k_, w_; \
+    p_[0] = _mm_unpacklo_epi16(a_, e_); p_[1] = _mm_unpackhi_epi16(a_, e_); \
+    p_[2] = _mm_unpacklo_epi16(b_, f_); p_[3] = _mm_unpackhi_epi16(b_, f_); \
+    for (k_ = 0; k_ < 4; k_++) { \
+      a_ = _mm_or_si128(_mm_and_si128(p_[k_], _mm_set1_epi64x(0xFFFFFF)), \
+			_mm_and_si128(_mm_srli_epi64(p_[k_], 8), \
+				      _mm_set1_epi64x(0xFFFFFF000000LL))); \
+      p_[k_] = _mm_or_si128(_mm_move_epi64(a_), \
+			    _mm_slli_si128(_mm_srli_si128(a_, 8), 6)); \
+    } \
+    for (k_ = 0; k_ < 3; k_++) \
+      _mm_storeu_si128((__m128i *) ((outptr) + k_ * 12), p_[k_]); \
+    _mm_storel_epi64((__m128i *) ((outptr) + 36), p_[3]); \
+    w_ = _mm_cvtsi128_si32(_mm_srli_si128(p_[3], 8)); \
+    MEMCOPY((outptr) + 44, &w_, 4); }
+
+#define JSIMD_STORE_PIXELS3_AVX2(outptr,c0,c1,c2)  { \
+    __m256i a_ = _mm256_unpacklo_epi8(c0, c1); \
+    __m256i b_ = _mm256_unpackhi_epi8(c0, c1); \
+    __m256i e_ = _mm256_unpacklo_epi8(c2, _mm256_setzero_si256()); \
+    __m256i f_ = _mm256_unpackhi_epi8(c2, _mm256_setzero_si256()); \
+    __m256i p_[4]; __m128i h_; int k_, w_; \
+    p_[0] = _mm256_unpacklo_epi16(a_, e_); \
+    p_[1] = _mm256_unpackhi_epi16(a_, e_); \
+    p_[2] = _mm256_unpacklo_epi16(b_, f_); \
+    p_[3] = _mm256_unpackhi_epi16(b_, f_); \
+    for (k_ = 0; k_ < 4; k_++) { \
+      p_[k_] = _mm256_shuffle_epi8(p_[k_], \
+		 _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1, \
+				  0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1)); \
+      _mm_storeu_si128((__m128i *) ((outptr) + k_ * 12), \
+		       _mm256_castsi256_si128(p_[k_])); \
+    } \
+    for (k_ = 0; k_ < 3; k_++) \
+      _mm_storeu_si128((__m128i *) ((outptr) + 48 + k_ * 12), \
+		       _mm256_extracti128_si256(p_[k_], 1)); \
+    h_ = _mm256_extracti128_si256(p_[3], 1); \
+    _mm_storel_epi64((__m128i *) ((outptr) + 84), h_); \
+    w_ = _mm_cvtsi128_si32(_mm_srli_si128(h_, 8)); \
+    MEMCOPY((outptr) + 92, &w_, 4); }
+
+/* The same for four-byte pixels: 16 pixels, 64 bytes, for SSE2, and 32
+ * pixels, 128 bytes, for AVX2.  The AVX2 unpacks leave the pixels of each
+ * 128-bit lane in four-pixel groups, which the lane permutes put in order.
+ */
+
+#define JSIMD_STORE_PIXELS4_SSE2(outptr,c0,c1,c2,c3)  { \
+    __m128i a_ = _mm_unpacklo_epi8(c0, c1), b_ = _mm_unpackhi_epi8(c0, c1); \
+    __m128i e_ = _mm_unpacklo_epi8(c2, c3), f_ = _mm_unpackhi_epi8(c2, c3); \
+    _mm_storeu_si128((__m128i *) (outptr), _mm_unpacklo_epi16(a_, e_)); \
+    _mm_storeu_si128((__m128i *) ((outptr) + 16), \
+		     _mm_unpackhi_epi16(a_, e_)); \
+    _mm_storeu_si128((__m128i *) ((outptr) + 32), \
+		     _mm_unpacklo_epi16(b_, f_)); \
+    _mm_storeu_si128((__m128i *) ((outptr) + 48), \
+		     _mm_unpackhi_epi16(b_, f_)); }
+
+#define JSIMD_STORE_PIXELS4_AVX2(outptr,c0,c1,c2,c3)  { \
+    __m256i a_ = _mm256_unpacklo_epi8(c0, c1); \
+    __m256i b_ = _mm256_unpackhi_epi8(c0, c1); \
+    __m256i e_ = _mm256_unpacklo_epi8(c2, c3); \
+    __m256i f_ = _mm256_unpackhi_epi8(c2, c3); \
+    __m256i p0_ = _mm256_unpacklo_epi16(a_, e_); \
+    __m256i p1_ = _mm256_unpackhi_epi16(a_, e_); \
+    __m256i p2_ = _mm256_unpacklo_epi16(b_, f_); \
+    __m256i p3_ = _mm256_unpackhi_epi16(b_, f_); \
+    _mm256_storeu_si256((__m256i *) (outptr), \
+			_mm256_permute2x128_si256(p0_, p1_, 0x20)); \
+    _mm256_storeu_si256((__m256i *) ((outptr) + 32), \
+			_mm256_permute2x128_si256(p2_, p3_, 0x20)); \
+    _mm256_storeu_si256((__m256i *) ((outptr) + 64), \
+			_mm256_permute2x128_si256(p0_, p1_, 0x31)); \
+    _mm256_storeu_si256((__m256i *) ((outptr) + 96), \
+			_mm256_permute2x128_si256(p2_, p3_, 0x31)); }
+
+/* Output pixel layouts of the decoder's RGB row routines (jdcolor.c,
+ * jdmerge.c): the samples in R,G,B or B,G,R order, and optionally a fourth
+ * byte, after or before them, set to MAXJSAMPLE.  JSIMD_STORE_RGB_xxx
+ * stores the red, green and blue byte vectors r, g, b at outptr in the
+ * given layout.
+ */
+
+#define JSIMD_RGB	0
+#define JSIMD_BGR	1
+#define JSIMD_RGBX	2
+#define JSIMD_BGRX	3
+#define JSIMD_XRGB	6
+#define JSIMD_XBGR	7
+
+#define JSIMD_LAYOUT_PIXELSIZE(layout)	((layout) & 2 ? 4 : 3)
+
+#define JSIMD_STORE_RGB_SSE2(outptr,layout,r,g,b)  { \
+    __m128i s0_ = ((layout) & 1) ? (b) : (r); \
+    __m128i s2_ = ((layout) & 1) ? (r) : (b); \
+    if ((layout) & 4) \
+      JSIMD_STORE_PIXELS4_SSE2(outptr, _mm_set1_epi8(-1), s0_, g, s2_) \
+    else if ((layout) & 2) \
+      JSIMD_STORE_PIXELS4_SSE2(outptr, s0_, g, s2_, _mm_set1_epi8(-1)) \
+    else \
+      JSIMD_STORE_PIXELS3_SSE2(outptr, s0_, g, s2_) }
+
+#define JSIMD_STORE_RGB_AVX2(outptr,layout,r,g,b)  { \
+    __m256i s0_ = ((layout) & 1) ? (b) : (r); \
+    __m256i s2_ = ((layout) & 1) ? (r) : (b); \
+    if ((layout) & 4) \
+      JSIMD_STORE_PIXELS4_AVX2(outptr, _mm256_set1_epi8(-1), s0_, g, s2_) \
+    else if ((layout) & 2) \
+      JSIMD_STORE_PIXELS4_AVX2(outptr, s0_, g, s2_, _mm256_set1_epi8(-1)) \
+    else \
+      JSIMD_STORE_PIXELS3_AVX2(outptr, s0_, g, s2_) }
+
+/* Load 16 (SSE2) or 32 (AVX2) pixels of three bytes each from inptr into
+ * p[0..3], one pixel per 32-bit lane in order, with a zero fourth byte.
+ * Nothing beyond the pixels is read (and, as for the stores, no load
+ * depends on the alignment of inptr).
+ */
+
+#define JSIMD_LOAD_PIXELS3_SSE2(p,inptr)  { \
+    __m128i v_; int k_, w_; \
+    for (k_ = 0; k_ < 4; k_++) { \
+      MEMCOPY(&w_, (inptr) + k_ * 12 + 8, 4); \
+      v_ = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) \
+					      ((inptr) + k_ * 12)), \
+			      _mm_cvtsi32_si128(w_)); \
+      v_ = _mm_unpacklo_epi64(v_, _mm_srli_si128(v_, 6)); \
+      p[k_] = _mm_or_si128(_mm_and_si128(v_, _mm_set1_epi64x(0xFFFFFF)), \
+			   _mm_and_si128(_mm_slli_epi64(v_, 8), \
+					 _mm_set1_epi64x(0xFFFFFF00000000LL))); \
+    } }
+
+#define JSIMD_LOAD_PIXELS3_AVX2(p,inptr)  { \
+    __m256i v_; int k_; \
+    for (k_ = 0; k_ < 4; k_++) { \
+      v_ = _mm256_maskload_epi32((const int *) ((inptr) + k_ * 24), \
+				 _mm256_setr_epi32(-1,-1,-1,-1,-1,-1,0,0)); \
+      v_ = _mm256_permutevar8x32_epi32(v_, \
+				       _mm256_setr_epi32(0,1,2,2,3,4,5,5)); \
+      p[k_] = _mm256_shuffle_epi8(v_, \
+		_mm256_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1, \
+				 0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1)); \
+    } }
+
+/* The same for pixels of four bytes, which need no rearranging. */
+
+#define JSIMD_LOAD_PIXELS4_SSE2(p,inptr)  { \
+    int k_; \
+    for (k_ = 0; k_ < 4; k_++) \
+      p[k_] = _mm_loadu_si128((const __m128i *) ((inptr) + k_ * 16)); }
+
+#define JSIMD_LOAD_PIXELS4_AVX2(p,inptr)  { \
+    int k_; \
+    for (k_ = 0; k_ < 4; k_++) \
+      p[k_] = _mm256_loadu_si256((const __m256i *) ((inptr) + k_ * 32)); }
+
+/* Multiply the 16-bit pairs (a[i], b[i]) by the pair of constants in k
+ * (pmaddwd), add the 32-bit bias and shift right by n, giving 16-bit
+ * results in the order of a and b.  The color converters use this to
+ * reproduce their fixed-point arithmetic exactly.
+ */
+
+#define JSIMD_MADD_DESCALE_SSE2(a,b,k,bias,n)  \
+    _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16( \
+			_mm_unpacklo_epi16(a, b), k), bias), n), \
+		    _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16( \
+			_mm_unpackhi_epi16(a, b), k), bias), n))
+#define JSIMD_MADD_DESCALE_AVX2(a,b,k,bias,n)  \
+    _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16( \
+			_mm256_unpacklo_epi16(a, b), k), bias), n), \
+		       _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16( \
+			_mm256_unpackhi_epi16(a, b), k), bias), n))
+
+/* Make a pmaddwd constant from the 16-bit values a (low) and b (high). */
+
+#define JSIMD_PAIR(a,b)  ((int) (((b) << 16) | ((a) & 0xFFFF)))
+
+/* Compute the chroma terms of YCbCr->RGB conversion, which jdcolor.c and
+ * jdmerge.c look up in their tables, from 16-bit Cb and Cr values less
+ * CENTERJSAMPLE (xb, xr): rt = Cr_r_tab[cr], gt = the descaled sum of
+ * Cb_g_tab[cb] and Cr_g_tab[cr], bt = Cb_b_tab[cb].  The arithmetic that
+ * built the tables is repeated in 32-bit lanes, so the results are exact.
+ * pmaddwd takes 16-bit operands, so constants of 1.0 or more have their
+ * integer part split off, and ONE_HALF goes in as 2 * (ONE_HALF/2):
+ *	rt = xr + ((FIX(1.40200)-ONE) * xr + ONE_HALF) >> SCALEBITS
+ *	gt = -xr + (-FIX(0.34414) * xb + (ONE-FIX(0.71414)) * xr + ONE_HALF)
+ *		>> SCALEBITS
+ *	bt = 2*xb + ((FIX(1.77200)-2*ONE) * xb + ONE_HALF) >> SCALEBITS
+ * The SCALEBITS, ONE_HALF and FIX definitions of those files are used.
+ */
+
+#define JSIMD_YCC_ONE	((INT32) 1 << SCALEBITS)
+#define JSIMD_YCC_K_R	JSIMD_PAIR(FIX(1.40200) - JSIMD_YCC_ONE, ONE_HALF/2)
+#define JSIMD_YCC_K_G	JSIMD_PAIR(- FIX(0.34414), JSIMD_YCC_ONE - FIX(0.71414))
+#define JSIMD_YCC_K_B	JSIMD_PAIR(FIX(1.77200) - 2*JSIMD_YCC_ONE, ONE_HALF/2)
+
+#define JSIMD_YCC_TERMS_SSE2(xb,xr,rt,gt,bt)  { \
+    __m128i two_ = _mm_set1_epi16(2), zero_ = _mm_setzero_si128(); \
+    rt = _mm_add_epi16(xr, JSIMD_MADD_DESCALE_SSE2(xr, two_, \
+	   _mm_set1_epi32(JSIMD_YCC_K_R), zero_, SCALEBITS)); \
+    gt = _mm_sub_epi16(JSIMD_MADD_DESCALE_SSE2(xb, xr, \
+	   _mm_set1_epi32(JSIMD_YCC_K_G), _mm_set1_epi32((int) ONE_HALF), \
+	   SCALEBITS), xr); \
+    bt = _mm_add_epi16(_mm_add_epi16(xb, xb), \
+	   JSIMD_MADD_DESCALE_SSE2(xb, two_, \
+	     _mm_set1_epi32(JSIMD_YCC_K_B), zero_, SCALEBITS)); }
+
+#define JSIMD_YCC_TERMS_AVX2(xb,xr,rt,gt,bt)  { \
+    __m256i two_ = _mm256_set1_epi16(2), zero_ = _mm256_setzero_si256(); \
+    rt = _mm256_add_epi16(xr, JSIMD_MADD_DESCALE_AVX2(xr, two_, \
+	   _mm256_set1_epi32(JSIMD_YCC_K_R), zero_, SCALEBITS)); \
+    gt = _mm256_sub_epi16(JSIMD_MADD_DESCALE_AVX2(xb, xr, \
+	   _mm256_set1_epi32(JSIMD_YCC_K_G), _mm256_set1_epi32((int) ONE_HALF), \
+	   SCALEBITS), xr); \
+    bt = _mm256_add_epi16(_mm256_add_epi16(xb, xb), \
+	   JSIMD_MADD_DESCALE_AVX2(xb, two_, \
+	     _mm256_set1_epi32(JSIMD_YCC_K_B), zero_, SCALEBITS)); }
+
+/* Gather 64 byte flags into zigzag order and set mask (an unsigned long of
+ * 64 bits) to their top bits, bit k for zigzag position k.  flags[s] holds
+ * the flags of natural-order coefficients 16*s..16*s+15, one byte each.
+ * Each group of 16 zigzag positions takes four pshufb, so this is SSSE3
+ * code, for AVX2 routines only.
+ */
+
+#define JSIMD_ZIGZAG_MOVEMASK(mask,flags)  { \
+    const __m128i * idx_ = (const __m128i *) jpeg_zigzag_shuffle; \
+    __m128i z_; int c_; \
+    mask = 0; \
+    for (c_ = 0; c_ < 4; c_++) { \
+      z_ = _mm_or_si128( \
+	     _mm_or_si128(_mm_shuffle_epi8(flags[0], \
+					   _mm_loadu_si128(idx_ + 4*c_)), \
+			  _mm_shuffle_epi8(flags[1], \
+					   _mm_loadu_si128(idx_ + 4*c_ + 1))), \
+	     _mm_or_si128(_mm_shuffle_epi8(flags[2], \
+					   _mm_loadu_si128(idx_ + 4*c_ + 2)), \
+			  _mm_shuffle_epi8(flags[3], \
+					   _mm_loadu_si128(idx_ + 4*c_ + 3)))); \
+      mask |= (unsigned long) (unsigned int) _mm_movemask_epi8(z_) \
+	      << (16 * c_); \
+    } }
+
+
+/* Short forms of external names for systems with brain-damaged linkers. */
+
+#ifdef NEED_SHORT_EXTERNAL_NAMES
+#define jsimd_cpu_support	jSimdCPU
+#define jsimd_note_kernel	jSimdNote
+#define jsimd_clear_kernels	jSimdClear
+#define jpeg_zigzag_shuffle	jZZShuf
+#define jpeg_idct_islow_sse2	jRDislS2
+#define jpeg_idct_islow_avx2	jRDislA2
+#define jpeg_idct_islow_quad_sse2	jRDiq4S2
+#define jpeg_idct_islow_quad_avx2	jRDiq4A2
+#define jpeg_idct_ifast_sse2	jRDifaS2
+#define jpeg_idct_ifast_avx2	jRDifaA2
+#define jpeg_idct_float_sse2	jRDfloS2
+#define jpeg_idct_float_avx2	jRDfloA2
+#define jpeg_fdct_islow_sse2	jFDislS2
+#define jpeg_fdct_islow_avx2	jFDislA2
+#define jpeg_fdct_ifast_sse2	jFDifaS2
+#define jpeg_fdct_ifast_avx2	jFDifaA2
+#define jpeg_fdct_float_sse2	jFDfloS2
+#define jpeg_fdct_float_avx2	jFDfloA2
+#endif /* NEED_SHORT_EXTERNAL_NAMES */
+
+/* CPU feature detection, the record of the kernels chosen for the
+ * current image, and the zigzag shuffle table, in jutils.c
+ */
+
+EXTERN(int) jsimd_cpu_support JPP((void));
+EXTERN(void) jsimd_note_kernel JPP((int kernel, int isets));
+EXTERN(void) jsimd_clear_kernels JPP((int first, int last));
+extern const UINT8 jpeg_zigzag_shuffle[4][4][16];
+
+/* SIMD inverse DCTs, in jidctint.c, jidctfst.c and jidctflt.c */
+
+#define JSIMD_IDCT_ARGS  JPP((j_decompress_ptr cinfo, \
+			      jpeg_component_info * compptr, \
+			      JCOEFPTR coef_block, JSAMPARRAY output_buf, \
+			      JDIMENSION output_col))
+
+EXTERN(void) jpeg_idct_islow_sse2 JSIMD_IDCT_ARGS;
+EXTERN(void) jpeg_idct_islow_avx2 JSIMD_IDCT_ARGS;
+EXTERN(void) jpeg_idct_islow_quad_sse2 JSIMD_IDCT_ARGS;
+EXTERN(void) jpeg_idct_islow_quad_avx2 JSIMD_IDCT_ARGS;
+EXTERN(void) jpeg_idct_ifast_sse2 JSIMD_IDCT_ARGS;
+EXTERN(void) jpeg_idct_ifast_avx2 JSIMD_IDCT_ARGS;
+EXTERN(void) jpeg_idct_float_sse2 JSIMD_IDCT_ARGS;
+EXTERN(void) jpeg_idct_float_avx2 JSIMD_IDCT_ARGS;
+
+#ifdef RANGE_MASK		/* jdct.h has been included */
+
+/* SIMD forward DCTs, in jfdctint.c, jfdctfst.c and jfdctflt.c.
+ * Unlike the C versions, these load the samples themselves (doing the
+ * unsigned->signed conversion on the way); the result is left in data[]
+ * just as the C versions leave it.
+ */
+
+typedef JMETHOD(void, jsimd_fdct_ptr,
+		(DCTELEM * data, JSAMPARRAY sample_data,
+		 JDIMENSION start_col));
+typedef JMETHOD(void, jsimd_float_fdct_ptr,
+		(FAST_FLOAT * data, JSAMPARRAY sample_data,
+		 JDIMENSION start_col));
+
+EXTERN(void) jpeg_fdct_islow_sse2
+    JPP((DCTELEM * data, JSAMPARRAY sample_data, JDIMENSION start_col));
+EXTERN(void) jpeg_fdct_islow_avx2
+    JPP((DCTELEM * data, JSAMPARRAY sample_data, JDIMENSION start_col));
+EXTERN(void) jpeg_fdct_ifast_sse2
+    JPP((DCTELEM * data, JSAMPARRAY sample_data, JDIMENSION start_col));
+EXTERN(void) jpeg_fdct_ifast_avx2
+    JPP((DCTELEM * data, JSAMPARRAY sample_data, JDIMENSION start_col));
+EXTERN(void) jpeg_fdct_float_sse2
+    JPP((FAST_FLOAT * data, JSAMPARRAY sample_data, JDIMENSION start_col));
+EXTERN(void) jpeg_fdct_float_avx2
+    JPP((FAST_FLOAT * data, JSAMPARRAY sample_data, JDIMENSION start_col));
+
+#endif /* RANGE_MASK */
+
+#endif /* JSIMD_SUPPORTED */
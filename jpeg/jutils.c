@@ -14,6 +14,8 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jdct.h"		/* jsimd.h needs the DCT types */
+#include "jsimd.h"
 
 
 /*
@@ -64,6 +66,51 @@ const int jpeg_natural_order[DCTSIZE2+16] = {
 };
 
 
+#ifdef JSIMD_SUPPORTED
+
+/*
+ * jpeg_zigzag_shuffle[c][s] is the pshufb index vector that picks, for
+ * zigzag positions 16*c..16*c+15, the flags held in natural order for
+ * coefficients 16*s..16*s+15; an X entry (which makes pshufb store a zero)
+ * means that the zigzag position is not among them.  See
+ * JSIMD_ZIGZAG_MOVEMASK in jsimd.h.
+ */
+
+#define X  0x80
+
+const UINT8 jpeg_zigzag_shuffle[4][4][16] = {
+  {
+    {  0,  1,  8,  X,  9,  2,  3, 10,  X,  X,  X,  X,  X, 11,  4,  5 },
+    {  X,  X,  X,  0,  X,  X,  X,  X,  1,  8,  X,  9,  2,  X,  X,  X },
+    {  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  0,  X,  X,  X,  X,  X },
+    {  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X }
+  },
+  {
+    { 12,  X,  X,  X,  X,  X,  X,  X,  X,  X, 13,  6,  7, 14,  X,  X },
+    {  X,  3, 10,  X,  X,  X,  X,  X, 11,  4,  X,  X,  X,  X,  5, 12 },
+    {  X,  X,  X,  1,  8,  X,  9,  2,  X,  X,  X,  X,  X,  X,  X,  X },
+    {  X,  X,  X,  X,  X,  0,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X }
+  },
+  {
+    {  X,  X,  X,  X,  X,  X,  X,  X,  X,  X, 15,  X,  X,  X,  X,  X },
+    {  X,  X,  X,  X,  X,  X,  X,  X, 13,  6,  X,  7, 14,  X,  X,  X },
+    {  3, 10,  X,  X,  X,  X, 11,  4,  X,  X,  X,  X,  X,  5, 12,  X },
+    {  X,  X,  1,  8,  9,  2,  X,  X,  X,  X,  X,  X,  X,  X,  X,  3 }
+  },
+  {
+    {  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X },
+    {  X,  X,  X,  X,  X, 15,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X },
+    {  X,  X,  X, 13,  6,  X,  7, 14,  X,  X,  X,  X, 15,  X,  X,  X },
+    { 10, 11,  4,  X,  X,  X,  X,  X,  5, 12, 13,  6,  X,  7, 14, 15 }
+  }
+};
+
+
+#undef X
+
+#endif /* JSIMD_SUPPORTED */
+
+
 /*
  * Arithmetic utilities
  */
@@ -177,3 +224,121 @@ jzero_far (void FAR * target, size_t bytestozero)
   }
 #endif
 }
+
+
+#ifdef JSIMD_SUPPORTED
+
+#include <cpuid.h>
+
+#ifndef NO_GETENV
+#ifndef HAVE_STDLIB_H		/* <stdlib.h> should declare getenv() */
+extern char * getenv JPP((const char * name));
+#endif
+#endif
+
+GLOBAL(int)
+jsimd_cpu_support (void)
+/* Report which SIMD instruction sets (JSIMD_xxx bits) may be used. */
+/* The answer cannot change, so it is computed once and cached. */
+{
+  static int support = -1;	/* racing threads just store the same value */
+  unsigned int eax, ebx, ecx, edx;
+  int flags = 0;
+#ifndef NO_GETENV
+  char * simdenv;
+#endif
+
+  if (support >= 0)
+    return support;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    if (edx & bit_SSE2)
+      flags |= JSIMD_SSE2;
+#ifndef _WIN32			/* GCC misaligns spilled YMM registers there */
+    /* AVX2 also needs the OS to save the YMM registers (XCR0 bits 1,2) */
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX) &&
+	__get_cpuid_max(0, (unsigned int *) NULL) >= 7) {
+      unsigned int xcr0_lo, xcr0_hi;
+
+      __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+      if ((xcr0_lo & 6) == 6) {
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if (ebx & bit_AVX2)
+	  flags |= JSIMD_AVX2;
+      }
+    }
+#endif
+  }
+#ifndef NO_GETENV
+  /* TKJPEG_SIMD=none, sse2 or avx2 caps the choice (for timing tests and
+   * for isolating SIMD problems); it cannot enable what the CPU lacks.
+   */
+  if ((simdenv = getenv("TKJPEG_SIMD")) != NULL) {
+    if (strcmp(simdenv, "none") == 0)
+      flags = 0;
+    else if (strcmp(simdenv, "sse2") == 0)
+      flags &= JSIMD_SSE2;
+  }
+#endif
+  support = flags;
+  return flags;
+}
+
+
+/*
+ * The library's SIMD kernels, in the order of their JSIMD_K_xxx numbers.
+ * Each module that has SIMD versions of a kernel calls jsimd_note_kernel
+ * when it is set up for an image, with the instruction set it actually
+ * chose (0 for the C code: the CPU may lack the set, or the image may not
+ * suit the SIMD version).  The master control modules clear their half of
+ * the record first, so a kernel the image did not need shows as unused.
+ * The record is per process, like the CPU mask, and describes the image
+ * most recently started.
+ */
+
+static const char * const simd_kernel_names[JSIMD_NUM_KERNELS] = {
+  "fdct", "quantize", "huff_encode", "color_in", "downsample",
+  "idct", "color_out", "upsample", "merged_upsample", "huff_decode",
+  "color_index", "color_search"
+};
+
+static int simd_kernel_used[JSIMD_NUM_KERNELS]; /* JSIMD_xxx bit, or 0 */
+
+
+GLOBAL(void)
+jsimd_note_kernel (int kernel, int isets)
+/* Record that the best set in isets (if any) is used for the kernel */
+{
+  simd_kernel_used[kernel] = (isets & JSIMD_AVX2) ? JSIMD_AVX2 :
+			     (isets & JSIMD_SSE2);
+}
+
+
+GLOBAL(void)
+jsimd_clear_kernels (int first, int last)
+/* Mark kernels first..last-1 as not using SIMD code */
+{
+  int k;
+
+  for (k = first; k < last; k++)
+    simd_kernel_used[k] = 0;
+}
+
+#endif /* JSIMD_SUPPORTED */
+
+
+GLOBAL(const char *)
+jpeg_simd_kernel (int which, const char ** iset)
+/* Return the name of the which'th SIMD kernel, or NULL if there is none, */
+/* and set *iset to the instruction set it used for the latest image: */
+/* "avx2", "sse2" or "none". */
+{
+#ifdef JSIMD_SUPPORTED
+  if (which >= 0 && which < JSIMD_NUM_KERNELS) {
+    *iset = (simd_kernel_used[which] == JSIMD_AVX2) ? "avx2" :
+	    (simd_kernel_used[which] == JSIMD_SSE2) ? "sse2" : "none";
+    return simd_kernel_names[which];
+  }
+#endif
+  *iset = "none";
+  return NULL;
+}
@@ -4,14 +4,23 @@ use Test;
 use Tk;        
 use Tk::Photo;    
 
-my @writeopt = ([],[-grayscale],[-progressive],[-quality => 13],[-smooth => 12]);
+my @writeopt = ([],[-grayscale],[-progressive],[-quality => 13],[-smooth => 12],
+                [-progressive, -maxmemory => 16],[-targetsize => 4000]);
+my @scaleopt = (['1/2',114,75],['1/8',29,19]);
+my @quantopt = ([-colors => 16],[-colors => 16, -dither => 'none'],
+                [-colors => 16, -dither => 'ordered'],[-colors => 16, '-samecolormap'],
+                [-colors => 4, '-grayscale']);
 
 
-plan tests => 7*@writeopt+6;
+plan tests => 7*@writeopt+3*@scaleopt+3*@quantopt+29;
 
 eval { require Tk::JPEG };
 ok($@,'',"Cannot load Tk::JPEG");
 
+my %simd = Tk::JPEG::simd();
+ok(scalar(grep { !/^(none|sse2|avx2)$/ } values %simd),0,"Bad SIMD report");
+ok(scalar(Tk::JPEG::simd()) =~ /^(none|sse2|avx2)$/ ? 1 : 0,1,"Bad SIMD level");
+
 my $file = (@ARGV) ? shift : 'jpeg/testimg.jpg';
 
 my $mw = MainWindow->new;
@@ -24,9 +33,57 @@ my $l = $mw->Label(-image => $image, -bd => 0, -padx => 0, -pady => 0)->pack;
 $mw->update;
 ok($l->width,227,"Wrong width");
 ok($l->height,149,"Wrong height");
+%simd = Tk::JPEG::simd();
+ok(join(',',grep { !exists $simd{$_} } qw(idct color_out upsample merged_upsample
+   huff_decode color_index color_search fdct quantize huff_encode color_in
+   downsample)),'',"SIMD kernel missing from report");
 
 my $image2;
 
+foreach my $scale (@scaleopt)
+ {
+  my ($opt,$w,$h) = @$scale;
+  eval {$image2 = $mw->Photo('-format' => ['jpeg', -scale => $opt], -file => $file)};
+  ok($@,'',"Error $@");
+  ok($image2->width,$w,"Wrong width");
+  ok($image2->height,$h,"Wrong height");
+ }
+
+foreach my $opt (@quantopt)
+ {
+  eval {$image2 = $mw->Photo('-format' => ['jpeg', @$opt], -file => $file)};
+  ok($@,'',"Error $@");
+  ok($image2->width,227,"Wrong width");
+  ok($image2->height,149,"Wrong height");
+ }
+
+eval {$image2 = $mw->Photo('-format' => ['jpeg', -colors => 4], -file => $file)};
+ok($@ =~ /bad colors/ ? 1 : 0,1,"Too few colors accepted");
+eval {$image2 = $mw->Photo('-format' => ['jpeg', -colors => 16, -dither => 'ordered',
+                                         '-samecolormap'], -file => $file)};
+ok($@ =~ /samecolormap/ ? 1 : 0,1,"Ordered dither with -samecolormap accepted");
+
+foreach my $mem ('16x', '4g', 'm', '-5')
+ {
+  eval {$image2 = $mw->Photo('-format' => ['jpeg', -maxmemory => $mem], -file => $file)};
+  ok($@ =~ /bad memory size/ ? 1 : 0,1,"Memory size $mem accepted");
+ }
+eval {$image2 = $mw->Photo('-format' => ['jpeg', -maxmemory => '99999999999999999999m'],
+                           -file => $file)};
+ok($@ =~ /too large/ ? 1 : 0,1,"Overflowing memory size accepted");
+
+# A progressive image needs a whole-image buffer, which spills to a
+# temporary file when -maxmemory is tiny.
+my $tempdir = Tk::JPEG::tempdir('/nonexistent/Tk-JPEG-tempdir');
+eval {$image2 = $mw->Photo('-format' => ['jpeg', -maxmemory => 1],
+                           -file => 'jpeg/testimgp.jpg')};
+ok($@ =~ /temporary file/ ? 1 : 0,1,"Missing temporary directory not reported");
+Tk::JPEG::tempdir($tempdir);
+eval {$image2 = $mw->Photo('-format' => ['jpeg', -maxmemory => 1],
+                           -file => 'jpeg/testimgp.jpg')};
+ok($@,'',"Error $@");
+ok(Tk::JPEG::peakmemory() > 0 ? 1 : 0,1,"No peak memory recorded");
+
 foreach  my $opt (@writeopt)
  {
   unlink("testout.jpg") if -f "testout.jpg";
@@ -46,6 +103,24 @@ foreach  my $opt (@writeopt)
   ok($l->height,149,"Wrong height");
  }
 
+my %size;
+foreach my $target (2000, 4000)
+ {
+  unlink("testout.jpg") if -f "testout.jpg";
+  eval { $image->write("testout.jpg", -format => ['jpeg', -targetsize => $target]) };
+  ok($@,'',"Error $@");
+  $size{$target} = -s "testout.jpg" || 0;
+  ok($size{$target} > 0 && $size{$target} <= $target ? 1 : 0,1,
+     "File of $size{$target} bytes for target $target");
+  ok(Tk::JPEG::warning(),undef,"Unexpected warning");
+ }
+ok($size{4000} > $size{2000} ? 1 : 0,1,"Larger target gave no larger file");
+
+unlink("testout.jpg") if -f "testout.jpg";
+eval { $image->write("testout.jpg", -format => ['jpeg', -targetsize => 100]) };
+ok($@,'',"Error $@");
+ok((-s "testout.jpg") ? 1 : 0,1,"No file for unreachable target");
+ok((Tk::JPEG::warning() || '') =~ /target size/ ? 1 : 0,1,"No target size warning");
 
 $mw->after(1000,[destroy => $mw]);
 MainLoop;